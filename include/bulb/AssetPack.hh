@@ -0,0 +1,133 @@
+#ifndef BULB_ASSETPACK_HH_
+#define BULB_ASSETPACK_HH_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+
+#include "bulb/AssetReader.hh"
+
+namespace bulb
+{
+   /*
+    * .bulbpak layout (little endian):
+    *    PackHeader
+    *    PackEntry[entryCount]           (at indexOffset)
+    *    name strings, not terminated    (at namesOffset)
+    *    blobs, each PACK_ALIGNMENT aligned
+    */
+   static constexpr char PACK_MAGIC[8] = { 'B', 'U', 'L', 'B', 'P', 'A', 'K', '\0' };
+   static constexpr uint32_t PACK_VERSION = 2; // 2: nameHash is hash64 (was FNV-1a) and is used for lookups
+   static constexpr uint64_t PACK_ALIGNMENT = 64;
+
+   enum class PackEntryType : uint8_t { OTHER = 0, MATERIAL, FILAMESH, GLTF, BUFFER, TEXTURE };
+
+   struct PackHeader
+   {
+      char magic[8];
+      uint32_t version;
+      uint32_t entryCount;
+      uint64_t indexOffset;
+      uint64_t namesOffset;
+   };
+
+   struct PackEntry
+   {
+      uint64_t offset;
+      uint64_t size;
+      uint64_t nameHash;     // hash64 of the name
+      uint32_t nameOffset;   // Relative to namesOffset
+      uint16_t nameLength;
+      uint8_t type;          // PackEntryType
+      uint8_t reserved;
+   };
+
+   static_assert(sizeof(PackHeader) == 32, "PackHeader must be 32 bytes");
+   static_assert(sizeof(PackEntry) == 32, "PackEntry must be 32 bytes");
+
+   /**
+    * A read-only .bulbpak archive. The whole pack is mapped once (using AssetReader, so on Android a pack stored
+    * uncompressed in the APK is used in place) and entries are returned as AssetViews into the mapping which keep
+    * the pack mapped while they are referenced. Mount packs with AssetReader::mount_pack to have read_asset_* and
+    * map_asset served from them.
+    */
+   class AssetPack
+   //=============
+   {
+   public:
+      /** @return The opened pack or nullptr if the file could not be read or is not a valid pack. */
+      static std::shared_ptr<AssetPack> open(const char* path);
+
+      /** @return A view of the named entry or nullptr if the pack does not contain it. */
+      std::shared_ptr<AssetView> find(const std::string& name) const;
+
+      bool contains(const std::string& name) const { return (find_entry(name) != nullptr); }
+
+      /** @return The size of the named entry or 0 if the pack does not contain it. */
+      size_t entry_size(const std::string& name) const;
+
+      PackEntryType entry_type(const std::string& name) const;
+
+      /** @return true if the name is a directory prefix of one or more entries. */
+      bool is_dir(const std::string& name) const;
+
+      std::vector<std::string> names() const;
+
+      size_t size() const { return index.size(); }
+
+      const std::string& get_path() const { return path; }
+
+      /** Removes "./" components and repeated separators so lookups match the baked names. */
+      static std::string normalize(const std::string& name);
+
+      static PackEntryType type_of(const std::string& name);
+
+   private:
+      AssetPack() = default;
+
+      std::string path;
+      std::shared_ptr<AssetView> contents;
+      const PackEntry* entries = nullptr;
+      const char* entryNames = nullptr;
+      std::unordered_multimap<uint64_t, uint32_t> index; // PackEntry::nameHash to entry, names compared in place
+
+      const PackEntry* find_entry(const std::string& name) const;
+
+      std::string name_of(const PackEntry& entry) const
+      {
+         return std::string(entryNames + entry.nameOffset, entry.nameLength);
+      }
+   };
+
+   /** Builds a .bulbpak from files and directories (used by the bulb_bake tool). */
+   class AssetPackWriter
+   //===================
+   {
+   public:
+      /** Adds a file, stored under name (or its normalized path if name is empty). */
+      bool add_file(const std::string& file, const std::string& name ="");
+
+      /** Adds every file under dir (skipping hidden files), stored under their normalized paths. */
+      size_t add_directory(const std::string& dir, bool isRecursive =true);
+
+      /** Adds caller supplied contents. An existing entry with the same name is replaced. */
+      void add(const std::string& name, std::shared_ptr<AssetView> contents,
+               PackEntryType type =PackEntryType::OTHER);
+
+      bool write(const char* packPath);
+
+      size_t size() const { return pending.size(); }
+
+   private:
+      struct Pending
+      {
+         std::string name;
+         std::shared_ptr<AssetView> contents;
+         PackEntryType type;
+      };
+      std::vector<Pending> pending;
+   };
+}
+#endif
@@ -5,21 +5,107 @@
 #include <fstream>
 #include <vector>
 #include <memory>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <future>
+#include <cstdint>
+#include <cstring>
 
 #ifdef __ANDROID__
 #include <android/asset_manager.h>
 #include <android/asset_manager_jni.h>
 #else
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "backend/BufferDescriptor.h"
+
 #include "bulb/ut.hh"
+#include "bulb/Trace.hh"
 
 namespace bulb
 {
+   /**
+    * A read-only view of the contents of an asset. The memory is owned by the view and released (munmap for
+    * memory mapped files, AAsset_close for Android assets or a caller supplied releaser for memory spans) when
+    * the view is destroyed, so views are handled through std::shared_ptr and kept alive for as long as the
+    * contents are referenced, including by filament after a buffer has been handed to it (@see buffer_descriptor).
+    */
+   class AssetView
+   //=============
+   {
+   public:
+      using Releaser = std::function<void(const void* data, size_t size)>;
+
+      AssetView(const void* data, size_t size, Releaser releaser =nullptr) :
+         contents(data), length(size), releaser(std::move(releaser)) {}
+      AssetView(AssetView const&) = delete;
+      AssetView& operator=(AssetView const&) = delete;
+      ~AssetView() { if (releaser) releaser(contents, length); }
+
+      const void* data() const { return contents; }
+      const uint8_t* bytes() const { return static_cast<const uint8_t*>(contents); }
+      const char* begin() const { return static_cast<const char*>(contents); }
+      const char* end() const { return static_cast<const char*>(contents) + length; }
+      size_t size() const { return length; }
+      bool empty() const { return (length == 0); }
+
+      /** Reads one byte per page so that the contents are resident before they are parsed. */
+      void touch() const
+      //----------------
+      {
+         volatile uint8_t sink = 0;
+         for (size_t i = 0; i < length; i += 4096)
+            sink ^= bytes()[i];
+         (void) sink;
+      }
+
+      /** @return An opaque reference to view to be passed as the user parameter of release_callback. */
+      static void* retain(std::shared_ptr<AssetView> view) { return new std::shared_ptr<AssetView>(std::move(view)); }
+
+      /** filament BufferDescriptor callback which drops a reference obtained from retain. */
+      static void release_callback(void* buffer, size_t size, void* user)
+      {
+         delete static_cast<std::shared_ptr<AssetView>*>(user);
+      }
+
+      /**
+       * @return A BufferDescriptor for length bytes of view from offset (to the end if length is SIZE_MAX) which
+       * keeps the view alive until filament has finished with the buffer, avoiding a copy of the contents.
+       */
+      static filament::backend::BufferDescriptor buffer_descriptor(const std::shared_ptr<AssetView>& view,
+                                                                   size_t offset =0, size_t length =SIZE_MAX)
+      //---------------------------------------------------------------------------------------------------
+      {
+         if ( (! view) || (offset > view->size()) )
+            return filament::backend::BufferDescriptor();
+         if ( (length == SIZE_MAX) || (offset + length > view->size()) )
+            length = view->size() - offset;
+         return filament::backend::BufferDescriptor(view->begin() + offset, length, &AssetView::release_callback,
+                                                    retain(view));
+      }
+
+   private:
+      const void* contents;
+      size_t length;
+      Releaser releaser;
+   };
+
+   class AssetPack;
+
+   /** Called on an AssetReader I/O thread with the view of the asset or nullptr if it could not be read. */
+   using AssetCallback = std::function<void(const std::string& assetname, std::shared_ptr<AssetView> view)>;
+
+   /**
+    * Reads assets from Android assets or desktop files. All methods may be called concurrently from any thread.
+    */
    class AssetReader
    //================
    {
@@ -34,12 +120,127 @@ namespace bulb
          static AssetReader the_instance;
          return the_instance;
       }
+
+      /**
+       * Returns a read-only view of the contents of an asset without copying it. Memory assets (@see
+       * add_memory_asset) are returned first, then entries in mounted packs (@see mount_pack), otherwise
+       * desktop files are memory mapped and Android assets are opened in AASSET_MODE_BUFFER.
+       * @return The view or nullptr if the asset could not be opened.
+       */
+      std::shared_ptr<AssetView> map_asset(const char* assetname)
+      //---------------------------------------------------------
+      {
+         if (assetname == nullptr)
+            return nullptr;
+         BULB_TRACE_SCOPE("AssetReader::map_asset", "io");
+         return find_asset(assetname);
+      }
+
+      /**
+       * Mounts a .bulbpak archive (@see AssetPack) so that reads of the assets it contains are served from the
+       * single mapping of the pack instead of opening the individual files. Packs are searched in the order
+       * they were mounted.
+       * @return false if the pack could not be opened.
+       */
+      bool mount_pack(const char* packPath);
+
+      bool unmount_pack(const char* packPath);
+
+      /**
+       * Wraps caller supplied memory in a view.
+       * @param releaser Called with data and size when the view is destroyed, nullptr if the caller retains
+       *                 ownership (in which case the memory must outlive the view).
+       */
+      static std::shared_ptr<AssetView> make_view(const void* data, size_t size, AssetView::Releaser releaser =nullptr)
+      {
+         return std::make_shared<AssetView>(data, size, std::move(releaser));
+      }
+
+      /**
+       * Serves the contents of view for assetname from all subsequent reads (map_asset, read_asset_* etc.)
+       * instead of the file system or Android assets, until removed.
+       */
+      void add_memory_asset(const char* assetname, std::shared_ptr<AssetView> view)
+      //---------------------------------------------------------------------------
+      {
+         if ( (assetname == nullptr) || (! view) )
+            return;
+         std::lock_guard<std::mutex> lock(memoryMutex);
+         memoryAssets[assetname] = std::move(view);
+      }
+
+      bool remove_memory_asset(const char* assetname)
+      //---------------------------------------------
+      {
+         std::lock_guard<std::mutex> lock(memoryMutex);
+         return (memoryAssets.erase(assetname) > 0);
+      }
+
+      template<typename T>
+      bool read_asset_vector(const char* assetname, std::vector<T>& v)
+      //--------------------------------------------------------------
+      {
+         BULB_TRACE_SCOPE("AssetReader::read_asset", "io");
+         v.clear();
+         std::shared_ptr<AssetView> view = find_asset(assetname);
+         if (! view)
+            return false;
+         v.assign(view->begin(), view->end()); // Single allocation, memcpy for byte sized T
+         return true;
+      }
+
+      char* read_asset_buffer(const char* assetname, size_t &n)
+      //-------------------------------------------------------
+      {
+         BULB_TRACE_SCOPE("AssetReader::read_asset", "io");
+         n = 0;
+         std::shared_ptr<AssetView> view = find_asset(assetname);
+         if ( (! view) || (view->empty()) )
+            return nullptr;
+         n = view->size();
+         char* contents = new char[n];
+         std::memcpy(contents, view->data(), n);
+         return contents;
+      }
+
+      bool read_asset_string(const char* assetname, std::string& s)
+      //-----------------------------------------------------------
+      {
+         BULB_TRACE_SCOPE("AssetReader::read_asset", "io");
+         std::shared_ptr<AssetView> view = find_asset(assetname);
+         if (! view)
+         {
+            s.clear();
+            return false;
+         }
+         s.assign(view->begin(), view->end());
+         return true;
+      }
+
+      /**
+       * Maps an asset and faults its contents in on an I/O thread. Concurrent requests for an asset which is
+       * still being read share the same read.
+       * @return A future for the view (nullptr if the asset could not be read).
+       */
+      std::shared_future<std::shared_ptr<AssetView>> read_async(const char* assetname);
+
+      /** As read_async(assetname) with callback invoked on the I/O thread once the asset has been read. */
+      void read_async(const char* assetname, AssetCallback callback);
+
+      /**
+       * Asks for assets to be read into the page cache in the background, without waiting, so that later
+       * reads do not block on storage. Desktop directories prefetch the files they contain (non-recursively).
+       */
+      void prefetch(const std::vector<std::string>& assetnames);
+
 #ifdef __ANDROID__
       void set_manager(AAssetManager *pManager) { androidAssetManager = pManager; }
 
       bool is_asset_dir(const char* assetdir)
       //-------------------------------------
       {
+         if (is_pack_dir(assetdir))
+            return true;
          if (androidAssetManager == nullptr)
             return false;
          std::string assetDir(assetdir);
@@ -56,6 +257,8 @@ namespace bulb
       bool exists(const char *assetname)
       //--------------------------------
       {
+         if ( (find_memory_asset(assetname)) || (find_pack_asset(assetname)) )
+            return true;
          if (androidAssetManager == nullptr)
          return false;
          std::string assetName(assetname);
@@ -68,76 +271,14 @@ namespace bulb
          return true;
       }
 
-   template<typename T>
-   bool read_asset_vector(const char* assetname, std::vector<T>& v)
-//-----------------------------------------------------------------------------------
-   {
-      if (androidAssetManager == nullptr)
-         return false;
-      std::string assetName(assetname);
-      if (assetName.find("assets/") == 0)
-         assetName = "/" + assetName.substr(7);
-      struct D { void operator()(AAsset* p) const { if (p) AAsset_close(p); }; };
-      D d;
-      AAsset* ass = AAssetManager_open(androidAssetManager, assetName.c_str(), AASSET_MODE_BUFFER);
-      if (ass == nullptr)
-      {
-         v.clear();
-         return false;
-      }
-      std::unique_ptr<AAsset, D> asset_p(ass, d);
-//   std::unique_ptr<AAsset, D> asset_p(AAssetManager_open(asset_manager, assetName.c_str(), AASSET_MODE_BUFFER), d);
-      if (! asset_p)
-      {
-         v.clear();
-         return false;
-      }
-      size_t len = AAsset_getLength(asset_p.get());
-      v.resize(len);
-      int rlen = AAsset_read(asset_p.get(), v.data(), len);
-      if (rlen < len)
-      {
-         v.clear();
-         return false;
-      }
-      return true;
-   }
-
-   bool read_asset_string(const char* assetname, std::string& s)
-   //-----------------------------------------------------------
-   {
-      if (androidAssetManager == nullptr)
-      {
-         s.clear();
-         return false;
-      }
-      std::string assetName(assetname);
-      if (assetName.find("assets/") == 0)
-         assetName = "/" + assetName.substr(7);
-      struct D { void operator()(AAsset* p) const { if (p) AAsset_close(p); }; };
-      D d;
-      std::unique_ptr<AAsset, D> asset_p(AAssetManager_open(androidAssetManager, assetName.c_str(), AASSET_MODE_BUFFER), d);
-      if (! asset_p)
-      {
-         s.clear();
-         return false;
-      }
-      size_t len = AAsset_getLength(asset_p.get());
-      std::unique_ptr<char[]> pch(new char[len+1]);
-      int rlen = AAsset_read(asset_p.get(), pch.get(), len);
-      if (rlen < len)
-      {
-         s.clear();
-         return false;
-      }
-      pch[len] = 0;
-      s = static_cast<const char *>(pch.get());
-      return true;
-   }
-
    size_t asset_length(const char* assetname)
    //----------------------------------------
    {
+      std::shared_ptr<AssetView> view = find_memory_asset(assetname);
+      if (! view)
+         view = find_pack_asset(assetname);
+      if (view)
+         return view->size();
       if (androidAssetManager == nullptr)
          return false;
       std::string assetName(assetname);
@@ -151,39 +292,6 @@ namespace bulb
       return AAsset_getLength(asset_p.get());
    }
 
-   char* read_asset_buffer(const char* assetname, size_t &n)
-   //-----------------------------------------------------------
-   {
-      n = 0;
-      if (androidAssetManager == nullptr)
-      {
-         s.clear();
-         return nullptr;
-      }
-      std::string assetName(assetname);
-      if (assetName.find("assets/") == 0)
-         assetName = "/" + assetName.substr(7);
-      struct D { void operator()(AAsset* p) const { if (p) AAsset_close(p); }; };
-      D d;
-      std::unique_ptr<AAsset, D> asset_p(AAssetManager_open(androidAssetManager, assetName.c_str(), AASSET_MODE_BUFFER), d);
-      if (! asset_p)
-      {
-         s.clear();
-         return nullptr;
-      }
-      n = AAsset_getLength(asset_p.get());
-      if (n == 0)
-         return nullptr;
-      char* pch = new char[n];
-      int rlen = AAsset_read(asset_p.get(), pch, len);
-      if (rlen < len)
-      {
-         s.clear();
-         return nullptr;
-      }
-      return pch;
-   }
-
    bool copy_assets_to(const char *assetdir, const char *sdcardDir, bool isRecurse=false)
    //-------------------------------------------------------------------------------------
    {
@@ -231,69 +339,49 @@ namespace bulb
 
    private:
       AAssetManager *androidAssetManager;
-#else
-      bool is_asset_dir(const char* assetdir) { return is_dir(assetdir); }
-
-      bool exists(const char *assetname) { std::ifstream ifs(assetname); return ifs.good(); }
 
-      template<typename T>
-      bool read_asset_vector(const char* assetname, std::vector<T>& v)
-      //-----------------------------------------------------------------------------------
+      std::shared_ptr<AssetView> map_platform_asset(const char* assetname)
+      //------------------------------------------------------------------
       {
-         v.clear();
-         std::ifstream ifs(assetname);
-         if (!ifs.good())
-            return false;
-         ifs.seekg(0, ifs.end);
-         size_t len = ifs.tellg();
-         ifs.seekg(0, ifs.beg);
-         std::unique_ptr<char[]> contents(new char[len+1]);
-         ifs.read(contents.get(), len);
-         if (!ifs.good())
-            return false;
-         for (int i=0; i<len; i++)
-         {
-            T x = static_cast<T>(contents[i]);
-            v.emplace_back(x);
-         }
-         return true;
-      }
-
-      char* read_asset_buffer(const char* assetname, size_t &n)
-      //-----------------------------------------------------------
-      {
-         n = 0;
-         std::ifstream ifs(assetname);
-         if (!ifs.good())
+         if (androidAssetManager == nullptr)
             return nullptr;
-         n = asset_length(assetname);
-         if (n == 0)
+         std::string assetName(assetname);
+         if (assetName.find("assets/") == 0)
+            assetName = "/" + assetName.substr(7);
+         AAsset* ass = AAssetManager_open(androidAssetManager, assetName.c_str(), AASSET_MODE_BUFFER);
+         if (ass == nullptr)
             return nullptr;
-         char* contents = new char[n];
-         ifs.read(contents, n);
-         if (!ifs.good())
+         const void* buffer = AAsset_getBuffer(ass);
+         if (buffer == nullptr)
+         {
+            AAsset_close(ass);
             return nullptr;
-         return contents;
+         }
+         return std::make_shared<AssetView>(buffer, static_cast<size_t>(AAsset_getLength(ass)),
+                                            [ass](const void*, size_t) { AAsset_close(ass); });
       }
+#else
+      bool is_asset_dir(const char* assetdir) { return ( (is_pack_dir(assetdir)) || (is_dir(assetdir)) ); }
 
-      bool read_asset_string(const char* assetname, std::string& s)
-      //-----------------------------------------------------------
+      bool exists(const char *assetname)
       {
-         std::ifstream ifs(assetname);
-         if (!ifs.good())
-            return false;
-         std::string ss((std::istreambuf_iterator<char>(ifs)), (std::istreambuf_iterator<char>()));
-         if (!ifs.good())
-            return false;
-         s = std::move(ss);
-         return true;
+         if ( (find_memory_asset(assetname)) || (find_pack_asset(assetname)) )
+            return true;
+         return (access(assetname, R_OK) == 0);
       }
 
       size_t asset_length(const char* assetname)
       //----------------------------------------
       {
-         std::ifstream in(assetname, std::ifstream::ate | std::ifstream::binary);
-         return in.tellg();
+         std::shared_ptr<AssetView> view = find_memory_asset(assetname);
+         if (! view)
+            view = find_pack_asset(assetname);
+         if (view)
+            return view->size();
+         struct stat sb;
+         if (stat(assetname, &sb) != 0)
+            return 0;
+         return static_cast<size_t>(sb.st_size);
       }
 
       bool copy_assets_to(const char *assetdir, const char *sdcardDir, bool isRecurse=false)
@@ -326,9 +414,78 @@ namespace bulb
          }
          return true;
       }
-#endif
+
    private:
+      std::shared_ptr<AssetView> map_platform_asset(const char* assetname)
+      //------------------------------------------------------------------
+      {
+         int fd = open(assetname, O_RDONLY | O_CLOEXEC);
+         if (fd < 0)
+            return nullptr;
+         struct stat sb;
+         if ( (fstat(fd, &sb) != 0) || (! S_ISREG(sb.st_mode)) )
+         {
+            close(fd);
+            return nullptr;
+         }
+         size_t len = static_cast<size_t>(sb.st_size);
+         if (len == 0)
+         {
+            close(fd);
+            return std::make_shared<AssetView>(nullptr, 0);
+         }
+         void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+         close(fd); // The mapping remains valid after the descriptor is closed
+         if (p == MAP_FAILED)
+            return nullptr;
+         return std::make_shared<AssetView>(p, len,
+                                            [](const void* data, size_t size) { munmap(const_cast<void*>(data), size); });
+      }
+#endif
       AssetReader() = default;
+
+      std::mutex memoryMutex;
+      std::unordered_map<std::string, std::shared_ptr<AssetView>> memoryAssets;
+
+      struct AsyncRead
+      {
+         std::shared_future<std::shared_ptr<AssetView>> future;
+         std::vector<AssetCallback> callbacks;
+      };
+      std::mutex asyncMutex;
+      std::unordered_map<std::string, AsyncRead> asyncReads;
+
+      AsyncRead& start_read_locked(const std::string& assetname);
+
+      std::vector<std::shared_ptr<AssetPack>> packs; // Guarded by memoryMutex
+
+      std::shared_ptr<AssetView> find_pack_asset(const char* assetname);
+      bool is_pack_dir(const char* assetdir);
+
+      // map_asset without its trace scope, for the reads which record their own.
+      std::shared_ptr<AssetView> find_asset(const char* assetname)
+      //-----------------------------------------------------------
+      {
+         if (assetname == nullptr)
+            return nullptr;
+         std::shared_ptr<AssetView> view = find_memory_asset(assetname);
+         if (view)
+            return view;
+         view = find_pack_asset(assetname);
+         if (view)
+            return view;
+         return map_platform_asset(assetname);
+      }
+
+      std::shared_ptr<AssetView> find_memory_asset(const char* assetname)
+      //-----------------------------------------------------------------
+      {
+         std::lock_guard<std::mutex> lock(memoryMutex);
+         if (memoryAssets.empty())
+            return nullptr;
+         auto it = memoryAssets.find(assetname);
+         return (it != memoryAssets.end()) ? it->second : nullptr;
+      }
    };
 }
 #endif
@@ -0,0 +1,108 @@
+#ifndef BULB_FRAMESCHEDULER_HH_
+#define BULB_FRAMESCHEDULER_HH_
+
+#include <functional>
+#include <chrono>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace bulb
+{
+   /** Called for each fixed timestep with the simulation time at the start of the step and the step length. */
+   using FixedUpdateCallback = std::function<void(double time, double dt)>;
+
+   /**
+    * Called once per frame after the fixed updates with the fraction (0 to 1) of a step the frame time lies past the
+    * last update, to interpolate between the previous and current simulation states.
+    */
+   using InterpolateCallback = std::function<void(double alpha)>;
+
+   /**
+    * Paces a render loop: each run_frame performs the fixed timestep updates due for the elapsed time, the
+    * interpolation callback and the render, and then sleeps until the next frame deadline instead of polling, so a
+    * loop of run_frame calls uses no CPU between frames. Deadlines advance by whole frame periods so that occasional
+    * late frames do not accumulate drift, and are resynchronised after a long stall. The measured frame period and
+    * its jitter are available for monitoring.
+    */
+   class FrameScheduler
+   //==================
+   {
+   public:
+      /**
+       * @param framesPerSecond Target frame rate (usually the display refresh rate), 0 to render without pacing.
+       * @param updatesPerSecond Fixed update rate.
+       */
+      explicit FrameScheduler(double framesPerSecond =60, double updatesPerSecond =60);
+
+      void set_frame_rate(double framesPerSecond);
+
+      double get_frame_rate() const { return frameRate; }
+
+      void set_update_rate(double updatesPerSecond);
+
+      double get_update_rate() const { return 1.0 / updateStep; }
+
+      /** Limits the updates run in one frame so a slow frame does not cause ever longer catch ups (default 5). */
+      void set_max_updates(unsigned count) { maxUpdates = (count > 0) ? count : 1; }
+
+      /**
+       * The scheduler sleeps until this long (default 500) before a deadline and then yields until it, as sleeps
+       * may overshoot by a scheduler quantum. 0 sleeps until the deadline.
+       */
+      void set_spin_margin(uint64_t micros) { spinMargin = std::chrono::microseconds(micros); }
+
+      void on_update(FixedUpdateCallback callback) { updateCallback = std::move(callback); }
+
+      void on_interpolate(InterpolateCallback callback) { interpolateCallback = std::move(callback); }
+
+      /**
+       * Runs one frame: the due fixed updates, interpolation, render and a sleep until the next frame deadline.
+       * @return The result of render.
+       */
+      bool run_frame(const std::function<bool()>& render);
+
+      /** @return The simulation time (seconds) reached by the fixed updates. */
+      double simulation_time() const { return simulationTime; }
+
+      /** @return The time (seconds) of the frame being rendered, interpolated between the last two updates. */
+      double interpolated_time() const { return simulationTime - updateStep + alpha * updateStep; }
+
+      /** @return The interpolation fraction of the current frame. */
+      double interpolation() const { return alpha; }
+
+      /** @return The change in interpolated_time since the previous frame (seconds). */
+      double frame_delta() const { return frameDelta; }
+
+      /** @return The mean measured time between frame starts over recent frames (seconds). */
+      double frame_period() const;
+
+      /** @return The standard deviation of the measured frame period over recent frames (seconds). */
+      double frame_jitter() const;
+
+      uint64_t frame_count() const { return frames; }
+
+      /** Restarts the simulation clock and measurements (eg after a pause). */
+      void reset();
+
+   private:
+      using Clock = std::chrono::steady_clock;
+
+      double frameRate;
+      double updateStep;
+      unsigned maxUpdates = 5;
+      std::chrono::microseconds spinMargin{500};
+      FixedUpdateCallback updateCallback;
+      InterpolateCallback interpolateCallback;
+
+      bool isStarted = false;
+      Clock::time_point lastFrame, deadline;
+      double accumulator = 0, simulationTime = 0, alpha = 1, frameDelta = 0, lastInterpolated = 0;
+      uint64_t frames = 0;
+      std::array<double, 120> periods{}; // Ring of recent measured frame periods
+      size_t periodCount = 0;
+
+      void sleep_until_deadline();
+   };
+}
+#endif
@@ -0,0 +1,128 @@
+#ifndef BULB_FRAMESTATS_HH_
+#define BULB_FRAMESTATS_HH_
+
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace bulb
+{
+   /** The timed phases of SceneGraph::render. */
+   enum class FramePhase : uint8_t
+   {
+      MUTATIONS = 0,     // Pending gltf loads and texture uploads applied
+      TRAVERSAL,         // Scene graph traversal, excluding PRE_RENDER
+      PRE_RENDER,        // Drawable::pre_render calls
+      SCENE_REBUILD,     // Scene recreated and renderables added
+      BEGIN_FRAME,
+      RENDER_BACKGROUND,
+      RENDER_VIEW,
+      POST_RENDER,       // Post render callback
+      END_FRAME,
+      TOTAL,
+      COUNT
+   };
+
+   const char* frame_phase_name(FramePhase phase);
+
+   /** Percentiles and maximum (microseconds) of a phase over the frames held by FrameStats. */
+   struct FramePhaseStats
+   {
+      uint32_t p50 = 0, p95 = 0, p99 = 0, max = 0;
+      size_t frames = 0;
+   };
+
+   /** The phase times (microseconds) of one frame. */
+   struct FrameTimes
+   {
+      uint32_t phases[static_cast<size_t>(FramePhase::COUNT)] = {};
+
+      uint32_t& operator[](FramePhase phase) { return phases[static_cast<size_t>(phase)]; }
+      uint32_t operator[](FramePhase phase) const { return phases[static_cast<size_t>(phase)]; }
+   };
+
+   /**
+    * Per phase frame times over the most recent frames. Frames are recorded by the render thread into a fixed ring
+    * of atomics without locking, while phase_stats may be called from any thread (a frame being overwritten as it
+    * is read may contribute a mix of old and new phase times). Frames over the budget are logged, at most once a
+    * second with the number of further frames over budget since the previous log.
+    */
+   class FrameStats
+   //==============
+   {
+   public:
+      explicit FrameStats(size_t capacity =512);
+
+      FrameStats(FrameStats const&) = delete;
+      FrameStats& operator=(FrameStats const&) = delete;
+
+      /** Records a frame (one thread only). */
+      void record(const FrameTimes& frame);
+
+      FramePhaseStats phase_stats(FramePhase phase) const;
+
+      /** @return The number of frames recorded since construction or reset (more than are held). */
+      uint64_t frame_count() const { return head.load(std::memory_order_acquire); }
+
+      /** Sets the frame budget in microseconds (0, the default, disables budget logging). */
+      void set_budget(uint32_t micros) { budget.store(micros, std::memory_order_relaxed); }
+
+      uint32_t get_budget() const { return budget.load(std::memory_order_relaxed); }
+
+      /** @return The number of recorded frames which exceeded the budget. */
+      uint64_t over_budget_count() const { return overBudget.load(std::memory_order_relaxed); }
+
+      /** Logs the stats of every phase at info level. */
+      void log() const;
+
+      /** Discards the recorded frames (on the recording thread). */
+      void reset();
+
+   private:
+      static constexpr size_t PHASES = static_cast<size_t>(FramePhase::COUNT);
+
+      const size_t capacity;
+      std::unique_ptr<std::atomic<uint32_t>[]> samples; // [slot * PHASES + phase]
+      std::atomic<uint64_t> head{0};
+      std::atomic<uint32_t> budget{0};
+      std::atomic<uint64_t> overBudget{0};
+      uint64_t overBudgetLogged = 0;
+      std::chrono::steady_clock::time_point lastBudgetLog;
+   };
+
+   /** Accumulates the time between successive lap() calls into FrameTimes phases. */
+   class PhaseTimer
+   //==============
+   {
+   public:
+      explicit PhaseTimer(FrameTimes& frameTimes) : times(frameTimes), start(std::chrono::steady_clock::now()),
+                                                    last(start) {}
+
+      /** Adds the time since the previous lap (or construction) to phase. */
+      void lap(FramePhase phase)
+      //------------------------
+      {
+         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+         times[phase] += micros(now - last);
+         last = now;
+      }
+
+      /** Restarts the lap without recording the time since the previous one. */
+      void skip() { last = std::chrono::steady_clock::now(); }
+
+      /** Sets the TOTAL phase to the time since construction. */
+      void finish() { times[FramePhase::TOTAL] = micros(std::chrono::steady_clock::now() - start); }
+
+      static uint32_t micros(std::chrono::steady_clock::duration d)
+      {
+         return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+      }
+
+   private:
+      FrameTimes& times;
+      std::chrono::steady_clock::time_point start, last;
+   };
+}
+#endif
@@ -0,0 +1,152 @@
+#ifndef BULB_GLTFASSET_HH_
+#define BULB_GLTFASSET_HH_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <chrono>
+
+#include "filament/Engine.h"
+#include "filament/Fence.h"
+#include "utils/Entity.h"
+#include "gltfio/AssetLoader.h"
+#include "gltfio/ResourceLoader.h"
+#include "gltfio/FilamentAsset.h"
+#include "gltfio/Animator.h"
+
+#include "bulb/AssetReader.hh"
+
+namespace bulb
+{
+   struct LodChain;
+   class Managers;
+
+   using GltfResource = std::pair<std::string, std::shared_ptr<AssetView>>; // URI as in the gltf, contents
+
+   /** Number of indices to draw for a primitive of a gltfio entity (indexed in FilamentAsset::getEntities order). */
+   struct GltfIndexCount
+   {
+      size_t entity;
+      size_t primitive;
+      size_t count;
+   };
+
+   /** A gltf or glb and its external resources read into memory, @see GltfAsset::read. */
+   struct GltfSource
+   {
+      std::string path, name, resourceDir;
+      bool isBinary = false;
+      std::shared_ptr<AssetView> gltf;
+      std::vector<GltfResource> resources;
+   };
+
+   /**
+    * A filament gltf asset created with one or more instances, which share the asset's vertex buffers, index buffers,
+    * textures and materials while each has its own entity hierarchy. MultiGeometry nodes take an instance each
+    * (acquire_instance) and hold a shared_ptr to the asset, so the asset and its GPU resources are destroyed when the
+    * last node displaying it is destroyed. gltfio can only create instances along with the asset, so the number of
+    * instances is fixed when the asset is created.
+    */
+   class GltfAsset
+   //=============
+   {
+   public:
+      /**
+       * Reads a gltf, glb or zipped gltf and all the external buffers and images it references into source. Makes
+       * no filament calls so may be called on any thread. Directories are not searched and are reported as errors.
+       * @param isOptimized Reorder the mesh buffers with MeshOptimizer::optimize_gltf after reading.
+       */
+      static bool read(const char* gltfPath, GltfSource& source, bool isOptimized =false);
+
+      /**
+       * gltf URIs may be percent encoded (eg %20 for spaces), the names of the files they refer to are not.
+       * @return uri with its escapes decoded. Malformed or truncated escapes are kept as is.
+       */
+      static std::string decode_uri(const std::string& uri);
+
+      /**
+       * Creates the filament asset from source (render thread only).
+       * @param context The context (and therefore Engine) to create the asset in, which must outlive it.
+       * @param instanceCount Number of instances to create (1 creates a non-instanced asset).
+       * @param isAsync Textures are decoded in the background and uploaded by update(), which must then be called
+       *                every frame until it returns true, instead of before returning.
+       * @param loader A loader shared with other assets (which must outlive this asset) or nullptr to create one
+       *               (and a material generator) for this asset only.
+       */
+      static std::shared_ptr<GltfAsset> create(Managers& context, GltfSource& source, size_t instanceCount =1,
+                                               bool isAsync =false, gltfio::AssetLoader* loader =nullptr);
+
+      /**
+       * Creates an asset for each level of chain (@see MeshOptimizer::gltf_lods) from source (render thread only).
+       * gltfio cannot share vertex buffers or textures between assets, so each level is a complete asset with only
+       * its index buffers simplified, trading memory for fewer triangles. Parameters are as for create.
+       * @return The level assets, ending at the first level which could not be created.
+       */
+      static std::vector<std::shared_ptr<GltfAsset>> create_lods(Managers& context, const GltfSource& source,
+                                                                 const LodChain& chain, size_t instanceCount =1,
+                                                                 bool isAsync =false,
+                                                                 gltfio::AssetLoader* loader =nullptr);
+
+      GltfAsset(GltfAsset const&) = delete;
+      GltfAsset& operator=(GltfAsset const&) = delete;
+      ~GltfAsset();
+
+      /** Uploads textures decoded since the last call (render thread only). @return true once loading is complete. */
+      bool update();
+
+      bool is_loading() const { return (resourceLoader != nullptr); }
+
+      /**
+       * Draws count indices of the given primitives in every instance (render thread only). Skipped with a warning
+       * if the asset does not have entityCount entities, as the entity indices would then not match.
+       */
+      void set_index_counts(const std::vector<GltfIndexCount>& counts, size_t entityCount);
+
+      /** @return The index of an unused instance or -1 if all are in use. */
+      int acquire_instance();
+
+      void release_instance(int instance);
+
+      size_t free_instances() const;
+
+      size_t instance_count() const { return isUsed.size(); }
+
+      utils::Entity get_root(int instance) const;
+
+      /** @return The entities of instance, placing their count in count. */
+      const utils::Entity* get_entities(int instance, size_t& count) const;
+
+      /**
+       * @return The animator for instance (which animates and skins that instance only) or nullptr while the
+       *         resources are still loading (render thread only).
+       */
+      gltfio::Animator* get_animator(int instance);
+
+      gltfio::FilamentAsset* get_asset() { return asset; }
+
+      gltfio::AssetLoader* get_loader() { return loader; }
+
+      const std::string& get_path() const { return path; }
+
+      /** @return The context (and therefore Engine) the asset was created in. */
+      Managers& get_managers() { return *managers; }
+
+   private:
+      GltfAsset() = default;
+
+      Managers* managers = nullptr;
+      std::string path;
+      gltfio::AssetLoader* loader = nullptr;
+      gltfio::MaterialProvider* materials = nullptr;  // Only set if loader is owned by this asset
+      gltfio::FilamentAsset* asset = nullptr;
+      std::vector<gltfio::FilamentInstance*> instances; // Empty for a non-instanced asset
+      std::vector<bool> isUsed;
+      std::unique_ptr<gltfio::ResourceLoader> resourceLoader;
+      filament::Fence* resourceFence = nullptr;
+      std::chrono::high_resolution_clock::time_point resourceStart;
+
+      bool finish_resources(bool isWait);
+   };
+}
+#endif
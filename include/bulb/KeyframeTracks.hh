@@ -0,0 +1,120 @@
+#ifndef BULB_KEYFRAMETRACKS_HH_
+#define BULB_KEYFRAMETRACKS_HH_
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#include "bulb/nodes/AffineTransform.hh"
+
+namespace bulb
+{
+   /** How a KeyframeChannel is interpolated between keys, as for glTF animation samplers. */
+   enum class KeyframeInterpolation { STEP, LINEAR, CUBIC_SPLINE };
+
+   /**
+    * The keyframes of one translation, rotation or scale channel. times are in seconds and must not decrease.
+    * values holds 3 floats per key (x, y, z) for translation and scale or 4 (quaternion x, y, z, w) for rotation.
+    * CUBIC_SPLINE channels hold three of these per key, the in tangent, the value and the out tangent (as glTF).
+    */
+   struct KeyframeChannel
+   {
+      std::vector<float> times;
+      std::vector<float> values;
+      KeyframeInterpolation interpolation = KeyframeInterpolation::LINEAR;
+
+      bool empty() const { return times.empty(); }
+   };
+
+   /**
+    * Built in keyframe animation of AffineTransform translation, rotation and scale. The keys of all tracks are
+    * stored as structure of arrays (one array per component for each kind of channel) and evaluate() samples every
+    * channel at once: each channel keeps a cursor to its last key so sampling a steadily advancing time does not
+    * search the keys, and the interpolation (lerp for translation and scale, an approximated slerp for rotation) is
+    * done four channels at a time with SSE2 or NEON where available. STEP channels hold each key until the next,
+    * and CUBIC_SPLINE channels are evaluated while gathering the keys (rotations are then normalized). Times
+    * before the first key hold the first key and, for tracks which do not loop, times after the last key hold the
+    * last. The results are written straight into the target transforms, replacing per transform
+    * Transform::animate callbacks and clock queries.
+    * Targets must outlive their tracks (clear() before destroying them).
+    */
+   class KeyframeTracks
+   //==================
+   {
+   public:
+      KeyframeTracks();
+
+      /**
+       * Adds a track animating target. Empty channels leave that part of the transform unchanged.
+       * @param isLooping Repeat the track (with a period of its last key time) instead of holding the last key.
+       * @return The track index or -1 if target is null, all channels are empty or a channel is malformed.
+       */
+      int add_track(AffineTransform* target, const KeyframeChannel& translation, const KeyframeChannel& rotation,
+                    const KeyframeChannel& scale, bool isLooping =true);
+
+      /** Disabled tracks are neither sampled nor written to their target. */
+      void set_enabled(int track, bool isEnabled);
+
+      /** @return The time of the last key of track. */
+      float duration(int track) const;
+
+      /**
+       * Samples every enabled track at time (seconds) and writes the results into their targets. Large sets of
+       * tracks are sampled on ThreadPool::workers(). Tracks sharing a target are written by the same thread, in the
+       * order they were added.
+       */
+      void evaluate(double time);
+
+      /**
+       * Selects the SSE2/NEON interpolation kernels (the default) or the portable scalar kernels they are checked
+       * against. Without SSE2 or NEON both are scalar.
+       */
+      void set_simd(bool isSimd) { isSimdEnabled = isSimd; }
+
+      bool is_simd() const { return isSimdEnabled; }
+
+      size_t size() const { return tracks.size(); }
+
+      bool empty() const { return tracks.empty(); }
+
+      void clear();
+
+   private:
+      struct Track
+      {
+         AffineTransform* target;
+         float duration;
+         bool isLooping;
+         bool isEnabled;
+         int channel[3]; // Index in channels[kind] or -1
+      };
+
+      // All channels of one kind with their keys and per frame sampling arrays, each component in its own array.
+      struct ChannelSet
+      {
+         unsigned components;
+         std::vector<float> times;
+         std::vector<float> values[4];
+         std::vector<uint32_t> offset, count, cursor, track;
+         std::vector<KeyframeInterpolation> interpolation;
+         std::vector<uint32_t> tangentOffset; // CUBIC_SPLINE only, index of the first key's in tangent
+         std::vector<float> tangents[4]; // In and out tangent of each key of the CUBIC_SPLINE channels
+         std::vector<float> alpha;
+         std::vector<float> from[4], to[4], result[4]; // Padded to a multiple of 4 channels
+      };
+
+      enum { TRANSLATION = 0, ROTATION = 1, SCALE = 2 };
+
+      std::vector<Track> tracks;
+      ChannelSet channels[3];
+      std::vector<float> trackTimes;
+      std::unordered_map<AffineTransform*, uint32_t> targetIndex; // Index in targetTracks
+      std::vector<std::vector<uint32_t>> targetTracks; // The tracks of each target
+      bool isSimdEnabled = true;
+
+      void sample(ChannelSet& set, size_t first, size_t last);
+      void write(size_t firstTarget, size_t lastTarget);
+   };
+}
+#endif
@@ -3,18 +3,168 @@
 
 #include <string>
 #include <utility>
-
-#if defined(__ANDROID__)
-#include <android/log.h>
-#else
-#include <stdio.h>
-#endif
+#include <atomic>
+#include <tuple>
+#include <new>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
 
 #define FMT_HEADER_ONLY
 #include "fmt/format.h"
 
+// Messages below this level (0 debug, 1 info, 2 warn, 3 error, 4 none) are compiled out.
+#if !defined(BULB_LOG_LEVEL)
+#define BULB_LOG_LEVEL 0
+#endif
+
 namespace bulb
 {
+   enum class LogLevel : int { DEBUG = 0, INFO, WARN, ERROR, NONE };
+
+   /**
+    * A queued message: the format string, annotation and arguments copied (strings into the record itself) by the
+    * logging thread, and the function that formats them on the writer thread.
+    */
+   struct LogRecord
+   {
+      static constexpr size_t TAG_SIZE = 32, DATA_SIZE = 448;
+
+      LogLevel level;
+      void (*format)(const void* data, fmt::memory_buffer& out);
+      char tag[TAG_SIZE];
+      alignas(std::max_align_t) unsigned char data[DATA_SIZE];
+   };
+
+   // Copies the strings of a message into the space left in a record after its argument tuple.
+   struct LogArena
+   {
+      char* next;
+      char* end;
+      bool isFull = false;
+
+      fmt::string_view copy(const char* s, size_t n)
+      {
+         if (n > static_cast<size_t>(end - next))
+         {
+            isFull = true;
+            return fmt::string_view();
+         }
+         std::memcpy(next, s, n);
+         fmt::string_view copied(next, n);
+         next += n;
+         return copied;
+      }
+   };
+
+   // How a message argument is held until the writer formats it. Numbers, enums and pointers (formatted as
+   // addresses, never followed) are copied as they are and strings into the record. Messages with any other argument,
+   // such as views, spans or structs which may refer to memory freed after the call, are formatted by the logging
+   // thread.
+   template <typename T>
+   struct LogArg
+   {
+      static constexpr bool isDeferrable = (std::is_arithmetic<T>::value) || (std::is_enum<T>::value) ||
+                                           (std::is_pointer<T>::value);
+      using type = T;
+      static const T& store(const T& value, LogArena&) { return value; }
+   };
+
+   template <>
+   struct LogArg<const char*>
+   {
+      static constexpr bool isDeferrable = true;
+      using type = fmt::string_view;
+      static type store(const char* s, LogArena& arena)
+      {
+         if (s == nullptr)
+            s = "(null)";
+         return arena.copy(s, std::strlen(s));
+      }
+   };
+
+   template <>
+   struct LogArg<char*> : LogArg<const char*> {};
+
+   template <>
+   struct LogArg<std::string>
+   {
+      static constexpr bool isDeferrable = true;
+      using type = fmt::string_view;
+      static type store(const std::string& s, LogArena& arena) { return arena.copy(s.data(), s.size()); }
+   };
+
+   template <>
+   struct LogArg<fmt::string_view>
+   {
+      static constexpr bool isDeferrable = true;
+      using type = fmt::string_view;
+      static type store(fmt::string_view s, LogArena& arena) { return arena.copy(s.data(), s.size()); }
+   };
+
+   template <bool...> struct LogAll;
+   template <> struct LogAll<> : std::true_type {};
+   template <bool B, bool... Rest> struct LogAll<B, Rest...> : std::integral_constant<bool, B && LogAll<Rest...>::value> {};
+
+   template <typename ...Args>
+   struct LogDeferred
+   {
+      fmt::string_view annotation, templ;
+      std::tuple<typename LogArg<Args>::type...> values;
+
+      static constexpr bool isDeferrable = LogAll<LogArg<Args>::isDeferrable...>::value;
+
+      template <typename S>
+      static bool store(LogRecord& record, const std::string& annotation, const S& templ, const Args&... args)
+      {
+         return store(std::integral_constant<bool, (isDeferrable) && (sizeof(LogDeferred) <= LogRecord::DATA_SIZE) &&
+                                                   (std::is_convertible<const S&, fmt::string_view>::value)>(),
+                      record, annotation, templ, args...);
+      }
+
+      static void format(const void* data, fmt::memory_buffer& out)
+      {
+         const LogDeferred& message = *static_cast<const LogDeferred*>(data);
+         if (message.annotation.size() > 0)
+            fmt::format_to(out, "{} ", message.annotation);
+         message.format_values(out, std::index_sequence_for<Args...>());
+      }
+
+   private:
+      template <typename S>
+      static bool store(std::false_type, LogRecord&, const std::string&, const S&, const Args&...) { return false; }
+
+      template <typename S>
+      static bool store(std::true_type, LogRecord& record, const std::string& annotation, const S& templ,
+                        const Args&... args)
+      {
+         LogArena arena{ reinterpret_cast<char*>(record.data) + sizeof(LogDeferred),
+                         reinterpret_cast<char*>(record.data) + LogRecord::DATA_SIZE };
+         const fmt::string_view templateView(templ);
+         new (record.data) LogDeferred{ arena.copy(annotation.data(), annotation.size()),
+                                        arena.copy(templateView.data(), templateView.size()),
+                                        std::tuple<typename LogArg<Args>::type...>(LogArg<Args>::store(args, arena)...) };
+         record.format = &LogDeferred::format;
+         return (! arena.isFull);
+      }
+
+      template <size_t ...I>
+      void format_values(fmt::memory_buffer& out, std::index_sequence<I...>) const
+      {
+         fmt::format_to(out, templ, std::get<I>(values)...);
+      }
+   };
+
+   /**
+    * Messages are queued with their arguments into a per thread lock free ring and formatted and written (to
+    * stdout/stderr or the Android log) by a background thread, so logging from the render or load threads neither
+    * formats nor waits on I/O. Levels below BULB_LOG_LEVEL are removed at compile time and levels below the runtime
+    * level (set_level) return before anything is copied. Messages from one thread are written in order, but those of
+    * different threads may be interleaved differently to the order they were logged. Messages whose arguments do not
+    * fit in a ring slot (or are not strings, numbers, enums or pointers), or that arrive while the ring is full, are
+    * formatted and written synchronously after the queued messages are flushed. The writer is never destroyed; at
+    * exit it is stopped and later messages are written synchronously.
+    */
    struct Log
       {
          std::string tag, annotation;
@@ -39,121 +189,77 @@ namespace bulb
          virtual ~Log() { }
 
          template <typename S, typename ...Args>
-         void error(const S templ, const Args... args)
-         //--------------------------------------------
-         {
-            fmt::memory_buffer buf;
-            if (! annotation.empty())
-               fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, templ, std::forward<const Args>(args)...);
-            // fmt::format(templ, std::forward<Args>(args)...);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_ERROR, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stderr, "ERROR %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
-         }
+         void error(const S templ, const Args... args) { write(compiled<LogLevel::ERROR>(), LogLevel::ERROR, templ, args...); }
 
-         void error(const char* message)
-         {
-            fmt::memory_buffer buf;
-            if (! annotation.empty())
-               fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, "%s", message);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_ERROR, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stderr, "ERROR %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
-         }
+         void error(const char* message) { write(compiled<LogLevel::ERROR>(), LogLevel::ERROR, "{}", message); }
 
          template <typename S, typename ...Args>
-         void warn(const S templ, const Args... args)
-         //--------------------------------------------
-         {
-            fmt::memory_buffer buf;
-            if (! annotation.empty())
-               fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, templ, std::forward<const Args>(args)...);
-            // fmt::format(templ, std::forward<Args>(args)...);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_WARN, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stderr, "WARN %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
+         void warn(const S templ, const Args... args) { write(compiled<LogLevel::WARN>(), LogLevel::WARN, templ, args...); }
 
-         }
+         void warn(const char* message) { write(compiled<LogLevel::WARN>(), LogLevel::WARN, "{}", message); }
 
-         void warn(const char* message)
-         {
-            fmt::memory_buffer buf;
-            if (! annotation.empty())
-               fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, "%s", message);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_WARN, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stderr, "WARN %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
-         }
+         template <typename S, typename ...Args>
+         void info(const S templ, const Args... args) { write(compiled<LogLevel::INFO>(), LogLevel::INFO, templ, args...); }
+
+         void info(const char* message) { write(compiled<LogLevel::INFO>(), LogLevel::INFO, "{}", message); }
 
          template <typename S, typename ...Args>
-         void info(const S templ, const Args... args)
-         //--------------------------------------------
-         {
-            fmt::memory_buffer buf;
-            if (! annotation.empty())
-               fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, templ, std::forward<const Args>(args)...);
-            // fmt::format(templ, std::forward<Args>(args)...);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_INFO, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stdout, "INFO %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
-         }
+         void debug(const S templ, const Args... args) { write(compiled<LogLevel::DEBUG>(), LogLevel::DEBUG, templ, args...); }
+
+         void debug(const char* message) { write(compiled<LogLevel::DEBUG>(), LogLevel::DEBUG, "{}", message); }
 
-         void info(const char* message)
+         /** Sets the lowest level written at runtime (default LogLevel::DEBUG). */
+         static void set_level(LogLevel level) { runtimeLevel.store(static_cast<int>(level), std::memory_order_relaxed); }
+
+         static LogLevel get_level() { return static_cast<LogLevel>(runtimeLevel.load(std::memory_order_relaxed)); }
+
+         static bool is_enabled(LogLevel level)
          {
-            fmt::memory_buffer buf;
-            if (! annotation.empty())
-               fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, "%s", message);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_INFO, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stdout, "INFO %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
+            return (static_cast<int>(level) >= BULB_LOG_LEVEL) &&
+                   (static_cast<int>(level) >= runtimeLevel.load(std::memory_order_relaxed));
          }
 
+         /** Writes subsequent messages on the calling thread instead of queueing them (eg when debugging a crash). */
+         static void set_synchronous(bool isSynchronous);
+
+         /** Writes all queued messages before returning. */
+         static void flush();
+
+      private:
+         static std::atomic<int> runtimeLevel;
+
+         template <LogLevel level>
+         using compiled = std::integral_constant<bool, (static_cast<int>(level) >= BULB_LOG_LEVEL)>;
+
          template <typename S, typename ...Args>
-         void debug(const S templ, const Args... args)
-         //--------------------------------------------
-         {
-            fmt::memory_buffer buf;
-            if (! annotation.empty())
-               fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, templ, std::forward<const Args>(args)...);
-            // fmt::format(templ, std::forward<Args>(args)...);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_DEBUG, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stdout, "DEBUG %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
-         }
+         void write(std::false_type, LogLevel, const S&, const Args&...) { }
 
-         void debug(const char* message)
+         template <typename S, typename ...Args>
+         void write(std::true_type, LogLevel level, const S& templ, const Args&... args)
+         //-----------------------------------------------------------------------------
          {
+            if (static_cast<int>(level) < runtimeLevel.load(std::memory_order_relaxed))
+               return;
+            LogRecord* record = reserve(level, tag);
+            if ( (record != nullptr) && (LogDeferred<Args...>::store(*record, annotation, templ, args...)) )
+            {
+               commit();
+               return;
+            }
             fmt::memory_buffer buf;
             if (! annotation.empty())
                fmt::format_to(buf, "{} ", annotation);
-            fmt::format_to(buf, "%s", message);
-#if defined(__ANDROID__)
-            __android_log_print(ANDROID_LOG_DEBUG, tag.c_str(), "%s", buf.data());
-#else
-            fprintf(stdout, "DEBUG %s %s\n", tag.c_str(), fmt::to_string(buf).c_str());
-#endif
+            fmt::format_to(buf, templ, args...);
+            post(level, tag, buf.data(), buf.size());
          }
+
+         /** @return The next free record of the calling thread's ring, or nullptr to write synchronously. */
+         static LogRecord* reserve(LogLevel level, const std::string& tag);
+
+         /** Queues the record returned by reserve for the writer. */
+         static void commit();
+
+         static void post(LogLevel level, const std::string& tag, const char* text, size_t size);
       };
 }
  #endif
@@ -12,17 +12,60 @@ const filament::Engine::Backend DEFAULT_BACKEND = filament::Engine::Backend::OPE
 
 namespace bulb
 {
-   static filament::Engine::Backend SELECTED_BACKEND = DEFAULT_BACKEND;
+   class MaterialCache;
+   class MaterialInstancePool;
+   class TextureLoader;
 
+   /** How Managers creates the filament Engine (@see Managers::configure). */
+   struct EngineConfig
+   {
+      // NOOP runs the whole library without a GPU or display (eg for benchmarks and batch jobs on servers), with
+      // SceneGraph::create_headless in place of a native window.
+      filament::Engine::Backend backend = DEFAULT_BACKEND;
+      filament::Engine::Platform* platform = nullptr;
+      void* sharedGLContext = nullptr;
+      // Workers in the library's own ThreadPool::workers(), 0 for one less than the hardware concurrency. This is not
+      // the filament job system, which in this filament version has no Engine::Config and sizes itself from the
+      // hardware concurrency.
+      size_t bulbWorkerThreads = 0;
+      // Threads in ThreadPool::io_workers(), which runs AssetReader::read_async, 0 for the default of 4.
+      size_t ioThreads = 0;
+   };
+
+   /**
+    * An Engine with its managers and the per Engine caches (MaterialCache, MaterialInstancePool, TextureLoader).
+    * The default context is created from configure() on the first use of instance(). Further independent contexts
+    * are created with create(), so several Engines can render in one process, each on its own thread. The context
+    * is passed explicitly to the SceneGraphs, nodes and GltfAssets that use it, which keep it for their lifetime and
+    * must be used and destroyed while it is alive.
+    */
    class Managers
+   //============
    {
    public:
-      static Managers& instance()
-      //--------------------------------
-      {
-         static Managers the_instance;
-         return the_instance;
-      }
+      /**
+       * Sets the configuration used to create the Engine of the default context. Must be called before the first
+       * use of instance(), and for the worker counts before the first use of ThreadPool::workers() and
+       * ThreadPool::io_workers().
+       * @return false, leaving the configuration unchanged, if the Engine (or either pool if its count differs) have
+       *         already been created.
+       */
+      static bool configure(const EngineConfig& config);
+
+      static const EngineConfig& get_config() { return config(); }
+
+
+      /** @return The default context, created (@see configure) on first use. */
+      static Managers& instance();
+
+      /**
+       * Creates an independent context with its own Engine. The worker counts of config are ignored as the
+       * ThreadPool pools are shared by all contexts (@see ThreadPool::set_worker_count).
+       * @return The context or nullptr if the Engine could not be created.
+       */
+      static std::shared_ptr<Managers> create(const EngineConfig& config);
+
+      ~Managers();
 
       Managers(Managers const&) = delete;
       Managers(Managers&&) = delete;
@@ -35,13 +78,30 @@ namespace bulb
       filament::RenderableManager& renderManager;
       filament::LightManager& lightManager;
 
+      /**
+       * Creates a swapchain rendering to nativeWindow, or if it is null an offscreen (headless) swapchain of
+       * width x height.
+       */
+      filament::SwapChain* create_swapchain(void* nativeWindow, uint32_t width =0, uint32_t height =0,
+                                            uint64_t flags =0);
+
+      MaterialCache& material_cache() { return *materialCache; }
+
+      MaterialInstancePool& material_instances() { return *materialInstances; }
+
+      TextureLoader& texture_loader() { return *textureLoader; }
+
    private:
-      Managers() : engine(filament::Engine::create(SELECTED_BACKEND),
-                                                   [](filament::Engine* p) { if (p) filament::Engine::destroy(&p); }),
-                   entityManager(utils::EntityManager::get()),
-                   transformManager(engine->getTransformManager()),
-                   renderManager(engine->getRenderableManager()),
-                   lightManager(engine->getLightManager()) {}
+      explicit Managers(filament::Engine* engine);
+
+      static EngineConfig& config();
+
+      static filament::Engine* create_default_engine();
+
+      // Destroyed (in reverse order) before the engine in ~Managers.
+      std::unique_ptr<MaterialInstancePool> materialInstances;
+      std::unique_ptr<MaterialCache> materialCache;
+      std::unique_ptr<TextureLoader> textureLoader;
    };
 }
 
@@ -0,0 +1,82 @@
+#ifndef BULB_MATERIALCACHE_HH_
+#define BULB_MATERIALCACHE_HH_
+
+#include <unordered_map>
+#include <string>
+#include <mutex>
+
+#include "filament/Engine.h"
+#include "filament/Material.h"
+
+namespace bulb
+{
+   class Managers;
+
+   /**
+    * Per Engine cache of filament Materials keyed by the content hash of the material package (and by path for
+    * packages read through AssetReader, so repeated path requests don't re-read the package). Repeated requests
+    * for the same package return the same filament::Material which is reference counted and destroyed when the
+    * last reference is released. Each Managers context owns one cache.
+    */
+   class MaterialCache
+   //=================
+   {
+   public:
+      MaterialCache(MaterialCache const&) = delete;
+      MaterialCache(MaterialCache&&) = delete;
+      MaterialCache& operator=(MaterialCache const&) = delete;
+      MaterialCache& operator=(MaterialCache &&) = delete;
+      ~MaterialCache();
+
+      /**
+       * @param path Path of a compiled material package (read using AssetReader).
+       * @return The (possibly shared) material with its reference count incremented or nullptr on error.
+       */
+      filament::Material* acquire(const char* path);
+
+      /**
+       * @param data The compiled material package contents.
+       * @return The (possibly shared) material with its reference count incremented or nullptr on error.
+       */
+      filament::Material* acquire(const void* data, size_t size);
+
+      /**
+       * Increments the reference count of material if it is managed by the cache.
+       * @return true if material is managed by the cache, false otherwise.
+       */
+      bool retain(const filament::Material* material);
+
+      /**
+       * Decrements the reference count of material if it is managed by the cache, destroying it (and any pooled
+       * instances) when the count reaches zero.
+       * @return true if material is managed by the cache, false otherwise.
+       */
+      bool release(const filament::Material* material);
+
+      bool contains(const filament::Material* material);
+
+      size_t size();
+
+   private:
+      explicit MaterialCache(Managers& managers);
+
+      Managers& managers;
+
+      struct Entry
+      {
+         filament::Material* material;
+         size_t references;
+      };
+
+      std::mutex mtx;
+      std::unordered_map<uint64_t, Entry> materials;
+      std::unordered_map<const filament::Material*, uint64_t> hashes;
+      std::unordered_map<std::string, uint64_t> paths;
+
+      filament::Material* acquire_locked(uint64_t key, const void* data, size_t size);
+      void destroy_locked(uint64_t key);
+
+      friend class Managers;
+   };
+}
+#endif
@@ -0,0 +1,88 @@
+#ifndef BULB_MATERIALINSTANCEPOOL_HH_
+#define BULB_MATERIALINSTANCEPOOL_HH_
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <functional>
+#include <mutex>
+
+#include "filament/Material.h"
+#include "filament/MaterialInstance.h"
+
+namespace bulb
+{
+   class Managers;
+
+   /**
+    * Pool of filament MaterialInstances keyed by the filament Material they were created from. Nodes acquire an
+    * instance when the material they render with changes and release it when it changes again or the node is
+    * destroyed, so instances are created once and reused across scene rebuilds instead of every node sharing
+    * the material default instance. Each Managers context owns one pool.
+    */
+   class MaterialInstancePool
+   //========================
+   {
+   public:
+      MaterialInstancePool(MaterialInstancePool const&) = delete;
+      MaterialInstancePool(MaterialInstancePool&&) = delete;
+      MaterialInstancePool& operator=(MaterialInstancePool const&) = delete;
+      MaterialInstancePool& operator=(MaterialInstancePool &&) = delete;
+      ~MaterialInstancePool();
+
+      /**
+       * @param material The material to obtain an instance of.
+       * @return A free pooled instance of material or a new one if there are none free.
+       */
+      filament::MaterialInstance* acquire(filament::Material* material);
+
+      /**
+       * Returns an instance to the pool. Instances which have had per-node parameters set are destroyed rather
+       * than pooled as their parameter values would otherwise leak into the next owner.
+       */
+      void release(filament::MaterialInstance* instance, bool isModified =false);
+
+      /**
+       * Records that the user of an acquired instance has set param on it, so that update_instances no longer
+       * overwrites it. The overrides are cleared when the instance is released.
+       */
+      void set_override(filament::MaterialInstance* instance, const std::string& param);
+
+      void clear_overrides(filament::MaterialInstance* instance);
+
+      /**
+       * Applies f to every instance of material, skipping in use instances which override param. Used by
+       * bulb::Material to propagate default parameter changes to instances created before the change.
+       */
+      void update_instances(const filament::Material* material, const std::string& param,
+                            const std::function<void(filament::MaterialInstance*)>& f);
+
+      /** Destroys all free instances of material (must be called before the material is destroyed). */
+      void purge(const filament::Material* material);
+
+      /** Destroys all free instances. */
+      void clear();
+
+   private:
+      explicit MaterialInstancePool(Managers& managers);
+
+      Managers& managers;
+
+      struct Slot
+      {
+         filament::MaterialInstance* instance;
+         bool inUse;
+         std::unordered_set<std::string> overrides; // Parameters set by the user of the instance
+      };
+
+      std::mutex mtx;
+      std::unordered_map<const filament::Material*, std::vector<Slot>> slots;
+
+      Slot* find_locked(filament::MaterialInstance* instance);
+
+      friend class Managers;
+   };
+}
+#endif
@@ -0,0 +1,150 @@
+#ifndef BULB_MESHOPTIMIZER_HH_
+#define BULB_MESHOPTIMIZER_HH_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#include "bulb/AssetReader.hh"
+#include "bulb/GltfAsset.hh"
+
+namespace bulb
+{
+   /** Sizes and vertex cache efficiency before and after MeshOptimizer processing. */
+   struct MeshOptimizeStats
+   {
+      size_t vertexBytesBefore = 0, vertexBytesAfter = 0;
+      size_t indexBytesBefore = 0, indexBytesAfter = 0;
+      size_t primitives = 0, skipped = 0;
+      // Average cache miss ratio (vertices transformed per triangle) over all processed primitives
+      double acmrBefore = 0, acmrAfter = 0;
+      size_t triangles = 0;
+   };
+
+   /** Sizes and decoding time of the compressed streams decoded by MeshOptimizer. */
+   struct MeshDecodeStats
+   {
+      size_t streams = 0;
+      size_t compressedBytes = 0, decodedBytes = 0;
+      double milliseconds = 0;
+   };
+
+   /**
+    * Simplified triangle lists for a mesh as levels[level][primitive], where primitives are filamesh parts or gltf
+    * mesh primitives (all meshes, in order). Indices refer to the unchanged source vertices. An empty list means the
+    * primitive was not simplified and keeps its full index list.
+    */
+   struct LodChain
+   {
+      std::vector<float> ratios;
+      std::vector<std::vector<std::vector<uint32_t>>> levels;
+      // Filamesh only: the (offset, count) of each part in the source index buffer and the source vertex count
+      std::vector<std::pair<uint32_t, uint32_t>> sourceRanges;
+      size_t vertexCount = 0;
+
+      size_t level_count() const { return levels.size(); }
+   };
+
+   /**
+    * Post load mesh processing using meshoptimizer. Triangles are reordered for the post transform vertex cache and
+    * then for overdraw, vertices are reordered for fetch locality (dropping unreferenced vertices where the format
+    * allows) and 32 bit indices are narrowed to 16 bits where the vertex count permits.
+    * Vertex formats are left as loaded: filamesh vertices are already quantized (half positions and UVs, snorm16
+    * tangent frames), while changing gltf accessor formats would mean rewriting the gltf JSON.
+    */
+   class MeshOptimizer
+   //=================
+   {
+   public:
+      /**
+       * @return An optimized copy of filamesh, or filamesh itself if it is compressed or its layout is not
+       *         recognized.
+       */
+      static std::shared_ptr<AssetView> optimize_filamesh(const std::shared_ptr<AssetView>& filamesh,
+                                                          MeshOptimizeStats& stats);
+
+      /**
+       * Optimizes the indexed triangle primitives of source, writing to copies of the buffers they use which replace
+       * the originals in source. Primitives whose accessors are shared, sparse or morphed are skipped, and index
+       * widths are unchanged.
+       */
+      static bool optimize_gltf(GltfSource& source, MeshOptimizeStats& stats);
+
+      /**
+       * Reorders the triangles in indices for the vertex cache and then, if positions (float3 with the given stride)
+       * is not null, for overdraw allowing the cache efficiency to degrade by up to overdrawThreshold.
+       */
+      static void optimize_triangles(uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                     const float* positions =nullptr, size_t positionStride =3*sizeof(float),
+                                     float overdrawThreshold =1.05f);
+
+      /** @return true if indices into vertexCount vertices fit in 16 bits. */
+      static bool fits_short_indices(size_t vertexCount) { return (vertexCount <= 65536); }
+
+      /** Target ratios (of the source index count) used when none are specified: 50%, 25% and 10%. */
+      static const std::vector<float>& default_lod_ratios();
+
+      /**
+       * Sets the directory in which generated LOD chains are cached, keyed by a hash of the source mesh data, the
+       * ratios and the target error. Empty (the default) disables the cache.
+       */
+      static void set_lod_cache_dir(const std::string& dir);
+
+      static std::string get_lod_cache_dir();
+
+      /** Simplifies each part of filamesh (in parallel) to each of ratios. */
+      static bool filamesh_lods(const AssetView& filamesh, const std::vector<float>& ratios, LodChain& chain,
+                                float targetError =0.02f);
+
+      /**
+       * Simplifies each indexed triangle primitive of source (in parallel) to each of ratios. Primitives without
+       * float3 positions or with morph targets are left unsimplified.
+       */
+      static bool gltf_lods(const GltfSource& source, const std::vector<float>& ratios, LodChain& chain,
+                            float targetError =0.02f);
+
+      /**
+       * Makes lodSource a copy of source displaying level of chain. The gltf JSON is unchanged, so the simplified
+       * indices are written over copies of the index accessors padded with degenerate triangles, and counts receives
+       * the shorter index counts to apply once the asset is created (@see GltfAsset::set_index_counts). entityCount
+       * receives the number of entities gltfio creates for the asset (or each instance) which counts refer to.
+       */
+      static bool make_gltf_lod(const GltfSource& source, const LodChain& chain, size_t level, GltfSource& lodSource,
+                                std::vector<GltfIndexCount>& counts, size_t& entityCount);
+
+      /**
+       * Simplifies a triangle list to each of ratios (of indexCount) using the meshoptimizer simplifier, falling
+       * back to the sloppy simplifier where targetError prevents the target being approached. Each level is then
+       * reordered for the vertex cache.
+       */
+      static void simplify(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+                           size_t positionStride, const std::vector<float>& ratios, float targetError,
+                           std::vector<std::vector<uint32_t>>& levels);
+
+      /**
+       * Decodes a filamesh with meshopt compressed streams (as written by filamesh --compress) into an uncompressed
+       * filamesh with separate vertex arrays. The vertex and index streams are decoded in parallel.
+       * @return The decoded filamesh, filamesh itself if it is not compressed or nullptr if decoding failed.
+       */
+      static std::shared_ptr<AssetView> decode_filamesh(const std::shared_ptr<AssetView>& filamesh,
+                                                        MeshDecodeStats& stats);
+
+      /**
+       * Decodes the EXT_meshopt_compression buffer views of source (in parallel) into their fallback buffers, which
+       * are added to the source resources. The JSON is then rewritten with EXT_meshopt_compression removed from the
+       * buffer views, buffers, extensionsUsed and extensionsRequired so gltfio loads the decoded data as ordinary
+       * buffers. Views whose fallback buffer has a URI are left to the fallback data.
+       */
+      static bool decode_gltf(GltfSource& source, MeshDecodeStats& stats);
+
+      /** Logs stats (at info level) for the named mesh. */
+      static void log(const std::string& name, const MeshOptimizeStats& stats);
+
+      /** Logs decoding sizes and throughput (at info level) for the named mesh. */
+      static void log(const std::string& name, const MeshDecodeStats& stats);
+   };
+}
+#endif
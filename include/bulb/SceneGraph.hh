@@ -5,10 +5,14 @@
 #include <memory>
 #include <atomic>
 #include <stack>
+#include <mutex>
+#include <future>
+#include <functional>
 
 #include "filament/Engine.h"
 #include "filament/Camera.h"
 #include "filament/View.h"
+#include "filament/Viewport.h"
 #include "filament/Renderer.h"
 #include "filament/Scene.h"
 #include "filament/Material.h"
@@ -24,6 +28,7 @@
 #include "math/vec3.h"
 #include "math/vec4.h"
 
+#include "bulb/Managers.hh"
 #include "bulb/nodes/Node.hh"
 #include "bulb/nodes/Composite.hh"
 #include "bulb/nodes/Material.hh"
@@ -33,6 +38,10 @@
 #include "bulb/nodes/MultiGeometry.hh"
 #include "bulb/nodes/PositionalLight.hh"
 #include "bulb/nodes/Visitor.hh"
+#include "bulb/KeyframeTracks.hh"
+#include "bulb/FrameScheduler.hh"
+#include "bulb/FrameStats.hh"
+#include "bulb/StreamingTexture.hh"
 
 namespace bulb
 {
@@ -49,17 +58,66 @@ namespace bulb
    using SceneCallback = std::function<void(filament::Scene* newScene, filament::View* view)>;
    using PostRenderCallback = std::function<void(filament::Engine*, filament::View*, filament::Renderer*,
                                                  filament::Scene*, void*)>;
+   /** Called on the render thread when an asynchronously loaded gltf has been created (isLoaded) or failed to load. */
+   using GltfCallback = std::function<void(bulb::MultiGeometry* geometry, bool isLoaded)>;
 
    class SceneGraph
    //==============
    {
    public:
-      SceneGraph(std::shared_ptr<filament::Engine>& engine, filament::SwapChain* swapChain, filament::View* view) :
-         engine(engine), view(view), foregroundCamera(&view->getCamera()), swapchain(swapChain), renderer(engine->createRenderer()),
-         dirty(true), isUpdating(false), scenePtr(engine->createScene(), SceneDeleter(engine))
+      /**
+       * Creates a graph rendering with the Engine of context (which must outlive the graph) to swapChain and view,
+       * which were created by that Engine. Nodes made by the graph are created in context, so graphs of different
+       * contexts can render concurrently on different threads.
+       */
+      SceneGraph(Managers& context, filament::SwapChain* swapChain, filament::View* view) :
+         managers(context), engine(context.engine), view(view), foregroundCamera(&view->getCamera()), swapchain(swapChain),
+         renderer(engine->createRenderer()), dirty(true), isUpdating(false),
+         scenePtr(engine->createScene(), SceneDeleter(engine))
          {
          }
 
+      ~SceneGraph();
+
+      /**
+       * Creates a graph that renders to an offscreen swapchain of width x height with its own view and camera
+       * (@see get_view), destroyed with the graph, so that no native window is needed. Combined with the NOOP
+       * backend (EngineConfig::backend) the graph runs without a GPU or display.
+       * @param context The context to create the graph in (@see Managers::create).
+       * @return The graph or nullptr if the engine or swapchain could not be created.
+       */
+      static std::unique_ptr<SceneGraph> create_headless(Managers& context, uint32_t width, uint32_t height);
+
+      Managers& get_managers() { return managers; }
+
+      filament::View* get_view() { return view; }
+
+      filament::Camera* get_camera() { return foregroundCamera; }
+
+      /**
+       * Adds a view which renders the graph's scene into viewport with its own camera, after the main view
+       * (@see get_view) in the same frame, eg for split screen, picture in picture or stereo. The graph is traversed
+       * and the scene rebuilt once per frame however many views there are, while each view culls and renders the
+       * scene for its camera. A view may also be given its own render target (View::setRenderTarget) eg to capture
+       * the faces of a cubemap.
+       * @param camera The camera to render with or nullptr to create one (destroyed with the view) with a 45 degree
+       *               vertical field of view and the aspect ratio of viewport.
+       * @return The view, destroyed by remove_view or with the graph.
+       */
+      filament::View* add_view(const filament::Viewport& viewport, filament::Camera* camera =nullptr);
+
+      /** Destroys a view added by add_view (and its camera if it was created by add_view). */
+      bool remove_view(filament::View* view);
+
+      /** Disabled views are neither rendered nor considered when culling animation (@see animate_gltf). */
+      bool set_view_enabled(filament::View* view, bool isEnabled);
+
+      /** @return The number of views including the main view. */
+      size_t view_count() const { return 1 + views.size(); }
+
+      /** @return The view at index i (0 being the main view) or nullptr if i is out of range. */
+      filament::View* get_view_at(size_t i) { return (i == 0) ? view : ( (i <= views.size()) ? views[i - 1].view : nullptr ); }
+
       bool is_dirty() { return dirty; }
 
       bool start_updating();
@@ -67,7 +125,14 @@ namespace bulb
       void end_updating(bool setDirty =true);
 
       bulb::Composite* make_root(const char* name ="Root", bool isReplace =false);
-      void adopt_root(bulb::Composite* newroot) { nodes.clear(); root.reset(newroot); }
+      void adopt_root(bulb::Composite* newroot)
+      {
+         cancel_gltf_loads();
+         keyframes.clear();
+         multiGeometries.clear();
+         nodes.clear();
+         root.reset(newroot);
+      }
 
       bulb::Material* make_material(const char* name, filament::Material* m);
       bulb::Material* make_material(const char* name, const void* data, size_t datasize);
@@ -106,6 +171,7 @@ namespace bulb
       bool adopt_custom_transform(bulb::CustomTransform* transform, void* animationParams =nullptr);
 
       bulb::Geometry* make_geometry(const char* name = nullptr, filament::Material* mat = nullptr, Transform* internalTransform =nullptr);
+      /** Takes ownership of geometry, which must have been created in the graph's context (@see get_managers). */
       bool adopt_geometry(bulb::Geometry* geometry);
 
       bulb::MultiGeometry* make_multi_geometry(const char* name, filament::Material* defaultMaterial, Transform* internalTransform =nullptr);
@@ -114,8 +180,51 @@ namespace bulb
                                                bool normalized = true,
                                                bool bestShaders =false);
 
+      /**
+       * Returns an empty MultiGeometry immediately, which may be added to the graph as a placeholder. The gltf (or glb
+       * or zip) and its resources are read and parsed on ThreadPool::workers(), after which render() creates the
+       * filament asset within the gltf load budget and swaps its entities into the placeholder. Textures are then
+       * decoded in the background by gltfio and appear over the following frames. If the placeholder is destroyed
+       * before the asset is created, its instance and callback are skipped.
+       */
+      bulb::MultiGeometry* make_multi_geometry_async(const char* name, const char* gltfAssetPath,
+                                                     Transform* internalTransform =nullptr, bool normalized = true,
+                                                     bool bestShaders =false, GltfCallback callback =nullptr);
+
       bool adopt_multi_geometry(bulb::MultiGeometry* geometry);
 
+      /**
+       * Selects the gltf materials used for assets loaded by this graph without bestShaders: the precompiled
+       * ubershader materials, which need no material builds at load time, or (the default) materials generated to
+       * match each asset. Either way materials are shared by all MultiGeometry nodes created by the graph.
+       */
+      void set_gltf_ubershader(bool isUbershader) { isGltfUbershader = isUbershader; }
+
+      /** Run MeshOptimizer over gltf assets read by this graph (default off). Assets already cached are unaffected. */
+      void set_mesh_optimization(bool isOptimized) { isMeshOptimized = isOptimized; }
+
+      /**
+       * Generates levels of detail with these fractions of the triangles (eg MeshOptimizer::default_lod_ratios())
+       * for gltf assets subsequently read by this graph, selectable with MultiGeometry::set_lod. Empty (the default)
+       * disables level of detail generation. Set MeshOptimizer::set_lod_cache_dir to reuse generated levels across
+       * runs.
+       */
+      void set_gltf_lods(const std::vector<float>& ratios) { gltfLodRatios = ratios; }
+
+      /**
+       * @return The gltf AssetLoader (and so MaterialProvider) shared by MultiGeometry nodes, created on first use.
+       *         bestShaders always selects generated materials.
+       */
+      gltfio::AssetLoader* get_gltf_loader(bool bestShaders =false);
+
+      /**
+       * Sets the number of instances to create when gltfAssetPath is first loaded. Loading the same path into further
+       * MultiGeometry nodes (make_multi_geometry or make_multi_geometry_async) takes a free instance of the cached
+       * asset, sharing its buffers, textures and materials, while a new asset is only created once all instances are
+       * in use. Async loads of a path made before its asset is created are also combined into one instanced asset.
+       */
+      void set_gltf_instances(const char* gltfAssetPath, size_t count);
+
       bulb::PositionalLight* make_spotlight(const char* name, filament::LinearColor color, filament::math::float3 initialPosition,
                                             filament::math::float3 direction,
                                             filament::math::float2 cone ={bulb::pi<float> / 8, (bulb::pi<float> / 8) * 1.1 },
@@ -146,25 +255,104 @@ namespace bulb
       bool set_background_image(unsigned char* data, uint32_t width, uint32_t height, uint32_t channels,
                                 filament::backend::BufferDescriptor::Callback dataDeletor =nullptr);
 
+      /**
+       * As set_background, but the background is a StreamingTexture ring fed by submit_background_frame (eg
+       * camera frames for AR) which render() advances by at most one frame per rendered frame.
+       * @param maxPending Frames queued before the oldest queued frame is dropped.
+       * @return The first texture of the ring or nullptr on error.
+       */
+      filament::Texture* set_background_stream(uint32_t width, uint32_t height, size_t maxPending =2,
+                                               filament::TextureSampler backgroundSampler =
+                                                 filament::TextureSampler(filament::TextureSampler::MinFilter::LINEAR,
+                                                                          filament::TextureSampler::MagFilter::LINEAR));
+
+      /**
+       * Queues a copy of a width x height RGBA8 frame for the background without waiting on the render thread. May be
+       * called from any thread, but not concurrently with set_background(_stream) or the destruction of the graph.
+       * @return false if there is no background stream or size is not that of a frame.
+       */
+      bool submit_background_frame(const void* rgba, size_t size);
+
+      /** @return The background stream (eg for its zero copy submit or statistics) or nullptr if there is none. */
+      StreamingTexture* get_background_stream() { return backgroundStream.get(); }
+
       void remove_directional_light(const char* name);
 
       bool render(PostRenderCallback postRenderCallback =PostRenderCallback(), void* postRenderParams = nullptr);
 
+      /**
+       * Runs one paced frame with scheduler (@see FrameScheduler::run_frame): its fixed updates, then the keyframe
+       * tracks sampled at the interpolated frame time and the gltf animations advanced by the frame delta, then
+       * render() and a sleep until the next frame deadline.
+       */
+      bool run_frame(FrameScheduler& scheduler, PostRenderCallback postRenderCallback =PostRenderCallback(),
+                     void* postRenderParams = nullptr);
+
+      /**
+       * Per phase timings of the frames drawn by render(), which may be read from any thread. Set a budget
+       * (FrameStats::set_budget) to have frames exceeding it logged.
+       */
+      FrameStats& get_frame_stats() { return frameStats; }
+
+      /**
+       * Sets the time (microseconds, 0 for unlimited) render() may spend per frame creating textures for images
+       * decoded by TextureLoader.
+       */
+      void set_texture_upload_budget(uint64_t micros) { textureUploadBudget = micros; }
+
+      /**
+       * Sets the time (microseconds, 0 for unlimited) render() may spend per frame creating and updating assets
+       * loaded by make_multi_geometry_async. At least one asset is created per frame.
+       */
+      void set_gltf_load_budget(uint64_t micros) { gltfLoadBudget = micros; }
+
+      /** @return The number of make_multi_geometry_async loads which have not yet completed. */
+      size_t pending_gltf_loads();
+
       void add_scene_listener(std::weak_ptr<SceneCallback> listener) { scene_listeners.push_back(listener); }
 
       bulb::Node* get_node(std::string name);
 
       std::vector<bulb::Transform*> get_animated_transforms();
 
+      /** Keyframe tracks animating transforms of this graph, evaluated by animate_keyframes. */
+      KeyframeTracks& get_keyframe_tracks() { return keyframes; }
+
+      /**
+       * Samples the keyframe tracks at time (seconds) and writes them into their transforms, marking the graph
+       * dirty. @return false if there are no tracks or the graph is being updated elsewhere (start_updating).
+       */
+      bool animate_keyframes(double time);
+
+      /**
+       * Advances the gltf animations of all MultiGeometry nodes of the graph (@see MultiGeometry::set_animation_weight)
+       * by dt seconds and applies them as one batch: node transforms are set in a single TransformManager local
+       * transform transaction, blends of several animations are computed on ThreadPool::workers() if isParallel and
+       * skinning bone matrices are only updated for assets whose bounds intersect the camera frustum. Call on the
+       * render thread before render().
+       * @return The number of animated nodes.
+       */
+      size_t animate_gltf(float dt, bool isParallel =true);
+
    protected:
+      Managers& managers;
       std::shared_ptr<filament::Engine> engine;
       filament::View* view;
       filament::Camera* foregroundCamera;
       filament::SwapChain* swapchain;
+      bool isOwningTarget = false; // swapchain, view and its camera are destroyed with the graph (create_headless)
+      struct SceneView
+      {
+         filament::View* view;
+         filament::Camera* camera;
+         bool isOwningCamera, isEnabled;
+      };
+      std::vector<SceneView> views; // Added by add_view, rendered after the main view
       std::unique_ptr<bulb::Composite> root;
       std::vector<std::unique_ptr<bulb::Node>> nodes;
       filament::Renderer* renderer;
       bool dirty, backgroundDirty = false;
+      uint64_t textureUploadBudget = 4000, gltfLoadBudget = 8000;
       std::atomic_bool isUpdating;
       std::shared_ptr<filament::Scene> scenePtr;
       std::vector<std::weak_ptr<SceneCallback>> scene_listeners;
@@ -175,14 +363,59 @@ namespace bulb
       std::shared_ptr<filament::Scene> backgroundScenePtr;
       filament::View* backgroundView = nullptr;
       filament::Material* backgroundMaterial = nullptr;
+      filament::MaterialInstance* backgroundMaterialInstance = nullptr;
       filament::Camera* backgroundCamera;
       filament::VertexBuffer* backgroundVertexBuf = nullptr;
       filament::IndexBuffer* backgroundIndexBuffer = nullptr;
       utils::Entity background;
+      std::unique_ptr<StreamingTexture> backgroundStream;
 
       std::unordered_map<std::string, bulb::Node*> nodesByName;
       std::unordered_map<std::string, utils::Entity> directional_lights;
       std::unordered_map<std::string, bulb::Transform*> animationTransforms;
+      KeyframeTracks keyframes;
+      std::vector<bulb::MultiGeometry*> multiGeometries;
+      FrameStats frameStats;
+
+      struct GltfLoad
+      {
+         std::string key;
+         std::shared_ptr<GltfSource> source;
+         std::shared_ptr<LodChain> lods;
+         std::future<bool> read;
+         bool bestShaders = false;
+         std::vector<bulb::MultiGeometry*> geometries; // Each gets an instance of the asset
+         std::vector<std::shared_ptr<const std::atomic<bool>>> alive; // MultiGeometry::liveness of each geometry
+         std::vector<bool> normalized;
+         std::vector<GltfCallback> callbacks;
+      };
+      struct SharedGltfLoader
+      {
+         gltfio::MaterialProvider* materials = nullptr;
+         gltfio::AssetLoader* loader = nullptr;
+      };
+      SharedGltfLoader gltfGeneratedLoader, gltfUbershaderLoader;
+      bool isGltfUbershader = false;
+      bool isMeshOptimized = false;
+      std::vector<float> gltfLodRatios;
+      std::unordered_map<std::string, std::vector<std::weak_ptr<GltfAsset>>> gltfCache;
+      std::unordered_map<std::string, size_t> gltfInstances;
+      std::mutex gltfMutex;
+      std::vector<GltfLoad> gltfLoads;              // Being read (guarded by gltfMutex)
+      std::vector<std::weak_ptr<GltfAsset>> gltfUpdates; // Created, textures loading (guarded by gltfMutex)
+
+      void release_background_material();
+      bool update_gltf_loads();
+      void cancel_gltf_loads();
+      std::string gltf_key(const char* gltfAssetPath, bool bestShaders);
+      bool is_same_context(const Managers* context, const char* caller);
+      std::shared_ptr<GltfAsset> find_cached_gltf(const std::string& key);
+      size_t gltf_instance_count(const char* gltfAssetPath, size_t required);
+      std::string gltf_lod_key(const std::string& key, size_t level);
+      std::vector<std::shared_ptr<GltfAsset>> find_cached_gltf_lods(const std::string& key);
+      std::vector<std::shared_ptr<GltfAsset>> create_gltf_lods(const GltfSource& source, const LodChain& chain,
+                                                               const std::string& key, size_t instanceCount,
+                                                               bool isAsync, bool bestShaders);
    };
 }
 
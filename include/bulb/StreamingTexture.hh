@@ -0,0 +1,125 @@
+#ifndef BULB_STREAMINGTEXTURE_HH_
+#define BULB_STREAMINGTEXTURE_HH_
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "filament/Engine.h"
+#include "filament/Texture.h"
+
+namespace bulb
+{
+   /**
+    * The queue of filled staging buffers between the producer thread and the render thread of a StreamingTexture,
+    * oldest first and holding at most max_pending() buffers. Buffers are only passed through, never allocated or
+    * freed. May be used from any thread.
+    */
+   class FrameQueue
+   //==============
+   {
+   public:
+      explicit FrameQueue(size_t maxPending);
+
+      /**
+       * Queues staging after the buffers already queued.
+       * @return The oldest queued buffer if it was dropped to make room, which the caller then owns, else nullptr.
+       */
+      uint8_t* push(uint8_t* staging);
+
+      /** @return The oldest queued buffer, which the caller then owns, or nullptr if the queue is empty. */
+      uint8_t* pop();
+
+      size_t size();
+
+      size_t max_pending() const { return maxPending; }
+
+   private:
+      const size_t maxPending;
+      std::mutex mutex;
+      std::vector<uint8_t*> pending;
+   };
+
+   /**
+    * A ring of RING_SIZE (triple buffered) RGBA8 textures fed with frames (eg from a camera or video decoder) by a
+    * producer thread. submit() copies a frame into a pooled staging buffer and queues it without waiting on the
+    * render thread, dropping the oldest queued frame if the render thread has fallen maxPending frames behind.
+    * update() uploads the oldest queued frame into the next texture of the ring, so a frame is never written into
+    * the texture sampled by the frames still in flight, and the staging buffer returns to the pool from the
+    * BufferDescriptor callback once filament has consumed it. Once the pool has grown to cover the frames queued
+    * and in flight, no further memory is allocated.
+    */
+   class StreamingTexture
+   //====================
+   {
+   public:
+      static constexpr size_t RING_SIZE = 3;
+
+      /** @return The texture of the ring which the upload following one into texture is written to. */
+      static constexpr size_t next_texture(size_t texture) { return (texture + 1) % RING_SIZE; }
+
+      /** Creates the textures (render thread). @see is_valid */
+      StreamingTexture(filament::Engine& engine, uint32_t width, uint32_t height, size_t maxPending =2);
+
+      StreamingTexture(StreamingTexture const&) = delete;
+      StreamingTexture& operator=(StreamingTexture const&) = delete;
+      ~StreamingTexture();
+
+      bool is_valid() const { return textures[RING_SIZE - 1] != nullptr; }
+
+      /**
+       * Queues a copy of a width x height RGBA8 frame. May be called from any thread.
+       * @return false if size is not that of a frame.
+       */
+      bool submit(const void* rgba, size_t size);
+
+      /**
+       * Zero copy alternative to submit(const void*, size_t): returns a pooled staging buffer of frame_size() bytes
+       * for the caller to fill and pass to submit(uint8_t*), or to return unsubmitted with recycle(). Buffers must
+       * be submitted or recycled before the StreamingTexture is destroyed.
+       */
+      uint8_t* acquire();
+
+      bool submit(uint8_t* staging);
+
+      void recycle(uint8_t* staging);
+
+      /**
+       * Uploads the oldest queued frame, if any, into the next texture of the ring (render thread).
+       * @return The texture the frame was uploaded to, which becomes current(), or nullptr if no frame was queued.
+       */
+      filament::Texture* update();
+
+      /** @return The texture holding the most recently uploaded frame (the first texture before any upload). */
+      filament::Texture* current() const { return textures[currentTexture]; }
+
+      size_t frame_size() const { return frameSize; }
+
+      uint32_t width() const { return frameWidth; }
+
+      uint32_t height() const { return frameHeight; }
+
+      uint64_t submitted() const { return submittedFrames.load(std::memory_order_relaxed); }
+
+      uint64_t uploaded() const { return uploadedFrames.load(std::memory_order_relaxed); }
+
+      /** @return The number of frames dropped because maxPending frames were already queued. */
+      uint64_t dropped() const { return droppedFrames.load(std::memory_order_relaxed); }
+
+   private:
+      struct StagingPool;
+
+      filament::Engine& engine;
+      const uint32_t frameWidth, frameHeight;
+      const size_t frameSize;
+      std::array<filament::Texture*, RING_SIZE> textures{};
+      size_t currentTexture = 0;
+      FrameQueue queue;
+      StagingPool* pool; // Reference counted as buffers still owned by filament return to it after destruction
+      std::atomic<uint64_t> submittedFrames{0}, uploadedFrames{0}, droppedFrames{0};
+   };
+}
+#endif
@@ -0,0 +1,148 @@
+#ifndef BULB_TEXTURELOADER_HH_
+#define BULB_TEXTURELOADER_HH_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "filament/Engine.h"
+#include "filament/Texture.h"
+
+#include "bulb/ThreadPool.hh"
+
+namespace bulb
+{
+   class Managers;
+
+   /** Called on the render thread with the loaded texture or nullptr if the load failed. */
+   using TextureCallback = std::function<void(const std::string& path, filament::Texture* texture)>;
+
+   /**
+    * Loads 2D textures (PNG/JPG etc. using stb_image, EXR using tinyexr) in the background. Decoding and the
+    * generation of the mip chain (box filtered, in linear light for sRGB textures and with SIMD where available
+    * otherwise) run on ThreadPool::workers(), while the filament calls which must be made on the render thread
+    * (Texture::Builder, setImage) are deferred to update(), which SceneGraph::render calls every frame within an
+    * upload time budget.
+    * Repeated loads of the same path share a single decode and texture. Textures are reference counted by load()
+    * and release(). The options of the first load of a path apply to all subsequent loads of the path.
+    * Each Managers context owns one loader whose textures are created with the context Engine.
+    */
+   class TextureLoader
+   //=================
+   {
+   public:
+      TextureLoader(TextureLoader const&) = delete;
+      TextureLoader(TextureLoader&&) = delete;
+      TextureLoader& operator=(TextureLoader const&) = delete;
+      TextureLoader& operator=(TextureLoader &&) = delete;
+      ~TextureLoader();
+
+      /**
+       * Queues an image file for decoding.
+       * @param path Image file path (read using AssetReader). Files with a .exr extension are decoded to RGBA16F
+       *             textures, other formats to RGBA8 (or SRGB8_A8).
+       * @param callback Invoked from update() once the texture has been created (or immediately on the next
+       *                 update() if it already has been).
+       * @param isSRGB Create an sRGB texture (ignored for EXR).
+       * @param isMipmapped Generate and upload the full mip chain, otherwise only level 0.
+       * @return false if path is null.
+       */
+      bool load(const char* path, TextureCallback callback =nullptr, bool isSRGB =true, bool isMipmapped =true);
+
+      /** @return The texture for path if it has been created, otherwise nullptr. */
+      filament::Texture* get(const char* path);
+
+      /** @return true if path has been queued but its texture has not yet been created. */
+      bool is_loading(const char* path);
+
+      /**
+       * Creates and uploads the textures for completed decodes and invokes pending callbacks. Must be called on the
+       * render thread.
+       * @param budgetMicros Stop after this many microseconds have elapsed (at least one texture is uploaded per
+       *                     call), 0 for no limit.
+       * @return The number of textures created.
+       */
+      size_t update(filament::Engine* engine, uint64_t budgetMicros =0);
+
+      /** Blocks until all queued loads have been decoded then creates their textures (render thread only). */
+      size_t finish(filament::Engine* engine);
+
+      /**
+       * Decrements the reference count for path, destroying the texture when it reaches zero. A load still being
+       * decoded or uploaded is then cancelled and its callbacks are not invoked.
+       */
+      bool release(const char* path);
+
+      /** Destroys all textures (render thread only, after any materials using them). */
+      void clear();
+
+      /** @return Number of loads not yet completed. */
+      size_t pending();
+
+      /** @return The number of mip levels in a full chain for a width x height image. */
+      static uint8_t mip_levels(uint32_t width, uint32_t height);
+
+      /**
+       * Box filters an RGBA8 image to half its size (rounded down, minimum 1) into dst. Rows are split across pool
+       * if it is not null.
+       */
+      static void downsample_rgba8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst,
+                                   ThreadPool* pool =nullptr);
+
+      /**
+       * As downsample_rgba8 for sRGB encoded RGBA8 images: the colour channels are averaged in linear light and
+       * encoded again, alpha (which is linear) is averaged as is.
+       */
+      static void downsample_srgba8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst,
+                                    ThreadPool* pool =nullptr);
+
+      /** As downsample_rgba8 for RGBA 32 bit float images. */
+      static void downsample_rgba32f(const float* src, uint32_t width, uint32_t height, float* dst,
+                                     ThreadPool* pool =nullptr);
+
+   private:
+      explicit TextureLoader(Managers& managers);
+
+      Managers& managers;
+
+      enum class State { DECODING, DECODED, READY, FAILED };
+
+      struct Level
+      {
+         void* data;   // malloc allocated, ownership passes to filament on upload
+         size_t size;
+      };
+
+      struct Entry
+      {
+         std::string path;
+         State state = State::DECODING;
+         bool isSRGB, isMipmapped, isFloat = false;
+         bool isCancelled = false; // Released (or cleared) before its callbacks were invoked
+         uint32_t width = 0, height = 0;
+         std::vector<Level> levels;
+         filament::Texture* texture = nullptr;
+         size_t references = 0;
+         std::vector<TextureCallback> callbacks;
+      };
+
+      std::mutex mtx;
+      std::condition_variable decodedCondition;
+      std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+      std::deque<std::shared_ptr<Entry>> completed;
+      size_t decoding = 0;
+
+      void decode(std::shared_ptr<Entry> entry);
+      bool upload(filament::Engine* engine, Entry& entry);
+      static void free_levels(Entry& entry);
+
+      friend class Managers;
+   };
+}
+#endif
@@ -0,0 +1,152 @@
+#ifndef BULB_THREADPOOL_HH_
+#define BULB_THREADPOOL_HH_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+
+namespace bulb
+{
+   /**
+    * Fixed size pool of worker threads used for CPU bound background work (decoding, mip generation etc.).
+    * Tasks are run in submission order. parallel_for splits a range across the workers and the calling thread,
+    * which runs queued tasks while it waits so it may also be called from within a task without deadlocking.
+    */
+   class ThreadPool
+   //==============
+   {
+   public:
+      /** @param threads Number of workers, 0 for one less than the hardware concurrency (minimum 1). */
+      explicit ThreadPool(size_t threads =0);
+
+      ThreadPool(ThreadPool const&) = delete;
+      ThreadPool(ThreadPool&&) = delete;
+      ThreadPool& operator=(ThreadPool const&) = delete;
+      ThreadPool& operator=(ThreadPool &&) = delete;
+
+      /** Runs any queued tasks then joins the workers. */
+      ~ThreadPool();
+
+      /** Process-wide pool shared by the library loaders. */
+      static ThreadPool& workers()
+      //--------------------------
+      {
+         static ThreadPool the_instance(claim_worker_count());
+         return the_instance;
+      }
+
+      /**
+       * Sets the number of threads workers() is created with (0 for the default) if it has not been created yet.
+       * @return false if workers() already exists with a different number of threads.
+       */
+      static bool set_worker_count(size_t threads);
+
+      /** @return true if set_worker_count(threads) would succeed. */
+      static bool can_set_worker_count(size_t threads);
+
+      /**
+       * Process-wide pool for blocking reads (AssetReader::read_async), separate from workers() so tasks running on
+       * the workers can wait on reads without the reads queueing behind them.
+       */
+      static ThreadPool& io_workers()
+      //-----------------------------
+      {
+         static ThreadPool the_instance(claim_io_worker_count());
+         return the_instance;
+      }
+
+      /**
+       * Sets the number of threads io_workers() is created with (0 for the default of 4) if it has not been created
+       * yet. @return false if io_workers() already exists with a different number of threads.
+       */
+      static bool set_io_worker_count(size_t threads);
+
+      /** @return true if set_io_worker_count(threads) would succeed. */
+      static bool can_set_io_worker_count(size_t threads);
+
+      /** Queues a task without a result. */
+      void post(std::function<void()> task);
+
+      /** Queues a task, returning a future for its result. */
+      template <typename F>
+      auto submit(F f) -> std::future<decltype(f())>
+      //--------------------------------------------
+      {
+         using R = decltype(f());
+         auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+         std::future<R> result = task->get_future();
+         post([task]() { (*task)(); });
+         return result;
+      }
+
+      /**
+       * Calls f(first, last) on contiguous sub-ranges of [begin, end) of at least grain elements, using the workers
+       * and the calling thread. Returns when all sub-ranges have completed.
+       */
+      template <typename F>
+      void parallel_for(size_t begin, size_t end, F f, size_t grain =1)
+      //---------------------------------------------------------------
+      {
+         if (end <= begin)
+            return;
+         size_t n = end - begin;
+         grain = std::max<size_t>(grain, 1);
+         size_t chunks = std::min((n + grain - 1) / grain, size() + 1);
+         if (chunks <= 1)
+         {
+            f(begin, end);
+            return;
+         }
+         size_t chunk = (n + chunks - 1) / chunks;
+         std::vector<std::future<void>> pending;
+         pending.reserve(chunks);
+         size_t first = begin + chunk;
+         for (; first < end; first += chunk)
+         {
+            size_t last = std::min(first + chunk, end);
+            pending.emplace_back(submit([&f, first, last]() { f(first, last); }));
+         }
+         f(begin, std::min(begin + chunk, end));
+         for (std::future<void>& fut : pending)
+         {
+            while (fut.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+               if (! run_one())
+                  fut.wait();
+            }
+            fut.get();
+         }
+      }
+
+      size_t size() const { return threads.size(); }
+
+      /** Number of tasks queued but not yet started. */
+      size_t queued();
+
+      /** @return true if the calling thread is a worker of this pool. */
+      bool is_worker() const;
+
+   private:
+      static size_t claim_worker_count();
+      static size_t claim_io_worker_count();
+
+      std::vector<std::thread> threads;
+      std::deque<std::function<void()>> tasks;
+      std::mutex mtx;
+      std::condition_variable available;
+      bool isStopping = false;
+
+      void run();
+
+      /** Runs one queued task on the calling thread, @return false if the queue was empty. */
+      bool run_one();
+   };
+}
+#endif
@@ -0,0 +1,81 @@
+#ifndef BULB_TRACE_HH_
+#define BULB_TRACE_HH_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace bulb
+{
+   /**
+    * Scoped trace markers (@see BULB_TRACE_SCOPE) recorded into per thread buffers and exported as Chrome
+    * trace event JSON, which can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing to show the library
+    * work on all threads on one timeline. Tracing is off until enabled, when a marker costs one relaxed atomic load;
+    * building with BULB_NO_TRACE defined removes the markers altogether.
+    * Marker names and categories must be string literals (or otherwise outlive the trace). Each thread records up
+    * to a fixed number of events after which its further events are dropped (and counted) until clear().
+    */
+   class Trace
+   //=========
+   {
+   public:
+      static void enable(bool isEnabled);
+
+      static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+      /** Names the calling thread in the exported trace. name is copied. */
+      static void set_thread_name(const char* name);
+
+      /** Records a complete event on the calling thread (times from now()). */
+      static void record(const char* name, const char* category, uint64_t startNanos, uint64_t endNanos);
+
+      /** Writes the recorded events as Chrome trace event JSON. @return false if the file could not be written. */
+      static bool write_json(const char* path);
+
+      /** Discards the recorded events. Call while tracing is disabled. */
+      static void clear();
+
+      /** @return The number of events dropped because a thread buffer was full. */
+      static uint64_t dropped();
+
+      static uint64_t now()
+      {
+         return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                      std::chrono::steady_clock::now().time_since_epoch()).count());
+      }
+
+   private:
+      static std::atomic<bool> enabled;
+   };
+
+   /** Records the lifetime of the scope as a trace event if tracing is enabled when the scope is entered. */
+   class TraceScope
+   //==============
+   {
+   public:
+      explicit TraceScope(const char* name, const char* category ="bulb") : name(name), category(category),
+                                                                             start(Trace::is_enabled() ? Trace::now() : 0)
+      {}
+
+      ~TraceScope() { if (start != 0) Trace::record(name, category, start, Trace::now()); }
+
+      TraceScope(TraceScope const&) = delete;
+      TraceScope& operator=(TraceScope const&) = delete;
+
+   private:
+      const char* name;
+      const char* category;
+      uint64_t start;
+   };
+}
+
+#define BULB_TRACE_CONCAT_(a, b) a##b
+#define BULB_TRACE_CONCAT(a, b) BULB_TRACE_CONCAT_(a, b)
+#if defined(BULB_NO_TRACE)
+#define BULB_TRACE_SCOPE(...)
+#else
+/** BULB_TRACE_SCOPE(name [, category]) traces the enclosing scope. */
+#define BULB_TRACE_SCOPE(...) bulb::TraceScope BULB_TRACE_CONCAT(bulbTraceScope, __LINE__)(__VA_ARGS__)
+#endif
+
+#endif
@@ -131,6 +131,34 @@ namespace bulb
 
       const filament::math::mat4& get_scaling() const { return S; }
 
+      /** Sets any of the rotation, translation and scale (nullptr leaves it unchanged) with a single matrix update. */
+      AffineTransform& set_trs(const filament::math::quat* q, const filament::math::double3* t,
+                               const filament::math::double3* s)
+      //---------------------------------------------------------------------------------------------------------
+      {
+         if (q != nullptr)
+         {
+            R = filament::math::mat4(*q);
+            Ri = transpose(R);
+         }
+         if (t != nullptr)
+         {
+            const filament::math::double3& tt = *t;
+            T[3][0] = tt[0]; T[3][1] = tt[1]; T[3][2] = tt[2];
+            Ti[3][0] = -tt[0]; Ti[3][1] = -tt[1]; Ti[3][2] = -tt[2];
+         }
+         if (s != nullptr)
+         {
+            const filament::math::double3& ss = *s;
+            S = filament::math::mat4(filament::math::double4(ss[0], ss[1], ss[2], 1));
+            Si = filament::math::mat4(filament::math::double4(near_zero(ss[0], EPSILON) ? 0 : 1/ss[0],
+                                                              near_zero(ss[1], EPSILON) ? 0 : 1/ss[1],
+                                                              near_zero(ss[2], EPSILON) ? 0 : 1/ss[2], 1));
+         }
+         mul();
+         return *this;
+      }
+
       filament::math::mat4 matrix() override { return filament::math::mat4(M); }
 
       filament::math::mat4f matrixf() override { return filament::math::mat4f(M); }
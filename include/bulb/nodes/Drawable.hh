@@ -21,8 +21,10 @@ namespace bulb
    //==========================
    {
    public:
-      explicit Drawable(const char* name, Transform* internalTransform = nullptr) : Node(true, name),
-            renderedEntity(Managers::instance().entityManager.create()), internalTransform(internalTransform) {}
+      /** @param context The context (and therefore Engine) the node renders in, which must outlive it. */
+      Drawable(Managers& context, const char* name, Transform* internalTransform = nullptr) : Node(true, name),
+            managers(context), renderedEntity(managers.entityManager.create()),
+            internalTransform(internalTransform) {}
 
       ~Drawable() override;
 
@@ -38,7 +40,11 @@ namespace bulb
 
       Transform* get_transform() { return internalTransform.get(); }
 
+      /** @return The context (and therefore Engine) the node was created in. */
+      Managers& get_managers() { return managers; }
+
    protected:
+      Managers& managers;
       utils::Entity renderedEntity;
       filament::math::mat4f M{1.0f};
       filament::Box BB;
@@ -4,11 +4,13 @@
 #define _3601667ab5151555050ba341e2e6008f
 
 #include <map>
+#include <vector>
 
 #include "bulb/Managers.hh"
 #include "bulb/nodes/Drawable.hh"
 #include "bulb/nodes/Materializable.hh"
 #include "bulb/nodes/Material.hh"
+#include "bulb/MeshOptimizer.hh"
 
 #include "filament/Material.h"
 #include <filameshio/MeshReader.h>
@@ -20,11 +22,26 @@ namespace bulb
    //=====================================================
    {
    public:
-      explicit Geometry(const char *name = nullptr, filament::Material* defaultMaterial = nullptr,
+      explicit Geometry(Managers& context, const char *name = nullptr, filament::Material* defaultMaterial = nullptr,
                         Transform* internalTransform = nullptr) :
-                        Drawable(name, internalTransform), material(defaultMaterial) { }
+                        Drawable(context, name, internalTransform), material(defaultMaterial) { }
 
-      bool open_filamesh(const char* filemeshPath, filament::Material* defaultMat = nullptr);
+      /**
+       * @param isOptimized Reorder the mesh with MeshOptimizer (vertex cache, overdraw and fetch order, 16 bit
+       *                    indices where possible) before uploading it.
+       * @param lodRatios If not empty, levels of detail with these fractions of the mesh triangles are generated
+       *                  (@see MeshOptimizer::filamesh_lods) and can be displayed using set_lod.
+       */
+      bool open_filamesh(const char* filemeshPath, filament::Material* defaultMat = nullptr, bool isOptimized = false,
+                         const std::vector<float>& lodRatios = std::vector<float>());
+
+      /** @return The number of levels of detail, including the full mesh (level 0). */
+      size_t lod_count() const { return lods.size(); }
+
+      size_t get_lod() const { return lod; }
+
+      /** Displays level of detail level, from 0 (the full mesh) to lod_count() - 1 (the fewest triangles). */
+      bool set_lod(size_t level);
 
       void pre_render(std::vector<utils::Entity>& renderables) override;
 
@@ -39,9 +56,20 @@ namespace bulb
       filament::VertexBuffer* meshVertexBuffer = nullptr;
       filament::IndexBuffer* meshIndexBuffer = nullptr;
 
+      struct LodRange
+      {
+         filament::IndexBuffer* indices;
+         uint32_t offset, count;
+      };
+      std::vector<std::vector<LodRange>> lods; // [level][part], level 0 being the full mesh
+      std::vector<filament::IndexBuffer*> lodIndexBuffers;
+      size_t lod = 0;
+
+      void make_lods(const LodChain& chain);
+      void release_lods();
+
    private:
-      char* filameshData = nullptr;
-      static void delete_filamesh(void* p, size_t size, void* user);
+      filament::Material* defaultMaterial = nullptr; // Cached default material reference acquired by open_filamesh
    };
 }
 #endif
@@ -7,6 +7,8 @@
 #include "filament/Material.h"
 
 #include "bulb/Managers.hh"
+#include "bulb/MaterialInstancePool.hh"
+#include "bulb/MaterialCache.hh"
 #include "bulb/nodes/Composite.hh"
 #include "bulb/nodes/Visitor.hh"
 
@@ -15,22 +17,38 @@ namespace bulb
    class Material  : public Composite
    {
    public:
-      explicit Material(const char* name =nullptr) : Composite(true, name), material(nullptr) {}
+      /** @param context The context whose MaterialCache holds the material, which must outlive the node. */
+      explicit Material(Managers& context, const char* name =nullptr) : Composite(true, name), managers(context),
+                                                                        material(nullptr) {}
 
-      explicit Material(filament::Material* m, const char* name =nullptr) : Composite(true, name), material(m) {}
+      Material(Managers& context, filament::Material* m, const char* name =nullptr) : Composite(true, name),
+            managers(context), material(m), isCached(managers.material_cache().retain(m)) {}
 
-      Material(const void* data, size_t datasize, const char* name =nullptr);
+      Material(Managers& context, const void* data, size_t datasize, const char* name =nullptr);
 
-      Material(const Material& other) = default;
+      Material(const Material& other);
+
+      // Reassigning would have to move the MaterialCache reference between contexts, so Materials are copied instead.
+      Material& operator=(const Material&) = delete;
+      Material& operator=(Material&&) = delete;
+
+      ~Material() override;
 
       bool open(const char* filename, const char* name =nullptr);
 
       void accept(NodeVisitor* visitor) override {  visitor->visit(this); }
 
+      /**
+       * Sets a default parameter value for the material. The value is also applied to pooled instances already
+       * bound to descendant nodes unless the node overrides the parameter (@see Materializable::set_parameter).
+       */
       template <typename T>
       bulb::Material& operator()(const char* param, T value)
       {
          material->setDefaultParameter(param, value);
+         managers.material_instances().update_instances(material, param,
+                                                        [param, value](filament::MaterialInstance* mi)
+                                                        { mi->setParameter(param, value); });
          return *this;
       }
 
@@ -54,14 +72,18 @@ namespace bulb
 
       filament::Material* get_material() { return material; }
 
+      Managers& get_managers() { return managers; }
+
       filament::Texture* operator[](const char* textureName) { return get_texture(textureName); }
 
       filament::Texture* get_texture(const char *textureName);
 
    protected:
+      Managers& managers; // The context the material (and its MaterialCache reference) belongs to
       filament::Material* material;
       std::unordered_map<std::string, filament::Texture*> textures;
       std::unordered_map<std::string, filament::TextureSampler> samplers;
+      bool isCached = false; // material reference held in MaterialCache
 
    };
 }
@@ -1,10 +1,92 @@
 #ifndef BULB_MATERIALIZABLE_HH_
 #define BULB_MATERIALIZABLE_HH_
 
+#include <string>
+#include <map>
+#include <functional>
+
 #include "filament/Material.h"
+#include "filament/MaterialInstance.h"
+#include "filament/Texture.h"
+#include "filament/TextureSampler.h"
+#include "utils/Entity.h"
 
 namespace bulb
 {
+   class Managers;
+
+   /**
+    * The MaterialInstance bound to the primitives of a renderable entity. The instance is taken from
+    * MaterialInstancePool and the primitives are only rebound when the material or the entity changes.
+    * Parameters set on the binding override the material defaults for this binding only. Instances are taken
+    * from (and returned to) the pool of the context the binding is bound in.
+    */
+   class MaterialBinding
+   //===================
+   {
+   public:
+      MaterialBinding() = default;
+      MaterialBinding(const MaterialBinding&) = delete;
+      MaterialBinding& operator=(const MaterialBinding&) = delete;
+      MaterialBinding(MaterialBinding&& other) noexcept;
+      MaterialBinding& operator=(MaterialBinding&& other) noexcept;
+      ~MaterialBinding() { unbind(); }
+
+      /**
+       * Binds an instance of material, taken from the pool of context, to all primitives of entity. A previously
+       * bound entity which is still alive is detached (@see unbind) and the previous instance is only released once
+       * no longer referenced. Binding in a different context first unbinds from the previous one.
+       * @return true if the primitives were (re)bound, false if the binding was already current.
+       */
+      bool bind(Managers& context, utils::Entity entity, filament::Material* material);
+
+      /**
+       * Returns the instance to the pool after rebinding the primitives of the entity, if it is still alive, to the
+       * default instance of the engine's default material, so the released instance is no longer referenced.
+       */
+      void unbind();
+
+      filament::Material* get_material() const { return material; }
+
+      filament::MaterialInstance* get_instance() const { return instance; }
+
+      template <typename T>
+      void set_parameter(const char* name, T value)
+      //-------------------------------------------
+      {
+         std::string param(name);
+         set_override(param, [param, value](filament::MaterialInstance* mi) { mi->setParameter(param.c_str(), value); });
+      }
+
+      void set_parameter(const char* name, filament::Texture* texture, const filament::TextureSampler& sampler)
+      //------------------------------------------------------------------------------------------------------
+      {
+         std::string param(name);
+         set_override(param, [param, texture, sampler](filament::MaterialInstance* mi)
+                             { mi->setParameter(param.c_str(), texture, sampler); });
+      }
+
+      bool has_parameter(const std::string& name) const { return overrides.find(name) != overrides.end(); }
+
+      /**
+       * Removes all overrides. Values already set remain on the bound instance until it is replaced or the material
+       * defaults are changed.
+       */
+      void clear_parameters();
+
+   private:
+      Managers* managers = nullptr;
+      filament::Material* material = nullptr;
+      filament::MaterialInstance* instance = nullptr;
+      utils::Entity entity;
+      std::map<std::string, std::function<void(filament::MaterialInstance*)>> overrides;
+      bool isModified = false;
+
+      void set_override(const std::string& name, std::function<void(filament::MaterialInstance*)> f);
+      void detach(utils::Entity renderable);
+      void release(filament::MaterialInstance* released, filament::Material* releasedMaterial, bool wasModified);
+   };
+
    class Materializable
    //===================
    {
@@ -13,6 +95,22 @@ namespace bulb
       virtual void set_material(filament::Material* material) =0;
       virtual filament::Material* get_material_at(size_t i) { return nullptr; }
       virtual void set_material_at(size_t i, filament::Material* material) {}
+
+      /**
+       * Sets a material parameter for this node only, without affecting other nodes using the same material.
+       */
+      template <typename T>
+      void set_parameter(const char* name, T value) { materialBinding.set_parameter(name, value); }
+
+      void set_parameter(const char* name, filament::Texture* texture, const filament::TextureSampler& sampler)
+      {
+         materialBinding.set_parameter(name, texture, sampler);
+      }
+
+      filament::MaterialInstance* get_material_instance() { return materialBinding.get_instance(); }
+
+   protected:
+      MaterialBinding materialBinding;
    };
 }
 #endif //_MATERIALIZABLE_HH_
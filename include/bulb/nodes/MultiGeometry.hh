@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <memory>
+#include <atomic>
 
 #include "bulb/nodes/Drawable.hh"
 #include "bulb/nodes/Materializable.hh"
@@ -13,6 +14,8 @@
 #include "gltfio/AssetLoader.h"
 #include "gltfio/ResourceLoader.h"
 
+#include "bulb/GltfAsset.hh"
+
 namespace bulb
 {
    /**
@@ -24,11 +27,111 @@ namespace bulb
       //=====================================================
    {
    public:
-      explicit MultiGeometry(const char* name = nullptr, filament::Material* defaultMaterial = nullptr,
+      explicit MultiGeometry(Managers& context, const char* name = nullptr, filament::Material* defaultMaterial = nullptr,
                              Transform* internalTransform = nullptr) :
-            Drawable(name, internalTransform), defaultRootMaterial(defaultMaterial) { }
+            Drawable(context, name, internalTransform), defaultRootMaterial(defaultMaterial) { }
+
+      MultiGeometry(const MultiGeometry&) = delete;
+      MultiGeometry& operator=(const MultiGeometry&) = delete;
+
+      ~MultiGeometry() override;
+
+      /**
+       * @return A flag which is cleared when the node is destroyed, for work which completes later on the render
+       *         thread (eg SceneGraph::make_multi_geometry_async) and must check the node still exists before each
+       *         use. Nodes are owned by their SceneGraph, not shared.
+       */
+      std::shared_ptr<const std::atomic<bool>> liveness() const { return alive; }
+
+      /**
+       * @param loader A gltf AssetLoader shared with other nodes (@see SceneGraph::get_gltf_loader) or nullptr to
+       *               create one (and a material generator) for this node only. A shared loader must outlive the node.
+       * @param isOptimized Reorder the mesh buffers with MeshOptimizer before creating the asset.
+       * @param lodRatios If not empty, levels of detail with these fractions of the triangles are created (each as a
+       *                  separate asset, @see GltfAsset::create_lods) and can be displayed using set_lod.
+       */
+      bool open_gltf(const char* gltfPath, bool normalized = true, bool bestShaders =false,
+                     gltfio::AssetLoader* loader =nullptr, bool isOptimized =false,
+                     const std::vector<float>& lodRatios =std::vector<float>());
+
+      /**
+       * Displays an unused instance of a (possibly shared) gltf asset, replacing any asset previously displayed.
+       * @return false if asset has no free instances.
+       */
+      bool attach_gltf(std::shared_ptr<GltfAsset> asset, bool normalized = true);
+
+      std::shared_ptr<GltfAsset> get_gltf() { return gltf; }
+
+      /**
+       * Adds simplified versions of the displayed asset as levels of detail, levels[i] being displayed by
+       * set_lod(i + 1). Each level takes an instance of its asset, and all levels are kept in the scene with those not
+       * displayed hidden by their layer mask, so switching levels does not rebuild the scene.
+       */
+      bool attach_gltf_lods(const std::vector<std::shared_ptr<GltfAsset>>& levels);
+
+      /** @return The number of levels of detail, including the full asset (level 0). */
+      size_t lod_count() const { return (gltf) ? lods.size() + 1 : 0; }
+
+      size_t get_lod() const { return lod; }
+
+      /** Displays level of detail level, from 0 (the full asset) to lod_count() - 1 (the fewest triangles). */
+      bool set_lod(size_t level);
+
+      /** @return The number of animations in the displayed gltf, 0 until its resources have loaded. */
+      size_t animation_count();
+
+      float animation_duration(size_t animation);
+
+      const char* animation_name(size_t animation);
+
+      /**
+       * Sets how much an animation contributes to the pose, 0 (the default) stopping it. Active animations are
+       * blended by their relative weights, so a single active animation plays as authored whatever its weight.
+       */
+      void set_animation_weight(size_t animation, float weight);
 
-      bool open_gltf(const char* gltfPath, bool normalized = true, bool bestShaders =false);
+      float get_animation_weight(size_t animation) const;
+
+      void set_animation_time(size_t animation, float seconds);
+
+      float get_animation_time(size_t animation) const;
+
+      /** Looping animations wrap at their duration, others hold their last frame (default true). */
+      void set_animation_looping(bool isLooping) { isAnimationLooping = isLooping; }
+
+      /** @return true if any animation has a non-zero weight. */
+      bool is_animated() const;
+
+      /** Advances the time of the active animations by dt seconds. */
+      void advance_animations(float dt);
+
+      /**
+       * Advances and applies the active animations to this node only (render thread only).
+       * SceneGraph::animate_gltf does the same for all nodes of a graph in one batch.
+       */
+      void animate(float dt, bool isUpdatingBones =true);
+
+      /**
+       * Applies the active animations to the entity transforms (render thread only). When several animations are
+       * active each is applied in turn and the resulting local transforms captured for blend_animations.
+       * @return true if blend_animations and store_animations must follow.
+       */
+      bool apply_animations();
+
+      /** Blends the transforms captured by apply_animations. Makes no filament calls so may run on any thread. */
+      void blend_animations();
+
+      /** Sets the transforms computed by blend_animations (render thread only). */
+      void store_animations();
+
+      /**
+       * Updates the skinning bone matrices from the entity world transforms (render thread only, after any
+       * TransformManager local transform transaction has been committed).
+       */
+      void update_bones();
+
+      /** @return false if no gltf is displayed, else true with the world space bounds of the asset in box. */
+      bool world_bounds(filament::Box& box);
 
       void pre_render(std::vector<utils::Entity>& renderables) override;
 
@@ -40,6 +143,24 @@ namespace bulb
 
       void set_material_at(size_t i, filament::Material* material) override;
 
+      /**
+       * Sets a material parameter for child i only (the child must have a material set using set_material_at).
+       */
+      template <typename T>
+      void set_parameter_at(size_t i, const char* name, T value)
+      {
+         MaterialBinding* binding = child_binding(i);
+         if (binding != nullptr) binding->set_parameter(name, value);
+      }
+
+      void set_parameter_at(size_t i, const char* name, filament::Texture* texture, const filament::TextureSampler& sampler)
+      {
+         MaterialBinding* binding = child_binding(i);
+         if (binding != nullptr) binding->set_parameter(name, texture, sampler);
+      }
+
+      filament::MaterialInstance* get_material_instance_at(size_t i);
+
       virtual utils::Entity& get_root() { return renderedEntity; }
 
       virtual utils::Entity* get_root_ptr() { return &renderedEntity; }
@@ -54,9 +175,36 @@ namespace bulb
       filament::Material* defaultRootMaterial = nullptr;
       std::vector<utils::Entity> children;
       std::vector<filament::Material*> childrenMaterials;
-      gltfio::AssetLoader* gltfLoader = nullptr;
-      gltfio::FilamentAsset* gltfAsset = nullptr;
+      std::vector<MaterialBinding> childrenBindings;
+      std::shared_ptr<GltfAsset> gltf;
+      int gltfInstance = -1;
+      struct GltfLod
+      {
+         std::shared_ptr<GltfAsset> asset;
+         int instance;
+      };
+      std::vector<GltfLod> lods; // Levels 1 to n, level 0 being gltf
+      size_t lod = 0;
       filament::math::mat4f S{1.0f};
+      struct GltfAnimation
+      {
+         float time = 0;
+         float weight = 0;
+      };
+      std::vector<GltfAnimation> animations;
+      bool isAnimationLooping = true;
+      std::vector<size_t> activeAnimations;
+      std::vector<filament::math::mat4f> animationPoses; // [active animation * entity count + entity]
+      std::vector<filament::math::mat4f> blendedPoses;
+
+      /** @return The asset (and in instance its instance) of the displayed level of detail, or nullptr. */
+      GltfAsset* displayed_gltf(int& instance);
+
+      MaterialBinding* child_binding(size_t i);
+      void release_gltf();
+
+   private:
+      std::shared_ptr<std::atomic<bool>> alive = std::make_shared<std::atomic<bool>>(true); // @see liveness
    };
 };
 
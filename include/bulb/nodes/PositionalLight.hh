@@ -17,14 +17,14 @@ namespace bulb
    //================================
    {
    public:
-      PositionalLight(const char* name, filament::LinearColor color, filament::math::float3 initialPosition,
-                      filament::math::float3 direction,
+      PositionalLight(Managers& context, const char* name, filament::LinearColor color,
+                      filament::math::float3 initialPosition, filament::math::float3 direction,
                       filament::math::float2 cone ={bulb::pi<float> / 8, (bulb::pi<float> / 8) * 1.1 },
                       float intensity =5000.0f, float efficiency =filament::LightManager::EFFICIENCY_HALOGEN,
                       float fade =2.0f, bool hasShadows =false);
 
-      PositionalLight(const char* name, filament::LinearColor color, filament::math::float3 initialPosition,
-                      filament::math::float3 direction, float intensity =5000.0f,
+      PositionalLight(Managers& context, const char* name, filament::LinearColor color,
+                      filament::math::float3 initialPosition, filament::math::float3 direction, float intensity =5000.0f,
                       float efficiency =filament::LightManager::EFFICIENCY_HALOGEN,
                       float fade =2.0f, bool hasShadows =false);
 
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <list>
+#include <chrono>
 
 #include "math/mat4.h"
 #include "utils/Entity.h"
@@ -56,6 +57,7 @@ namespace bulb
       std::list<filament::math::mat4> matrixStack;
       std::vector<utils::Entity> renderables;
       filament::Material* currentMaterial = nullptr;
+      std::chrono::steady_clock::duration preRenderTime{0}; // Total time in Drawable::pre_render
    };
 }
 #endif //_VISITOR_HH_
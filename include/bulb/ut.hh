@@ -2,7 +2,11 @@
 #define H93979eb388c712f426ceb96ae5d97234
 
 #include <cmath>
+#include <cstdint>
 #include <fstream>
+#include <string>
+#include <unordered_map>
+#include <memory>
 
 #include "filament/Box.h"
 #include "math/quat.h"
@@ -10,6 +14,8 @@
 
 namespace bulb
 {
+   class AssetView;
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunused-function"
 
@@ -49,8 +55,22 @@ namespace bulb
 
    void deldirs(const char* dir, int maxDepth =0);
 
+   /**
+    * A fast non-cryptographic 64 bit hash of size bytes, the one hash used by the library: material and LOD cache
+    * keys and the asset pack name index (so PACK_VERSION must change with it).
+    */
+   uint64_t hash64(const void* data, size_t size, uint64_t seed =0);
+
 #ifdef HAVE_LIBZIP
    bool unzip(const char* zipfile, std::string dir);
+
+   /**
+    * Decompresses every file entry in zipfile into memory without writing to disk. The archive is read using
+    * AssetReader (so it may also be a memory, pack or Android asset) and entries are decompressed in parallel on
+    * ThreadPool::workers().
+    * @param entries Receives the contents of each file entry keyed by its name in the archive.
+    */
+   bool unzip(const char* zipfile, std::unordered_map<std::string, std::shared_ptr<AssetView>>& entries);
 #endif
 
 #if !defined(NDEBUG)
@@ -31,6 +31,7 @@
 #include "bulb/Managers.hh"
 #include "bulb/AssetReader.hh"
 #include "bulb/ut.hh"
+#include "bulb/Log.hh"
 #include "bulb/nodes/Geometry.hh"
 #include "bulb/nodes/AffineTransform.hh"
 #include "bulb/nodes/MultiGeometry.hh"
@@ -39,7 +40,6 @@
 #include "stb/stb_image.h"
 
 #ifdef HAVE_LIBPNG
-#define TINYEXR_IMPLEMENTATION
 #include "exr/tinyexr.h"
 #endif
 
@@ -61,6 +61,7 @@ std::unique_ptr<Win> window;
 void* nativeWindow = nullptr;
 int windowWidth =1024, windowHeight =768;
 bool isFreeze = false;
+bool isFrameTiming = false; // --frame-timing logs the frame period and jitter (at debug level) every 400 frames
 #ifdef HAVE_LIBPNG
 bool isScreenShot = false;
 #endif
@@ -99,6 +100,7 @@ double minor_axis(double majorAxis, double eccentricity) { return majorAxis*sqrt
 #define TEAPOT_ECCENTRICITY 0.1
 #define TEAPOT_SCALE 0.15
 
+std::shared_ptr<bulb::Managers> context; // Declared before graph so it is destroyed after it
 std::unique_ptr<bulb::SceneGraph> graph;
 filament::math::double3 cameraTranslation;
 int toLoadCount = 10;
@@ -149,14 +151,23 @@ void window_resized(unsigned lastWidth, unsigned lastHeight, unsigned newWidth,
 int main(int argc, char** argv)
 //------------------------------
 {
-   if (argc > 1)
+   if (bulb::AssetReader::instance().exists("samples.bulbpak")) // Baked with bulb_bake
+      bulb::AssetReader::instance().mount_pack("samples.bulbpak");
+   bulb::EngineConfig config;
+   for (int i = 1; i < argc; i++)
    {
-      std::string arg(argv[1]);
+      std::string arg(argv[i]);
       std::transform(arg.begin(), arg.end(), arg.begin(), ::tolower);
       if ( (arg == "vulkan") || (arg == "vulcan") )
-      {
-         bulb::SELECTED_BACKEND = filament::Engine::Backend::VULKAN;
-      }
+         config.backend = filament::Engine::Backend::VULKAN;
+      else if (arg == "--frame-timing")
+         isFrameTiming = true;
+   }
+   context = bulb::Managers::create(config);
+   if (! context)
+   {
+      std::cerr << "Error creating the filament engine\n";
+      return 1;
    }
 #ifdef HAVE_SDL2
    if (SDL_Init(SDL_INIT_EVENTS /*| SDL_INIT_VIDEO*/) < 0)
@@ -278,9 +289,21 @@ void on_post_render(filament::Engine* engine, filament::View* view, filament::Re
 void event_loop()
 //---------------
 {
-   double fps = 40;
-   long spf = 1000000000L / fps;
-   auto frame_start = std::chrono::high_resolution_clock::now();
+   // Overlap reading the models with the loading of the earlier ones.
+   bulb::AssetReader::instance().prefetch({ "samples/model/Sol", "samples/model/Mercury", "samples/model/Venus",
+                                            "samples/model/Earth", "samples/model/Luna", "samples/model/Mars",
+                                            "samples/model/Station", "samples/model/Jupiter",
+                                            "samples/model/Monolith", "samples/model/Teapot" });
+   // Renders at 40 fps, animating at a fixed 40 updates per second, and sleeps between frames.
+   bulb::FrameScheduler scheduler(40, 40);
+   scheduler.on_update([](double, double)
+   {
+      if ( (! graph) || (isFreeze) || (animationTransforms.empty()) || (! graph->start_updating()) )
+         return;
+      for (bulb::Transform* transform : animationTransforms)
+         transform->animate(ellipticAnimator);
+      graph->end_updating(true);
+   });
    bool is_quit = false;
    do
    {
@@ -298,41 +321,25 @@ void event_loop()
          break;
 #endif
       if (! graph) continue;
-      auto frame_end = std::chrono::high_resolution_clock::now();
-      long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_end - frame_start).count(), last_duration;
-      if (elapsed >= spf)
+      if (toLoadCount > 0)
       {
+         load_a_node();
+         animationTransforms = graph->get_animated_transforms();
+      }
 #ifdef HAVE_LIBPNG
-         if (isScreenShot)
-         {
-            graph->render(on_post_render);
-            isScreenShot = false;
-         }
-         else
-#endif
-            graph->render();
-         frame_start = frame_end;
-         last_duration = elapsed;
+      if (isScreenShot)
+      {
+         graph->run_frame(scheduler, on_post_render);
+         isScreenShot = false;
       }
-      else //if (elapsed < spf)
+      else
+#endif
+         graph->run_frame(scheduler);
+      if ( (isFrameTiming) && ((scheduler.frame_count() % 400) == 0) )
       {
-         if (toLoadCount > 0)
-         {
-            load_a_node();
-            animationTransforms = graph->get_animated_transforms();
-         }
-         if ( (isFreeze) || (animationTransforms.empty()) )
-            std::this_thread::sleep_for(std::chrono::milliseconds(5));
-         else
-         {
-            for (bulb::Transform* transform : animationTransforms)
-            {
-               while (!graph->start_updating());
-               transform->animate(ellipticAnimator);
-               graph->end_updating(true);
-
-            }
-         }
+         bulb::Log logger("orbits");
+         logger.debug("Frame period {0}ms, jitter {1}ms", scheduler.frame_period()*1000.0,
+                      scheduler.frame_jitter()*1000.0);
       }
    } while (! is_quit);
    destroy_graph();
@@ -344,7 +351,7 @@ void event_loop()
 void destroy_graph()
 //--------------------
 {
-   std::shared_ptr<filament::Engine> engine = bulb::Managers::instance().engine;
+   std::shared_ptr<filament::Engine> engine = context->engine;
    if (engine)
    {
       filament::Fence::waitAndDestroy(engine->createFence());
@@ -392,7 +399,7 @@ std::pair<bulb::AffineTransform*, bulb::MultiGeometry*> make_satellite(bulb::Com
 {
    bulb::AffineTransform* transformNode = graph->make_affine_transform(nodeTransformName, R, t, scale, animationParams);
    parent->add_child(transformNode);
-   bulb::MultiGeometry* planet = graph->make_multi_geometry(nodeName, modelPath);
+   bulb::MultiGeometry* planet = graph->make_multi_geometry_async(nodeName, modelPath);
    transformNode->add_child(planet);
    return std::make_pair(transformNode, planet);
 }
@@ -400,7 +407,7 @@ std::pair<bulb::AffineTransform*, bulb::MultiGeometry*> make_satellite(bulb::Com
 bool create_graph()
 //------------------------------------
 {
-   std::shared_ptr<filament::Engine> engine = bulb::Managers::instance().engine;
+   std::shared_ptr<filament::Engine> engine = context->engine;
    swapChain = engine->createSwapChain(nativeWindow);
    view = engine->createView();
    view->setClearColor({0, 0, 0, 1.0});
@@ -418,7 +425,7 @@ bool create_graph()
 
    cameraTranslation = cameraManipulator->get_translation();
    view->setCamera(perspectiveCamera);
-   graph = std::make_unique<bulb::SceneGraph>(engine, swapChain, view);
+   graph = std::make_unique<bulb::SceneGraph>(*context, swapChain, view);
 
    while (!graph->start_updating())  // Not really necessary here, but good practise for multithreaded updates to the graph
       std::this_thread::sleep_for(std::chrono::milliseconds(5));
@@ -433,15 +440,15 @@ bool create_graph()
 }
 
 
-// Filament gltf loader not multithreaded.
+// Models are loaded in the background by make_multi_geometry_async and appear when ready.
 int load_a_node()
 //--------------
 {
    if (sol == nullptr)
    {
-      sol = graph->make_multi_geometry("Sun", "samples/model/Sol/Sol.gltf",
-                                       new bulb::AffineTransform("SunTransform", filament::math::mat3(1.0),
-                                                                 filament::math::double3(0, 0, 0.5), 0.5));
+      sol = graph->make_multi_geometry_async("Sun", "samples/model/Sol/Sol.gltf",
+                                             new bulb::AffineTransform("SunTransform", filament::math::mat3(1.0),
+                                                                       filament::math::double3(0, 0, 0.5), 0.5));
       if (sol == nullptr)
       {
          std::cerr << "The sun has expired\n";
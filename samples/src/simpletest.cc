@@ -26,6 +26,7 @@
 #include "bulb/Managers.hh"
 #include "bulb/ut.hh"
 #include "bulb/AssetReader.hh"
+#include "bulb/TextureLoader.hh"
 #include "bulb/nodes/Geometry.hh"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -97,6 +98,7 @@ filament::Camera* perspectiveCamera = nullptr;
 #ifndef HAVE_SDL2
 std::unique_ptr<Win> window;
 #endif
+std::shared_ptr<bulb::Managers> context; // Declared before graph so it is destroyed after it
 std::unique_ptr<bulb::SceneGraph> graph;
 
 void event_loop();
@@ -108,7 +110,7 @@ std::string bakedColor("samples/material/bakedColor"), bakedTexture("samples/mat
             cubeTextureFile("samples/model/cube/default.png");
 
 filament::Texture* monoTexture;
-filament::TextureSampler monoSampler(filament::TextureSampler::MinFilter::LINEAR,
+filament::TextureSampler monoSampler(filament::TextureSampler::MinFilter::LINEAR_MIPMAP_LINEAR,
                                      filament::TextureSampler::MagFilter::LINEAR);
 
 void window_resized(unsigned lastWidth, unsigned lastHeight, unsigned newWidth, unsigned newHeight)
@@ -131,12 +133,21 @@ void window_resized(unsigned lastWidth, unsigned lastHeight, unsigned newWidth,
 int main(int argc, char** argv)
 //------------------------------
 {
+   if (bulb::AssetReader::instance().exists("samples.bulbpak")) // Baked with bulb_bake
+      bulb::AssetReader::instance().mount_pack("samples.bulbpak");
+   bulb::EngineConfig config;
    if (argc > 1)
    {
       std::string arg(argv[1]);
       std::transform(arg.begin(), arg.end(), arg.begin(), ::tolower);
       if ( (arg == "vulkan") || (arg == "vulcan") )
-         bulb::SELECTED_BACKEND = filament::Engine::Backend::VULKAN;
+         config.backend = filament::Engine::Backend::VULKAN;
+   }
+   context = bulb::Managers::create(config);
+   if (! context)
+   {
+      std::cerr << "Error creating the filament engine\n";
+      return 1;
    }
 #ifdef HAVE_SDL2
    if (SDL_Init(SDL_INIT_EVENTS /*| SDL_INIT_VIDEO*/) < 0)
@@ -285,7 +296,7 @@ void event_loop()
 void destroy_graph()
 //--------------------
 {
-   std::shared_ptr<filament::Engine> engine = bulb::Managers::instance().engine;
+   std::shared_ptr<filament::Engine> engine = context->engine;
    if (engine)
    {
       if (perspectiveCamera) engine->destroy(perspectiveCamera); perspectiveCamera = nullptr;
@@ -319,7 +330,7 @@ bool create_cube(filament::Engine* engine, bulb::SceneGraph* graph, bulb::Compos
 bool create_graph()
 //------------------------------------
 {
-   std::shared_ptr<filament::Engine> engine = bulb::Managers::instance().engine;
+   std::shared_ptr<filament::Engine> engine = context->engine;
    swapChain = engine->createSwapChain(nativeWindow);
    view = engine->createView();
    view->setClearColor(filament::Color::toLinear({0, 0.5, 0, 0}));
@@ -333,7 +344,7 @@ bool create_graph()
    perspectiveCamera->setProjection(50, double(windowWidth) / double(windowHeight), 0.0625, 10.0); //, filament::Camera::Fov::HORIZONTAL);
 //   std::cout << "Contains (-0.15, 0.06, " << TRIANGLE_Z << ") " << (perspectiveCamera->getFrustum().contains({-0.15, 0.06, TRIANGLE_Z}) < 0) << std::endl;
    view->setCamera(perspectiveCamera);
-   graph = std::make_unique<bulb::SceneGraph>(engine, swapChain, view);
+   graph = std::make_unique<bulb::SceneGraph>(*context, swapChain, view);
 
    while (! graph->start_updating())  // Not really necessary here, but good practise for multithreaded updates to the graph
       std::this_thread::sleep_for(std::chrono::milliseconds(5));
@@ -387,18 +398,19 @@ bool create_graph()
       return false;
    }
    root->add_child(texMaterialNode);
-   int w, h, channels;
-   unsigned char* img = stbi_load(textureFile.c_str(), &w, &h, &channels, 4);
-   assert(img != nullptr);
-   filament::Texture* texture = filament::Texture::Builder().width(uint32_t(w)).height(uint32_t(h)).
-                                                             levels(1).sampler(filament::Texture::Sampler::SAMPLER_2D).
-                                                             format(filament::backend::TextureFormat::RGBA8).build(*engine);
-   filament::Texture::PixelBufferDescriptor buffer(img, size_t(w * h * 4),
-                                                   filament::Texture::Format::RGBA, filament::Texture::Type::UBYTE,
-                                                   [](void* p, size_t size, void* user) { if (p) stbi_image_free(p); });
-   texture->setImage(*engine, 0, std::move(buffer));
-   texMaterialNode->setTexture("albedo", texture, filament::TextureSampler::MinFilter::LINEAR,
-                               filament::TextureSampler::MagFilter::LINEAR);
+   // Decoded and mipmapped on worker threads while the rest of the scene is built, see TextureLoader::finish below.
+   context->texture_loader().load(textureFile.c_str(),
+   [texMaterialNode](const std::string& path, filament::Texture* texture)
+   //--------------------------------------------------------------------
+   {
+      if (texture == nullptr)
+      {
+         std::cerr << "Error loading texture " << path << std::endl;
+         return;
+      }
+      texMaterialNode->setTexture("albedo", texture, filament::TextureSampler::MinFilter::LINEAR_MIPMAP_LINEAR,
+                                  filament::TextureSampler::MagFilter::LINEAR);
+   });
    bulb::AffineTransform* triangleTransform3 = graph->make_affine_transform("Triangle 3 Transform", filament::math::mat3(1),
                                                                             filament::math::double3(0, 0, 0.08),
                                                                             filament::math::double3(0.025, 0.025, 1));
@@ -468,6 +480,7 @@ bool create_graph()
 
    filament::LinearColor lightColor = filament::Color::toLinear<filament::ACCURATE>(filament::sRGBColor(0.98f, 0.98f, 0.98f));
    graph->add_sunlight(lightColor, { 0, -1, -0.8 }, 200000.0f);
+   context->texture_loader().finish(engine.get()); // Bind textures before the first frame
    graph->end_updating();
    return true;
 }
@@ -487,22 +500,18 @@ bool create_cube(filament::Engine* engine, bulb::SceneGraph* graph, bulb::Compos
    reader.read_asset_vector("samples/material/cube", materialData);
 //   reader.read_asset_vector("assets/bakedTexture", materialData);
    cubeMaterial = filament::Material::Builder().package(materialData.data(), materialData.size()).build(*engine);
-   int w, h, channels;
-   unsigned char* img = stbi_load(cubeTextureFile.c_str(), &w, &h, &channels, 4);
-   if (! img)
+   context->texture_loader().load(cubeTextureFile.c_str(),
+   [](const std::string& path, filament::Texture* texture)
+   //-----------------------------------------------------
    {
-      std::cerr <<  "Error opening cube texture " << cubeTextureFile << std::endl;
-      return false;
-   }
-   monoTexture = filament::Texture::Builder().width(uint32_t(w)).height(uint32_t(h)).
-                                              levels(1).sampler(filament::Texture::Sampler::SAMPLER_2D).
-                                              format(filament::backend::TextureFormat::RGBA8).
-                                              build(*engine);
-   filament::Texture::PixelBufferDescriptor buffer(img, size_t(w * h * 4),
-                                                   filament::Texture::Format::RGBA, filament::Texture::Type::UBYTE,
-                                                   [](void* p, size_t size, void* user) { if (p) stbi_image_free(p); });
-   monoTexture->setImage(*engine, 0, std::move(buffer));
-   cubeMaterial->setDefaultParameter("albedo", monoTexture, monoSampler);
+      if (texture == nullptr)
+      {
+         std::cerr <<  "Error opening cube texture " << path << std::endl;
+         return;
+      }
+      monoTexture = texture;
+      cubeMaterial->setDefaultParameter("albedo", monoTexture, monoSampler);
+   });
    cubeMaterial->setDefaultParameter("metallic", 1.0f);
    cubeMaterial->setDefaultParameter("roughness", 0.4f);
    cubeMaterial->setDefaultParameter("reflectance", 0.4f);
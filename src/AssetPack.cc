@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cctype>
+
+#include <dirent.h>
+
+#include "bulb/AssetPack.hh"
+#include "bulb/Log.hh"
+#include "bulb/ut.hh"
+
+namespace bulb
+{
+   std::string AssetPack::normalize(const std::string& name)
+   //-------------------------------------------------------
+   {
+      std::string normalized;
+      normalized.reserve(name.size());
+      size_t i = 0;
+      while (i < name.size())
+      {
+         size_t next = name.find('/', i);
+         if (next == std::string::npos)
+            next = name.size();
+         std::string component = name.substr(i, next - i);
+         if ( (! component.empty()) && (component != ".") )
+         {
+            if (! normalized.empty())
+               normalized += '/';
+            normalized += component;
+         }
+         i = next + 1;
+      }
+      return normalized;
+   }
+
+   PackEntryType AssetPack::type_of(const std::string& name)
+   //-------------------------------------------------------
+   {
+      std::string::size_type p = name.rfind('.');
+      std::string::size_type slash = name.rfind('/');
+      if ( (p == std::string::npos) || ( (slash != std::string::npos) && (p < slash) ) )
+         return PackEntryType::OTHER;
+      std::string ext = name.substr(p + 1);
+      std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+      if (ext == "filamat")
+         return PackEntryType::MATERIAL;
+      if (ext == "filamesh")
+         return PackEntryType::FILAMESH;
+      if ( (ext == "gltf") || (ext == "glb") )
+         return PackEntryType::GLTF;
+      if (ext == "bin")
+         return PackEntryType::BUFFER;
+      if ( (ext == "png") || (ext == "jpg") || (ext == "jpeg") || (ext == "exr") || (ext == "ktx") || (ext == "hdr") )
+         return PackEntryType::TEXTURE;
+      return PackEntryType::OTHER;
+   }
+
+   std::shared_ptr<AssetPack> AssetPack::open(const char* packPath)
+   //--------------------------------------------------------------
+   {
+      Log logger("AssetPack::open");
+      if (packPath == nullptr)
+         return nullptr;
+      std::shared_ptr<AssetView> contents = AssetReader::instance().map_asset(packPath);
+      if ( (! contents) || (contents->size() < sizeof(PackHeader)) )
+      {
+         logger.error("Error reading asset pack {0}", packPath);
+         return nullptr;
+      }
+      PackHeader header;
+      std::memcpy(&header, contents->data(), sizeof(PackHeader));
+      const uint64_t size = contents->size();
+      if ( (std::memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0) || (header.version != PACK_VERSION) ||
+           (header.indexOffset + uint64_t(header.entryCount) * sizeof(PackEntry) > size) || (header.namesOffset > size) )
+      {
+         logger.error("{0} is not a valid version {1} asset pack", packPath, PACK_VERSION);
+         return nullptr;
+      }
+      std::shared_ptr<AssetPack> pack(new AssetPack);
+      pack->path = packPath;
+      pack->contents = contents;
+      pack->entries = reinterpret_cast<const PackEntry*>(contents->bytes() + header.indexOffset);
+      pack->entryNames = contents->begin() + header.namesOffset;
+      pack->index.reserve(header.entryCount);
+      for (uint32_t i = 0; i < header.entryCount; i++)
+      {
+         const PackEntry& entry = pack->entries[i];
+         if ( (header.namesOffset + entry.nameOffset + entry.nameLength > size) || (entry.offset + entry.size > size) )
+         {
+            logger.error("Asset pack {0} entry {1} is out of bounds", packPath, i);
+            return nullptr;
+         }
+         pack->index.emplace(entry.nameHash, i);
+      }
+      return pack;
+   }
+
+   const PackEntry* AssetPack::find_entry(const std::string& name) const
+   //-------------------------------------------------------------------
+   {
+      const std::string normalized = normalize(name);
+      auto range = index.equal_range(hash64(normalized.data(), normalized.size()));
+      for (auto it = range.first; it != range.second; ++it)
+      {
+         const PackEntry& entry = entries[it->second];
+         if ( (entry.nameLength == normalized.size()) &&
+              (std::memcmp(entryNames + entry.nameOffset, normalized.data(), normalized.size()) == 0) )
+            return &entry;
+      }
+      return nullptr;
+   }
+
+   std::shared_ptr<AssetView> AssetPack::find(const std::string& name) const
+   //-----------------------------------------------------------------------
+   {
+      const PackEntry* found = find_entry(name);
+      if (found == nullptr)
+         return nullptr;
+      const PackEntry& entry = *found;
+      std::shared_ptr<AssetView> pack = contents;
+      // The entry view holds a reference to the pack mapping rather than owning memory of its own.
+      return std::make_shared<AssetView>(contents->bytes() + entry.offset, static_cast<size_t>(entry.size),
+                                         [pack](const void*, size_t) {});
+   }
+
+   size_t AssetPack::entry_size(const std::string& name) const
+   //---------------------------------------------------------
+   {
+      const PackEntry* entry = find_entry(name);
+      return (entry == nullptr) ? 0 : static_cast<size_t>(entry->size);
+   }
+
+   PackEntryType AssetPack::entry_type(const std::string& name) const
+   //----------------------------------------------------------------
+   {
+      const PackEntry* entry = find_entry(name);
+      return (entry == nullptr) ? PackEntryType::OTHER : static_cast<PackEntryType>(entry->type);
+   }
+
+   bool AssetPack::is_dir(const std::string& name) const
+   //---------------------------------------------------
+   {
+      std::string prefix = normalize(name) + "/";
+      for (const auto& pp : index)
+      {
+         const PackEntry& entry = entries[pp.second];
+         if ( (entry.nameLength >= prefix.size()) &&
+              (std::memcmp(entryNames + entry.nameOffset, prefix.data(), prefix.size()) == 0) )
+            return true;
+      }
+      return false;
+   }
+
+   std::vector<std::string> AssetPack::names() const
+   //-----------------------------------------------
+   {
+      std::vector<std::string> v;
+      v.reserve(index.size());
+      for (const auto& pp : index)
+         v.push_back(name_of(entries[pp.second]));
+      std::sort(v.begin(), v.end());
+      return v;
+   }
+
+   void AssetPackWriter::add(const std::string& name, std::shared_ptr<AssetView> contents, PackEntryType type)
+   //---------------------------------------------------------------------------------------------------------
+   {
+      std::string normalized = AssetPack::normalize(name);
+      auto it = std::find_if(pending.begin(), pending.end(),
+                             [&normalized](const Pending& p) -> bool { return (p.name == normalized); });
+      if (it != pending.end())
+      {
+         it->contents = std::move(contents);
+         it->type = type;
+      }
+      else
+         pending.push_back(Pending{normalized, std::move(contents), type});
+   }
+
+   bool AssetPackWriter::add_file(const std::string& file, const std::string& name)
+   //------------------------------------------------------------------------------
+   {
+      std::shared_ptr<AssetView> contents = AssetReader::instance().map_asset(file.c_str());
+      if (! contents)
+      {
+         Log logger("AssetPackWriter::add_file");
+         logger.error("Error reading {0}", file);
+         return false;
+      }
+      const std::string& entryName = (name.empty()) ? file : name;
+      PackEntryType type = AssetPack::type_of(entryName);
+      // Compiled material packages usually have no extension so are recognised by their leading chunk tag.
+      if ( (type == PackEntryType::OTHER) && (contents->size() >= 8) &&
+           (std::memcmp(contents->data(), "SREV_TAM", 8) == 0) )
+         type = PackEntryType::MATERIAL;
+      add(entryName, contents, type);
+      return true;
+   }
+
+   size_t AssetPackWriter::add_directory(const std::string& dir, bool isRecursive)
+   //-----------------------------------------------------------------------------
+   {
+      struct D { void operator()(DIR* p) const { if (p) closedir(p); }; };
+      std::unique_ptr<DIR, D> d(opendir(dir.c_str()), D());
+      if (! d)
+         return 0;
+      size_t count = 0;
+      struct dirent* dp;
+      while ((dp = readdir(d.get())) != nullptr)
+      {
+         if (dp->d_name[0] == '.')
+            continue;
+         std::string path = dir + "/" + dp->d_name;
+         if (bulb::is_dir(path.c_str()))
+         {
+            if (isRecursive)
+               count += add_directory(path, true);
+         }
+         else if (add_file(path))
+            count++;
+      }
+      return count;
+   }
+
+   bool AssetPackWriter::write(const char* packPath)
+   //-----------------------------------------------
+   {
+      Log logger("AssetPackWriter::write");
+      std::vector<Pending> sorted(pending);
+      std::sort(sorted.begin(), sorted.end(), [](const Pending& a, const Pending& b) { return (a.name < b.name); });
+
+      std::string names;
+      std::vector<PackEntry> entries(sorted.size());
+      for (size_t i = 0; i < sorted.size(); i++)
+      {
+         if (sorted[i].name.size() > UINT16_MAX)
+         {
+            logger.error("Asset name {0} is too long", sorted[i].name);
+            return false;
+         }
+         PackEntry& entry = entries[i];
+         std::memset(&entry, 0, sizeof(PackEntry));
+         entry.nameOffset = static_cast<uint32_t>(names.size());
+         entry.nameLength = static_cast<uint16_t>(sorted[i].name.size());
+         entry.nameHash = hash64(sorted[i].name.data(), sorted[i].name.size());
+         entry.type = static_cast<uint8_t>(sorted[i].type);
+         entry.size = (sorted[i].contents) ? sorted[i].contents->size() : 0;
+         names += sorted[i].name;
+      }
+
+      auto align = [](uint64_t offset) { return (offset + PACK_ALIGNMENT - 1) & ~(PACK_ALIGNMENT - 1); };
+      PackHeader header;
+      std::memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+      header.version = PACK_VERSION;
+      header.entryCount = static_cast<uint32_t>(entries.size());
+      header.indexOffset = sizeof(PackHeader);
+      header.namesOffset = header.indexOffset + entries.size() * sizeof(PackEntry);
+      uint64_t offset = align(header.namesOffset + names.size());
+      for (PackEntry& entry : entries)
+      {
+         entry.offset = offset;
+         offset = align(offset + entry.size);
+      }
+
+      std::ofstream out(packPath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+      if (! out)
+      {
+         logger.error("Error creating {0}", packPath);
+         return false;
+      }
+      out.write(reinterpret_cast<const char*>(&header), sizeof(PackHeader));
+      out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackEntry));
+      out.write(names.data(), names.size());
+      static const char padding[PACK_ALIGNMENT] = {};
+      uint64_t position = header.namesOffset + names.size();
+      for (size_t i = 0; i < sorted.size(); i++)
+      {
+         out.write(padding, entries[i].offset - position);
+         if (entries[i].size > 0)
+            out.write(sorted[i].contents->begin(), entries[i].size);
+         position = entries[i].offset + entries[i].size;
+      }
+      if (! out.good())
+      {
+         logger.error("Error writing {0}", packPath);
+         return false;
+      }
+      return true;
+   }
+}
@@ -0,0 +1,168 @@
+#include "bulb/AssetReader.hh"
+#include "bulb/ThreadPool.hh"
+#include "bulb/AssetPack.hh"
+
+namespace bulb
+{
+   AssetReader::AsyncRead& AssetReader::start_read_locked(const std::string& assetname)
+   //----------------------------------------------------------------------------------
+   {
+      auto it = asyncReads.find(assetname);
+      if (it != asyncReads.end())
+         return it->second;
+      auto promise = std::make_shared<std::promise<std::shared_ptr<AssetView>>>();
+      AsyncRead& read = asyncReads[assetname];
+      read.future = promise->get_future().share();
+      ThreadPool::io_workers().post([this, assetname, promise]()
+      {
+         std::shared_ptr<AssetView> view;
+         {
+            BULB_TRACE_SCOPE("AssetReader async read", "io");
+            view = find_asset(assetname.c_str());
+            if (view)
+               view->touch();
+         }
+         std::vector<AssetCallback> callbacks;
+         {
+            std::lock_guard<std::mutex> lock(asyncMutex);
+            auto it = asyncReads.find(assetname);
+            if (it != asyncReads.end())
+            {
+               callbacks.swap(it->second.callbacks);
+               asyncReads.erase(it);
+            }
+         }
+         promise->set_value(view);
+         for (AssetCallback& callback : callbacks)
+            callback(assetname, view);
+      });
+      return read;
+   }
+
+   std::shared_future<std::shared_ptr<AssetView>> AssetReader::read_async(const char* assetname)
+   //-------------------------------------------------------------------------------------------
+   {
+      if (assetname == nullptr)
+      {
+         std::promise<std::shared_ptr<AssetView>> none;
+         none.set_value(nullptr);
+         return none.get_future().share();
+      }
+      std::lock_guard<std::mutex> lock(asyncMutex);
+      return start_read_locked(assetname).future;
+   }
+
+   void AssetReader::read_async(const char* assetname, AssetCallback callback)
+   //-------------------------------------------------------------------------
+   {
+      if (assetname == nullptr)
+      {
+         if (callback)
+            callback("", nullptr);
+         return;
+      }
+      std::lock_guard<std::mutex> lock(asyncMutex);
+      AsyncRead& read = start_read_locked(assetname);
+      if (callback)
+         read.callbacks.push_back(std::move(callback));
+   }
+
+   void AssetReader::prefetch(const std::vector<std::string>& assetnames)
+   //--------------------------------------------------------------------
+   {
+      for (const std::string& assetname : assetnames)
+      {
+         if (find_memory_asset(assetname.c_str()))
+            continue;
+         ThreadPool::io_workers().post([this, assetname]()
+         {
+            BULB_TRACE_SCOPE("AssetReader prefetch", "io");
+#ifdef __ANDROID__
+            std::shared_ptr<AssetView> view = map_platform_asset(assetname.c_str());
+            if (view)
+               view->touch();
+#else
+            std::vector<std::string> files;
+            if (is_dir(assetname.c_str()))
+            {
+               struct D { void operator()(DIR* p) const { if (p) closedir(p); }; };
+               std::unique_ptr<DIR, D> dir(opendir(assetname.c_str()), D());
+               struct dirent* dp;
+               while ( (dir) && ((dp = readdir(dir.get())) != nullptr) )
+               {
+                  if (dp->d_name[0] != '.')
+                     files.push_back(assetname + "/" + dp->d_name);
+               }
+            }
+            else
+               files.push_back(assetname);
+            for (const std::string& file : files)
+            {
+               int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+               if (fd >= 0)
+               {
+                  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED); // Asynchronous readahead into the page cache
+                  close(fd);
+               }
+            }
+#endif
+         });
+      }
+   }
+
+   bool AssetReader::mount_pack(const char* packPath)
+   //------------------------------------------------
+   {
+      std::shared_ptr<AssetPack> pack = AssetPack::open(packPath);
+      if (! pack)
+         return false;
+      std::lock_guard<std::mutex> lock(memoryMutex);
+      packs.push_back(pack);
+      return true;
+   }
+
+   bool AssetReader::unmount_pack(const char* packPath)
+   //--------------------------------------------------
+   {
+      if (packPath == nullptr)
+         return false;
+      std::lock_guard<std::mutex> lock(memoryMutex);
+      auto it = std::find_if(packs.begin(), packs.end(),
+                             [packPath](const std::shared_ptr<AssetPack>& pack) -> bool
+                             { return (pack->get_path() == packPath); });
+      if (it == packs.end())
+         return false;
+      packs.erase(it); // Views already returned keep the pack mapped
+      return true;
+   }
+
+   std::shared_ptr<AssetView> AssetReader::find_pack_asset(const char* assetname)
+   //----------------------------------------------------------------------------
+   {
+      std::vector<std::shared_ptr<AssetPack>> mounted;
+      {
+         std::lock_guard<std::mutex> lock(memoryMutex);
+         if (packs.empty())
+            return nullptr;
+         mounted = packs;
+      }
+      std::string name(assetname);
+      for (const std::shared_ptr<AssetPack>& pack : mounted)
+      {
+         std::shared_ptr<AssetView> view = pack->find(name);
+         if (view)
+            return view;
+      }
+      return nullptr;
+   }
+
+   bool AssetReader::is_pack_dir(const char* assetdir)
+   //-------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(memoryMutex);
+      for (const std::shared_ptr<AssetPack>& pack : packs)
+         if (pack->is_dir(assetdir))
+            return true;
+      return false;
+   }
+}
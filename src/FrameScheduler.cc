@@ -0,0 +1,129 @@
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+#include "bulb/FrameScheduler.hh"
+
+namespace bulb
+{
+   FrameScheduler::FrameScheduler(double framesPerSecond, double updatesPerSecond) :
+      frameRate(std::max(framesPerSecond, 0.0)), updateStep(1.0 / ((updatesPerSecond > 0) ? updatesPerSecond : 60.0))
+   //----------------------------------------------------------------------------------------------------------------
+   {
+   }
+
+   void FrameScheduler::set_frame_rate(double framesPerSecond)
+   //---------------------------------------------------------
+   {
+      frameRate = std::max(framesPerSecond, 0.0);
+      deadline = Clock::now();
+   }
+
+   void FrameScheduler::set_update_rate(double updatesPerSecond)
+   //-----------------------------------------------------------
+   {
+      if (updatesPerSecond > 0)
+         updateStep = 1.0 / updatesPerSecond;
+   }
+
+   void FrameScheduler::reset()
+   //--------------------------
+   {
+      isStarted = false;
+      accumulator = simulationTime = frameDelta = lastInterpolated = 0;
+      alpha = 1;
+      frames = 0;
+      periodCount = 0;
+   }
+
+   bool FrameScheduler::run_frame(const std::function<bool()>& render)
+   //-----------------------------------------------------------------
+   {
+      const Clock::time_point now = Clock::now();
+      if (! isStarted)
+      {
+         isStarted = true;
+         lastFrame = deadline = now;
+         // The first frame shows the initial state as the result of one update.
+         if (updateCallback)
+            updateCallback(0.0, updateStep);
+         simulationTime = updateStep;
+         lastInterpolated = 0;
+      }
+      else
+      {
+         const double elapsed = std::chrono::duration<double>(now - lastFrame).count();
+         periods[periodCount++ % periods.size()] = elapsed;
+         lastFrame = now;
+         accumulator += elapsed;
+         unsigned updates = 0;
+         while ( (accumulator >= updateStep) && (updates < maxUpdates) )
+         {
+            if (updateCallback)
+               updateCallback(simulationTime, updateStep);
+            simulationTime += updateStep;
+            accumulator -= updateStep;
+            updates++;
+         }
+         // Time that could not be simulated within maxUpdates is dropped rather than carried into later frames.
+         if (updates == maxUpdates)
+            accumulator = std::min(accumulator, updateStep);
+      }
+      alpha = std::min(accumulator / updateStep, 1.0);
+      const double interpolated = interpolated_time();
+      frameDelta = std::max(interpolated - lastInterpolated, 0.0);
+      lastInterpolated = interpolated;
+      if (interpolateCallback)
+         interpolateCallback(alpha);
+
+      const bool isRendered = (render) ? render() : true;
+      frames++;
+      sleep_until_deadline();
+      return isRendered;
+   }
+
+   void FrameScheduler::sleep_until_deadline()
+   //-----------------------------------------
+   {
+      if (frameRate <= 0)
+         return;
+      const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate));
+      deadline += period;
+      Clock::time_point now = Clock::now();
+      // After a stall of more than a frame the schedule restarts from now instead of rendering a burst of frames to
+      // catch up.
+      if (now > deadline + period)
+         deadline = now;
+      if (now >= deadline)
+         return;
+      if (deadline - now > spinMargin)
+         std::this_thread::sleep_until(deadline - spinMargin);
+      while (Clock::now() < deadline)
+         std::this_thread::yield();
+   }
+
+   double FrameScheduler::frame_period() const
+   //-----------------------------------------
+   {
+      const size_t n = std::min(periodCount, periods.size());
+      if (n == 0)
+         return 0;
+      double sum = 0;
+      for (size_t i = 0; i < n; i++)
+         sum += periods[i];
+      return sum / n;
+   }
+
+   double FrameScheduler::frame_jitter() const
+   //-----------------------------------------
+   {
+      const size_t n = std::min(periodCount, periods.size());
+      if (n < 2)
+         return 0;
+      const double mean = frame_period();
+      double sum = 0;
+      for (size_t i = 0; i < n; i++)
+         sum += (periods[i] - mean) * (periods[i] - mean);
+      return std::sqrt(sum / (n - 1));
+   }
+}
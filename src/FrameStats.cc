@@ -0,0 +1,112 @@
+#include <vector>
+#include <algorithm>
+
+#include "bulb/FrameStats.hh"
+#include "bulb/Log.hh"
+
+namespace bulb
+{
+   const char* frame_phase_name(FramePhase phase)
+   //--------------------------------------------
+   {
+      switch (phase)
+      {
+         case FramePhase::MUTATIONS: return "mutations";
+         case FramePhase::TRAVERSAL: return "traversal";
+         case FramePhase::PRE_RENDER: return "pre_render";
+         case FramePhase::SCENE_REBUILD: return "scene rebuild";
+         case FramePhase::BEGIN_FRAME: return "beginFrame";
+         case FramePhase::RENDER_BACKGROUND: return "render background";
+         case FramePhase::RENDER_VIEW: return "render view";
+         case FramePhase::POST_RENDER: return "post render";
+         case FramePhase::END_FRAME: return "endFrame";
+         case FramePhase::TOTAL: return "total";
+         default: return "";
+      }
+   }
+
+   FrameStats::FrameStats(size_t capacity) : capacity(std::max(capacity, size_t(1))),
+                                             samples(new std::atomic<uint32_t>[this->capacity * PHASES])
+   //---------------------------------------------------------------------------------------------------
+   {
+      for (size_t i = 0; i < this->capacity * PHASES; i++)
+         samples[i].store(0, std::memory_order_relaxed);
+   }
+
+   void FrameStats::record(const FrameTimes& frame)
+   //----------------------------------------------
+   {
+      const uint64_t slot = head.load(std::memory_order_relaxed);
+      std::atomic<uint32_t>* p = &samples[(slot % capacity) * PHASES];
+      for (size_t i = 0; i < PHASES; i++)
+         p[i].store(frame.phases[i], std::memory_order_relaxed);
+      head.store(slot + 1, std::memory_order_release);
+
+      const uint32_t limit = budget.load(std::memory_order_relaxed);
+      if ( (limit == 0) || (frame[FramePhase::TOTAL] <= limit) )
+         return;
+      const uint64_t count = overBudget.fetch_add(1, std::memory_order_relaxed) + 1;
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if ( (overBudgetLogged > 0) && (now - lastBudgetLog < std::chrono::seconds(1)) )
+         return;
+      Log logger("FrameStats");
+      logger.warn("Frame {0} took {1}us (budget {2}us, {3} more over budget since last report): mutations {4}, "
+                  "traversal {5}, pre_render {6}, scene rebuild {7}, beginFrame {8}, render background {9}, "
+                  "render view {10}, post render {11}, endFrame {12}", slot, frame[FramePhase::TOTAL], limit,
+                  count - overBudgetLogged - 1, frame[FramePhase::MUTATIONS], frame[FramePhase::TRAVERSAL],
+                  frame[FramePhase::PRE_RENDER], frame[FramePhase::SCENE_REBUILD], frame[FramePhase::BEGIN_FRAME],
+                  frame[FramePhase::RENDER_BACKGROUND], frame[FramePhase::RENDER_VIEW],
+                  frame[FramePhase::POST_RENDER], frame[FramePhase::END_FRAME]);
+      overBudgetLogged = count;
+      lastBudgetLog = now;
+   }
+
+   FramePhaseStats FrameStats::phase_stats(FramePhase phase) const
+   //-------------------------------------------------------------
+   {
+      FramePhaseStats stats;
+      const size_t index = static_cast<size_t>(phase);
+      if (index >= PHASES)
+         return stats;
+      const uint64_t recorded = head.load(std::memory_order_acquire);
+      const size_t n = static_cast<size_t>(std::min<uint64_t>(recorded, capacity));
+      if (n == 0)
+         return stats;
+      std::vector<uint32_t> values(n);
+      for (size_t i = 0; i < n; i++)
+         values[i] = samples[i * PHASES + index].load(std::memory_order_relaxed);
+      auto percentile = [&values, n](double p) -> uint32_t
+      {
+         const size_t k = std::min(static_cast<size_t>(p * n), n - 1);
+         std::nth_element(values.begin(), values.begin() + k, values.end());
+         return values[k];
+      };
+      stats.frames = n;
+      stats.p50 = percentile(0.50);
+      stats.p95 = percentile(0.95);
+      stats.p99 = percentile(0.99);
+      stats.max = *std::max_element(values.begin(), values.end());
+      return stats;
+   }
+
+   void FrameStats::log() const
+   //--------------------------
+   {
+      Log logger("FrameStats");
+      for (size_t i = 0; i < PHASES; i++)
+      {
+         const FramePhase phase = static_cast<FramePhase>(i);
+         const FramePhaseStats stats = phase_stats(phase);
+         logger.info("{0}: p50 {1}us, p95 {2}us, p99 {3}us, max {4}us over {5} frames", frame_phase_name(phase),
+                     stats.p50, stats.p95, stats.p99, stats.max, stats.frames);
+      }
+   }
+
+   void FrameStats::reset()
+   //----------------------
+   {
+      head.store(0, std::memory_order_release);
+      overBudget.store(0, std::memory_order_relaxed);
+      overBudgetLogged = 0;
+   }
+}
@@ -0,0 +1,454 @@
+#include <unordered_map>
+#include <unordered_set>
+#include <future>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <cgltf.h>
+
+#include "bulb/GltfAsset.hh"
+#include "bulb/MeshOptimizer.hh"
+#include "bulb/Managers.hh"
+#include "bulb/Trace.hh"
+#include "bulb/Log.hh"
+#include "bulb/ut.hh"
+
+namespace bulb
+{
+   std::string GltfAsset::decode_uri(const std::string& uri)
+   //-------------------------------------------------------
+   {
+      std::string decoded;
+      decoded.reserve(uri.size());
+      for (size_t i = 0; i < uri.size(); i++)
+      {
+         if ( (uri[i] == '%') && (i + 2 < uri.size()) && (std::isxdigit(static_cast<unsigned char>(uri[i+1]))) &&
+              (std::isxdigit(static_cast<unsigned char>(uri[i+2]))) )
+         {
+            decoded += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+         }
+         else
+            decoded += uri[i];
+      }
+      return decoded;
+   }
+
+   bool GltfAsset::read(const char* gltfPath, GltfSource& source, bool isOptimized)
+   //------------------------------------------------------------------------------
+   {
+      BULB_TRACE_SCOPE("GltfAsset::read", "gltf");
+      Log logger("GltfAsset::read");
+      AssetReader& reader = AssetReader::instance();
+      if (!reader.exists(gltfPath))
+      {
+         logger.error("{0} does not exist.", gltfPath);
+         return false;
+      }
+      if (reader.is_asset_dir(gltfPath))
+      {
+         logger.error("{0} is a directory but a gltf, glb or zip file was expected.", gltfPath);
+         return false;
+      }
+
+      std::string filepath(gltfPath),  assetsDir, assetName, ext;
+      auto p = filepath.rfind('/');
+#if defined (WIN32)
+      if (p == std::string::npos)
+            p = filepath.rfind('\\');
+#endif
+      if (p != std::string::npos)
+      {
+         assetsDir = filepath.substr(0, p);
+         assetName = filepath.substr(p+1);
+      }
+      else
+      {
+#if defined(__ANDROID__)
+         assetsDir = "/";
+#else
+         assetsDir = ".";
+#endif
+         assetName = filepath;
+      }
+      p = assetName.rfind('.');
+      ext = (p != std::string::npos) ? assetName.substr(p) : "";
+
+      // Zipped assets are decompressed into memory. The gltf/glb entry is located and the remaining entries
+      // supply its external resources, with names relative to the directory holding the gltf entry in the archive.
+      std::unordered_map<std::string, std::shared_ptr<AssetView>> zipEntries;
+      std::string zipDir;
+      std::shared_ptr<AssetView> data;
+      const bool isZip = (ext == ".zip");
+      if (isZip)
+      {
+#ifdef HAVE_LIBZIP
+         auto unzipStart = std::chrono::high_resolution_clock::now();
+         if (! unzip(gltfPath, zipEntries))
+         {
+            logger.error("Error decompressing {0}", gltfPath);
+            return false;
+         }
+         std::string gltfEntry;
+         for (const auto& pp : zipEntries)
+         {
+            const std::string& name = pp.first;
+            std::string::size_type dot = name.rfind('.');
+            std::string entryExt = (dot == std::string::npos) ? "" : name.substr(dot);
+            if ( ( (entryExt == ".gltf") || (entryExt == ".glb") ) &&
+                 ( (gltfEntry.empty()) || (std::count(name.begin(), name.end(), '/') <
+                                           std::count(gltfEntry.begin(), gltfEntry.end(), '/')) ) )
+               gltfEntry = name;
+         }
+         if (gltfEntry.empty())
+         {
+            logger.error("No gltf or glb file found in {0}", gltfPath);
+            return false;
+         }
+         data = zipEntries[gltfEntry];
+         zipEntries.erase(gltfEntry);
+         p = gltfEntry.rfind('/');
+         zipDir = (p == std::string::npos) ? "" : gltfEntry.substr(0, p + 1);
+         assetName = gltfEntry.substr(p == std::string::npos ? 0 : p + 1);
+         ext = assetName.substr(assetName.rfind('.'));
+         auto unzipEnd = std::chrono::high_resolution_clock::now();
+         logger.info("Decompressed {0} entries from {1} in {2}ms", zipEntries.size() + 1, gltfPath,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(unzipEnd - unzipStart).count());
+#else
+         logger.error("Cannot handle {0} due to not being compiled with libzip support.", gltfPath);
+         return false;
+#endif
+      }
+      else
+         data = reader.map_asset((assetsDir + "/" + assetName).c_str());
+      if ( (! data) || (data->empty()) )
+      {
+         logger.error("Error loading data from asset file {0}", gltfPath);
+         return false;
+      }
+      source.path = gltfPath;
+      source.name = assetName;
+      source.resourceDir = assetsDir;
+      source.isBinary = (ext == ".glb");
+      source.gltf = data;
+
+      // The JSON is parsed here only to find the URIs of the external buffers and images so they can be read
+      // (in parallel) ahead of the gltfio ResourceLoader, which would otherwise open files relative to the gltf
+      // and so would not see zip entries, asset packs or Android assets.
+      cgltf_options options;
+      std::memset(&options, 0, sizeof(options));
+      cgltf_data* parsed = nullptr;
+      if (cgltf_parse(&options, data->data(), data->size(), &parsed) != cgltf_result_success)
+      {
+         logger.error("Error parsing {0}", gltfPath);
+         return false;
+      }
+      std::vector<std::string> uris;
+      for (size_t i = 0; i < parsed->buffers_count; i++)
+         if (parsed->buffers[i].uri != nullptr)
+            uris.emplace_back(parsed->buffers[i].uri);
+      for (size_t i = 0; i < parsed->images_count; i++)
+         if (parsed->images[i].uri != nullptr)
+            uris.emplace_back(parsed->images[i].uri);
+      cgltf_free(parsed);
+
+      std::vector<std::pair<std::string, std::shared_future<std::shared_ptr<AssetView>>>> reads;
+      std::unordered_set<std::string> queued; // Read, or being read, by this call
+      for (const std::string& uri : uris)
+      {
+         if ( (uri.compare(0, 5, "data:") == 0) || (! queued.insert(uri).second) ||
+              (std::find_if(source.resources.begin(), source.resources.end(),
+                            [&uri](const GltfResource& r) -> bool { return (r.first == uri); }) !=
+               source.resources.end()) )
+            continue;
+         std::string name = decode_uri(uri);
+         if (isZip)
+         {
+            auto it = zipEntries.find(zipDir + name);
+            if (it == zipEntries.end())
+               logger.error("Resource {0} not found in {1}", name, gltfPath);
+            else
+               source.resources.emplace_back(uri, it->second);
+         }
+         else
+            reads.emplace_back(uri, reader.read_async((assetsDir + "/" + name).c_str()));
+      }
+      for (auto& read : reads)
+      {
+         std::shared_ptr<AssetView> view = read.second.get();
+         if (view)
+            source.resources.emplace_back(read.first, view);
+         else
+            logger.error("Error reading resource {0} for {1}", read.first, gltfPath);
+      }
+      MeshDecodeStats decodeStats;
+      if (! MeshOptimizer::decode_gltf(source, decodeStats))
+      {
+         logger.error("Error decoding EXT_meshopt_compression data in {0}", gltfPath);
+         return false;
+      }
+      if (decodeStats.streams > 0)
+         MeshOptimizer::log(gltfPath, decodeStats);
+      if (isOptimized)
+      {
+         MeshOptimizeStats stats;
+         if (MeshOptimizer::optimize_gltf(source, stats))
+            MeshOptimizer::log(gltfPath, stats);
+      }
+      return true;
+   }
+
+   std::shared_ptr<GltfAsset> GltfAsset::create(Managers& context, GltfSource& source, size_t instanceCount,
+                                                bool isAsync, gltfio::AssetLoader* loader)
+   //-------------------------------------------------------------------------------------------------------
+   {
+      BULB_TRACE_SCOPE("GltfAsset::create", "gltf");
+      Log logger("GltfAsset::create");
+      if ( (! source.gltf) || (source.gltf->empty()) )
+      {
+         logger.error("No gltf data for {0}", source.path);
+         return nullptr;
+      }
+      std::shared_ptr<GltfAsset> gltf(new GltfAsset);
+      gltf->managers = &context;
+      filament::Engine* engine = gltf->managers->engine.get();
+      gltf->path = source.path;
+      if (loader != nullptr)
+         gltf->loader = loader;
+      else
+      {
+         gltf->materials = gltfio::createMaterialGenerator(engine);
+         gltf->loader = gltfio::AssetLoader::create({engine, gltf->materials});
+      }
+      instanceCount = std::max(instanceCount, size_t(1));
+      auto loadStart = std::chrono::high_resolution_clock::now();
+      {
+         BULB_TRACE_SCOPE("gltf asset load", "gltf");
+         if (instanceCount > 1)
+         {
+            gltf->instances.resize(instanceCount, nullptr);
+            gltf->asset = gltf->loader->createInstancedAsset(source.gltf->bytes(),
+                                                             static_cast<uint32_t>(source.gltf->size()),
+                                                             gltf->instances.data(), instanceCount);
+         }
+         else if (source.isBinary)
+            gltf->asset = gltf->loader->createAssetFromBinary(source.gltf->bytes(), static_cast<uint32_t>(source.gltf->size()));
+         else
+            gltf->asset = gltf->loader->createAssetFromJson(source.gltf->bytes(), static_cast<uint32_t>(source.gltf->size()));
+      }
+      auto loadEnd = std::chrono::high_resolution_clock::now();
+      logger.info("GLTF load for {0} ({1} instances) took {2}ms", source.name, instanceCount,
+                  std::chrono::duration_cast<std::chrono::milliseconds>(loadEnd - loadStart).count());
+      source.gltf.reset();
+      if ((! gltf->asset) || (gltf->asset->getEntityCount() == 0))
+      {
+         logger.error("Error loading asset(s) from {0}", source.path);
+         return nullptr;
+      }
+      gltf->isUsed.resize(instanceCount, false);
+
+      gltf->resourceStart = std::chrono::high_resolution_clock::now();
+      {
+         BULB_TRACE_SCOPE("gltf resource load", "gltf");
+         utils::Path assetPath(source.resourceDir + "/" + source.name);
+         gltf->resourceLoader.reset(new gltfio::ResourceLoader({engine, assetPath.getParent(), true, false}));
+         for (GltfResource& resource : source.resources)
+            gltf->resourceLoader->addResourceData(resource.first.c_str(),
+                                                  AssetView::buffer_descriptor(resource.second));
+         source.resources.clear(); // The ResourceLoader holds the resources until it is destroyed
+         if (isAsync)
+         {
+            // Buffers are uploaded immediately while textures are decoded on the gltfio job threads and uploaded
+            // by update().
+            if (! gltf->resourceLoader->asyncBeginLoad(gltf->asset))
+            {
+               logger.error("Error loading resources from {0}", source.path);
+               gltf->resourceLoader.reset();
+            }
+         }
+         else if (! gltf->resourceLoader->loadResources(gltf->asset))
+            logger.error("Error loading resources from {0}", source.path);
+      }
+      if (! isAsync)
+         gltf->finish_resources(true);
+      return gltf;
+   }
+
+   GltfAsset::~GltfAsset()
+   //---------------------
+   {
+      if (resourceLoader)
+      {
+         resourceLoader->asyncCancelLoad();
+         finish_resources(true);
+      }
+      if ( (loader) && (asset) )
+         loader->destroyAsset(asset);
+      if (materials)
+      {
+         if (loader)
+            gltfio::AssetLoader::destroy(&loader);
+         materials->destroyMaterials();
+         delete materials;
+      }
+   }
+
+   bool GltfAsset::update()
+   //----------------------
+   {
+      if (! resourceLoader)
+         return true;
+      BULB_TRACE_SCOPE("GltfAsset::update", "gltf");
+      if (resourceFence == nullptr)
+      {
+         resourceLoader->asyncUpdateLoad();
+         if (resourceLoader->asyncGetLoadProgress() < 1.0f)
+            return false;
+      }
+      return finish_resources(false);
+   }
+
+   gltfio::Animator* GltfAsset::get_animator(int instance)
+   //-----------------------------------------------------
+   {
+      if ( (asset == nullptr) || (resourceLoader) || (instance < 0) || (static_cast<size_t>(instance) >= isUsed.size()) )
+         return nullptr;
+      return (instances.empty()) ? asset->getAnimator() : instances[instance]->getAnimator();
+   }
+
+   bool GltfAsset::finish_resources(bool isWait)
+   //-------------------------------------------
+   {
+      if (! resourceLoader)
+         return true;
+      BULB_TRACE_SCOPE("GltfAsset::finish_resources", "gltf");
+      filament::Engine* engine = managers->engine.get();
+      // Vertex, index and texture uploads may still reference the resource memory which is released along with
+      // the ResourceLoader, so it is only destroyed once a fence placed after the uploads has been passed.
+      if (resourceFence == nullptr)
+      {
+         if (asset)
+         {
+            // Animators are built from the source data, so must be created before it is released.
+            if (instances.empty())
+               asset->getAnimator();
+            for (gltfio::FilamentInstance* instance : instances)
+               instance->getAnimator();
+            asset->releaseSourceData();
+         }
+         resourceFence = engine->createFence();
+      }
+      if (isWait)
+         filament::Fence::waitAndDestroy(resourceFence);
+      else
+      {
+         if (resourceFence->wait(filament::Fence::Mode::FLUSH, 0) != filament::Fence::FenceStatus::CONDITION_SATISFIED)
+            return false;
+         engine->destroy(resourceFence);
+      }
+      resourceFence = nullptr;
+      resourceLoader.reset();
+      Log logger("GltfAsset::finish_resources");
+      logger.info("GLTF Resources load for {0} took {1}ms", path,
+                  std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() -
+                                                                        resourceStart).count());
+      return true;
+   }
+
+   std::vector<std::shared_ptr<GltfAsset>> GltfAsset::create_lods(Managers& context, const GltfSource& source,
+                                                                  const LodChain& chain, size_t instanceCount,
+                                                                  bool isAsync, gltfio::AssetLoader* loader)
+   //--------------------------------------------------------------------------------------------------------------
+   {
+      std::vector<std::shared_ptr<GltfAsset>> levels;
+      for (size_t level = 0; level < chain.level_count(); level++)
+      {
+         GltfSource lodSource;
+         std::vector<GltfIndexCount> counts;
+         size_t entityCount = 0;
+         if (! MeshOptimizer::make_gltf_lod(source, chain, level, lodSource, counts, entityCount))
+            break;
+         std::shared_ptr<GltfAsset> asset = create(context, lodSource, instanceCount, isAsync, loader);
+         if (! asset)
+            break;
+         asset->set_index_counts(counts, entityCount);
+         levels.push_back(asset);
+      }
+      return levels;
+   }
+
+   void GltfAsset::set_index_counts(const std::vector<GltfIndexCount>& counts, size_t entityCount)
+   //---------------------------------------------------------------------------------------------
+   {
+      if (counts.empty())
+         return;
+      filament::RenderableManager& rm = managers->renderManager;
+      const size_t n = std::max(instances.size(), size_t(1));
+      for (size_t i = 0; i < n; i++)
+      {
+         size_t count = 0;
+         const utils::Entity* entities = get_entities(static_cast<int>(i), count);
+         if (count != entityCount)
+         {
+            Log logger("GltfAsset::set_index_counts");
+            logger.warn("{0} has {1} entities, expected {2}. Index counts not set.", path, count, entityCount);
+            return;
+         }
+         for (const GltfIndexCount& c : counts)
+         {
+            utils::EntityInstance<filament::RenderableManager> renderable = rm.getInstance(entities[c.entity]);
+            if ( (renderable) && (c.primitive < rm.getPrimitiveCount(renderable)) )
+               rm.setGeometryAt(renderable, c.primitive, filament::RenderableManager::PrimitiveType::TRIANGLES, 0,
+                                c.count);
+         }
+      }
+   }
+
+   int GltfAsset::acquire_instance()
+   //-------------------------------
+   {
+      for (size_t i = 0; i < isUsed.size(); i++)
+      {
+         if (! isUsed[i])
+         {
+            isUsed[i] = true;
+            return static_cast<int>(i);
+         }
+      }
+      return -1;
+   }
+
+   void GltfAsset::release_instance(int instance)
+   //--------------------------------------------
+   {
+      if ( (instance >= 0) && (static_cast<size_t>(instance) < isUsed.size()) )
+         isUsed[instance] = false;
+   }
+
+   size_t GltfAsset::free_instances() const
+   //--------------------------------------
+   {
+      return static_cast<size_t>(std::count(isUsed.begin(), isUsed.end(), false));
+   }
+
+   utils::Entity GltfAsset::get_root(int instance) const
+   //---------------------------------------------------
+   {
+      if (instances.empty())
+         return asset->getRoot();
+      return instances[instance]->getRoot();
+   }
+
+   const utils::Entity* GltfAsset::get_entities(int instance, size_t& count) const
+   //-----------------------------------------------------------------------------
+   {
+      if (instances.empty())
+      {
+         count = asset->getEntityCount();
+         return asset->getEntities();
+      }
+      count = instances[instance]->getEntityCount();
+      return instances[instance]->getEntities();
+   }
+}
@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BULB_KEYFRAME_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BULB_KEYFRAME_NEON 1
+#endif
+
+#include "bulb/KeyframeTracks.hh"
+#include "bulb/ThreadPool.hh"
+#include "bulb/Log.hh"
+
+namespace bulb
+{
+   // Channels sampled per task and the minimum number of tracks before evaluation is split across the workers.
+   static constexpr size_t SAMPLE_BLOCK = 256;
+   static constexpr size_t PARALLEL_TRACKS = 1024;
+
+   // Four lane float vectors with the handful of operations the interpolation kernels need. ScalarLanes is portable
+   // and is the reference for SimdLanes, which uses SSE2 or NEON where available.
+   struct ScalarLanes
+   {
+      struct vfloat { float f[4]; };
+
+      template <typename F>
+      static inline vfloat map(vfloat a, vfloat b, F f)
+      {
+         return vfloat{ { f(a.f[0], b.f[0]), f(a.f[1], b.f[1]), f(a.f[2], b.f[2]), f(a.f[3], b.f[3]) } };
+      }
+      static inline vfloat load(const float* p) { return vfloat{ { p[0], p[1], p[2], p[3] } }; }
+      static inline void store(float* p, vfloat a) { std::copy(a.f, a.f + 4, p); }
+      static inline vfloat set(float f) { return vfloat{ { f, f, f, f } }; }
+      static inline vfloat add(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return x + y; }); }
+      static inline vfloat sub(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return x - y; }); }
+      static inline vfloat mul(vfloat a, vfloat b) { return map(a, b, [](float x, float y) { return x * y; }); }
+      static inline vfloat sign(vfloat a)
+      {
+         return map(a, a, [](float x, float) { return std::signbit(x) ? -0.0f : 0.0f; });
+      }
+      /** a with its sign flipped where sign is negative. */
+      static inline vfloat flip(vfloat a, vfloat sign)
+      {
+         return map(a, sign, [](float x, float s) { return std::signbit(s) ? -x : x; });
+      }
+      static inline vfloat abs(vfloat a) { return map(a, a, [](float x, float) { return std::fabs(x); }); }
+      static inline vfloat rsqrt(vfloat a) { return map(a, a, [](float x, float) { return 1.0f / std::sqrt(x); }); }
+   };
+
+#if defined(BULB_KEYFRAME_SSE2)
+   struct SimdLanes
+   {
+      using vfloat = __m128;
+      static inline vfloat load(const float* p) { return _mm_loadu_ps(p); }
+      static inline void store(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+      static inline vfloat set(float f) { return _mm_set1_ps(f); }
+      static inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+      static inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+      static inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+      static inline vfloat sign(vfloat a) { return _mm_and_ps(a, _mm_set1_ps(-0.0f)); }
+      static inline vfloat flip(vfloat a, vfloat sign) { return _mm_xor_ps(a, sign); }
+      static inline vfloat abs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+      static inline vfloat rsqrt(vfloat a) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a)); }
+   };
+#elif defined(BULB_KEYFRAME_NEON)
+   struct SimdLanes
+   {
+      using vfloat = float32x4_t;
+      static inline vfloat load(const float* p) { return vld1q_f32(p); }
+      static inline void store(float* p, vfloat a) { vst1q_f32(p, a); }
+      static inline vfloat set(float f) { return vdupq_n_f32(f); }
+      static inline vfloat add(vfloat a, vfloat b) { return vaddq_f32(a, b); }
+      static inline vfloat sub(vfloat a, vfloat b) { return vsubq_f32(a, b); }
+      static inline vfloat mul(vfloat a, vfloat b) { return vmulq_f32(a, b); }
+      static inline vfloat sign(vfloat a)
+      {
+         return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vdupq_n_u32(0x80000000u)));
+      }
+      static inline vfloat flip(vfloat a, vfloat sign)
+      {
+         return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(sign)));
+      }
+      static inline vfloat abs(vfloat a) { return vabsq_f32(a); }
+      static inline vfloat rsqrt(vfloat a)
+      {
+         // Estimate refined by two Newton-Raphson steps.
+         vfloat r = vrsqrteq_f32(a);
+         r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+         return vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+      }
+   };
+#else
+   using SimdLanes = ScalarLanes;
+#endif
+
+   /** result = from + (to - from) * alpha for each component of channels [first, last) (a multiple of 4 wide). */
+   template <typename V>
+   static void lerp_channels(const std::vector<float>* from, const std::vector<float>* to, const float* alpha,
+                             std::vector<float>* result, unsigned components, size_t first, size_t last)
+   //------------------------------------------------------------------------------------------------------------
+   {
+      using vfloat = typename V::vfloat;
+      for (size_t i = first; i < last; i += 4)
+      {
+         const vfloat t = V::load(alpha + i);
+         for (unsigned c = 0; c < components; c++)
+         {
+            const vfloat a = V::load(from[c].data() + i);
+            V::store(result[c].data() + i, V::add(a, V::mul(V::sub(V::load(to[c].data() + i), a), t)));
+         }
+      }
+   }
+
+   /**
+    * Quaternion slerp for channels [first, last), approximated as an nlerp with the interpolation parameter
+    * corrected by a polynomial in the cosine of the angle between the keys, which keeps the angular velocity close
+    * to constant (errors of a few 1e-4 radians) without trigonometric functions, so it vectorizes.
+    */
+   template <typename V>
+   static void slerp_channels(const std::vector<float>* from, const std::vector<float>* to, const float* alpha,
+                              std::vector<float>* result, size_t first, size_t last)
+   //-----------------------------------------------------------------------------------------------------------
+   {
+      using vfloat = typename V::vfloat;
+      const vfloat half = V::set(0.5f), one = V::set(1.0f);
+      for (size_t i = first; i < last; i += 4)
+      {
+         const vfloat ax = V::load(from[0].data() + i), ay = V::load(from[1].data() + i),
+                      az = V::load(from[2].data() + i), aw = V::load(from[3].data() + i);
+         vfloat bx = V::load(to[0].data() + i), by = V::load(to[1].data() + i),
+                bz = V::load(to[2].data() + i), bw = V::load(to[3].data() + i);
+         const vfloat cosine = V::add(V::add(V::mul(ax, bx), V::mul(ay, by)), V::add(V::mul(az, bz), V::mul(aw, bw)));
+         // Take the shortest path by negating the destination key if the keys are in opposite hemispheres.
+         const vfloat sign = V::sign(cosine);
+         bx = V::flip(bx, sign); by = V::flip(by, sign); bz = V::flip(bz, sign); bw = V::flip(bw, sign);
+         const vfloat d = V::abs(cosine);
+         const vfloat A = V::add(V::set(1.0904f), V::mul(d, V::add(V::set(-3.2452f),
+                                                                 V::mul(d, V::sub(V::set(3.55645f),
+                                                                                  V::mul(d, V::set(1.43519f)))))));
+         const vfloat B = V::add(V::set(0.848013f), V::mul(d, V::add(V::set(-1.06021f),
+                                                                   V::mul(d, V::set(0.215638f)))));
+         const vfloat t = V::load(alpha + i);
+         const vfloat tc = V::sub(t, half);
+         const vfloat k = V::add(V::mul(A, V::mul(tc, tc)), B);
+         const vfloat ot = V::add(t, V::mul(V::mul(t, tc), V::mul(V::sub(t, one), k)));
+         const vfloat rx = V::add(ax, V::mul(V::sub(bx, ax), ot)), ry = V::add(ay, V::mul(V::sub(by, ay), ot)),
+                      rz = V::add(az, V::mul(V::sub(bz, az), ot)), rw = V::add(aw, V::mul(V::sub(bw, aw), ot));
+         const vfloat n = V::rsqrt(V::add(V::add(V::mul(rx, rx), V::mul(ry, ry)),
+                                          V::add(V::mul(rz, rz), V::mul(rw, rw))));
+         V::store(result[0].data() + i, V::mul(rx, n));
+         V::store(result[1].data() + i, V::mul(ry, n));
+         V::store(result[2].data() + i, V::mul(rz, n));
+         V::store(result[3].data() + i, V::mul(rw, n));
+      }
+   }
+
+   /** Cubic Hermite spline between v0 (with out tangent b0) and v1 (with in tangent a1) over a span of duration. */
+   static inline float hermite(float v0, float b0, float v1, float a1, float duration, float s)
+   //------------------------------------------------------------------------------------------
+   {
+      const float s2 = s * s, s3 = s2 * s;
+      return (2*s3 - 3*s2 + 1) * v0 + (s3 - 2*s2 + s) * duration * b0 + (-2*s3 + 3*s2) * v1 +
+             (s3 - s2) * duration * a1;
+   }
+
+   KeyframeTracks::KeyframeTracks()
+   //------------------------------
+   {
+      channels[TRANSLATION].components = 3;
+      channels[ROTATION].components = 4;
+      channels[SCALE].components = 3;
+   }
+
+   int KeyframeTracks::add_track(AffineTransform* target, const KeyframeChannel& translation,
+                                 const KeyframeChannel& rotation, const KeyframeChannel& scale, bool isLooping)
+   //--------------------------------------------------------------------------------------------------------
+   {
+      Log logger("KeyframeTracks::add_track");
+      if ( (target == nullptr) || ( (translation.empty()) && (rotation.empty()) && (scale.empty()) ) )
+      {
+         logger.error("A track needs a target and at least one channel");
+         return -1;
+      }
+      const KeyframeChannel* sources[3] = { &translation, &rotation, &scale };
+      for (int kind = TRANSLATION; kind <= SCALE; kind++)
+      {
+         const KeyframeChannel& channel = *sources[kind];
+         const size_t valuesPerKey = (channel.interpolation == KeyframeInterpolation::CUBIC_SPLINE) ? 3 : 1;
+         if (channel.values.size() != channel.times.size() * channels[kind].components * valuesPerKey)
+         {
+            logger.error("Channel {0} of {1} has {2} values for {3} keys", kind, target->get_name(),
+                         channel.values.size(), channel.times.size());
+            return -1;
+         }
+         if (! std::is_sorted(channel.times.begin(), channel.times.end()))
+         {
+            logger.error("Channel {0} of {1} has decreasing key times", kind, target->get_name());
+            return -1;
+         }
+      }
+
+      const uint32_t index = static_cast<uint32_t>(tracks.size());
+      Track track{ target, 0.0f, isLooping, true, { -1, -1, -1 } };
+      for (int kind = TRANSLATION; kind <= SCALE; kind++)
+      {
+         const KeyframeChannel& channel = *sources[kind];
+         if (channel.empty())
+            continue;
+         ChannelSet& set = channels[kind];
+         track.channel[kind] = static_cast<int>(set.offset.size());
+         track.duration = std::max(track.duration, channel.times.back());
+         set.offset.push_back(static_cast<uint32_t>(set.times.size()));
+         set.count.push_back(static_cast<uint32_t>(channel.times.size()));
+         set.cursor.push_back(0);
+         set.track.push_back(index);
+         set.interpolation.push_back(channel.interpolation);
+         set.tangentOffset.push_back(static_cast<uint32_t>(set.tangents[0].size()));
+         set.times.insert(set.times.end(), channel.times.begin(), channel.times.end());
+         const bool isCubic = (channel.interpolation == KeyframeInterpolation::CUBIC_SPLINE);
+         const size_t stride = (isCubic) ? 3 * set.components : set.components;
+         for (size_t key = 0; key < channel.times.size(); key++)
+         {
+            const float* tangentIn = &channel.values[key * stride];
+            const float* value = (isCubic) ? tangentIn + set.components : tangentIn;
+            float scale = 1.0f;
+            if (kind == ROTATION)
+            {
+               const float length = std::sqrt(value[0]*value[0] + value[1]*value[1] + value[2]*value[2] +
+                                              value[3]*value[3]);
+               scale = (length > 0) ? 1.0f / length : 1.0f;
+            }
+            for (unsigned c = 0; c < set.components; c++)
+            {
+               set.values[c].push_back(value[c] * scale);
+               if (isCubic)
+               {
+                  set.tangents[c].push_back(tangentIn[c] * scale);
+                  set.tangents[c].push_back(value[set.components + c] * scale);
+               }
+            }
+         }
+         // Sampling arrays are padded so the kernels always process whole vectors.
+         const size_t padded = (set.offset.size() + 3) & ~size_t(3);
+         set.alpha.resize(padded, 0.0f);
+         for (unsigned c = 0; c < set.components; c++)
+         {
+            set.from[c].resize(padded, 0.0f);
+            set.to[c].resize(padded, 0.0f);
+            set.result[c].resize(padded, 0.0f);
+         }
+      }
+      tracks.push_back(track);
+      trackTimes.push_back(0.0f);
+      auto it = targetIndex.find(target);
+      if (it == targetIndex.end())
+      {
+         targetIndex.emplace(target, static_cast<uint32_t>(targetTracks.size()));
+         targetTracks.emplace_back(1, index);
+      }
+      else
+         targetTracks[it->second].push_back(index);
+      return static_cast<int>(index);
+   }
+
+   void KeyframeTracks::set_enabled(int track, bool isEnabled)
+   //---------------------------------------------------------
+   {
+      if ( (track >= 0) && (static_cast<size_t>(track) < tracks.size()) )
+         tracks[track].isEnabled = isEnabled;
+   }
+
+   float KeyframeTracks::duration(int track) const
+   //---------------------------------------------
+   {
+      return ( (track >= 0) && (static_cast<size_t>(track) < tracks.size()) ) ? tracks[track].duration : 0.0f;
+   }
+
+   void KeyframeTracks::clear()
+   //--------------------------
+   {
+      tracks.clear();
+      trackTimes.clear();
+      targetIndex.clear();
+      targetTracks.clear();
+      for (ChannelSet& set : channels)
+      {
+         const unsigned components = set.components;
+         set = ChannelSet();
+         set.components = components;
+      }
+   }
+
+   void KeyframeTracks::sample(ChannelSet& set, size_t first, size_t last)
+   //---------------------------------------------------------------------
+   {
+      const size_t n = set.offset.size();
+      for (size_t i = first; i < std::min(last, n); i++)
+      {
+         const Track& track = tracks[set.track[i]];
+         if (! track.isEnabled)
+            continue;
+         const float t = trackTimes[set.track[i]];
+         const float* times = set.times.data() + set.offset[i];
+         const uint32_t count = set.count[i];
+         // Keys are usually sampled in increasing time, so step forward from the previous key and only restart
+         // from the first key when time goes backwards (eg when a looping track wraps).
+         uint32_t cursor = set.cursor[i];
+         if ( (cursor >= count) || (times[cursor] > t) )
+            cursor = 0;
+         while ( (cursor + 1 < count) && (times[cursor + 1] <= t) )
+            cursor++;
+         set.cursor[i] = cursor;
+         const uint32_t key0 = set.offset[i] + cursor;
+         uint32_t key1 = key0;
+         float alpha = 0.0f, span = 0.0f;
+         if ( (cursor + 1 < count) && (set.interpolation[i] != KeyframeInterpolation::STEP) )
+         {
+            key1 = key0 + 1;
+            span = times[cursor + 1] - times[cursor];
+            alpha = (span > 0) ? std::min(std::max((t - times[cursor]) / span, 0.0f), 1.0f) : 0.0f;
+         }
+         if ( (set.interpolation[i] == KeyframeInterpolation::CUBIC_SPLINE) && (key1 != key0) )
+         {
+            // Evaluated here, leaving the kernel to pass it through (alpha 0) and normalize rotations.
+            const uint32_t tangent = set.tangentOffset[i] + 2 * cursor;
+            for (unsigned c = 0; c < set.components; c++)
+            {
+               const std::vector<float>& tangents = set.tangents[c];
+               set.from[c][i] = set.to[c][i] = hermite(set.values[c][key0], tangents[tangent + 1],
+                                                       set.values[c][key1], tangents[tangent + 2], span, alpha);
+            }
+            set.alpha[i] = 0.0f;
+            continue;
+         }
+         set.alpha[i] = alpha;
+         for (unsigned c = 0; c < set.components; c++)
+         {
+            set.from[c][i] = set.values[c][key0];
+            set.to[c][i] = set.values[c][key1];
+         }
+      }
+      last = std::min((last + 3) & ~size_t(3), set.alpha.size());
+      if ( (set.components == 4) && (isSimdEnabled) )
+         slerp_channels<SimdLanes>(set.from, set.to, set.alpha.data(), set.result, first, last);
+      else if (set.components == 4)
+         slerp_channels<ScalarLanes>(set.from, set.to, set.alpha.data(), set.result, first, last);
+      else if (isSimdEnabled)
+         lerp_channels<SimdLanes>(set.from, set.to, set.alpha.data(), set.result, set.components, first, last);
+      else
+         lerp_channels<ScalarLanes>(set.from, set.to, set.alpha.data(), set.result, set.components, first, last);
+   }
+
+   void KeyframeTracks::evaluate(double time)
+   //----------------------------------------
+   {
+      if (tracks.empty())
+         return;
+      for (size_t i = 0; i < tracks.size(); i++)
+      {
+         const Track& track = tracks[i];
+         double t = std::max(time, 0.0);
+         if ( (track.isLooping) && (track.duration > 0) )
+            t = std::fmod(t, static_cast<double>(track.duration));
+         trackTimes[i] = static_cast<float>(std::min(t, static_cast<double>(track.duration)));
+      }
+
+      const bool isParallel = (tracks.size() >= PARALLEL_TRACKS);
+      for (ChannelSet& set : channels)
+      {
+         const size_t n = set.offset.size();
+         if (n == 0)
+            continue;
+         if (isParallel)
+            ThreadPool::workers().parallel_for(0, (n + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK,
+                                               [this, &set](size_t first, size_t last)
+                                               {
+                                                  sample(set, first * SAMPLE_BLOCK, last * SAMPLE_BLOCK);
+                                               });
+         else
+            sample(set, 0, n);
+      }
+
+      // Split by target rather than by track, as tracks sharing a target (eg its translation and its rotation)
+      // update the same transform.
+      if (isParallel)
+         ThreadPool::workers().parallel_for(0, targetTracks.size(),
+                                            [this](size_t first, size_t last) { write(first, last); }, SAMPLE_BLOCK);
+      else
+         write(0, targetTracks.size());
+   }
+
+   void KeyframeTracks::write(size_t firstTarget, size_t lastTarget)
+   //---------------------------------------------------------------
+   {
+      const ChannelSet& translations = channels[TRANSLATION];
+      const ChannelSet& rotations = channels[ROTATION];
+      const ChannelSet& scales = channels[SCALE];
+      for (size_t target = firstTarget; target < lastTarget; target++)
+      {
+         for (uint32_t i : targetTracks[target])
+         {
+            const Track& track = tracks[i];
+            if (! track.isEnabled)
+               continue;
+            filament::math::double3 t, s;
+            filament::math::quat q;
+            int c = track.channel[TRANSLATION];
+            if (c >= 0)
+               t = filament::math::double3(translations.result[0][c], translations.result[1][c],
+                                           translations.result[2][c]);
+            if ( (c = track.channel[ROTATION]) >= 0)
+               q = filament::math::quat(rotations.result[3][c], rotations.result[0][c], rotations.result[1][c],
+                                        rotations.result[2][c]);
+            if ( (c = track.channel[SCALE]) >= 0)
+               s = filament::math::double3(scales.result[0][c], scales.result[1][c], scales.result[2][c]);
+            track.target->set_trs((track.channel[ROTATION] >= 0) ? &q : nullptr,
+                                  (track.channel[TRANSLATION] >= 0) ? &t : nullptr,
+                                  (track.channel[SCALE] >= 0) ? &s : nullptr);
+         }
+      }
+   }
+}
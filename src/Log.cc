@@ -0,0 +1,281 @@
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+
+#if defined(__ANDROID__)
+#include <android/log.h>
+#else
+#include <stdio.h>
+#endif
+
+#include "bulb/Log.hh"
+
+namespace bulb
+{
+   std::atomic<int> Log::runtimeLevel{static_cast<int>(LogLevel::DEBUG)};
+
+   static constexpr size_t LOG_RING_SLOTS = 128; // Per thread, a power of 2
+
+   // Single producer (the owning thread advances head) single consumer (the writer advances tail) ring.
+   struct LogRing
+   {
+      LogRecord records[LOG_RING_SLOTS];
+      std::atomic<size_t> head{0}, tail{0};
+   };
+
+   static void write_message(LogLevel level, const char* tag, const char* text, size_t size)
+   //---------------------------------------------------------------------------------------
+   {
+#if defined(__ANDROID__)
+      int priority;
+      switch (level)
+      {
+         case LogLevel::ERROR: priority = ANDROID_LOG_ERROR; break;
+         case LogLevel::WARN: priority = ANDROID_LOG_WARN; break;
+         case LogLevel::INFO: priority = ANDROID_LOG_INFO; break;
+         default: priority = ANDROID_LOG_DEBUG; break;
+      }
+      __android_log_print(priority, tag, "%.*s", static_cast<int>(size), text);
+#else
+      const char* name;
+      switch (level)
+      {
+         case LogLevel::ERROR: name = "ERROR"; break;
+         case LogLevel::WARN: name = "WARN"; break;
+         case LogLevel::INFO: name = "INFO"; break;
+         default: name = "DEBUG"; break;
+      }
+      fprintf((level >= LogLevel::WARN) ? stderr : stdout, "%s %s %.*s\n", name, tag, static_cast<int>(size), text);
+#endif
+   }
+
+   static void format_record(const LogRecord& record, fmt::memory_buffer& buf)
+   //-------------------------------------------------------------------------
+   {
+#if FMT_EXCEPTIONS
+      try
+      {
+         record.format(record.data, buf);
+      }
+      catch (const std::exception& e)
+      {
+         buf.resize(0);
+         fmt::format_to(buf, "Invalid log message: {}", e.what());
+      }
+#else
+      record.format(record.data, buf);
+#endif
+   }
+
+   class LogWriter
+   //=============
+   {
+   public:
+      // Never destroyed, as threads (eg ThreadPool workers joined by static destructors) may log during exit.
+      static LogWriter& instance()
+      {
+         static LogWriter* the_writer = new LogWriter();
+         return *the_writer;
+      }
+
+      LogWriter() : thread(&LogWriter::run, this) { std::atexit(&LogWriter::shutdown); }
+
+      LogRecord* reserve(LogLevel level, const std::string& tag)
+      //--------------------------------------------------------
+      {
+         if (isSynchronous.load(std::memory_order_relaxed))
+            return nullptr;
+         LogRing* threadRing = thread_ring();
+         if (threadRing == nullptr)
+            return nullptr;
+         LogRing& ring = *threadRing;
+         const size_t head = ring.head.load(std::memory_order_relaxed);
+         if (head - ring.tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS)
+            return nullptr;
+         LogRecord& record = ring.records[head & (LOG_RING_SLOTS - 1)];
+         record.level = level;
+         const size_t n = std::min(tag.size(), LogRecord::TAG_SIZE - 1);
+         std::memcpy(record.tag, tag.data(), n);
+         record.tag[n] = 0;
+         return &record;
+      }
+
+      void commit()
+      //-----------
+      {
+         LogRing& ring = *thread_ring();
+         ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+         // Pairs with the fence in run() (and shutdown) so either the writer sees the record or this thread sees
+         // that the writer is waiting (or stopped).
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if (isWaiting.load(std::memory_order_relaxed))
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            isPosted = true;
+            wake.notify_one();
+         }
+         else if (isStopped.load(std::memory_order_relaxed))
+            drain();
+      }
+
+      /** Writes every queued message (from any thread). */
+      void drain()
+      //----------
+      {
+         std::lock_guard<std::mutex> drainLock(drainMutex);
+         std::vector<std::shared_ptr<LogRing>> pending;
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = rings;
+         }
+         bool isWritten = false;
+         fmt::memory_buffer buf;
+         for (const std::shared_ptr<LogRing>& ring : pending)
+         {
+            size_t tail = ring->tail.load(std::memory_order_relaxed);
+            const size_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail != head; tail++)
+            {
+               const LogRecord& record = ring->records[tail & (LOG_RING_SLOTS - 1)];
+               buf.resize(0);
+               format_record(record, buf);
+               write_message(record.level, record.tag, buf.data(), buf.size());
+               isWritten = true;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+         }
+#if !defined(__ANDROID__)
+         if (isWritten)
+            fflush(stdout);
+#endif
+      }
+
+      std::atomic<bool> isSynchronous{false};
+
+   private:
+      std::mutex mutex, drainMutex;
+      std::condition_variable wake;
+      std::vector<std::shared_ptr<LogRing>> rings; // One per thread which has logged, until the thread exits
+      bool isStopping = false, isPosted = false; // Guarded by mutex
+      std::atomic<bool> isWaiting{false}, isStopped{false};
+      std::thread thread;
+
+      // Destroyed when its thread exits, writing the messages left in the thread's ring and then freeing it.
+      struct RingOwner
+      {
+         std::shared_ptr<LogRing> ring;
+
+         ~RingOwner()
+         {
+            isRingReleased = true;
+            if (ring)
+               LogWriter::instance().release_ring(ring);
+         }
+      };
+
+      // Set once the thread's RingOwner is destroyed, after which (eg from other thread_local destructors) the
+      // thread's messages are written synchronously.
+      static thread_local bool isRingReleased;
+
+      /** @return The calling thread's ring, created on first use, or nullptr if the thread is exiting. */
+      LogRing* thread_ring()
+      //--------------------
+      {
+         if (isRingReleased)
+            return nullptr;
+         static thread_local RingOwner owner;
+         if (! owner.ring)
+         {
+            owner.ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(mutex);
+            rings.push_back(owner.ring);
+         }
+         return owner.ring.get();
+      }
+
+      void release_ring(const std::shared_ptr<LogRing>& ring)
+      //-----------------------------------------------------
+      {
+         drain();
+         std::lock_guard<std::mutex> lock(mutex);
+         rings.erase(std::remove(rings.begin(), rings.end(), ring), rings.end());
+      }
+
+      bool is_pending_locked()
+      //----------------------
+      {
+         for (const std::shared_ptr<LogRing>& ring : rings)
+            if (ring->head.load(std::memory_order_relaxed) != ring->tail.load(std::memory_order_relaxed))
+               return true;
+         return false;
+      }
+
+      void run()
+      //--------
+      {
+         while (true)
+         {
+            drain();
+            std::unique_lock<std::mutex> lock(mutex);
+            isWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wake.wait(lock, [this] { return (isStopping) || (isPosted) || (is_pending_locked()); });
+            isWaiting.store(false, std::memory_order_relaxed);
+            isPosted = false;
+            if (isStopping)
+               return;
+         }
+      }
+
+      // Registered with atexit: stops the writer thread, after which messages are written synchronously.
+      static void shutdown()
+      //--------------------
+      {
+         LogWriter& writer = instance();
+         writer.isSynchronous.store(true);
+         writer.isStopped.store(true);
+         {
+            std::lock_guard<std::mutex> lock(writer.mutex);
+            writer.isStopping = true;
+         }
+         writer.wake.notify_one();
+         if (writer.thread.joinable())
+            writer.thread.join();
+         writer.drain();
+      }
+   };
+
+   thread_local bool LogWriter::isRingReleased = false;
+
+   LogRecord* Log::reserve(LogLevel level, const std::string& tag) { return LogWriter::instance().reserve(level, tag); }
+
+   void Log::commit() { LogWriter::instance().commit(); }
+
+   void Log::post(LogLevel level, const std::string& tag, const char* text, size_t size)
+   //-----------------------------------------------------------------------------------
+   {
+      LogWriter::instance().drain(); // Keeps the messages of this thread in order
+      write_message(level, tag.c_str(), text, size);
+   }
+
+   void Log::set_synchronous(bool isSynchronous)
+   //-------------------------------------------
+   {
+      LogWriter& writer = LogWriter::instance();
+      writer.isSynchronous.store(isSynchronous, std::memory_order_relaxed);
+      writer.drain();
+   }
+
+   void Log::flush()
+   //---------------
+   {
+      LogWriter::instance().drain();
+   }
+}
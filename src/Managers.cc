@@ -1,6 +1,115 @@
+#include <atomic>
+#include <algorithm>
+
 #include "bulb/Managers.hh"
+#include "bulb/MaterialCache.hh"
+#include "bulb/MaterialInstancePool.hh"
+#include "bulb/TextureLoader.hh"
+#include "bulb/ThreadPool.hh"
+#include "bulb/Log.hh"
 
 namespace bulb
 {
+   static std::atomic<bool> isEngineCreated{false};
+
+   EngineConfig& Managers::config()
+   //------------------------------
+   {
+      static EngineConfig the_config;
+      return the_config;
+   }
+
+   bool Managers::configure(const EngineConfig& engineConfig)
+   //--------------------------------------------------------
+   {
+      Log logger("Managers::configure");
+      if (isEngineCreated.load())
+      {
+         logger.error("The engine has already been created");
+         return false;
+      }
+      if (! ThreadPool::can_set_worker_count(engineConfig.bulbWorkerThreads))
+      {
+         logger.warn("ThreadPool::workers() has already been created with {0} threads", ThreadPool::workers().size());
+         return false;
+      }
+      if (! ThreadPool::can_set_io_worker_count(engineConfig.ioThreads))
+      {
+         logger.warn("ThreadPool::io_workers() has already been created with {0} threads",
+                     ThreadPool::io_workers().size());
+         return false;
+      }
+      // Only applied once all of it is known to be valid, so a rejected configuration changes nothing.
+      config() = engineConfig;
+      return (ThreadPool::set_worker_count(engineConfig.bulbWorkerThreads)) &&
+             (ThreadPool::set_io_worker_count(engineConfig.ioThreads));
+   }
+
+   static filament::Engine* create_engine(const EngineConfig& config)
+   //----------------------------------------------------------------
+   {
+      filament::Engine* engine = filament::Engine::create(config.backend, config.platform, config.sharedGLContext);
+      if (engine == nullptr)
+      {
+         Log logger("Managers");
+         logger.error("Error creating the filament engine");
+      }
+      return engine;
+   }
+
+   filament::Engine* Managers::create_default_engine()
+   //-------------------------------------------------
+   {
+      isEngineCreated.store(true);
+      return create_engine(config());
+   }
+
+   Managers& Managers::instance()
+   //----------------------------
+   {
+      static Managers the_instance(create_default_engine());
+      return the_instance;
+   }
+
+   std::shared_ptr<Managers> Managers::create(const EngineConfig& engineConfig)
+   //--------------------------------------------------------------------------
+   {
+      filament::Engine* engine = create_engine(engineConfig);
+      if (engine == nullptr)
+         return nullptr;
+      return std::shared_ptr<Managers>(new Managers(engine));
+   }
+
+   // The worker pool is referenced before the caches are created so that it is constructed before the default
+   // context and therefore destroyed after its TextureLoader.
+   Managers::Managers(filament::Engine* filamentEngine) :
+                          engine(filamentEngine, [](filament::Engine* p) { if (p) filament::Engine::destroy(&p); }),
+                          entityManager(utils::EntityManager::get()),
+                          transformManager(engine->getTransformManager()),
+                          renderManager(engine->getRenderableManager()),
+                          lightManager(engine->getLightManager())
+   //-------------------------------------------------------------------------------------------------------------
+   {
+      ThreadPool::workers();
+      materialInstances.reset(new MaterialInstancePool(*this));
+      materialCache.reset(new MaterialCache(*this));
+      textureLoader.reset(new TextureLoader(*this));
+   }
+
+   Managers::~Managers()
+   //-------------------
+   {
+      textureLoader.reset();
+      materialCache.reset();
+      materialInstances.reset();
+   }
 
-}
\ No newline at end of file
+   filament::SwapChain* Managers::create_swapchain(void* nativeWindow, uint32_t width, uint32_t height,
+                                                   uint64_t flags)
+   //-----------------------------------------------------------------------------------------------
+   {
+      if (nativeWindow != nullptr)
+         return engine->createSwapChain(nativeWindow, flags);
+      return engine->createSwapChain(std::max(width, 1u), std::max(height, 1u), flags);
+   }
+}
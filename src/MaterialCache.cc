@@ -0,0 +1,152 @@
+#include "bulb/MaterialCache.hh"
+#include "bulb/MaterialInstancePool.hh"
+#include "bulb/Managers.hh"
+#include "bulb/AssetReader.hh"
+#include "bulb/Trace.hh"
+#include "bulb/Log.hh"
+#include "bulb/ut.hh"
+
+namespace bulb
+{
+   MaterialCache::MaterialCache(Managers& context) : managers(context) {}
+
+   MaterialCache::~MaterialCache()
+   //-----------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      while (! materials.empty())
+         destroy_locked(materials.begin()->first);
+   }
+
+   filament::Material* MaterialCache::acquire(const char* path)
+   //----------------------------------------------------------
+   {
+      if (path == nullptr)
+         return nullptr;
+      std::string spath(path);
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = paths.find(spath);
+      if (it != paths.end())
+      {
+         auto mit = materials.find(it->second);
+         if (mit != materials.end())
+         {
+            mit->second.references++;
+            return mit->second.material;
+         }
+         paths.erase(it);
+      }
+      std::shared_ptr<AssetView> data = AssetReader::instance().map_asset(path);
+      if ( (! data) || (data->empty()) )
+      {
+         Log logger("MaterialCache::acquire");
+         logger.error("Error reading material package {0}", path);
+         return nullptr;
+      }
+      uint64_t key = hash64(data->data(), data->size());
+      filament::Material* material = acquire_locked(key, data->data(), data->size());
+      if (material != nullptr)
+         paths[spath] = key;
+      return material;
+   }
+
+   filament::Material* MaterialCache::acquire(const void* data, size_t size)
+   //-----------------------------------------------------------------------
+   {
+      if ( (data == nullptr) || (size == 0) )
+         return nullptr;
+      uint64_t key = hash64(data, size);
+      std::lock_guard<std::mutex> lock(mtx);
+      return acquire_locked(key, data, size);
+   }
+
+   filament::Material* MaterialCache::acquire_locked(uint64_t key, const void* data, size_t size)
+   //--------------------------------------------------------------------------------------------
+   {
+      auto it = materials.find(key);
+      if (it != materials.end())
+      {
+         it->second.references++;
+         return it->second.material;
+      }
+      filament::Engine* engine = managers.engine.get();
+      if (engine == nullptr)
+         return nullptr;
+      BULB_TRACE_SCOPE("material build");
+      filament::Material* material = filament::Material::Builder().package(data, size).build(*engine);
+      if (material == nullptr)
+      {
+         Log logger("MaterialCache::acquire");
+         logger.error("Error building material from package of {0} bytes", size);
+         return nullptr;
+      }
+      materials.emplace(key, Entry{material, 1});
+      hashes[material] = key;
+      return material;
+   }
+
+   bool MaterialCache::retain(const filament::Material* material)
+   //------------------------------------------------------------
+   {
+      if (material == nullptr)
+         return false;
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = hashes.find(material);
+      if (it == hashes.end())
+         return false;
+      materials[it->second].references++;
+      return true;
+   }
+
+   bool MaterialCache::release(const filament::Material* material)
+   //-------------------------------------------------------------
+   {
+      if (material == nullptr)
+         return false;
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = hashes.find(material);
+      if (it == hashes.end())
+         return false;
+      uint64_t key = it->second;
+      Entry& entry = materials[key];
+      if ( (entry.references == 0) || (--entry.references == 0) )
+         destroy_locked(key);
+      return true;
+   }
+
+   void MaterialCache::destroy_locked(uint64_t key)
+   //----------------------------------------------
+   {
+      auto it = materials.find(key);
+      if (it == materials.end())
+         return;
+      filament::Material* material = it->second.material;
+      materials.erase(it);
+      hashes.erase(material);
+      for (auto pit = paths.begin(); pit != paths.end();)
+      {
+         if (pit->second == key)
+            pit = paths.erase(pit);
+         else
+            ++pit;
+      }
+      managers.material_instances().purge(material);
+      filament::Engine* engine = managers.engine.get();
+      if (engine != nullptr)
+         engine->destroy(material);
+   }
+
+   bool MaterialCache::contains(const filament::Material* material)
+   //--------------------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      return hashes.find(material) != hashes.end();
+   }
+
+   size_t MaterialCache::size()
+   //--------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      return materials.size();
+   }
+}
@@ -0,0 +1,158 @@
+#include "bulb/MaterialInstancePool.hh"
+#include "bulb/Managers.hh"
+
+namespace bulb
+{
+   MaterialInstancePool::MaterialInstancePool(Managers& context) : managers(context) {}
+
+   MaterialInstancePool::~MaterialInstancePool() { clear(); }
+
+   filament::MaterialInstance* MaterialInstancePool::acquire(filament::Material* material)
+   //-------------------------------------------------------------------------------------
+   {
+      if (material == nullptr)
+         return nullptr;
+      std::lock_guard<std::mutex> lock(mtx);
+      std::vector<Slot>& materialSlots = slots[material];
+      for (Slot& slot : materialSlots)
+      {
+         if (! slot.inUse)
+         {
+            slot.inUse = true;
+            return slot.instance;
+         }
+      }
+      filament::MaterialInstance* instance = material->createInstance();
+      if (instance != nullptr)
+         materialSlots.push_back(Slot{instance, true, {}});
+      return instance;
+   }
+
+   void MaterialInstancePool::release(filament::MaterialInstance* instance, bool isModified)
+   //---------------------------------------------------------------------------------------
+   {
+      if (instance == nullptr)
+         return;
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = slots.find(instance->getMaterial());
+      if (it == slots.end())
+         return;
+      std::vector<Slot>& materialSlots = it->second;
+      auto sit = std::find_if(materialSlots.begin(), materialSlots.end(),
+                              [instance](const Slot& slot) -> bool { return slot.instance == instance; });
+      if (sit == materialSlots.end())
+         return;
+      if (isModified)
+      {
+         filament::Engine* engine = managers.engine.get();
+         if (engine != nullptr)
+            engine->destroy(instance);
+         materialSlots.erase(sit);
+      }
+      else
+      {
+         sit->inUse = false;
+         sit->overrides.clear();
+      }
+   }
+
+   MaterialInstancePool::Slot* MaterialInstancePool::find_locked(filament::MaterialInstance* instance)
+   //-------------------------------------------------------------------------------------------------
+   {
+      if (instance == nullptr)
+         return nullptr;
+      auto it = slots.find(instance->getMaterial());
+      if (it == slots.end())
+         return nullptr;
+      for (Slot& slot : it->second)
+      {
+         if (slot.instance == instance)
+            return &slot;
+      }
+      return nullptr;
+   }
+
+   void MaterialInstancePool::set_override(filament::MaterialInstance* instance, const std::string& param)
+   //-----------------------------------------------------------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      Slot* slot = find_locked(instance);
+      if ( (slot != nullptr) && (slot->inUse) )
+         slot->overrides.insert(param);
+   }
+
+   void MaterialInstancePool::clear_overrides(filament::MaterialInstance* instance)
+   //------------------------------------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      Slot* slot = find_locked(instance);
+      if (slot != nullptr)
+         slot->overrides.clear();
+   }
+
+   void MaterialInstancePool::update_instances(const filament::Material* material, const std::string& param,
+                                               const std::function<void(filament::MaterialInstance*)>& f)
+   //---------------------------------------------------------------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = slots.find(material);
+      if (it == slots.end())
+         return;
+      for (Slot& slot : it->second)
+      {
+         if ( (slot.inUse) && (slot.overrides.count(param) > 0) )
+            continue;
+         f(slot.instance);
+      }
+   }
+
+   void MaterialInstancePool::purge(const filament::Material* material)
+   //------------------------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = slots.find(material);
+      if (it == slots.end())
+         return;
+      filament::Engine* engine = managers.engine.get();
+      std::vector<Slot>& materialSlots = it->second;
+      for (auto sit = materialSlots.begin(); sit != materialSlots.end();)
+      {
+         if (! sit->inUse)
+         {
+            if (engine != nullptr)
+               engine->destroy(sit->instance);
+            sit = materialSlots.erase(sit);
+         }
+         else
+            ++sit;
+      }
+      if (materialSlots.empty())
+         slots.erase(it);
+   }
+
+   void MaterialInstancePool::clear()
+   //--------------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      filament::Engine* engine = managers.engine.get();
+      for (auto it = slots.begin(); it != slots.end();)
+      {
+         std::vector<Slot>& materialSlots = it->second;
+         for (auto sit = materialSlots.begin(); sit != materialSlots.end();)
+         {
+            if (! sit->inUse)
+            {
+               if (engine != nullptr)
+                  engine->destroy(sit->instance);
+               sit = materialSlots.erase(sit);
+            }
+            else
+               ++sit;
+         }
+         if (materialSlots.empty())
+            it = slots.erase(it);
+         else
+            ++it;
+      }
+   }
+}
@@ -0,0 +1,1585 @@
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+
+#include <meshoptimizer.h>
+#include <cgltf.h>
+
+#include "bulb/MeshOptimizer.hh"
+#include "bulb/GltfAsset.hh"
+#include "bulb/ThreadPool.hh"
+#include "bulb/ut.hh"
+#include "bulb/Log.hh"
+
+namespace bulb
+{
+   // filamesh layout as written by the filament filamesh tool and read by filameshio::MeshReader:
+   // "FILAMESH", FilameshHeader, vertices, indices, FilameshPart[parts], material names.
+   static constexpr size_t FILAMESH_MAGIC_SIZE = 8;
+   static constexpr uint32_t FILAMESH_INTERLEAVED = 0x1;
+   static constexpr uint32_t FILAMESH_COMPRESSION = 0x4;
+   static constexpr uint32_t FILAMESH_UI32 = 0, FILAMESH_UI16 = 1;
+
+   struct FilameshBox
+   {
+      float center[3];
+      float halfExtent[3];
+   };
+
+   struct FilameshHeader
+   {
+      uint32_t version;
+      uint32_t parts;
+      FilameshBox aabb;
+      uint32_t flags;
+      uint32_t offsetPosition;
+      uint32_t stridePosition;
+      uint32_t offsetTangents;
+      uint32_t strideTangents;
+      uint32_t offsetColor;
+      uint32_t strideColor;
+      uint32_t offsetUV0;
+      uint32_t strideUV0;
+      uint32_t offsetUV1;
+      uint32_t strideUV1;
+      uint32_t vertexCount;
+      uint32_t vertexSize;
+      uint32_t indexType;
+      uint32_t indexCount;
+      uint32_t indexSize;
+   };
+
+   struct FilameshPart
+   {
+      uint32_t offset;
+      uint32_t indexCount;
+      uint32_t minIndex;
+      uint32_t maxIndex;
+      uint32_t materialID;
+      FilameshBox aabb;
+   };
+
+   static float half_to_float(uint16_t h)
+   //------------------------------------
+   {
+      uint32_t sign = uint32_t(h & 0x8000) << 16;
+      uint32_t exponent = (h >> 10) & 0x1F;
+      uint32_t mantissa = h & 0x3FF;
+      uint32_t bits;
+      if (exponent == 0)
+      {
+         if (mantissa == 0)
+            bits = sign;
+         else
+         {  // Subnormal, renormalize
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0)
+            {
+               mantissa <<= 1;
+               exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+         }
+      }
+      else if (exponent == 0x1F)
+         bits = sign | 0x7F800000 | (mantissa << 13);
+      else
+         bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+      float f;
+      std::memcpy(&f, &bits, sizeof(float));
+      return f;
+   }
+
+   /** Reads and validates the header and parts of an uncompressed filamesh. */
+   static bool read_filamesh(const AssetView& filamesh, FilameshHeader& header, std::vector<FilameshPart>& parts)
+   //-----------------------------------------------------------------------------------------------------------
+   {
+      const size_t size = filamesh.size();
+      if ( (size < FILAMESH_MAGIC_SIZE + sizeof(FilameshHeader)) ||
+           (std::memcmp(filamesh.data(), "FILAMESH", FILAMESH_MAGIC_SIZE) != 0) )
+         return false;
+      std::memcpy(&header, filamesh.bytes() + FILAMESH_MAGIC_SIZE, sizeof(FilameshHeader));
+      const size_t indexStride = (header.indexType == FILAMESH_UI16) ? sizeof(uint16_t) : sizeof(uint32_t);
+      const size_t partsOffset = FILAMESH_MAGIC_SIZE + sizeof(FilameshHeader) + size_t(header.vertexSize) +
+                                 header.indexSize;
+      if ( (header.flags & FILAMESH_COMPRESSION) || (header.vertexCount == 0) ||
+           (partsOffset + size_t(header.parts) * sizeof(FilameshPart) > size) ||
+           ( (header.indexType != FILAMESH_UI16) && (header.indexType != FILAMESH_UI32) ) ||
+           (size_t(header.indexCount) * indexStride != header.indexSize) )
+         return false;
+      parts.resize(header.parts);
+      std::memcpy(parts.data(), filamesh.bytes() + partsOffset, parts.size() * sizeof(FilameshPart));
+      for (const FilameshPart& part : parts)
+         if (size_t(part.offset) + part.indexCount > header.indexCount)
+            return false;
+      return true;
+   }
+
+   static bool filamesh_indices(const AssetView& filamesh, const FilameshHeader& header, std::vector<uint32_t>& indices)
+   //------------------------------------------------------------------------------------------------------------------
+   {
+      indices.resize(header.indexCount);
+      const uint8_t* indexData = filamesh.bytes() + FILAMESH_MAGIC_SIZE + sizeof(FilameshHeader) + header.vertexSize;
+      if (header.indexType == FILAMESH_UI16)
+      {
+         const uint16_t* p = reinterpret_cast<const uint16_t*>(indexData);
+         std::copy(p, p + header.indexCount, indices.begin());
+      }
+      else
+         std::memcpy(indices.data(), indexData, header.indexSize);
+      for (uint32_t index : indices)
+      {
+         if (index >= header.vertexCount)
+         {
+            Log logger("MeshOptimizer");
+            logger.error("Filamesh index {0} out of range", index);
+            return false;
+         }
+      }
+      return true;
+   }
+
+   /** Expands the half4 filamesh positions to float3. */
+   static bool filamesh_positions(const AssetView& filamesh, const FilameshHeader& header, std::vector<float>& positions)
+   //-------------------------------------------------------------------------------------------------------------------
+   {
+      if ( (header.stridePosition < 3 * sizeof(uint16_t)) ||
+           (header.offsetPosition + size_t(header.stridePosition) * (header.vertexCount - 1) + 3 * sizeof(uint16_t) >
+            header.vertexSize) )
+         return false;
+      const uint8_t* vertices = filamesh.bytes() + FILAMESH_MAGIC_SIZE + sizeof(FilameshHeader);
+      positions.resize(size_t(header.vertexCount) * 3);
+      for (uint32_t v = 0; v < header.vertexCount; v++)
+      {
+         const uint8_t* p = vertices + header.offsetPosition + size_t(v) * header.stridePosition;
+         for (int c = 0; c < 3; c++)
+         {
+            uint16_t h;
+            std::memcpy(&h, p + c * sizeof(uint16_t), sizeof(uint16_t));
+            positions[v * 3 + c] = half_to_float(h);
+         }
+      }
+      return true;
+   }
+
+   static double acmr(const std::vector<uint32_t>& indices, size_t first, size_t count, size_t vertexCount)
+   //-----------------------------------------------------------------------------------------------------
+   {
+      if (count < 3)
+         return 0;
+      return meshopt_analyzeVertexCache(indices.data() + first, count, vertexCount, 16, 0, 0).acmr;
+   }
+
+   void MeshOptimizer::optimize_triangles(uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                          const float* positions, size_t positionStride, float overdrawThreshold)
+   //--------------------------------------------------------------------------------------------------------------
+   {
+      if (indexCount < 3)
+         return;
+      std::vector<uint32_t> reordered(indexCount);
+      meshopt_optimizeVertexCache(reordered.data(), indices, indexCount, vertexCount);
+      if (positions != nullptr)
+         meshopt_optimizeOverdraw(indices, reordered.data(), indexCount, positions, vertexCount, positionStride,
+                                  overdrawThreshold);
+      else
+         std::memcpy(indices, reordered.data(), indexCount * sizeof(uint32_t));
+   }
+
+   std::shared_ptr<AssetView> MeshOptimizer::optimize_filamesh(const std::shared_ptr<AssetView>& filamesh,
+                                                               MeshOptimizeStats& stats)
+   //-----------------------------------------------------------------------------------------------------
+   {
+      FilameshHeader header;
+      std::vector<FilameshPart> parts;
+      if ( (! filamesh) || (! read_filamesh(*filamesh, header, parts)) )
+      {
+         stats.skipped++;
+         return filamesh;
+      }
+      const size_t size = filamesh->size();
+      const size_t vertexOffset = FILAMESH_MAGIC_SIZE + sizeof(FilameshHeader);
+      const size_t partsEnd = vertexOffset + header.vertexSize + header.indexSize + parts.size() * sizeof(FilameshPart);
+
+      struct Stream
+      {
+         uint32_t* offset;
+         uint32_t stride;
+      };
+      std::vector<Stream> streams;
+      for (auto stream : { Stream{&header.offsetPosition, header.stridePosition},
+                           Stream{&header.offsetTangents, header.strideTangents},
+                           Stream{&header.offsetColor, header.strideColor},
+                           Stream{&header.offsetUV0, header.strideUV0},
+                           Stream{&header.offsetUV1, header.strideUV1} })
+      {
+         if ( (*stream.offset != std::numeric_limits<uint32_t>::max()) && (stream.stride > 0) )
+            streams.push_back(stream);
+      }
+      const bool isInterleaved = ( (header.flags & FILAMESH_INTERLEAVED) != 0 );
+      const uint32_t vertexStride = (isInterleaved) ? header.stridePosition : 0;
+      if ( (streams.empty()) ||
+           ( (isInterleaved) && (size_t(vertexStride) * header.vertexCount != header.vertexSize) ) )
+      {
+         stats.skipped++;
+         return filamesh;
+      }
+      const uint8_t* vertices = filamesh->bytes() + vertexOffset;
+      for (const Stream& stream : streams)
+      {
+         size_t end = (isInterleaved) ? header.vertexSize
+                                      : *stream.offset + size_t(stream.stride) * header.vertexCount;
+         if (end > header.vertexSize)
+         {
+            stats.skipped++;
+            return filamesh;
+         }
+      }
+
+      std::vector<uint32_t> indices;
+      std::vector<float> positions; // Half4 expanded to float3 for the overdraw optimizer
+      if ( (! filamesh_indices(*filamesh, header, indices)) || (! filamesh_positions(*filamesh, header, positions)) )
+      {
+         stats.skipped++;
+         return filamesh;
+      }
+
+      MeshOptimizeStats meshStats;
+      meshStats.vertexBytesBefore = header.vertexSize;
+      meshStats.indexBytesBefore = header.indexSize;
+      for (const FilameshPart& part : parts)
+      {
+         const size_t triangles = part.indexCount / 3;
+         meshStats.acmrBefore += acmr(indices, part.offset, part.indexCount, header.vertexCount) * triangles;
+         optimize_triangles(indices.data() + part.offset, part.indexCount, header.vertexCount, positions.data());
+         meshStats.triangles += triangles;
+         meshStats.primitives++;
+      }
+
+      std::vector<uint32_t> remap(header.vertexCount);
+      const size_t uniqueCount = meshopt_optimizeVertexFetchRemap(remap.data(), indices.data(), indices.size(),
+                                                                  header.vertexCount);
+      meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+
+      const size_t newVertexSize = (isInterleaved) ? uniqueCount * vertexStride
+                                                   : [&streams, uniqueCount]()
+                                                     {
+                                                        size_t n = 0;
+                                                        for (const Stream& stream : streams)
+                                                           n += uniqueCount * stream.stride;
+                                                        return n;
+                                                     }();
+      const bool isNarrowed = fits_short_indices(uniqueCount);
+      const size_t newIndexStride = (isNarrowed) ? sizeof(uint16_t) : sizeof(uint32_t);
+      const size_t newIndexSize = indices.size() * newIndexStride;
+      const size_t tailSize = size - partsEnd;
+      const size_t newSize = vertexOffset + newVertexSize + newIndexSize + parts.size() * sizeof(FilameshPart) + tailSize;
+      uint8_t* buffer = new uint8_t[newSize];
+      uint8_t* newVertices = buffer + vertexOffset;
+      if (isInterleaved)
+         meshopt_remapVertexBuffer(newVertices, vertices, header.vertexCount, vertexStride, remap.data());
+      else
+      {  // Separate arrays are packed in their original order
+         std::vector<Stream> ordered(streams);
+         std::sort(ordered.begin(), ordered.end(), [](const Stream& a, const Stream& b) { return (*a.offset < *b.offset); });
+         uint32_t offset = 0;
+         for (Stream& stream : ordered)
+         {
+            meshopt_remapVertexBuffer(newVertices + offset, vertices + *stream.offset, header.vertexCount,
+                                      stream.stride, remap.data());
+            *stream.offset = offset;
+            offset += static_cast<uint32_t>(uniqueCount * stream.stride);
+         }
+      }
+
+      uint8_t* newIndices = newVertices + newVertexSize;
+      if (isNarrowed)
+      {
+         uint16_t* p = reinterpret_cast<uint16_t*>(newIndices);
+         for (size_t i = 0; i < indices.size(); i++)
+            p[i] = static_cast<uint16_t>(indices[i]);
+      }
+      else
+         std::memcpy(newIndices, indices.data(), newIndexSize);
+      for (FilameshPart& part : parts)
+      {
+         if (part.indexCount == 0)
+            continue;
+         auto range = std::minmax_element(indices.begin() + part.offset, indices.begin() + part.offset + part.indexCount);
+         part.minIndex = *range.first;
+         part.maxIndex = *range.second;
+         meshStats.acmrAfter += acmr(indices, part.offset, part.indexCount, uniqueCount) * (part.indexCount / 3);
+      }
+      std::memcpy(newIndices + newIndexSize, parts.data(), parts.size() * sizeof(FilameshPart));
+      std::memcpy(newIndices + newIndexSize + parts.size() * sizeof(FilameshPart), filamesh->bytes() + partsEnd, tailSize);
+
+      header.vertexCount = static_cast<uint32_t>(uniqueCount);
+      header.vertexSize = static_cast<uint32_t>(newVertexSize);
+      header.indexType = (isNarrowed) ? FILAMESH_UI16 : FILAMESH_UI32;
+      header.indexSize = static_cast<uint32_t>(newIndexSize);
+      std::memcpy(buffer, filamesh->data(), FILAMESH_MAGIC_SIZE);
+      std::memcpy(buffer + FILAMESH_MAGIC_SIZE, &header, sizeof(FilameshHeader));
+
+      meshStats.vertexBytesAfter = newVertexSize;
+      meshStats.indexBytesAfter = newIndexSize;
+      stats.vertexBytesBefore += meshStats.vertexBytesBefore;
+      stats.vertexBytesAfter += meshStats.vertexBytesAfter;
+      stats.indexBytesBefore += meshStats.indexBytesBefore;
+      stats.indexBytesAfter += meshStats.indexBytesAfter;
+      stats.primitives += meshStats.primitives;
+      stats.triangles += meshStats.triangles;
+      stats.acmrBefore += meshStats.acmrBefore;
+      stats.acmrAfter += meshStats.acmrAfter;
+      return AssetReader::make_view(buffer, newSize,
+                                    [](const void* p, size_t) { delete[] static_cast<const uint8_t*>(p); });
+   }
+
+   static size_t element_size(const cgltf_accessor* accessor)
+   //--------------------------------------------------------
+   {
+      size_t components, bytes;
+      switch (accessor->type)
+      {
+         case cgltf_type_scalar: components = 1; break;
+         case cgltf_type_vec2: components = 2; break;
+         case cgltf_type_vec3: components = 3; break;
+         case cgltf_type_vec4: components = 4; break;
+         default: return 0;
+      }
+      switch (accessor->component_type)
+      {
+         case cgltf_component_type_r_8:
+         case cgltf_component_type_r_8u: bytes = 1; break;
+         case cgltf_component_type_r_16:
+         case cgltf_component_type_r_16u: bytes = 2; break;
+         case cgltf_component_type_r_32u:
+         case cgltf_component_type_r_32f: bytes = 4; break;
+         default: return 0;
+      }
+      return components * bytes;
+   }
+
+   static cgltf_data* parse_gltf(const GltfSource& source)
+   //-----------------------------------------------------
+   {
+      if ( (! source.gltf) || (source.gltf->empty()) )
+         return nullptr;
+      cgltf_options options;
+      std::memset(&options, 0, sizeof(options));
+      cgltf_data* parsed = nullptr;
+      if (cgltf_parse(&options, source.gltf->data(), source.gltf->size(), &parsed) != cgltf_result_success)
+      {
+         Log logger("MeshOptimizer");
+         logger.error("Error parsing {0}", source.path);
+         return nullptr;
+      }
+      return parsed;
+   }
+
+   struct GltfBuffer
+   {
+      std::shared_ptr<AssetView> contents;
+      size_t offset = 0;           // Of the buffer within contents (the glb binary chunk)
+      size_t resource = SIZE_MAX;  // Index in GltfSource::resources or SIZE_MAX for the glb binary chunk
+      uint8_t* copy = nullptr;     // Writable copy of contents
+   };
+
+   /** Locates the contents of the buffers of parsed in source (buffers not found or too short have no contents). */
+   static std::vector<GltfBuffer> gltf_buffers(const GltfSource& source, const cgltf_data* parsed)
+   //---------------------------------------------------------------------------------------------
+   {
+      std::vector<GltfBuffer> buffers(parsed->buffers_count);
+      for (size_t i = 0; i < parsed->buffers_count; i++)
+      {
+         GltfBuffer& buffer = buffers[i];
+         if (parsed->buffers[i].uri != nullptr)
+         {
+            std::string uri(parsed->buffers[i].uri);
+            auto it = std::find_if(source.resources.begin(), source.resources.end(),
+                                   [&uri](const GltfResource& r) -> bool { return (r.first == uri); });
+            if (it != source.resources.end())
+            {
+               buffer.contents = it->second;
+               buffer.resource = static_cast<size_t>(it - source.resources.begin());
+            }
+         }
+         else if (parsed->bin != nullptr)
+         {
+            buffer.contents = source.gltf;
+            buffer.offset = static_cast<const uint8_t*>(parsed->bin) - source.gltf->bytes();
+         }
+         if ( (buffer.contents) && (buffer.offset + parsed->buffers[i].size > buffer.contents->size()) )
+            buffer.contents.reset();
+      }
+      return buffers;
+   }
+
+   /** @return The buffer holding all of accessor or nullptr if accessor is out of bounds or has an unknown type. */
+   static GltfBuffer* gltf_accessor_buffer(std::vector<GltfBuffer>& buffers, const cgltf_data* parsed,
+                                           const cgltf_accessor* accessor)
+   //-----------------------------------------------------------------------------------------------------
+   {
+      if ( (accessor == nullptr) || (accessor->buffer_view == nullptr) || (accessor->buffer_view->buffer == nullptr) )
+         return nullptr;
+      GltfBuffer* buffer = &buffers[accessor->buffer_view->buffer - parsed->buffers];
+      if (! buffer->contents)
+         return nullptr;
+      size_t elementSize = element_size(accessor);
+      size_t end = accessor->buffer_view->offset + accessor->offset +
+                   ( (accessor->count > 0) ? (accessor->count - 1) * accessor->stride + elementSize : 0 );
+      if ( (elementSize == 0) || (end > accessor->buffer_view->buffer->size) )
+         return nullptr;
+      return buffer;
+   }
+
+   static const uint8_t* gltf_accessor_data(const GltfBuffer& buffer, const cgltf_accessor* accessor)
+   //-------------------------------------------------------------------------------------------------
+   {
+      const uint8_t* base = (buffer.copy != nullptr) ? buffer.copy : buffer.contents->bytes();
+      return base + buffer.offset + accessor->buffer_view->offset + accessor->offset;
+   }
+
+   static void make_writable(GltfBuffer* buffer)
+   //-------------------------------------------
+   {
+      if ( (buffer != nullptr) && (buffer->copy == nullptr) )
+      {
+         buffer->copy = new uint8_t[buffer->contents->size()];
+         std::memcpy(buffer->copy, buffer->contents->data(), buffer->contents->size());
+      }
+   }
+
+   /** Replaces the contents of source with the writable copies made of its buffers. */
+   static void replace_gltf_buffers(std::vector<GltfBuffer>& buffers, GltfSource& source)
+   //------------------------------------------------------------------------------------
+   {
+      for (GltfBuffer& buffer : buffers)
+      {
+         if (buffer.copy == nullptr)
+            continue;
+         std::shared_ptr<AssetView> copy = AssetReader::make_view(buffer.copy, buffer.contents->size(),
+                                                                  [](const void* p, size_t)
+                                                                  { delete[] static_cast<const uint8_t*>(p); });
+         buffer.copy = nullptr;
+         if (buffer.resource != SIZE_MAX)
+            source.resources[buffer.resource].second = copy;
+         else
+            source.gltf = copy;
+      }
+   }
+
+   /** Reads indices of any gltf index component type. */
+   static void read_gltf_indices(const uint8_t* data, const cgltf_accessor* accessor, std::vector<uint32_t>& indices)
+   //---------------------------------------------------------------------------------------------------------------
+   {
+      indices.resize(accessor->count);
+      for (size_t i = 0; i < indices.size(); i++)
+      {
+         const uint8_t* p = data + i * accessor->stride;
+         switch (accessor->component_type)
+         {
+            case cgltf_component_type_r_8u: indices[i] = *p; break;
+            case cgltf_component_type_r_16u:
+            {
+               uint16_t index;
+               std::memcpy(&index, p, sizeof(uint16_t));
+               indices[i] = index;
+               break;
+            }
+            default: std::memcpy(&indices[i], p, sizeof(uint32_t)); break;
+         }
+      }
+   }
+
+   static void write_gltf_indices(uint8_t* data, const cgltf_accessor* accessor, const uint32_t* indices, size_t count)
+   //-----------------------------------------------------------------------------------------------------------------
+   {
+      for (size_t i = 0; i < count; i++)
+      {
+         uint8_t* p = data + i * accessor->stride;
+         switch (accessor->component_type)
+         {
+            case cgltf_component_type_r_8u: *p = static_cast<uint8_t>(indices[i]); break;
+            case cgltf_component_type_r_16u:
+            {
+               uint16_t index = static_cast<uint16_t>(indices[i]);
+               std::memcpy(p, &index, sizeof(uint16_t));
+               break;
+            }
+            default: std::memcpy(p, &indices[i], sizeof(uint32_t)); break;
+         }
+      }
+   }
+
+   bool MeshOptimizer::optimize_gltf(GltfSource& source, MeshOptimizeStats& stats)
+   //-----------------------------------------------------------------------------
+   {
+      Log logger("MeshOptimizer::optimize_gltf");
+      cgltf_data* parsed = parse_gltf(source);
+      if (parsed == nullptr)
+         return false;
+      std::vector<GltfBuffer> buffers = gltf_buffers(source, parsed);
+      std::unordered_map<const cgltf_accessor*, size_t> uses;
+      for (size_t m = 0; m < parsed->meshes_count; m++)
+      {
+         for (size_t p = 0; p < parsed->meshes[m].primitives_count; p++)
+         {
+            const cgltf_primitive& primitive = parsed->meshes[m].primitives[p];
+            uses[primitive.indices]++;
+            for (size_t a = 0; a < primitive.attributes_count; a++)
+               uses[primitive.attributes[a].data]++;
+         }
+      }
+      auto accessor_buffer = [&parsed, &buffers](const cgltf_accessor* accessor) -> GltfBuffer*
+      {
+         return gltf_accessor_buffer(buffers, parsed, accessor);
+      };
+
+      std::vector<const cgltf_primitive*> eligible;
+      for (size_t m = 0; m < parsed->meshes_count; m++)
+      {
+         for (size_t p = 0; p < parsed->meshes[m].primitives_count; p++)
+         {
+            const cgltf_primitive& primitive = parsed->meshes[m].primitives[p];
+            const cgltf_accessor* indices = primitive.indices;
+            bool isEligible = ( (primitive.type == cgltf_primitive_type_triangles) && (indices != nullptr) &&
+                                (! indices->is_sparse) && (uses[indices] == 1) && (primitive.targets_count == 0) &&
+                                (primitive.attributes_count > 0) &&
+                                ( (indices->component_type == cgltf_component_type_r_16u) ||
+                                  (indices->component_type == cgltf_component_type_r_32u) ) &&
+                                (accessor_buffer(indices) != nullptr) );
+            const size_t vertexCount = (isEligible) ? primitive.attributes[0].data->count : 0;
+            for (size_t a = 0; (isEligible) && (a < primitive.attributes_count); a++)
+            {
+               const cgltf_accessor* attribute = primitive.attributes[a].data;
+               isEligible = ( (! attribute->is_sparse) && (uses[attribute] == 1) && (attribute->count == vertexCount) &&
+                              (accessor_buffer(attribute) != nullptr) );
+            }
+            if (isEligible)
+               eligible.push_back(&primitive);
+            else
+               stats.skipped++;
+         }
+      }
+      if (eligible.empty())
+      {
+         cgltf_free(parsed);
+         return true;
+      }
+
+      // Buffers are copied before any primitive is processed so primitives may then be processed in parallel.
+      for (const cgltf_primitive* primitive : eligible)
+      {
+         make_writable(accessor_buffer(primitive->indices));
+         for (size_t a = 0; a < primitive->attributes_count; a++)
+            make_writable(accessor_buffer(primitive->attributes[a].data));
+      }
+      auto address = [&accessor_buffer](const cgltf_accessor* accessor) -> uint8_t*
+      {
+         return const_cast<uint8_t*>(gltf_accessor_data(*accessor_buffer(accessor), accessor));
+      };
+
+      std::vector<MeshOptimizeStats> primitiveStats(eligible.size());
+      ThreadPool::workers().parallel_for(0, eligible.size(), [&](size_t first, size_t last)
+      {
+         for (size_t e = first; e < last; e++)
+         {
+            const cgltf_primitive& primitive = *eligible[e];
+            MeshOptimizeStats& primStats = primitiveStats[e];
+            const cgltf_accessor* indexAccessor = primitive.indices;
+            const size_t vertexCount = primitive.attributes[0].data->count;
+            uint8_t* indexData = address(indexAccessor);
+            std::vector<uint32_t> indices;
+            read_gltf_indices(indexData, indexAccessor, indices);
+            if ( (indices.size() < 3) || (std::any_of(indices.begin(), indices.end(),
+                                                      [vertexCount](uint32_t i) { return (i >= vertexCount); })) )
+            {
+               primStats.skipped++;
+               continue;
+            }
+
+            const float* positions = nullptr;
+            size_t positionStride = 0;
+            for (size_t a = 0; a < primitive.attributes_count; a++)
+            {
+               const cgltf_accessor* attribute = primitive.attributes[a].data;
+               if ( (primitive.attributes[a].type == cgltf_attribute_type_position) &&
+                    (attribute->component_type == cgltf_component_type_r_32f) && (attribute->type == cgltf_type_vec3) &&
+                    (reinterpret_cast<uintptr_t>(address(attribute)) % alignof(float) == 0) )
+               {
+                  positions = reinterpret_cast<const float*>(address(attribute));
+                  positionStride = attribute->stride;
+               }
+               primStats.vertexBytesBefore += attribute->count * element_size(attribute);
+            }
+            primStats.vertexBytesAfter = primStats.vertexBytesBefore;
+            primStats.indexBytesBefore = primStats.indexBytesAfter = indices.size() * element_size(indexAccessor);
+            const size_t triangles = indices.size() / 3;
+            primStats.acmrBefore = acmr(indices, 0, indices.size(), vertexCount) * triangles;
+            optimize_triangles(indices.data(), indices.size(), vertexCount, positions, positionStride);
+
+            // The accessor counts are fixed by the JSON, so vertices are reordered in place and unreferenced
+            // vertices are left (unused) after the referenced ones.
+            std::vector<uint32_t> remap(vertexCount);
+            meshopt_optimizeVertexFetchRemap(remap.data(), indices.data(), indices.size(), vertexCount);
+            meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+            for (size_t a = 0; a < primitive.attributes_count; a++)
+            {
+               const cgltf_accessor* attribute = primitive.attributes[a].data;
+               const size_t elementSize = element_size(attribute);
+               uint8_t* data = address(attribute);
+               std::vector<uint8_t> original(vertexCount * elementSize);
+               for (size_t v = 0; v < vertexCount; v++)
+                  std::memcpy(&original[v * elementSize], data + v * attribute->stride, elementSize);
+               for (size_t v = 0; v < vertexCount; v++)
+                  if (remap[v] != std::numeric_limits<uint32_t>::max())
+                     std::memcpy(data + size_t(remap[v]) * attribute->stride, &original[v * elementSize], elementSize);
+            }
+            write_gltf_indices(indexData, indexAccessor, indices.data(), indices.size());
+            primStats.acmrAfter = acmr(indices, 0, indices.size(), vertexCount) * triangles;
+            primStats.triangles = triangles;
+            primStats.primitives = 1;
+         }
+      });
+
+      for (const MeshOptimizeStats& primStats : primitiveStats)
+      {
+         stats.vertexBytesBefore += primStats.vertexBytesBefore;
+         stats.vertexBytesAfter += primStats.vertexBytesAfter;
+         stats.indexBytesBefore += primStats.indexBytesBefore;
+         stats.indexBytesAfter += primStats.indexBytesAfter;
+         stats.primitives += primStats.primitives;
+         stats.skipped += primStats.skipped;
+         stats.triangles += primStats.triangles;
+         stats.acmrBefore += primStats.acmrBefore;
+         stats.acmrAfter += primStats.acmrAfter;
+      }
+      replace_gltf_buffers(buffers, source);
+      cgltf_free(parsed);
+      return true;
+   }
+
+   // Compressed filamesh vertex data starts with the compressed size of each stream, followed by the streams.
+   struct FilameshCompression
+   {
+      uint32_t positions;
+      uint32_t tangents;
+      uint32_t colors;
+      uint32_t uv0;
+      uint32_t uv1;
+      uint32_t indices;
+   };
+
+   std::shared_ptr<AssetView> MeshOptimizer::decode_filamesh(const std::shared_ptr<AssetView>& filamesh,
+                                                             MeshDecodeStats& stats)
+   //---------------------------------------------------------------------------------------------------
+   {
+      Log logger("MeshOptimizer::decode_filamesh");
+      const size_t size = (filamesh) ? filamesh->size() : 0;
+      const size_t vertexOffset = FILAMESH_MAGIC_SIZE + sizeof(FilameshHeader);
+      if ( (size < vertexOffset) || (std::memcmp(filamesh->data(), "FILAMESH", FILAMESH_MAGIC_SIZE) != 0) )
+         return filamesh;
+      FilameshHeader header;
+      std::memcpy(&header, filamesh->bytes() + FILAMESH_MAGIC_SIZE, sizeof(FilameshHeader));
+      if ( (header.flags & FILAMESH_COMPRESSION) == 0 )
+         return filamesh;
+      const size_t partsOffset = vertexOffset + size_t(header.vertexSize) + header.indexSize;
+      const size_t partsEnd = partsOffset + size_t(header.parts) * sizeof(FilameshPart);
+      FilameshCompression sizes;
+      if ( (partsEnd > size) || (header.vertexSize < sizeof(FilameshCompression)) ||
+           ( (header.indexType != FILAMESH_UI16) && (header.indexType != FILAMESH_UI32) ) )
+      {
+         logger.error("Invalid compressed filamesh");
+         return nullptr;
+      }
+      std::memcpy(&sizes, filamesh->bytes() + vertexOffset, sizeof(FilameshCompression));
+      if ( (size_t(sizes.positions) + sizes.tangents + sizes.colors + sizes.uv0 + sizes.uv1 >
+            header.vertexSize - sizeof(FilameshCompression)) || (sizes.indices > header.indexSize) )
+      {
+         logger.error("Invalid compressed filamesh stream sizes");
+         return nullptr;
+      }
+
+      // Decoded streams are stored as separate (non interleaved) arrays in their compressed order.
+      struct Stream
+      {
+         uint32_t* offset;
+         uint32_t* stride;
+         uint32_t compressedSize;
+         uint32_t elementSize;
+         const uint8_t* compressed;
+      };
+      std::vector<Stream> streams;
+      const uint8_t* compressed = filamesh->bytes() + vertexOffset + sizeof(FilameshCompression);
+      size_t vertexSize = 0;
+      for (Stream stream : { Stream{ &header.offsetPosition, &header.stridePosition, sizes.positions, 8, nullptr },
+                             Stream{ &header.offsetTangents, &header.strideTangents, sizes.tangents, 8, nullptr },
+                             Stream{ &header.offsetColor, &header.strideColor, sizes.colors, 4, nullptr },
+                             Stream{ &header.offsetUV0, &header.strideUV0, sizes.uv0, 4, nullptr },
+                             Stream{ &header.offsetUV1, &header.strideUV1, sizes.uv1, 4, nullptr } })
+      {
+         if (stream.compressedSize == 0)
+         {
+            *stream.offset = std::numeric_limits<uint32_t>::max();
+            *stream.stride = 0;
+            continue;
+         }
+         stream.compressed = compressed;
+         compressed += stream.compressedSize;
+         *stream.offset = static_cast<uint32_t>(vertexSize);
+         *stream.stride = stream.elementSize;
+         vertexSize += size_t(stream.elementSize) * header.vertexCount;
+         streams.push_back(stream);
+      }
+      const size_t indexStride = (header.indexType == FILAMESH_UI16) ? sizeof(uint16_t) : sizeof(uint32_t);
+      const size_t indexSize = size_t(header.indexCount) * indexStride;
+      const size_t tailSize = size - partsEnd;
+      const size_t newSize = vertexOffset + vertexSize + indexSize + (size - partsOffset);
+      uint8_t* buffer = new uint8_t[newSize];
+      uint8_t* vertices = buffer + vertexOffset;
+      uint8_t* indices = vertices + vertexSize;
+      const uint8_t* compressedIndices = filamesh->bytes() + vertexOffset + header.vertexSize;
+
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<int> results(streams.size() + 1, 0);
+      ThreadPool::workers().parallel_for(0, streams.size() + 1, [&](size_t first, size_t last)
+      {
+         for (size_t i = first; i < last; i++)
+         {
+            if (i == streams.size())
+               results[i] = meshopt_decodeIndexBuffer(indices, header.indexCount, indexStride, compressedIndices,
+                                                      sizes.indices);
+            else
+               results[i] = meshopt_decodeVertexBuffer(vertices + *streams[i].offset, header.vertexCount,
+                                                       streams[i].elementSize, streams[i].compressed,
+                                                       streams[i].compressedSize);
+         }
+      }, 1);
+      if (std::any_of(results.begin(), results.end(), [](int result) { return (result != 0); }))
+      {
+         logger.error("Error decoding compressed filamesh");
+         delete[] buffer;
+         return nullptr;
+      }
+      stats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                                      start).count();
+      stats.streams += streams.size() + 1;
+      stats.compressedBytes += size_t(header.vertexSize) - sizeof(FilameshCompression) + sizes.indices;
+      stats.decodedBytes += vertexSize + indexSize;
+
+      header.flags &= ~(FILAMESH_COMPRESSION | FILAMESH_INTERLEAVED);
+      header.vertexSize = static_cast<uint32_t>(vertexSize);
+      header.indexSize = static_cast<uint32_t>(indexSize);
+      std::memcpy(buffer, filamesh->data(), FILAMESH_MAGIC_SIZE);
+      std::memcpy(buffer + FILAMESH_MAGIC_SIZE, &header, sizeof(FilameshHeader));
+      std::memcpy(indices + indexSize, filamesh->bytes() + partsOffset, (partsEnd - partsOffset) + tailSize);
+      return AssetReader::make_view(buffer, newSize,
+                                    [](const void* p, size_t) { delete[] static_cast<const uint8_t*>(p); });
+   }
+
+   /**
+    * Minimal JSON document model used to edit glTF JSON. Numbers and literals and the contents of strings (escapes
+    * included) are kept as their original text so a parsed document is written back unchanged apart from whitespace.
+    */
+   struct JsonValue
+   {
+      enum class Type { LITERAL, STRING, ARRAY, OBJECT };
+
+      Type type = Type::LITERAL;
+      std::string text; // LITERAL or STRING contents
+      std::vector<std::string> keys; // OBJECT member names (parallel to items)
+      std::vector<JsonValue> items; // ARRAY elements or OBJECT member values
+
+      JsonValue* member(const std::string& key)
+      {
+         for (size_t i = 0; i < keys.size(); i++)
+         {
+            if (keys[i] == key)
+               return &items[i];
+         }
+         return nullptr;
+      }
+
+      void set_member(const std::string& key, const JsonValue& value)
+      {
+         JsonValue* existing = member(key);
+         if (existing != nullptr)
+            *existing = value;
+         else
+         {
+            keys.push_back(key);
+            items.push_back(value);
+         }
+      }
+
+      void remove_member(const std::string& key)
+      {
+         for (size_t i = 0; i < keys.size(); i++)
+         {
+            if (keys[i] == key)
+            {
+               keys.erase(keys.begin() + i);
+               items.erase(items.begin() + i);
+               return;
+            }
+         }
+      }
+
+      static JsonValue string(const std::string& text)
+      {
+         JsonValue value;
+         value.type = Type::STRING;
+         value.text = text;
+         return value;
+      }
+   };
+
+   static void json_skip_space(const char*& p, const char* end)
+   //----------------------------------------------------------
+   {
+      while ( (p < end) && ( (*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r') ) )
+         p++;
+   }
+
+   static bool json_parse_string(const char*& p, const char* end, std::string& text)
+   //-------------------------------------------------------------------------------
+   {
+      const char* first = ++p;
+      while ( (p < end) && (*p != '"') )
+         p += (*p == '\\') ? 2 : 1;
+      if (p >= end)
+         return false;
+      text.assign(first, p++);
+      return true;
+   }
+
+   static bool json_parse(const char*& p, const char* end, JsonValue& value, int depth =0)
+   //------------------------------------------------------------------------------------
+   {
+      json_skip_space(p, end);
+      if ( (p >= end) || (depth > 256) )
+         return false;
+      if (*p == '"')
+      {
+         value.type = JsonValue::Type::STRING;
+         return json_parse_string(p, end, value.text);
+      }
+      if ( (*p == '[') || (*p == '{') )
+      {
+         const bool isObject = (*p++ == '{');
+         const char close = (isObject) ? '}' : ']';
+         value.type = (isObject) ? JsonValue::Type::OBJECT : JsonValue::Type::ARRAY;
+         json_skip_space(p, end);
+         if ( (p < end) && (*p == close) )
+         {
+            p++;
+            return true;
+         }
+         while (p < end)
+         {
+            if (isObject)
+            {
+               json_skip_space(p, end);
+               std::string key;
+               if ( (p >= end) || (*p != '"') || (! json_parse_string(p, end, key)) )
+                  return false;
+               json_skip_space(p, end);
+               if ( (p >= end) || (*p++ != ':') )
+                  return false;
+               value.keys.push_back(key);
+            }
+            value.items.emplace_back();
+            if (! json_parse(p, end, value.items.back(), depth + 1))
+               return false;
+            json_skip_space(p, end);
+            if (p >= end)
+               return false;
+            const char c = *p++;
+            if (c == close)
+               return true;
+            if (c != ',')
+               return false;
+         }
+         return false;
+      }
+      const char* first = p;
+      while ( (p < end) && ( (std::isalnum(static_cast<unsigned char>(*p))) || (*p == '-') || (*p == '+') ||
+                             (*p == '.') ) )
+         p++;
+      value.type = JsonValue::Type::LITERAL;
+      value.text.assign(first, p);
+      return (p > first);
+   }
+
+   static void json_write(const JsonValue& value, std::string& out)
+   //--------------------------------------------------------------
+   {
+      switch (value.type)
+      {
+         case JsonValue::Type::LITERAL:
+            out += value.text;
+            break;
+         case JsonValue::Type::STRING:
+            out += '"';
+            out += value.text;
+            out += '"';
+            break;
+         case JsonValue::Type::ARRAY:
+         case JsonValue::Type::OBJECT:
+         {
+            const bool isObject = (value.type == JsonValue::Type::OBJECT);
+            out += (isObject) ? '{' : '[';
+            for (size_t i = 0; i < value.items.size(); i++)
+            {
+               if (i > 0)
+                  out += ',';
+               if (isObject)
+               {
+                  out += '"';
+                  out += value.keys[i];
+                  out += "\":";
+               }
+               json_write(value.items[i], out);
+            }
+            out += (isObject) ? '}' : ']';
+            break;
+         }
+      }
+   }
+
+   /** Removes name from the "extensions" object of value, and the object itself if that leaves it empty. */
+   static void json_remove_extension(JsonValue& value, const char* name)
+   //------------------------------------------------------------------
+   {
+      JsonValue* extensions = value.member("extensions");
+      if ( (extensions == nullptr) || (extensions->type != JsonValue::Type::OBJECT) )
+         return;
+      extensions->remove_member(name);
+      if (extensions->items.empty())
+         value.remove_member("extensions");
+   }
+
+   /** Removes the string name from the array key of the glTF root, and the array itself if that leaves it empty. */
+   static void json_remove_listed_extension(JsonValue& root, const char* key, const char* name)
+   //-----------------------------------------------------------------------------------------
+   {
+      JsonValue* list = root.member(key);
+      if ( (list == nullptr) || (list->type != JsonValue::Type::ARRAY) )
+         return;
+      for (size_t i = list->items.size(); i-- > 0;)
+      {
+         if ( (list->items[i].type == JsonValue::Type::STRING) && (list->items[i].text == name) )
+            list->items.erase(list->items.begin() + i);
+      }
+      if (list->items.empty())
+         root.remove_member(key);
+   }
+
+   bool MeshOptimizer::decode_gltf(GltfSource& source, MeshDecodeStats& stats)
+   //-------------------------------------------------------------------------
+   {
+      Log logger("MeshOptimizer::decode_gltf");
+      cgltf_data* parsed = parse_gltf(source);
+      if (parsed == nullptr)
+         return false;
+      std::vector<GltfBuffer> buffers = gltf_buffers(source, parsed);
+      std::vector<const cgltf_buffer_view*> views;
+      std::vector<uint8_t*> decoded(parsed->buffers_count, nullptr);
+      auto release = [&decoded, parsed]()
+      {
+         for (uint8_t* p : decoded)
+            delete[] p;
+         cgltf_free(parsed);
+      };
+      for (size_t i = 0; i < parsed->buffer_views_count; i++)
+      {
+         const cgltf_buffer_view& view = parsed->buffer_views[i];
+         if (! view.has_meshopt_compression)
+            continue;
+         const size_t target = view.buffer - parsed->buffers;
+         if ( (view.buffer->uri != nullptr) || ( (target == 0) && (parsed->bin != nullptr) ) )
+            continue;
+         const cgltf_meshopt_compression& compression = view.meshopt_compression;
+         const GltfBuffer& compressed = buffers[compression.buffer - parsed->buffers];
+         if ( (! compressed.contents) || (compression.offset + compression.size > compression.buffer->size) ||
+              (compression.count * compression.stride > view.size) || (view.offset + view.size > view.buffer->size) )
+         {
+            logger.error("Invalid EXT_meshopt_compression buffer view {0} in {1}", i, source.path);
+            release();
+            return false;
+         }
+         if (decoded[target] == nullptr)
+            decoded[target] = new uint8_t[view.buffer->size]();
+         views.push_back(&view);
+      }
+      if (views.empty())
+      {
+         release();
+         return true;
+      }
+
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<int> results(views.size(), 0);
+      ThreadPool::workers().parallel_for(0, views.size(), [&](size_t first, size_t last)
+      {
+         for (size_t i = first; i < last; i++)
+         {
+            const cgltf_buffer_view& view = *views[i];
+            const cgltf_meshopt_compression& compression = view.meshopt_compression;
+            const GltfBuffer& compressed = buffers[compression.buffer - parsed->buffers];
+            const unsigned char* data = compressed.contents->bytes() + compressed.offset + compression.offset;
+            uint8_t* destination = decoded[view.buffer - parsed->buffers] + view.offset;
+            switch (compression.mode)
+            {
+               case cgltf_meshopt_compression_mode_attributes:
+                  results[i] = meshopt_decodeVertexBuffer(destination, compression.count, compression.stride, data,
+                                                          compression.size);
+                  break;
+               case cgltf_meshopt_compression_mode_triangles:
+                  results[i] = meshopt_decodeIndexBuffer(destination, compression.count, compression.stride, data,
+                                                         compression.size);
+                  break;
+               case cgltf_meshopt_compression_mode_indices:
+                  results[i] = meshopt_decodeIndexSequence(destination, compression.count, compression.stride, data,
+                                                           compression.size);
+                  break;
+               default:
+                  results[i] = -1;
+                  break;
+            }
+            if (results[i] != 0)
+               continue;
+            switch (compression.filter)
+            {
+               case cgltf_meshopt_compression_filter_octahedral:
+                  meshopt_decodeFilterOct(destination, compression.count, compression.stride);
+                  break;
+               case cgltf_meshopt_compression_filter_quaternion:
+                  meshopt_decodeFilterQuat(destination, compression.count, compression.stride);
+                  break;
+               case cgltf_meshopt_compression_filter_exponential:
+                  meshopt_decodeFilterExp(destination, compression.count, compression.stride);
+                  break;
+               default:
+                  break;
+            }
+         }
+      }, 1);
+      const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                                            start).count();
+      for (size_t i = 0; i < views.size(); i++)
+      {
+         if (results[i] != 0)
+         {
+            logger.error("Error {0} decoding EXT_meshopt_compression data in {1}", results[i], source.path);
+            release();
+            return false;
+         }
+         stats.compressedBytes += views[i]->meshopt_compression.size;
+         stats.decodedBytes += views[i]->meshopt_compression.count * views[i]->meshopt_compression.stride;
+      }
+      stats.streams += views.size();
+      stats.milliseconds += milliseconds;
+
+      // The JSON is edited as a document: the decoded fallback buffers are given URIs (served from the resources)
+      // and EXT_meshopt_compression is removed from the buffer views, buffers, extensionsUsed and
+      // extensionsRequired, so gltfio loads the fallback buffers as ordinary data. For glb the rewritten JSON chunk
+      // is padded with spaces to the 4 byte chunk alignment before the chunk and file lengths are rewritten.
+      const char* const EXTENSION = "EXT_meshopt_compression";
+      const uint8_t* glb = source.gltf->bytes();
+      uint32_t jsonLength = 0;
+      const char* text = source.gltf->begin();
+      size_t textSize = source.gltf->size();
+      if (source.isBinary)
+      {
+         if (source.gltf->size() >= 20)
+            std::memcpy(&jsonLength, glb + 12, sizeof(uint32_t));
+         if (size_t(20) + jsonLength > source.gltf->size())
+         {
+            logger.error("Invalid glb {0}", source.path);
+            release();
+            return false;
+         }
+         text += 20;
+         textSize = jsonLength;
+      }
+      const char* textEnd = text + textSize;
+      if ( (textSize >= 3) && (std::memcmp(text, "\xEF\xBB\xBF", 3) == 0) ) // UTF-8 BOM
+         text += 3;
+      JsonValue root;
+      JsonValue* bufferArray = nullptr;
+      if ( (! json_parse(text, textEnd, root)) || (root.type != JsonValue::Type::OBJECT) ||
+           ( (bufferArray = root.member("buffers")) == nullptr ) ||
+           (bufferArray->type != JsonValue::Type::ARRAY) || (bufferArray->items.size() != parsed->buffers_count) )
+      {
+         logger.error("Could not parse the buffers in {0}", source.path);
+         release();
+         return false;
+      }
+      std::vector<GltfResource> resources;
+      for (size_t i = 0; i < parsed->buffers_count; i++)
+      {
+         JsonValue& buffer = bufferArray->items[i];
+         if (buffer.type == JsonValue::Type::OBJECT)
+            json_remove_extension(buffer, EXTENSION);
+         if (decoded[i] == nullptr)
+            continue;
+         std::string uri = "bulb-meshopt-" + std::to_string(i) + ".bin";
+         buffer.set_member("uri", JsonValue::string(uri));
+         resources.emplace_back(uri, AssetReader::make_view(decoded[i], parsed->buffers[i].size,
+                                                            [](const void* p, size_t)
+                                                            { delete[] static_cast<const uint8_t*>(p); }));
+         decoded[i] = nullptr;
+      }
+      JsonValue* viewArray = root.member("bufferViews");
+      if ( (viewArray != nullptr) && (viewArray->type == JsonValue::Type::ARRAY) )
+      {
+         for (JsonValue& view : viewArray->items)
+         {
+            if (view.type == JsonValue::Type::OBJECT)
+               json_remove_extension(view, EXTENSION);
+         }
+      }
+      json_remove_listed_extension(root, "extensionsUsed", EXTENSION);
+      json_remove_listed_extension(root, "extensionsRequired", EXTENSION);
+      std::string json;
+      json.reserve(textSize + resources.size()*32);
+      json_write(root, json);
+
+      std::shared_ptr<AssetView> gltf;
+      if (source.isBinary)
+      {
+         while (json.size() % 4 != 0)
+            json += ' ';
+         const size_t binOffset = 20 + size_t(jsonLength);
+         const size_t newSize = 20 + json.size() + (source.gltf->size() - binOffset);
+         uint8_t* data = new uint8_t[newSize];
+         const uint32_t length = static_cast<uint32_t>(newSize), chunkLength = static_cast<uint32_t>(json.size());
+         std::memcpy(data, glb, 8); // Magic and version
+         std::memcpy(data + 8, &length, sizeof(uint32_t));
+         std::memcpy(data + 12, &chunkLength, sizeof(uint32_t));
+         std::memcpy(data + 16, glb + 16, sizeof(uint32_t)); // JSON chunk type
+         std::memcpy(data + 20, json.data(), json.size());
+         std::memcpy(data + 20 + json.size(), glb + binOffset, source.gltf->size() - binOffset);
+         gltf = AssetReader::make_view(data, newSize,
+                                       [](const void* p, size_t) { delete[] static_cast<const uint8_t*>(p); });
+      }
+      else
+      {
+         char* data = new char[json.size()];
+         std::memcpy(data, json.data(), json.size());
+         gltf = AssetReader::make_view(data, json.size(),
+                                       [](const void* p, size_t) { delete[] static_cast<const char*>(p); });
+      }
+      release();
+      source.gltf = gltf;
+      source.resources.insert(source.resources.end(), resources.begin(), resources.end());
+      return true;
+   }
+
+   const std::vector<float>& MeshOptimizer::default_lod_ratios()
+   //-----------------------------------------------------------
+   {
+      static const std::vector<float> ratios{ 0.5f, 0.25f, 0.1f };
+      return ratios;
+   }
+
+   static std::mutex lodCacheMutex;
+   static std::string lodCacheDir;
+
+   void MeshOptimizer::set_lod_cache_dir(const std::string& dir)
+   //-----------------------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(lodCacheMutex);
+      lodCacheDir = dir;
+   }
+
+   std::string MeshOptimizer::get_lod_cache_dir()
+   //--------------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(lodCacheMutex);
+      return lodCacheDir;
+   }
+
+   /*
+    * LOD cache file layout (native endian):
+    *    "BULBLOD1", uint32_t levels, uint32_t primitives, float ratios[levels],
+    *    then for each level and each primitive: uint32_t count, uint32_t indices[count]
+    */
+   static constexpr char LOD_MAGIC[8] = { 'B', 'U', 'L', 'B', 'L', 'O', 'D', '1' };
+
+   static uint64_t lod_seed(const std::vector<float>& ratios, float targetError)
+   //---------------------------------------------------------------------------
+   {
+      uint64_t seed = hash64(LOD_MAGIC, sizeof(LOD_MAGIC));
+      seed = hash64(&targetError, sizeof(float), seed);
+      return hash64(ratios.data(), ratios.size() * sizeof(float), seed);
+   }
+
+   // Callers check the cache directory is set before hashing the source, which is not free for large meshes.
+   static std::string lod_cache_path(const std::string& dir, uint64_t hash)
+   //----------------------------------------------------------------------
+   {
+      char name[32];
+      std::snprintf(name, sizeof(name), "%016llx.bulblod", static_cast<unsigned long long>(hash));
+      return dir + "/" + name;
+   }
+
+   static bool read_lod_cache(const std::string& path, size_t primitiveCount, LodChain& chain)
+   //----------------------------------------------------------------------------------------
+   {
+      if ( (path.empty()) || (! AssetReader::instance().exists(path.c_str())) )
+         return false;
+      std::shared_ptr<AssetView> contents = AssetReader::instance().map_asset(path.c_str());
+      const size_t headerSize = sizeof(LOD_MAGIC) + 2 * sizeof(uint32_t);
+      if ( (! contents) || (contents->size() < headerSize) ||
+           (std::memcmp(contents->data(), LOD_MAGIC, sizeof(LOD_MAGIC)) != 0) )
+         return false;
+      const uint8_t* p = contents->bytes() + sizeof(LOD_MAGIC);
+      const uint8_t* end = contents->bytes() + contents->size();
+      uint32_t levels, primitives;
+      std::memcpy(&levels, p, sizeof(uint32_t));
+      std::memcpy(&primitives, p + sizeof(uint32_t), sizeof(uint32_t));
+      p += 2 * sizeof(uint32_t);
+      if ( (levels != chain.ratios.size()) || (primitives != primitiveCount) ||
+           (size_t(end - p) < levels * sizeof(float)) )
+         return false;
+      p += levels * sizeof(float);
+      chain.levels.assign(levels, std::vector<std::vector<uint32_t>>(primitives));
+      for (uint32_t level = 0; level < levels; level++)
+      {
+         for (uint32_t primitive = 0; primitive < primitives; primitive++)
+         {
+            uint32_t count;
+            if (size_t(end - p) < sizeof(uint32_t))
+               return false;
+            std::memcpy(&count, p, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+            if (size_t(end - p) / sizeof(uint32_t) < count)
+               return false;
+            std::vector<uint32_t>& indices = chain.levels[level][primitive];
+            indices.resize(count);
+            std::memcpy(indices.data(), p, count * sizeof(uint32_t));
+            p += count * sizeof(uint32_t);
+         }
+      }
+      return true;
+   }
+
+   static void write_lod_cache(const std::string& path, const LodChain& chain)
+   //-------------------------------------------------------------------------
+   {
+      if (path.empty())
+         return;
+      mkdirs(MeshOptimizer::get_lod_cache_dir().c_str());
+      // Written to a temporary then renamed so a concurrent reader never maps a partial file.
+      std::string tmp = path + "." + std::to_string(reinterpret_cast<uintptr_t>(&chain)) + ".tmp";
+      {
+         std::ofstream out(tmp, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+         if (! out)
+            return;
+         uint32_t levels = static_cast<uint32_t>(chain.levels.size());
+         uint32_t primitives = (levels > 0) ? static_cast<uint32_t>(chain.levels[0].size()) : 0;
+         out.write(LOD_MAGIC, sizeof(LOD_MAGIC));
+         out.write(reinterpret_cast<const char*>(&levels), sizeof(uint32_t));
+         out.write(reinterpret_cast<const char*>(&primitives), sizeof(uint32_t));
+         out.write(reinterpret_cast<const char*>(chain.ratios.data()), levels * sizeof(float));
+         for (const std::vector<std::vector<uint32_t>>& level : chain.levels)
+         {
+            for (const std::vector<uint32_t>& indices : level)
+            {
+               uint32_t count = static_cast<uint32_t>(indices.size());
+               out.write(reinterpret_cast<const char*>(&count), sizeof(uint32_t));
+               out.write(reinterpret_cast<const char*>(indices.data()), count * sizeof(uint32_t));
+            }
+         }
+         if (! out.good())
+         {
+            out.close();
+            std::remove(tmp.c_str());
+            return;
+         }
+      }
+      if (std::rename(tmp.c_str(), path.c_str()) != 0)
+         std::remove(tmp.c_str());
+   }
+
+   void MeshOptimizer::simplify(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+                                size_t positionStride, const std::vector<float>& ratios, float targetError,
+                                std::vector<std::vector<uint32_t>>& levels)
+   //------------------------------------------------------------------------------------------------------------------
+   {
+      levels.assign(ratios.size(), std::vector<uint32_t>());
+      if (indexCount < 3)
+         return;
+      for (size_t l = 0; l < ratios.size(); l++)
+      {
+         const size_t target = std::max(size_t(indexCount * ratios[l]) / 3 * 3, size_t(3));
+         std::vector<uint32_t>& level = levels[l];
+         level.resize(indexCount);
+         size_t count = meshopt_simplify(level.data(), indices, indexCount, positions, vertexCount, positionStride,
+                                         target, targetError);
+         // The error limit can stop well short of the target, eg on meshes of many disconnected pieces.
+         if (count > target + target / 2)
+            count = meshopt_simplifySloppy(level.data(), indices, indexCount, positions, vertexCount, positionStride,
+                                           target);
+         if (count == 0) // Simplified away, so keep the previous (coarsest non empty) level
+         {
+            if (l > 0)
+               level = levels[l - 1];
+            else
+               level.clear();
+            continue;
+         }
+         level.resize(count);
+         meshopt_optimizeVertexCache(level.data(), level.data(), count, vertexCount);
+      }
+   }
+
+   bool MeshOptimizer::filamesh_lods(const AssetView& filamesh, const std::vector<float>& ratios, LodChain& chain,
+                                     float targetError)
+   //--------------------------------------------------------------------------------------------------------------
+   {
+      Log logger("MeshOptimizer::filamesh_lods");
+      FilameshHeader header;
+      std::vector<FilameshPart> parts;
+      chain.ratios = ratios;
+      chain.levels.clear();
+      if (! read_filamesh(filamesh, header, parts))
+      {
+         logger.error("Compressed or invalid filamesh");
+         return false;
+      }
+      chain.vertexCount = header.vertexCount;
+      chain.sourceRanges.clear();
+      for (const FilameshPart& part : parts)
+         chain.sourceRanges.emplace_back(part.offset, part.indexCount);
+      if (ratios.empty())
+         return true;
+      const std::string cacheDir = get_lod_cache_dir();
+      std::string cachePath;
+      if (! cacheDir.empty())
+         cachePath = lod_cache_path(cacheDir, hash64(filamesh.data(), filamesh.size(), lod_seed(ratios, targetError)));
+      if (read_lod_cache(cachePath, parts.size(), chain))
+         return true;
+      std::vector<uint32_t> indices;
+      std::vector<float> positions;
+      if ( (! filamesh_indices(filamesh, header, indices)) || (! filamesh_positions(filamesh, header, positions)) )
+         return false;
+
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<std::vector<std::vector<uint32_t>>> partLevels(parts.size()); // [part][level]
+      ThreadPool::workers().parallel_for(0, parts.size(), [&](size_t first, size_t last)
+      {
+         for (size_t i = first; i < last; i++)
+            simplify(indices.data() + parts[i].offset, parts[i].indexCount, positions.data(), header.vertexCount,
+                     3 * sizeof(float), ratios, targetError, partLevels[i]);
+      }, 1);
+      chain.levels.assign(ratios.size(), std::vector<std::vector<uint32_t>>(parts.size()));
+      for (size_t i = 0; i < parts.size(); i++)
+         for (size_t l = 0; l < ratios.size(); l++)
+            chain.levels[l][i] = std::move(partLevels[i][l]);
+      logger.info("Simplified {0} parts to {1} levels in {2}ms", parts.size(), ratios.size(),
+                  std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() -
+                                                                        start).count());
+      write_lod_cache(cachePath, chain);
+      return true;
+   }
+
+   static std::vector<const cgltf_primitive*> gltf_primitives(const cgltf_data* parsed)
+   //----------------------------------------------------------------------------------
+   {
+      std::vector<const cgltf_primitive*> primitives;
+      for (size_t m = 0; m < parsed->meshes_count; m++)
+         for (size_t p = 0; p < parsed->meshes[m].primitives_count; p++)
+            primitives.push_back(&parsed->meshes[m].primitives[p]);
+      return primitives;
+   }
+
+   bool MeshOptimizer::gltf_lods(const GltfSource& source, const std::vector<float>& ratios, LodChain& chain,
+                                 float targetError)
+   //------------------------------------------------------------------------------------------------------------
+   {
+      Log logger("MeshOptimizer::gltf_lods");
+      chain.ratios = ratios;
+      chain.levels.clear();
+      chain.sourceRanges.clear();
+      chain.vertexCount = 0;
+      cgltf_data* parsed = parse_gltf(source);
+      if (parsed == nullptr)
+         return false;
+      if (ratios.empty())
+      {
+         cgltf_free(parsed);
+         return true;
+      }
+      std::vector<GltfBuffer> buffers = gltf_buffers(source, parsed);
+      const std::vector<const cgltf_primitive*> primitives = gltf_primitives(parsed);
+      const std::string cacheDir = get_lod_cache_dir();
+      std::string cachePath;
+      if (! cacheDir.empty())
+      {
+         uint64_t hash = hash64(source.gltf->data(), source.gltf->size(), lod_seed(ratios, targetError));
+         for (const GltfBuffer& buffer : buffers)
+            if ( (buffer.contents) && (buffer.resource != SIZE_MAX) )
+               hash = hash64(buffer.contents->data(), buffer.contents->size(), hash);
+         cachePath = lod_cache_path(cacheDir, hash);
+      }
+      if (read_lod_cache(cachePath, primitives.size(), chain))
+      {
+         cgltf_free(parsed);
+         return true;
+      }
+
+      auto start = std::chrono::high_resolution_clock::now();
+      chain.levels.assign(ratios.size(), std::vector<std::vector<uint32_t>>(primitives.size()));
+      ThreadPool::workers().parallel_for(0, primitives.size(), [&](size_t first, size_t last)
+      {
+         std::vector<uint32_t> indices;
+         std::vector<float> positions;
+         std::vector<std::vector<uint32_t>> levels;
+         for (size_t i = first; i < last; i++)
+         {
+            const cgltf_primitive& primitive = *primitives[i];
+            const cgltf_accessor* positionAccessor = nullptr;
+            for (size_t a = 0; a < primitive.attributes_count; a++)
+               if (primitive.attributes[a].type == cgltf_attribute_type_position)
+                  positionAccessor = primitive.attributes[a].data;
+            const GltfBuffer* indexBuffer = gltf_accessor_buffer(buffers, parsed, primitive.indices);
+            const GltfBuffer* positionBuffer = gltf_accessor_buffer(buffers, parsed, positionAccessor);
+            if ( (primitive.type != cgltf_primitive_type_triangles) || (primitive.targets_count > 0) ||
+                 (indexBuffer == nullptr) || (primitive.indices->is_sparse) || (positionBuffer == nullptr) ||
+                 (positionAccessor->is_sparse) || (positionAccessor->type != cgltf_type_vec3) ||
+                 (positionAccessor->component_type != cgltf_component_type_r_32f) )
+               continue;
+            const size_t vertexCount = positionAccessor->count;
+            read_gltf_indices(gltf_accessor_data(*indexBuffer, primitive.indices), primitive.indices, indices);
+            if (std::any_of(indices.begin(), indices.end(), [vertexCount](uint32_t i) { return (i >= vertexCount); }))
+               continue;
+            positions.resize(vertexCount * 3);
+            const uint8_t* positionData = gltf_accessor_data(*positionBuffer, positionAccessor);
+            for (size_t v = 0; v < vertexCount; v++)
+               std::memcpy(&positions[v * 3], positionData + v * positionAccessor->stride, 3 * sizeof(float));
+            simplify(indices.data(), indices.size(), positions.data(), vertexCount, 3 * sizeof(float), ratios,
+                     targetError, levels);
+            for (size_t l = 0; l < ratios.size(); l++)
+               chain.levels[l][i] = std::move(levels[l]);
+         }
+      }, 1);
+      logger.info("Simplified {0} primitives of {1} to {2} levels in {3}ms", primitives.size(), source.path,
+                  ratios.size(), std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    std::chrono::high_resolution_clock::now() - start).count());
+      cgltf_free(parsed);
+      write_lod_cache(cachePath, chain);
+      return true;
+   }
+
+   /** Visits node and its descendants in the (pre)order gltfio creates their entities. */
+   static void visit_gltf_nodes(const cgltf_node* node, const std::function<void(const cgltf_node*)>& visit)
+   //-------------------------------------------------------------------------------------------------------
+   {
+      visit(node);
+      for (size_t i = 0; i < node->children_count; i++)
+         visit_gltf_nodes(node->children[i], visit);
+   }
+
+   bool MeshOptimizer::make_gltf_lod(const GltfSource& source, const LodChain& chain, size_t level,
+                                     GltfSource& lodSource, std::vector<GltfIndexCount>& counts, size_t& entityCount)
+   //----------------------------------------------------------------------------------------------------------------
+   {
+      counts.clear();
+      entityCount = 0;
+      if (level >= chain.level_count())
+         return false;
+      cgltf_data* parsed = parse_gltf(source);
+      if (parsed == nullptr)
+         return false;
+      const std::vector<const cgltf_primitive*> primitives = gltf_primitives(parsed);
+      if (chain.levels[level].size() != primitives.size())
+      {
+         cgltf_free(parsed);
+         return false;
+      }
+      std::unordered_map<const cgltf_accessor*, size_t> uses;
+      for (const cgltf_primitive* primitive : primitives)
+         uses[primitive->indices]++;
+      lodSource = source;
+      std::vector<GltfBuffer> buffers = gltf_buffers(lodSource, parsed);
+      std::vector<size_t> indexCounts(primitives.size(), 0);
+      for (size_t i = 0; i < primitives.size(); i++)
+      {
+         const std::vector<uint32_t>& indices = chain.levels[level][i];
+         const cgltf_accessor* accessor = primitives[i]->indices;
+         GltfBuffer* buffer = gltf_accessor_buffer(buffers, parsed, accessor);
+         // Accessors shared by several primitives keep their full index list.
+         if ( (indices.empty()) || (buffer == nullptr) || (uses[accessor] != 1) || (indices.size() > accessor->count) )
+            continue;
+         make_writable(buffer);
+         uint8_t* data = const_cast<uint8_t*>(gltf_accessor_data(*buffer, accessor));
+         write_gltf_indices(data, accessor, indices.data(), indices.size());
+         // Degenerate triangles are never rasterized, and once the index count is set are not even drawn.
+         std::vector<uint32_t> padding(accessor->count - indices.size(), indices.back());
+         write_gltf_indices(data + indices.size() * accessor->stride, accessor, padding.data(), padding.size());
+         indexCounts[i] = indices.size();
+      }
+      replace_gltf_buffers(buffers, lodSource);
+
+      std::vector<size_t> firstPrimitive(parsed->meshes_count, 0);
+      for (size_t m = 1; m < parsed->meshes_count; m++)
+         firstPrimitive[m] = firstPrimitive[m - 1] + parsed->meshes[m - 1].primitives_count;
+      auto visit = [&](const cgltf_node* node)
+      {
+         if (node->mesh != nullptr)
+         {
+            const size_t first = firstPrimitive[node->mesh - parsed->meshes];
+            for (size_t p = 0; p < node->mesh->primitives_count; p++)
+               if (indexCounts[first + p] > 0)
+                  counts.push_back(GltfIndexCount{ entityCount, p, indexCounts[first + p] });
+         }
+         entityCount++;
+      };
+      const cgltf_scene* scene = (parsed->scene != nullptr) ? parsed->scene
+                                                            : ( (parsed->scenes_count > 0) ? parsed->scenes : nullptr );
+      if (scene != nullptr)
+      {
+         for (size_t i = 0; i < scene->nodes_count; i++)
+            visit_gltf_nodes(scene->nodes[i], visit);
+      }
+      else
+      {
+         for (size_t i = 0; i < parsed->nodes_count; i++)
+            if (parsed->nodes[i].parent == nullptr)
+               visit_gltf_nodes(&parsed->nodes[i], visit);
+      }
+      cgltf_free(parsed);
+      return true;
+   }
+
+   void MeshOptimizer::log(const std::string& name, const MeshOptimizeStats& stats)
+   //------------------------------------------------------------------------------
+   {
+      Log logger("MeshOptimizer");
+      const double triangles = (stats.triangles > 0) ? double(stats.triangles) : 1.0;
+      logger.info("{0}: {1} primitives optimized ({2} skipped), vertices {3} -> {4} bytes, indices {5} -> {6} bytes, "
+                  "ACMR {7:.3f} -> {8:.3f}", name, stats.primitives, stats.skipped, stats.vertexBytesBefore,
+                  stats.vertexBytesAfter, stats.indexBytesBefore, stats.indexBytesAfter, stats.acmrBefore / triangles,
+                  stats.acmrAfter / triangles);
+   }
+
+   void MeshOptimizer::log(const std::string& name, const MeshDecodeStats& stats)
+   //----------------------------------------------------------------------------
+   {
+      Log logger("MeshOptimizer");
+      const double seconds = stats.milliseconds / 1000.0;
+      logger.info("{0}: decoded {1} compressed streams, {2} -> {3} bytes in {4:.2f}ms ({5:.1f} MB/s)", name,
+                  stats.streams, stats.compressedBytes, stats.decodedBytes, stats.milliseconds,
+                  (seconds > 0) ? (stats.decodedBytes / (1024.0 * 1024.0)) / seconds : 0.0);
+   }
+}
@@ -3,23 +3,117 @@
 #include "bulb/Managers.hh"
 #include "bulb/SceneGraph.hh"
 #include "bulb/AssetReader.hh"
+#include "bulb/MaterialCache.hh"
+#include "bulb/MaterialInstancePool.hh"
+#include "bulb/TextureLoader.hh"
+#include "bulb/ThreadPool.hh"
+#include "bulb/AssetPack.hh"
+#include "bulb/MeshOptimizer.hh"
+#include "bulb/Trace.hh"
 #include "Log.hh"
 
 namespace bulb
 {
+   SceneGraph::~SceneGraph()
+   //-----------------------
+   {
+      release_background_material();
+      // Nodes hold assets created by the shared gltf loaders so are destroyed before them.
+      cancel_gltf_loads();
+      root.reset();
+      multiGeometries.clear();
+      nodes.clear();
+      for (SharedGltfLoader* shared : { &gltfGeneratedLoader, &gltfUbershaderLoader })
+      {
+         if (shared->loader)
+            gltfio::AssetLoader::destroy(&shared->loader);
+         if (shared->materials)
+         {
+            shared->materials->destroyMaterials();
+            delete shared->materials;
+         }
+         shared->loader = nullptr;
+         shared->materials = nullptr;
+      }
+      for (SceneView& sceneView : views)
+      {
+         engine->destroy(sceneView.view);
+         if (sceneView.isOwningCamera)
+            engine->destroy(sceneView.camera);
+      }
+      views.clear();
+      if (isOwningTarget)
+      {
+         scenePtr.reset();
+         engine->destroy(renderer);
+         engine->destroy(view);
+         engine->destroy(foregroundCamera);
+         engine->destroy(swapchain);
+      }
+   }
+
+   std::unique_ptr<SceneGraph> SceneGraph::create_headless(Managers& managers, uint32_t width, uint32_t height)
+   //--------------------------------------------------------------------------------------------------------
+   {
+      Log logger("SceneGraph::create_headless");
+      std::shared_ptr<filament::Engine> engine = managers.engine;
+      if (! engine)
+      {
+         logger.error("No filament engine");
+         return nullptr;
+      }
+      filament::SwapChain* swapChain = managers.create_swapchain(nullptr, width, height);
+      if (swapChain == nullptr)
+      {
+         logger.error("Error creating {0}x{1} headless swapchain", width, height);
+         return nullptr;
+      }
+      filament::View* view = engine->createView();
+      view->setViewport({0, 0, width, height});
+      filament::Camera* camera = engine->createCamera();
+      camera->setProjection(45, double(width) / double(std::max(height, 1u)), 0.0625, 1000.0);
+      view->setCamera(camera);
+      std::unique_ptr<SceneGraph> graph(new SceneGraph(managers, swapChain, view));
+      graph->isOwningTarget = true;
+      return graph;
+   }
+
+   gltfio::AssetLoader* SceneGraph::get_gltf_loader(bool bestShaders)
+   //----------------------------------------------------------------
+   {
+      const bool isUbershader = ( (isGltfUbershader) && (! bestShaders) );
+      SharedGltfLoader& shared = (isUbershader) ? gltfUbershaderLoader : gltfGeneratedLoader;
+      if (shared.loader == nullptr)
+      {
+         shared.materials = (isUbershader) ? gltfio::createUbershaderLoader(engine.get())
+                                           : gltfio::createMaterialGenerator(engine.get());
+         shared.loader = gltfio::AssetLoader::create({engine.get(), shared.materials});
+      }
+      return shared.loader;
+   }
+
 
    bool bulb::SceneGraph::render(PostRenderCallback postRender, void* postRenderParams)
    //-------------------------------------------------------------------------------------------
    {
       if (isUpdating.load())
          return false;
+      BULB_TRACE_SCOPE("SceneGraph::render");
+      FrameTimes frameTimes;
+      PhaseTimer timer(frameTimes);
+      if (update_gltf_loads())
+         dirty = true;
+      timer.lap(FramePhase::MUTATIONS);
       std::unique_ptr<RenderVisitor> v(new RenderVisitor);
       std::vector<utils::Entity>& renderables = v->renderables;
       if (dirty)
       {
+         BULB_TRACE_SCOPE("scene rebuild");
          if (scenePtr->getRenderableCount() > 0)
          {
             view->setScene(nullptr);
+            for (SceneView& sceneView : views)
+               sceneView.view->setScene(nullptr);
             scenePtr.reset(engine->createScene(), SceneDeleter(engine));
          }
          if (!sun.isNull())
@@ -32,38 +126,141 @@ namespace bulb
                              renderables.push_back(pp.second);
                           });
          }
-         root->traverse(v.get());
+         timer.lap(FramePhase::SCENE_REBUILD);
+         {
+            BULB_TRACE_SCOPE("traversal");
+            root->traverse(v.get());
+         }
+         const uint32_t preRender = PhaseTimer::micros(v->preRenderTime);
+         timer.lap(FramePhase::TRAVERSAL);
+         frameTimes[FramePhase::PRE_RENDER] = preRender;
+         frameTimes[FramePhase::TRAVERSAL] -= std::min(preRender, frameTimes[FramePhase::TRAVERSAL]);
          scenePtr->addEntities(renderables.data(), renderables.size());
          view->setScene(scenePtr.get());
          view->setCamera(foregroundCamera);
+         for (SceneView& sceneView : views)
+            sceneView.view->setScene(scenePtr.get());
          for (std::weak_ptr<SceneCallback> listener : scene_listeners)
          {
             auto splistener = listener.lock();
             if (splistener) splistener->operator()(scenePtr.get(), view);
          }
          dirty = false;
+         timer.lap(FramePhase::SCENE_REBUILD);
       }
-      if (renderer->beginFrame(swapchain))
+      {
+         BULB_TRACE_SCOPE("texture uploads");
+         managers.texture_loader().update(engine.get(), textureUploadBudget);
+      }
+      if (backgroundStream)
+      {
+         filament::Texture* frame = backgroundStream->update();
+         if (frame != nullptr)
+         {
+            backgroundTexture = frame;
+            backgroundMaterialInstance->setParameter("albedo", frame, backgroundSampler);
+            backgroundDirty = true;
+         }
+      }
+      timer.lap(FramePhase::MUTATIONS);
+      bool isRendered = renderer->beginFrame(swapchain);
+      timer.lap(FramePhase::BEGIN_FRAME);
+      if (isRendered)
       {
          if (backgroundView != nullptr)
          {
             renderer->render(backgroundView);
             backgroundDirty = false;
+            timer.lap(FramePhase::RENDER_BACKGROUND);
          }
          // /src/Phd/c++/Bulb/filament/filament/src/Renderer.cpp RenderPass.cpp filament/backend/src/opengl/OpenGLDriver.cpp beginRenderPass
-         renderer->render(view);
+         {
+            BULB_TRACE_SCOPE("render view");
+            renderer->render(view);
+         }
+         for (SceneView& sceneView : views)
+         {
+            if (sceneView.isEnabled)
+            {
+               BULB_TRACE_SCOPE("render added view");
+               renderer->render(sceneView.view);
+            }
+         }
+         timer.lap(FramePhase::RENDER_VIEW);
          if (postRender)
+         {
             postRender(engine.get(), view, renderer, scenePtr.get(), postRenderParams);
+            timer.lap(FramePhase::POST_RENDER);
+         }
          renderer->endFrame();
+         timer.lap(FramePhase::END_FRAME);
       }
       else
-      {
          std::cerr << "Skipping frame\n";
-         return false;
+      timer.finish();
+      frameStats.record(frameTimes);
+      return isRendered;
+   }
+
+   filament::View* SceneGraph::add_view(const filament::Viewport& viewport, filament::Camera* camera)
+   //-----------------------------------------------------------------------------------------------
+   {
+      Log logger("SceneGraph::add_view");
+      filament::View* added = engine->createView();
+      if (added == nullptr)
+      {
+         logger.error("Error creating view");
+         return nullptr;
       }
+      const bool isOwningCamera = (camera == nullptr);
+      if (isOwningCamera)
+      {
+         camera = engine->createCamera();
+         camera->setProjection(45, double(viewport.width) / double(std::max(viewport.height, 1u)), 0.0625, 1000.0);
+      }
+      added->setViewport(viewport);
+      added->setCamera(camera);
+      added->setScene(scenePtr.get());
+      views.push_back(SceneView{ added, camera, isOwningCamera, true });
+      return added;
+   }
+
+   bool SceneGraph::remove_view(filament::View* removed)
+   //---------------------------------------------------
+   {
+      auto it = std::find_if(views.begin(), views.end(),
+                             [removed](const SceneView& sceneView) -> bool { return sceneView.view == removed; });
+      if (it == views.end())
+         return false;
+      engine->destroy(it->view);
+      if (it->isOwningCamera)
+         engine->destroy(it->camera);
+      views.erase(it);
       return true;
    }
 
+   bool SceneGraph::set_view_enabled(filament::View* enabled, bool isEnabled)
+   //------------------------------------------------------------------------
+   {
+      auto it = std::find_if(views.begin(), views.end(),
+                             [enabled](const SceneView& sceneView) -> bool { return sceneView.view == enabled; });
+      if (it == views.end())
+         return false;
+      it->isEnabled = isEnabled;
+      return true;
+   }
+
+   bool bulb::SceneGraph::run_frame(FrameScheduler& scheduler, PostRenderCallback postRender, void* postRenderParams)
+   //--------------------------------------------------------------------------------------------------------------
+   {
+      return scheduler.run_frame([this, &scheduler, &postRender, postRenderParams]() -> bool
+      {
+         animate_keyframes(scheduler.interpolated_time());
+         animate_gltf(static_cast<float>(scheduler.frame_delta()));
+         return render(postRender, postRenderParams);
+      });
+   }
+
    bool bulb::SceneGraph::start_updating()
 //-------------------------------------
    {
@@ -84,6 +281,9 @@ namespace bulb
       {
          if (isReplace)
          {
+            cancel_gltf_loads();
+            keyframes.clear();
+            multiGeometries.clear();
             nodes.clear();
             root.reset();
          }
@@ -210,7 +410,7 @@ namespace bulb
    bulb::Material* SceneGraph::make_material(const char* name, filament::Material* material)
    //---------------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::Material> node = std::make_unique<bulb::Material>(material, name);
+      std::unique_ptr<bulb::Material> node = std::make_unique<bulb::Material>(managers, material, name);
       nodes.emplace_back(std::move(node));
       auto m = dynamic_cast<bulb::Material*>(nodes.back().get());
       if (m == nullptr)
@@ -224,7 +424,7 @@ namespace bulb
    bulb::Material* SceneGraph::make_material(const char* name, const void* data, size_t datasize)
    //--------------------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::Material> node = std::make_unique<bulb::Material>(data, datasize, name);
+      std::unique_ptr<bulb::Material> node = std::make_unique<bulb::Material>(managers, data, datasize, name);
       nodes.emplace_back(std::move(node));
       auto m = dynamic_cast<bulb::Material*>(nodes.back().get());
       if (m == nullptr)
@@ -238,7 +438,7 @@ namespace bulb
    bulb::Material* SceneGraph::make_material(const char* name, const char* filename)
    //--------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::Material> node = std::make_unique<bulb::Material>(name);
+      std::unique_ptr<bulb::Material> node = std::make_unique<bulb::Material>(managers, name);
       if (!node->open(filename, name))
          return nullptr;
       nodes.emplace_back(std::move(node));
@@ -251,13 +451,23 @@ namespace bulb
       return m;
    }
 
+   bool SceneGraph::is_same_context(const Managers* context, const char* caller)
+   //--------------------------------------------------------------------------
+   {
+      if (context == &managers)
+         return true;
+      Log logger(caller);
+      logger.error("The node was created in a different Managers context (engine) to the scene graph");
+      return false;
+   }
+
    bool SceneGraph::adopt_material(bulb::Material* materialNode)
    //-----------------------------------------------------------
    {
       auto it = std::find_if(nodes.begin(), nodes.end(),
                              [materialNode](const std::unique_ptr<Node>& n) -> bool
                              { return n.get() == materialNode; });
-      if (it == std::end(nodes))
+      if ( (it == std::end(nodes)) && (is_same_context(&materialNode->get_managers(), "SceneGraph::adopt_material")) )
       {
          std::unique_ptr<bulb::Material> node(materialNode);
          nodes.emplace_back(std::move(node));
@@ -276,7 +486,7 @@ namespace bulb
    SceneGraph::make_geometry(const char* name, filament::Material* defaultMaterial, Transform* internalTransform)
    //-------------------------------------------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::Geometry> node = std::make_unique<bulb::Geometry>(name, defaultMaterial, internalTransform);
+      std::unique_ptr<bulb::Geometry> node = std::make_unique<bulb::Geometry>(managers, name, defaultMaterial, internalTransform);
       nodes.emplace_back(std::move(node));
       auto renderable = dynamic_cast<Geometry*>(nodes.back().get());
       if (renderable == nullptr)
@@ -292,7 +502,7 @@ namespace bulb
       auto it = std::find_if(nodes.begin(), nodes.end(),
                              [geometry](const std::unique_ptr<Node>& n) -> bool
                              { return n.get() == geometry; });
-      if (it == std::end(nodes))
+      if ( (it == std::end(nodes)) && (is_same_context(&geometry->get_managers(), "SceneGraph::adopt_geometry")) )
       {
          std::unique_ptr<bulb::Node> node(geometry);
          nodes.emplace_back(std::move(node));
@@ -311,42 +521,317 @@ namespace bulb
    SceneGraph::make_multi_geometry(const char* name, filament::Material* defaultMaterial, Transform* internalTransform)
    //------------------------------------------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::MultiGeometry> node = std::make_unique<bulb::MultiGeometry>(name, defaultMaterial, internalTransform);
+      std::unique_ptr<bulb::MultiGeometry> node = std::make_unique<bulb::MultiGeometry>(managers, name, defaultMaterial,
+                                                                                          internalTransform);
       nodes.emplace_back(std::move(node));
       auto renderable = dynamic_cast<MultiGeometry*>(nodes.back().get());
       if (renderable == nullptr)
          return nullptr;
+      multiGeometries.push_back(renderable);
       if (! renderable->get_name().empty())
          nodesByName[renderable->get_name()] = renderable;
       return renderable;
    }
 
+   std::string SceneGraph::gltf_key(const char* gltfAssetPath, bool bestShaders)
+   //--------------------------------------------------------------------------
+   {
+      // Assets created with different loaders (and so materials) are not interchangeable.
+      std::string key = AssetPack::normalize(gltfAssetPath);
+      if ( (isGltfUbershader) && (! bestShaders) )
+         key += "#ubershader";
+      return key;
+   }
+
+   std::shared_ptr<GltfAsset> SceneGraph::find_cached_gltf(const std::string& key)
+   //-----------------------------------------------------------------------------
+   {
+      auto it = gltfCache.find(key);
+      if (it == gltfCache.end())
+         return nullptr;
+      std::vector<std::weak_ptr<GltfAsset>>& assets = it->second;
+      std::shared_ptr<GltfAsset> found;
+      for (auto ait = assets.begin(); ait != assets.end();)
+      {
+         std::shared_ptr<GltfAsset> asset = ait->lock();
+         if (! asset)
+            ait = assets.erase(ait);
+         else
+         {
+            if ( (! found) && (asset->free_instances() > 0) )
+               found = asset;
+            ++ait;
+         }
+      }
+      if (assets.empty())
+         gltfCache.erase(it);
+      return found;
+   }
+
+   size_t SceneGraph::gltf_instance_count(const char* gltfAssetPath, size_t required)
+   //--------------------------------------------------------------------------------
+   {
+      auto it = gltfInstances.find(AssetPack::normalize(gltfAssetPath));
+      return std::max(required, (it == gltfInstances.end()) ? size_t(1) : it->second);
+   }
+
+   std::string SceneGraph::gltf_lod_key(const std::string& key, size_t level)
+   //------------------------------------------------------------------------
+   {
+      return key + "#lod" + std::to_string(gltfLodRatios[level]);
+   }
+
+   std::vector<std::shared_ptr<GltfAsset>> SceneGraph::find_cached_gltf_lods(const std::string& key)
+   //-----------------------------------------------------------------------------------------------
+   {
+      std::vector<std::shared_ptr<GltfAsset>> levels;
+      for (size_t level = 0; level < gltfLodRatios.size(); level++)
+      {
+         std::shared_ptr<GltfAsset> asset = find_cached_gltf(gltf_lod_key(key, level));
+         if (! asset)
+            break;
+         levels.push_back(asset);
+      }
+      return levels;
+   }
+
+   std::vector<std::shared_ptr<GltfAsset>> SceneGraph::create_gltf_lods(const GltfSource& source, const LodChain& chain,
+                                                                        const std::string& key, size_t instanceCount,
+                                                                        bool isAsync, bool bestShaders)
+   //------------------------------------------------------------------------------------------------------------------
+   {
+      std::vector<std::shared_ptr<GltfAsset>> levels = GltfAsset::create_lods(managers, source, chain, instanceCount,
+                                                                              isAsync, get_gltf_loader(bestShaders));
+      for (size_t level = 0; level < std::min(levels.size(), gltfLodRatios.size()); level++)
+      {
+         gltfCache[gltf_lod_key(key, level)].push_back(levels[level]);
+         if (levels[level]->is_loading())
+         {
+            std::lock_guard<std::mutex> lock(gltfMutex);
+            gltfUpdates.push_back(levels[level]);
+         }
+      }
+      return levels;
+   }
+
+   void SceneGraph::set_gltf_instances(const char* gltfAssetPath, size_t count)
+   //--------------------------------------------------------------------------
+   {
+      if (gltfAssetPath != nullptr)
+         gltfInstances[AssetPack::normalize(gltfAssetPath)] = std::max(count, size_t(1));
+   }
+
    bulb::MultiGeometry* SceneGraph::make_multi_geometry(const char* name, const char* gltfAssetPath, Transform* internalTransform,
                                                         bool normalized, bool bestShaders)
    //------------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::MultiGeometry> node = std::make_unique<bulb::MultiGeometry>(name, nullptr, internalTransform);
-      if (! node->open_gltf(gltfAssetPath, normalized, bestShaders))
+      if (gltfAssetPath == nullptr)
+         return nullptr;
+      const std::string key = gltf_key(gltfAssetPath, bestShaders);
+      std::shared_ptr<GltfAsset> asset = find_cached_gltf(key);
+      std::vector<std::shared_ptr<GltfAsset>> levels;
+      if (! asset)
+      {
+         GltfSource source;
+         if (! GltfAsset::read(gltfAssetPath, source, isMeshOptimized))
+            return nullptr;
+         const size_t instanceCount = gltf_instance_count(gltfAssetPath, 1);
+         asset = GltfAsset::create(managers, source, instanceCount, false, get_gltf_loader(bestShaders));
+         if (! asset)
+            return nullptr;
+         gltfCache[key].push_back(asset);
+         LodChain chain;
+         if ( (! gltfLodRatios.empty()) && (MeshOptimizer::gltf_lods(source, gltfLodRatios, chain)) )
+            levels = create_gltf_lods(source, chain, key, instanceCount, false, bestShaders);
+      }
+      else
+         levels = find_cached_gltf_lods(key);
+      std::unique_ptr<bulb::MultiGeometry> node = std::make_unique<bulb::MultiGeometry>(managers, name, nullptr, internalTransform);
+      if (! node->attach_gltf(asset, normalized))
       {
          node.reset();
          return nullptr;
       }
+      if (! levels.empty())
+         node->attach_gltf_lods(levels);
       nodes.emplace_back(std::move(node));
       auto renderable = dynamic_cast<MultiGeometry*>(nodes.back().get());
       if (renderable == nullptr)
          return nullptr;
+      multiGeometries.push_back(renderable);
       if (! renderable->get_name().empty())
          nodesByName[renderable->get_name()] = renderable;
       return renderable;
    }
 
+   bulb::MultiGeometry* SceneGraph::make_multi_geometry_async(const char* name, const char* gltfAssetPath,
+                                                              Transform* internalTransform, bool normalized,
+                                                              bool bestShaders, GltfCallback callback)
+   //-----------------------------------------------------------------------------------------------------------
+   {
+      if (gltfAssetPath == nullptr)
+         return nullptr;
+      bulb::MultiGeometry* renderable = make_multi_geometry(name, static_cast<filament::Material*>(nullptr),
+                                                            internalTransform);
+      if (renderable == nullptr)
+         return nullptr;
+      const std::string key = gltf_key(gltfAssetPath, bestShaders);
+      std::shared_ptr<GltfAsset> asset = find_cached_gltf(key);
+      if ( (asset) && (renderable->attach_gltf(asset, normalized)) )
+      {
+         renderable->attach_gltf_lods(find_cached_gltf_lods(key));
+         dirty = true;
+         if (callback)
+            callback(renderable, true);
+         return renderable;
+      }
+      std::lock_guard<std::mutex> lock(gltfMutex);
+      // Repeat loads of a path which is still being read become further instances of the same asset.
+      auto it = std::find_if(gltfLoads.begin(), gltfLoads.end(),
+                             [&key](const GltfLoad& load) -> bool { return (load.key == key); });
+      if (it != gltfLoads.end())
+      {
+         it->geometries.push_back(renderable);
+         it->alive.push_back(renderable->liveness());
+         it->normalized.push_back(normalized);
+         it->callbacks.push_back(std::move(callback));
+         return renderable;
+      }
+      auto source = std::make_shared<GltfSource>();
+      source->path = gltfAssetPath;
+      std::shared_ptr<LodChain> lods = (gltfLodRatios.empty()) ? nullptr : std::make_shared<LodChain>();
+      std::string path(gltfAssetPath);
+      const bool isOptimized = isMeshOptimized;
+      const std::vector<float> ratios = gltfLodRatios;
+      std::future<bool> read = ThreadPool::workers().submit([source, lods, path, isOptimized, ratios]() -> bool
+      {
+         if (! GltfAsset::read(path.c_str(), *source, isOptimized))
+            return false;
+         if ( (lods) && (! MeshOptimizer::gltf_lods(*source, ratios, *lods)) )
+            lods->levels.clear();
+         return true;
+      });
+      GltfLoad load;
+      load.key = key;
+      load.source = source;
+      load.lods = lods;
+      load.read = std::move(read);
+      load.bestShaders = bestShaders;
+      load.geometries.push_back(renderable);
+      load.alive.push_back(renderable->liveness());
+      load.normalized.push_back(normalized);
+      load.callbacks.push_back(std::move(callback));
+      gltfLoads.push_back(std::move(load));
+      return renderable;
+   }
+
+   bool SceneGraph::update_gltf_loads()
+   //----------------------------------
+   {
+      auto start = std::chrono::high_resolution_clock::now();
+      auto is_over_budget = [this, &start]() -> bool
+      {
+         return ( (gltfLoadBudget > 0) &&
+                  (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() -
+                                                                         start).count() >= (long) gltfLoadBudget) );
+      };
+      bool isChanged = false;
+      {
+         std::lock_guard<std::mutex> lock(gltfMutex);
+         for (auto it = gltfUpdates.begin(); it != gltfUpdates.end();)
+         {
+            std::shared_ptr<GltfAsset> asset = it->lock();
+            if ( (! asset) || (asset->update()) )
+               it = gltfUpdates.erase(it);
+            else
+               ++it;
+         }
+      }
+      // At least one asset is created per call, further ones only while within the budget.
+      do
+      {
+         GltfLoad load;
+         {
+            std::lock_guard<std::mutex> lock(gltfMutex);
+            auto it = std::find_if(gltfLoads.begin(), gltfLoads.end(), [](const GltfLoad& l) -> bool
+                                   { return (l.read.wait_for(std::chrono::seconds(0)) == std::future_status::ready); });
+            if (it == gltfLoads.end())
+               break;
+            load = std::move(*it);
+            gltfLoads.erase(it);
+         }
+         // Nodes destroyed while the asset was being read are skipped. Nodes are only destroyed on the render thread,
+         // so each is checked again just before it is used in case an earlier callback destroyed it.
+         auto is_alive = [&load](size_t i) -> bool { return load.alive[i]->load(std::memory_order_relaxed); };
+         size_t liveCount = 0;
+         for (size_t i = 0; i < load.geometries.size(); i++)
+         {
+            if (is_alive(i))
+               liveCount++;
+         }
+         if (liveCount == 0)
+            continue;
+         std::shared_ptr<GltfAsset> asset;
+         std::vector<std::shared_ptr<GltfAsset>> levels;
+         const size_t instanceCount = gltf_instance_count(load.source->path.c_str(), liveCount);
+         if (load.read.get())
+            asset = GltfAsset::create(managers, *load.source, instanceCount, true,
+                                      get_gltf_loader(load.bestShaders));
+         if (asset)
+         {
+            gltfCache[load.key].push_back(asset);
+            if (asset->is_loading())
+            {
+               std::lock_guard<std::mutex> lock(gltfMutex);
+               gltfUpdates.push_back(asset);
+            }
+            if ( (load.lods) && (load.lods->level_count() > 0) )
+               levels = create_gltf_lods(*load.source, *load.lods, load.key, instanceCount, true, load.bestShaders);
+         }
+         for (size_t i = 0; i < load.geometries.size(); i++)
+         {
+            if (! is_alive(i))
+               continue;
+            bulb::MultiGeometry* geometry = load.geometries[i];
+            bool isLoaded = ( (asset) && (geometry->attach_gltf(asset, load.normalized[i])) );
+            if ( (isLoaded) && (! levels.empty()) )
+               geometry->attach_gltf_lods(levels);
+            if (isLoaded)
+               isChanged = true;
+            else
+            {
+               Log logger("SceneGraph::update_gltf_loads");
+               logger.error("Error loading {0} for {1}", load.source->path, geometry->get_name());
+            }
+            if (load.callbacks[i])
+               load.callbacks[i](geometry, isLoaded);
+         }
+      } while (! is_over_budget());
+      return isChanged;
+   }
+
+   void SceneGraph::cancel_gltf_loads()
+   //----------------------------------
+   {
+      std::lock_guard<std::mutex> lock(gltfMutex);
+      gltfLoads.clear(); // Reads still running complete into their (shared) sources which are then released
+      gltfUpdates.clear();
+   }
+
+   size_t SceneGraph::pending_gltf_loads()
+   //-------------------------------------
+   {
+      std::lock_guard<std::mutex> lock(gltfMutex);
+      return gltfLoads.size() + gltfUpdates.size();
+   }
+
    bool SceneGraph::adopt_multi_geometry(bulb::MultiGeometry* geometry)
    //--------------------------------------------------------------------
    {
       auto it = std::find_if(nodes.begin(), nodes.end(),
                              [geometry](const std::unique_ptr<Node>& n) -> bool
                              { return n.get() == geometry; });
-      if (it == std::end(nodes))
+      if ( (it == std::end(nodes)) && (is_same_context(&geometry->get_managers(), "SceneGraph::adopt_multi_geometry")) )
       {
          std::unique_ptr<bulb::Node> node(geometry);
          nodes.emplace_back(std::move(node));
@@ -354,6 +839,7 @@ namespace bulb
          auto renderable = dynamic_cast<MultiGeometry*>(nodes.back().get());
          if (renderable == nullptr)
             return false;
+         multiGeometries.push_back(renderable);
          if (! renderable->get_name().empty())
             nodesByName[renderable->get_name()] = renderable;
          return true;
@@ -367,8 +853,8 @@ namespace bulb
                               float efficiency, float fade, bool hasShadows)
    //----------------------------------------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::PositionalLight> node = std::make_unique<bulb::PositionalLight>(name, color, initialPosition,
-         direction, cone, intensity, efficiency, fade, hasShadows);
+      std::unique_ptr<bulb::PositionalLight> node = std::make_unique<bulb::PositionalLight>(managers, name, color,
+         initialPosition, direction, cone, intensity, efficiency, fade, hasShadows);
       nodes.emplace_back(std::move(node));
       auto light = dynamic_cast<PositionalLight*>(nodes.back().get());
       if  ( (light) && (! light->get_name().empty()) )
@@ -382,8 +868,8 @@ namespace bulb
                                bool hasShadows)
    //---------------------------------------------------------------------------------------------------------------
    {
-      std::unique_ptr<bulb::PositionalLight> node = std::make_unique<bulb::PositionalLight>(name, color, initialPosition,
-            direction, intensity, efficiency, fade, hasShadows);
+      std::unique_ptr<bulb::PositionalLight> node = std::make_unique<bulb::PositionalLight>(managers, name, color,
+            initialPosition, direction, intensity, efficiency, fade, hasShadows);
       nodes.emplace_back(std::move(node));
       auto light = dynamic_cast<PositionalLight*>(nodes.back().get());
       if  ( (light) && (! light->get_name().empty()) )
@@ -397,7 +883,7 @@ namespace bulb
       auto it = std::find_if(nodes.begin(), nodes.end(),
                              [light](const std::unique_ptr<Node>& n) -> bool
                              { return n.get() == light; });
-      if (it == std::end(nodes))
+      if ( (it == std::end(nodes)) && (is_same_context(&light->get_managers(), "SceneGraph::adopt_light")) )
       {
          std::unique_ptr<bulb::Node> node(light);
          nodes.emplace_back(std::move(node));
@@ -413,8 +899,8 @@ namespace bulb
                             bool hasShadows, float angularRadius, float haloSize, float falloff)
    //--------------------------------------------------------------------------------------------------------------------
    {
-      utils::EntityManager& entityManager = Managers::instance().entityManager;
-      filament::LightManager& lightManager = Managers::instance().lightManager;
+      utils::EntityManager& entityManager = managers.entityManager;
+      filament::LightManager& lightManager = managers.lightManager;
       if (!sun.isNull())
       {
          lightManager.destroy(sun);
@@ -424,7 +910,7 @@ namespace bulb
       filament::LightManager::Builder(filament::LightManager::Type::SUN)
             .color(color).intensity(intensity).direction(direction).castShadows(hasShadows)
             .sunAngularRadius(angularRadius).sunHaloSize(haloSize).sunHaloFalloff(falloff)
-            .build(*Managers::instance().engine, sun);
+            .build(*managers.engine, sun);
       dirty = true;
       return sun;
    }
@@ -436,8 +922,8 @@ namespace bulb
       {
          if (scenePtr)
             scenePtr->remove(sun);
-         Managers::instance().lightManager.destroy(sun);
-         Managers::instance().entityManager.destroy(sun);
+         managers.lightManager.destroy(sun);
+         managers.entityManager.destroy(sun);
          dirty = true;
       }
    }
@@ -447,8 +933,8 @@ namespace bulb
                                      float intensity, bool hasShadows)
    //-----------------------------------------------------------------------------------------------------------
    {
-      utils::EntityManager& entityManager = Managers::instance().entityManager;
-      filament::LightManager& lightManager = Managers::instance().lightManager;
+      utils::EntityManager& entityManager = managers.entityManager;
+      filament::LightManager& lightManager = managers.lightManager;
       std::string sname(name);
       auto it = directional_lights.find(sname);
       if (it != directional_lights.end())
@@ -462,7 +948,7 @@ namespace bulb
       utils::Entity& light = directional_lights[sname];
       filament::LightManager::Builder(filament::LightManager::Type::DIRECTIONAL)
             .color(color).intensity(intensity).direction(direction).castShadows(hasShadows)
-            .build(*Managers::instance().engine, light);
+            .build(*managers.engine, light);
       dirty = true;
       return light;
    }
@@ -475,8 +961,8 @@ namespace bulb
       if (it != directional_lights.end())
       {
          utils::Entity& light = it->second;
-         Managers::instance().lightManager.destroy(light);
-         Managers::instance().entityManager.destroy(light);
+         managers.lightManager.destroy(light);
+         managers.entityManager.destroy(light);
          directional_lights.erase(it);
          dirty = true;
       }
@@ -486,14 +972,8 @@ namespace bulb
    //--------------------------------------------------------------------------------------------------------------
    {
       bulb::Log logger("SceneGraph::set_background");
-      bulb::AssetReader& reader = bulb::AssetReader::instance();
-      std::vector<char> materialData;
-      if (! reader.read_asset_vector("assets/bakedTexture", materialData))
-      {
-         logger.error("Error reading assets/bakedTexture");
-         return nullptr;
-      }
-      backgroundMaterial = filament::Material::Builder().package(materialData.data(), materialData.size()).build(*engine);
+      release_background_material();
+      backgroundMaterial = managers.material_cache().acquire("assets/bakedTexture");
       if (backgroundMaterial == nullptr)
       {
          logger.error("Error creating background material using assets/bakedTexture");
@@ -537,7 +1017,9 @@ namespace bulb
          logger.error("Error creating background texture.");
          return nullptr;
       }
-      filament::MaterialInstance* materialInstance = backgroundMaterial->getDefaultInstance();
+      // The material may be shared through the cache so the background texture is set on a private instance
+      backgroundMaterialInstance = managers.material_instances().acquire(backgroundMaterial);
+      filament::MaterialInstance* materialInstance = backgroundMaterialInstance;
       struct TexVertex3D
       {
          filament::math::float3 position;
@@ -580,7 +1062,7 @@ namespace bulb
                   delete[] data;
                }
             }));
-      background = Managers::instance().entityManager.create();
+      background = managers.entityManager.create();
       materialInstance->setParameter("albedo", backgroundTexture, backgroundSampler);
       filament::RenderableManager::Builder(1).boundingBox({{ -1, -1, -1 }, { 1, 1, 1 }}).material(0, materialInstance)
             .geometry(0, filament::RenderableManager::PrimitiveType::TRIANGLES, backgroundVertexBuf,
@@ -595,6 +1077,30 @@ namespace bulb
       return (backgroundTexture);
    }
 
+   void SceneGraph::release_background_material()
+   //--------------------------------------------
+   {
+      if (! background.isNull())
+      {
+         if (backgroundScenePtr)
+            backgroundScenePtr->remove(background);
+         engine->destroy(background);
+         managers.entityManager.destroy(background);
+         background.clear();
+      }
+      if (backgroundMaterialInstance != nullptr)
+         managers.material_instances().release(backgroundMaterialInstance, true);
+      backgroundMaterialInstance = nullptr;
+      if (backgroundMaterial != nullptr)
+         managers.material_cache().release(backgroundMaterial);
+      backgroundMaterial = nullptr;
+      if (backgroundStream)
+      {
+         backgroundTexture = nullptr; // One of the ring textures
+         backgroundStream.reset();
+      }
+   }
+
    bool SceneGraph::set_background_image(unsigned char* data, uint32_t width, uint32_t height, uint32_t channels,
                                          filament::backend::BufferDescriptor::Callback dataDeletor)
    //--------------------------------------------------------------------------------------
@@ -608,6 +1114,33 @@ namespace bulb
 
    }
 
+   filament::Texture* SceneGraph::set_background_stream(uint32_t width, uint32_t height, size_t maxPending,
+                                                        filament::TextureSampler sampler)
+   //----------------------------------------------------------------------------------------------------
+   {
+      bulb::Log logger("SceneGraph::set_background_stream");
+      if (set_background(width, height, sampler) == nullptr)
+         return nullptr;
+      std::unique_ptr<StreamingTexture> stream(new StreamingTexture(*engine, width, height, maxPending));
+      if (! stream->is_valid())
+      {
+         logger.error("Error creating the {0}x{1} background texture ring", width, height);
+         return nullptr;
+      }
+      engine->destroy(backgroundTexture); // Replaced by the ring
+      backgroundStream = std::move(stream);
+      backgroundTexture = backgroundStream->current();
+      backgroundMaterialInstance->setParameter("albedo", backgroundTexture, backgroundSampler);
+      return backgroundTexture;
+   }
+
+   bool SceneGraph::submit_background_frame(const void* rgba, size_t size)
+   //---------------------------------------------------------------------
+   {
+      StreamingTexture* stream = backgroundStream.get();
+      return (stream != nullptr) && (stream->submit(rgba, size));
+   }
+
    std::vector<bulb::Transform*> SceneGraph::get_animated_transforms()
    //----------------------------------------------------------------
    {
@@ -617,6 +1150,67 @@ namespace bulb
       return result;
    }
 
+   bool SceneGraph::animate_keyframes(double time)
+   //---------------------------------------------
+   {
+      if ( (keyframes.empty()) || (! start_updating()) )
+         return false;
+      keyframes.evaluate(time);
+      end_updating(true);
+      return true;
+   }
+
+   size_t SceneGraph::animate_gltf(float dt, bool isParallel)
+   //--------------------------------------------------------
+   {
+      std::vector<bulb::MultiGeometry*> animated, blended;
+      for (bulb::MultiGeometry* geometry : multiGeometries)
+         if (geometry->is_animated())
+            animated.push_back(geometry);
+      if (animated.empty())
+         return 0;
+      filament::TransformManager& tm = managers.transformManager;
+      // World transforms are updated once for all the local transforms set by the animators.
+      tm.openLocalTransformTransaction();
+      for (bulb::MultiGeometry* geometry : animated)
+      {
+         geometry->advance_animations(dt);
+         if (geometry->apply_animations())
+            blended.push_back(geometry);
+      }
+      if ( (isParallel) && (blended.size() > 1) )
+         ThreadPool::workers().parallel_for(0, blended.size(), [&blended](size_t first, size_t last)
+         {
+            for (size_t i = first; i < last; i++)
+               blended[i]->blend_animations();
+         });
+      else
+         for (bulb::MultiGeometry* geometry : blended)
+            geometry->blend_animations();
+      for (bulb::MultiGeometry* geometry : blended)
+         geometry->store_animations();
+      tm.commitLocalTransformTransaction();
+
+      // Bone matrices are derived from the world transforms so are updated after the commit, and only for assets
+      // which may be visible in one of the views.
+      using Frustum = decltype(foregroundCamera->getFrustum());
+      std::vector<Frustum> frustums{ foregroundCamera->getFrustum() };
+      for (const SceneView& sceneView : views)
+      {
+         if (sceneView.isEnabled)
+            frustums.push_back(sceneView.camera->getFrustum());
+      }
+      for (bulb::MultiGeometry* geometry : animated)
+      {
+         filament::Box bounds;
+         if ( (! geometry->world_bounds(bounds)) ||
+              (std::any_of(frustums.begin(), frustums.end(),
+                           [&bounds](const Frustum& frustum) { return frustum.intersects(bounds); })) )
+            geometry->update_bones();
+      }
+      return animated.size();
+   }
+
    bulb::Node* SceneGraph::get_node(std::string name)
    //-----------------------------------------------
    {
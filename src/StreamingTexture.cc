@@ -0,0 +1,196 @@
+#include <cstring>
+#include <algorithm>
+
+#include "bulb/StreamingTexture.hh"
+#include "bulb/Trace.hh"
+#include "bulb/Log.hh"
+
+namespace bulb
+{
+   FrameQueue::FrameQueue(size_t maxPendingFrames) : maxPending(std::max(maxPendingFrames, size_t(1)))
+   //-------------------------------------------------------------------------------------------------
+   {
+      pending.reserve(maxPending + 1);
+   }
+
+   uint8_t* FrameQueue::push(uint8_t* staging)
+   //-----------------------------------------
+   {
+      uint8_t* dropped = nullptr;
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending.size() >= maxPending)
+      {
+         dropped = pending.front();
+         pending.erase(pending.begin());
+      }
+      pending.push_back(staging);
+      return dropped;
+   }
+
+   uint8_t* FrameQueue::pop()
+   //------------------------
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending.empty())
+         return nullptr;
+      uint8_t* staging = pending.front();
+      pending.erase(pending.begin());
+      return staging;
+   }
+
+   size_t FrameQueue::size()
+   //-----------------------
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      return pending.size();
+   }
+
+   // Owned by the StreamingTexture and by each upload still held by filament, and deleted (along with the buffers)
+   // by whichever releases it last.
+   struct StreamingTexture::StagingPool
+   {
+      StagingPool(size_t size, size_t capacity) : bufferSize(size) { buffers.reserve(capacity); }
+
+      ~StagingPool()
+      {
+         for (uint8_t* buffer : buffers)
+            delete[] buffer;
+      }
+
+      uint8_t* take()
+      //-------------
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (! buffers.empty())
+            {
+               uint8_t* buffer = buffers.back();
+               buffers.pop_back();
+               return buffer;
+            }
+         }
+         return new uint8_t[bufferSize];
+      }
+
+      void give(uint8_t* buffer)
+      //------------------------
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         buffers.push_back(buffer);
+      }
+
+      static void release(StagingPool* pool)
+      //------------------------------------
+      {
+         if (pool->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete pool;
+      }
+
+      // Invoked by filament once the upload has consumed the buffer.
+      static void uploaded(void* buffer, size_t, void* user)
+      //----------------------------------------------------
+      {
+         StagingPool* pool = static_cast<StagingPool*>(user);
+         pool->give(static_cast<uint8_t*>(buffer));
+         release(pool);
+      }
+
+      const size_t bufferSize;
+      std::mutex mutex;
+      std::vector<uint8_t*> buffers; // Free buffers
+      std::atomic<size_t> references{1};
+   };
+
+   StreamingTexture::StreamingTexture(filament::Engine& filamentEngine, uint32_t width, uint32_t height,
+                                      size_t maxPendingFrames) :
+         engine(filamentEngine), frameWidth(std::max(width, 1u)), frameHeight(std::max(height, 1u)),
+         frameSize(size_t(frameWidth) * frameHeight * 4), queue(maxPendingFrames),
+         pool(new StagingPool(frameSize, RING_SIZE + queue.max_pending() + 1))
+   //----------------------------------------------------------------------------------------------------------
+   {
+      for (size_t i = 0; i < RING_SIZE; i++)
+      {
+         textures[i] = filament::Texture::Builder().width(frameWidth).height(frameHeight).levels(1)
+                                                   .sampler(filament::Texture::Sampler::SAMPLER_2D)
+                                                   .format(filament::Texture::InternalFormat::RGBA8).build(engine);
+         if (textures[i] == nullptr)
+         {
+            Log logger("StreamingTexture");
+            logger.error("Error creating {0}x{1} texture {2} of the ring", frameWidth, frameHeight, i);
+            break;
+         }
+      }
+   }
+
+   StreamingTexture::~StreamingTexture()
+   //-----------------------------------
+   {
+      for (uint8_t* staging = queue.pop(); staging != nullptr; staging = queue.pop())
+         pool->give(staging);
+      for (filament::Texture*& texture : textures)
+      {
+         if (texture != nullptr)
+            engine.destroy(texture);
+         texture = nullptr;
+      }
+      StagingPool::release(pool);
+   }
+
+   uint8_t* StreamingTexture::acquire() { return pool->take(); }
+
+   void StreamingTexture::recycle(uint8_t* staging)
+   //----------------------------------------------
+   {
+      if (staging != nullptr)
+         pool->give(staging);
+   }
+
+   bool StreamingTexture::submit(const void* rgba, size_t size)
+   //----------------------------------------------------------
+   {
+      if ( (rgba == nullptr) || (size != frameSize) )
+      {
+         Log logger("StreamingTexture::submit");
+         logger.error("Frame of {0} bytes submitted, expected {1}x{2} RGBA ({3} bytes)", size, frameWidth,
+                      frameHeight, frameSize);
+         return false;
+      }
+      uint8_t* staging = acquire();
+      std::memcpy(staging, rgba, size);
+      return submit(staging);
+   }
+
+   bool StreamingTexture::submit(uint8_t* staging)
+   //---------------------------------------------
+   {
+      if (staging == nullptr)
+         return false;
+      uint8_t* dropped = queue.push(staging);
+      submittedFrames.fetch_add(1, std::memory_order_relaxed);
+      if (dropped != nullptr)
+      {
+         pool->give(dropped);
+         droppedFrames.fetch_add(1, std::memory_order_relaxed);
+      }
+      return true;
+   }
+
+   filament::Texture* StreamingTexture::update()
+   //-------------------------------------------
+   {
+      if (! is_valid())
+         return nullptr;
+      uint8_t* staging = queue.pop();
+      if (staging == nullptr)
+         return nullptr;
+      BULB_TRACE_SCOPE("streaming texture upload");
+      const size_t next = next_texture(currentTexture);
+      pool->references.fetch_add(1, std::memory_order_relaxed);
+      filament::Texture::PixelBufferDescriptor buffer(staging, frameSize, filament::Texture::Format::RGBA,
+                                                      filament::Texture::Type::UBYTE, &StagingPool::uploaded, pool);
+      textures[next]->setImage(engine, 0, std::move(buffer));
+      currentTexture = next;
+      uploadedFrames.fetch_add(1, std::memory_order_relaxed);
+      return textures[next];
+   }
+}
@@ -0,0 +1,525 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "bulb/TextureLoader.hh"
+#include "bulb/Managers.hh"
+#include "bulb/AssetReader.hh"
+#include "bulb/Log.hh"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+#define TINYEXR_IMPLEMENTATION
+#include "exr/tinyexr.h"
+#pragma GCC diagnostic pop
+
+namespace bulb
+{
+   TextureLoader::TextureLoader(Managers& context) : managers(context) {}
+
+   TextureLoader::~TextureLoader()
+   //-----------------------------
+   {
+      std::unique_lock<std::mutex> lock(mtx);
+      decodedCondition.wait(lock, [this] { return decoding == 0; });
+      for (std::shared_ptr<Entry>& entry : completed)
+         free_levels(*entry);
+      completed.clear();
+      filament::Engine* engine = managers.engine.get();
+      for (auto& pp : entries)
+      {
+         if ( (engine != nullptr) && (pp.second->texture != nullptr) )
+            engine->destroy(pp.second->texture);
+         pp.second->texture = nullptr;
+      }
+      entries.clear();
+   }
+
+   static bool is_exr(const std::string& path)
+   //-----------------------------------------
+   {
+      std::string::size_type p = path.rfind('.');
+      if (p == std::string::npos)
+         return false;
+      std::string ext = path.substr(p + 1);
+      std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+      return (ext == "exr");
+   }
+
+   bool TextureLoader::load(const char* path, TextureCallback callback, bool isSRGB, bool isMipmapped)
+   //-------------------------------------------------------------------------------------------------
+   {
+      if (path == nullptr)
+         return false;
+      std::string spath(path);
+      std::shared_ptr<Entry> entry;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         auto it = entries.find(spath);
+         if (it != entries.end())
+         {
+            Entry& existing = *it->second;
+            existing.references++;
+            if (callback)
+            {
+               existing.callbacks.push_back(std::move(callback));
+               if ( (existing.state == State::READY) || (existing.state == State::FAILED) )
+                  completed.push_back(it->second); // Deliver on the next update
+            }
+            return true;
+         }
+         entry = std::make_shared<Entry>();
+         entry->path = spath;
+         entry->isSRGB = isSRGB;
+         entry->isMipmapped = isMipmapped;
+         entry->references = 1;
+         if (callback)
+            entry->callbacks.push_back(std::move(callback));
+         entries[spath] = entry;
+         decoding++;
+      }
+      ThreadPool::workers().post([this, entry]() { decode(entry); });
+      return true;
+   }
+
+   void TextureLoader::decode(std::shared_ptr<Entry> entry)
+   //------------------------------------------------------
+   {
+      Log logger("TextureLoader::decode");
+      bool isOk = false;
+      std::shared_ptr<AssetView> data = AssetReader::instance().map_asset(entry->path.c_str());
+      if ( (! data) || (data->empty()) )
+         logger.error("Error reading image file {0}", entry->path);
+      else if (is_exr(entry->path))
+      {
+         float* rgba = nullptr;
+         int w = 0, h = 0;
+         const char* err = nullptr;
+         if (LoadEXRFromMemory(&rgba, &w, &h, data->bytes(), data->size(), &err) == TINYEXR_SUCCESS)
+         {
+            entry->isFloat = true;
+            entry->width = static_cast<uint32_t>(w);
+            entry->height = static_cast<uint32_t>(h);
+            entry->levels.push_back(Level{rgba, size_t(w) * size_t(h) * 4 * sizeof(float)});
+            isOk = true;
+         }
+         else
+         {
+            logger.error("Error decoding EXR image {0}: {1}", entry->path, (err != nullptr) ? err : "");
+            if (err != nullptr)
+               FreeEXRErrorMessage(err);
+         }
+      }
+      else
+      {
+         int w = 0, h = 0, channels = 0;
+         stbi_uc* rgba = stbi_load_from_memory(data->bytes(), static_cast<int>(data->size()), &w, &h, &channels, 4);
+         if (rgba != nullptr)
+         {
+            entry->width = static_cast<uint32_t>(w);
+            entry->height = static_cast<uint32_t>(h);
+            entry->levels.push_back(Level{rgba, size_t(w) * size_t(h) * 4});
+            isOk = true;
+         }
+         else
+            logger.error("Error decoding image {0}: {1}", entry->path, stbi_failure_reason());
+      }
+      data.reset();
+
+      if ( (isOk) && (entry->isMipmapped) )
+      {
+         uint8_t count = mip_levels(entry->width, entry->height);
+         uint32_t w = entry->width, h = entry->height;
+         const size_t pixelSize = (entry->isFloat) ? 4 * sizeof(float) : 4;
+         ThreadPool& pool = ThreadPool::workers();
+         for (uint8_t level = 1; level < count; level++)
+         {
+            uint32_t lw = std::max(1u, w / 2), lh = std::max(1u, h / 2);
+            size_t size = size_t(lw) * size_t(lh) * pixelSize;
+            void* dst = malloc(size);
+            if (dst == nullptr)
+            {
+               logger.error("Out of memory generating mip level {0} of {1}", level, entry->path);
+               break;
+            }
+            const void* src = entry->levels.back().data;
+            if (entry->isFloat)
+               downsample_rgba32f(static_cast<const float*>(src), w, h, static_cast<float*>(dst), &pool);
+            else if (entry->isSRGB)
+               downsample_srgba8(static_cast<const uint8_t*>(src), w, h, static_cast<uint8_t*>(dst), &pool);
+            else
+               downsample_rgba8(static_cast<const uint8_t*>(src), w, h, static_cast<uint8_t*>(dst), &pool);
+            entry->levels.push_back(Level{dst, size});
+            w = lw; h = lh;
+         }
+      }
+
+      std::lock_guard<std::mutex> lock(mtx);
+      entry->state = (isOk) ? State::DECODED : State::FAILED;
+      completed.push_back(entry);
+      decoding--;
+      decodedCondition.notify_all();
+   }
+
+   size_t TextureLoader::update(filament::Engine* engine, uint64_t budgetMicros)
+   //---------------------------------------------------------------------------
+   {
+      if (engine == nullptr)
+         return 0;
+      auto start = std::chrono::steady_clock::now();
+      size_t count = 0;
+      while (true)
+      {
+         if ( (budgetMicros > 0) && (count > 0) &&
+              (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()
+               >= static_cast<long long>(budgetMicros)) )
+            break;
+         std::shared_ptr<Entry> entry;
+         {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (completed.empty())
+               break;
+            entry = completed.front();
+            completed.pop_front();
+            if (entry->isCancelled) // Released before upload
+            {
+               free_levels(*entry);
+               entry->state = State::FAILED;
+               entry->callbacks.clear();
+               continue;
+            }
+         }
+         if (entry->state == State::DECODED)
+         {
+            bool isOk = upload(engine, *entry);
+            count++;
+            std::lock_guard<std::mutex> lock(mtx);
+            entry->state = (isOk) ? State::READY : State::FAILED;
+            if ( (entry->isCancelled) && (entry->texture != nullptr) ) // Released during the upload
+            {
+               engine->destroy(entry->texture);
+               entry->texture = nullptr;
+            }
+         }
+         std::vector<TextureCallback> callbacks;
+         {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (! entry->isCancelled)
+               callbacks.swap(entry->callbacks);
+            else
+               entry->callbacks.clear();
+         }
+         for (TextureCallback& callback : callbacks)
+            callback(entry->path, entry->texture);
+      }
+      return count;
+   }
+
+   size_t TextureLoader::finish(filament::Engine* engine)
+   //----------------------------------------------------
+   {
+      {
+         std::unique_lock<std::mutex> lock(mtx);
+         decodedCondition.wait(lock, [this] { return decoding == 0; });
+      }
+      return update(engine, 0);
+   }
+
+   bool TextureLoader::upload(filament::Engine* engine, Entry& entry)
+   //----------------------------------------------------------------
+   {
+      filament::Texture::InternalFormat format;
+      if (entry.isFloat)
+         format = filament::Texture::InternalFormat::RGBA16F;
+      else
+         format = (entry.isSRGB) ? filament::Texture::InternalFormat::SRGB8_A8 : filament::Texture::InternalFormat::RGBA8;
+      filament::Texture* texture = filament::Texture::Builder().width(entry.width).height(entry.height)
+                                                               .levels(static_cast<uint8_t>(entry.levels.size()))
+                                                               .sampler(filament::Texture::Sampler::SAMPLER_2D)
+                                                               .format(format).build(*engine);
+      if (texture == nullptr)
+      {
+         Log logger("TextureLoader::upload");
+         logger.error("Error creating {0}x{1} texture for {2}", entry.width, entry.height, entry.path);
+         free_levels(entry);
+         return false;
+      }
+      const filament::Texture::Type type = (entry.isFloat) ? filament::Texture::Type::FLOAT
+                                                           : filament::Texture::Type::UBYTE;
+      for (size_t level = 0; level < entry.levels.size(); level++)
+      {
+         Level& l = entry.levels[level];
+         filament::Texture::PixelBufferDescriptor buffer(l.data, l.size, filament::Texture::Format::RGBA, type,
+                                                         [](void* p, size_t size, void* user) { free(p); });
+         l.data = nullptr;
+         texture->setImage(*engine, level, std::move(buffer));
+      }
+      entry.levels.clear();
+      entry.texture = texture;
+      return true;
+   }
+
+   void TextureLoader::free_levels(Entry& entry)
+   //-------------------------------------------
+   {
+      for (Level& level : entry.levels)
+         free(level.data);
+      entry.levels.clear();
+   }
+
+   filament::Texture* TextureLoader::get(const char* path)
+   //-----------------------------------------------------
+   {
+      if (path == nullptr)
+         return nullptr;
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = entries.find(path);
+      if ( (it == entries.end()) || (it->second->state != State::READY) )
+         return nullptr;
+      return it->second->texture;
+   }
+
+   bool TextureLoader::is_loading(const char* path)
+   //----------------------------------------------
+   {
+      if (path == nullptr)
+         return false;
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = entries.find(path);
+      return ( (it != entries.end()) &&
+               ( (it->second->state == State::DECODING) || (it->second->state == State::DECODED) ) );
+   }
+
+   bool TextureLoader::release(const char* path)
+   //--------------------------------------------
+   {
+      if (path == nullptr)
+         return false;
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = entries.find(path);
+      if (it == entries.end())
+         return false;
+      Entry& entry = *it->second;
+      if ( (entry.references > 0) && (--entry.references > 0) )
+         return true;
+      if (entry.texture != nullptr)
+      {
+         filament::Engine* engine = managers.engine.get();
+         if (engine != nullptr)
+            engine->destroy(entry.texture);
+         entry.texture = nullptr;
+      }
+      entry.isCancelled = true; // Pending decodes and callbacks are discarded by update()
+      entries.erase(it);
+      return true;
+   }
+
+   void TextureLoader::clear()
+   //-------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      filament::Engine* engine = managers.engine.get();
+      for (auto& pp : entries)
+      {
+         Entry& entry = *pp.second;
+         entry.references = 0;
+         entry.isCancelled = true;
+         if ( (engine != nullptr) && (entry.texture != nullptr) )
+            engine->destroy(entry.texture);
+         entry.texture = nullptr;
+      }
+      entries.clear();
+   }
+
+   size_t TextureLoader::pending()
+   //-----------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      size_t count = 0;
+      for (auto& pp : entries)
+         if ( (pp.second->state == State::DECODING) || (pp.second->state == State::DECODED) )
+            count++;
+      return count;
+   }
+
+   uint8_t TextureLoader::mip_levels(uint32_t width, uint32_t height)
+   //----------------------------------------------------------------
+   {
+      uint32_t dim = std::max(width, height);
+      uint8_t levels = 1;
+      while (dim > 1)
+      {
+         dim >>= 1;
+         levels++;
+      }
+      return levels;
+   }
+
+   // Averages 2x2 blocks of the rows r0 and r1 (which may be the same row for single row images).
+   static inline void downsample_row_rgba8(const uint8_t* r0, const uint8_t* r1, uint8_t* dst,
+                                           uint32_t srcWidth, uint32_t dstWidth)
+   //--------------------------------------------------------------------------------------------
+   {
+      uint32_t x = 0;
+      if (srcWidth >= 2)
+      {
+#if defined(__SSE2__)
+         const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+         for (; x + 4 <= dstWidth; x += 4) // 8 source pixels per row -> 4 destination pixels
+         {
+            const uint8_t* p0 = r0 + x*8;
+            const uint8_t* p1 = r1 + x*8;
+            __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p0));
+            __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p0 + 16));
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1));
+            __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1 + 16));
+            __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+            __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+            __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+            __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+            s0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8)); // Horizontal pixel pair sums in the low 64 bits
+            s1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+            s2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+            s3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+            __m128i q01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2);
+            __m128i q23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s2, s3), two), 2);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*4), _mm_packus_epi16(q01, q23));
+         }
+#elif defined(__ARM_NEON)
+         for (; x + 8 <= dstWidth; x += 8) // 16 source pixels per row -> 8 destination pixels
+         {
+            uint8x16x4_t a = vld4q_u8(r0 + x*8), b = vld4q_u8(r1 + x*8);
+            uint8x8x4_t out;
+            out.val[0] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(a.val[0]), vpaddlq_u8(b.val[0])), 2);
+            out.val[1] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(a.val[1]), vpaddlq_u8(b.val[1])), 2);
+            out.val[2] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(a.val[2]), vpaddlq_u8(b.val[2])), 2);
+            out.val[3] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(a.val[3]), vpaddlq_u8(b.val[3])), 2);
+            vst4_u8(dst + x*4, out);
+         }
+#endif
+      }
+      for (; x < dstWidth; x++)
+      {
+         const uint32_t x0 = 2*x*4, x1 = std::min(2*x + 1, srcWidth - 1)*4;
+         for (uint32_t c = 0; c < 4; c++)
+            dst[x*4 + c] = static_cast<uint8_t>((r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) >> 2);
+      }
+   }
+
+   void TextureLoader::downsample_rgba8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst,
+                                        ThreadPool* pool)
+   //-----------------------------------------------------------------------------------------------------
+   {
+      const uint32_t dw = std::max(1u, width / 2), dh = std::max(1u, height / 2);
+      auto rows = [src, width, height, dst, dw](size_t first, size_t last)
+      {
+         for (size_t y = first; y < last; y++)
+         {
+            const uint8_t* r0 = src + size_t(2*y)*width*4;
+            const uint8_t* r1 = src + size_t(std::min(uint32_t(2*y + 1), height - 1))*width*4;
+            downsample_row_rgba8(r0, r1, dst + y*dw*4, width, dw);
+         }
+      };
+      if (pool != nullptr)
+         pool->parallel_for(0, dh, rows, std::max<size_t>(1, 65536 / dw));
+      else
+         rows(0, dh);
+   }
+
+   // sRGB transfer function lookups: decoding each 8 bit value, and encoding linear values quantized to 14 bits
+   // (fine enough that the darkest sRGB steps, where the curve is steepest, still round correctly).
+   struct SrgbTables
+   {
+      static constexpr uint32_t ENCODE_SIZE = 16384;
+      float toLinear[256];
+      uint8_t fromLinear[ENCODE_SIZE];
+
+      SrgbTables()
+      {
+         for (uint32_t i = 0; i < 256; i++)
+         {
+            const float s = i / 255.0f;
+            toLinear[i] = (s <= 0.04045f) ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+         }
+         for (uint32_t i = 0; i < ENCODE_SIZE; i++)
+         {
+            const float l = i / float(ENCODE_SIZE - 1);
+            const float s = (l <= 0.0031308f) ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            fromLinear[i] = static_cast<uint8_t>(std::min(255.0f, s * 255.0f + 0.5f));
+         }
+      }
+
+      uint8_t encode(float linear) const
+      {
+         return fromLinear[static_cast<uint32_t>(linear * (ENCODE_SIZE - 1) + 0.5f)];
+      }
+   };
+
+   void TextureLoader::downsample_srgba8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst,
+                                         ThreadPool* pool)
+   //-----------------------------------------------------------------------------------------------------
+   {
+      static const SrgbTables tables;
+      const uint32_t dw = std::max(1u, width / 2), dh = std::max(1u, height / 2);
+      auto rows = [src, width, height, dst, dw](size_t first, size_t last)
+      {
+         const float* toLinear = tables.toLinear;
+         for (size_t y = first; y < last; y++)
+         {
+            const uint8_t* r0 = src + size_t(2*y)*width*4;
+            const uint8_t* r1 = src + size_t(std::min(uint32_t(2*y + 1), height - 1))*width*4;
+            uint8_t* d = dst + y*dw*4;
+            for (uint32_t x = 0; x < dw; x++)
+            {
+               const uint32_t x0 = 2*x*4, x1 = std::min(2*x + 1, width - 1)*4;
+               for (uint32_t c = 0; c < 3; c++)
+                  d[x*4 + c] = tables.encode((toLinear[r0[x0 + c]] + toLinear[r0[x1 + c]] + toLinear[r1[x0 + c]] +
+                                              toLinear[r1[x1 + c]]) * 0.25f);
+               d[x*4 + 3] = static_cast<uint8_t>((r0[x0 + 3] + r0[x1 + 3] + r1[x0 + 3] + r1[x1 + 3] + 2) >> 2);
+            }
+         }
+      };
+      if (pool != nullptr)
+         pool->parallel_for(0, dh, rows, std::max<size_t>(1, 65536 / dw));
+      else
+         rows(0, dh);
+   }
+
+   void TextureLoader::downsample_rgba32f(const float* src, uint32_t width, uint32_t height, float* dst,
+                                          ThreadPool* pool)
+   //-------------------------------------------------------------------------------------------------------
+   {
+      const uint32_t dw = std::max(1u, width / 2), dh = std::max(1u, height / 2);
+      auto rows = [src, width, height, dst, dw](size_t first, size_t last)
+      {
+         for (size_t y = first; y < last; y++)
+         {
+            const float* r0 = src + size_t(2*y)*width*4;
+            const float* r1 = src + size_t(std::min(uint32_t(2*y + 1), height - 1))*width*4;
+            float* d = dst + y*dw*4;
+            for (uint32_t x = 0; x < dw; x++)
+            {
+               const uint32_t x0 = 2*x*4, x1 = std::min(2*x + 1, width - 1)*4;
+               for (uint32_t c = 0; c < 4; c++)
+                  d[x*4 + c] = (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c]) * 0.25f;
+            }
+         }
+      };
+      if (pool != nullptr)
+         pool->parallel_for(0, dh, rows, std::max<size_t>(1, 65536 / dw));
+      else
+         rows(0, dh);
+   }
+}
@@ -0,0 +1,139 @@
+#include <atomic>
+
+#include "bulb/ThreadPool.hh"
+#include "bulb/Trace.hh"
+
+namespace bulb
+{
+   static thread_local const ThreadPool* currentPool = nullptr;
+   static std::atomic<size_t> workerCount{0};
+   static std::atomic<bool> isWorkersCreated{false};
+   static constexpr size_t DEFAULT_IO_WORKERS = 4;
+   static std::atomic<size_t> ioWorkerCount{0};
+   static std::atomic<bool> isIoWorkersCreated{false};
+
+   bool ThreadPool::set_worker_count(size_t threads)
+   //-----------------------------------------------
+   {
+      if (isWorkersCreated.load())
+         return (threads == 0) || (threads == workers().size());
+      workerCount.store(threads);
+      return true;
+   }
+
+   bool ThreadPool::can_set_worker_count(size_t threads)
+   //---------------------------------------------------
+   {
+      return (! isWorkersCreated.load()) || (threads == 0) || (threads == workers().size());
+   }
+
+   size_t ThreadPool::claim_worker_count()
+   //-------------------------------------
+   {
+      isWorkersCreated.store(true);
+      return workerCount.load();
+   }
+
+   bool ThreadPool::set_io_worker_count(size_t threads)
+   //--------------------------------------------------
+   {
+      if (isIoWorkersCreated.load())
+         return (threads == 0) || (threads == io_workers().size());
+      ioWorkerCount.store(threads);
+      return true;
+   }
+
+   bool ThreadPool::can_set_io_worker_count(size_t threads)
+   //------------------------------------------------------
+   {
+      return (! isIoWorkersCreated.load()) || (threads == 0) || (threads == io_workers().size());
+   }
+
+   size_t ThreadPool::claim_io_worker_count()
+   //----------------------------------------
+   {
+      isIoWorkersCreated.store(true);
+      const size_t count = ioWorkerCount.load();
+      return (count == 0) ? DEFAULT_IO_WORKERS : count;
+   }
+
+   ThreadPool::ThreadPool(size_t count)
+   //----------------------------------
+   {
+      if (count == 0)
+      {
+         unsigned hw = std::thread::hardware_concurrency();
+         count = (hw > 1) ? hw - 1 : 1;
+      }
+      threads.reserve(count);
+      for (size_t i = 0; i < count; i++)
+         threads.emplace_back(&ThreadPool::run, this);
+   }
+
+   ThreadPool::~ThreadPool()
+   //-----------------------
+   {
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         isStopping = true;
+      }
+      available.notify_all();
+      for (std::thread& t : threads)
+         if (t.joinable())
+            t.join();
+   }
+
+   void ThreadPool::post(std::function<void()> task)
+   //-----------------------------------------------
+   {
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         tasks.emplace_back(std::move(task));
+      }
+      available.notify_one();
+   }
+
+   size_t ThreadPool::queued()
+   //-------------------------
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      return tasks.size();
+   }
+
+   bool ThreadPool::is_worker() const { return currentPool == this; }
+
+   bool ThreadPool::run_one()
+   //------------------------
+   {
+      std::function<void()> task;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         if (tasks.empty())
+            return false;
+         task = std::move(tasks.front());
+         tasks.pop_front();
+      }
+      task();
+      return true;
+   }
+
+   void ThreadPool::run()
+   //--------------------
+   {
+      currentPool = this;
+      Trace::set_thread_name("bulb worker");
+      while (true)
+      {
+         std::function<void()> task;
+         {
+            std::unique_lock<std::mutex> lock(mtx);
+            available.wait(lock, [this] { return (isStopping) || (! tasks.empty()); });
+            if (tasks.empty())
+               return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+         }
+         task();
+      }
+   }
+}
@@ -0,0 +1,206 @@
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fstream>
+
+#include "bulb/Trace.hh"
+#include "bulb/Log.hh"
+
+namespace bulb
+{
+   std::atomic<bool> Trace::enabled{false};
+
+   // Events recorded per thread before further events are dropped.
+   static constexpr size_t TRACE_BUFFER_EVENTS = 32768;
+
+   struct TraceEvent
+   {
+      const char* name;
+      const char* category;
+      uint64_t start;
+      uint64_t duration;
+   };
+
+   // Written only by its thread. The count is published with release ordering so the exporter can read the events
+   // below it while the thread keeps recording. When the thread exits its events are moved (under the registry
+   // mutex) into exited and the full size buffer is freed.
+   struct TraceBuffer
+   {
+      explicit TraceBuffer(uint32_t threadId) : tid(threadId), events(new TraceEvent[TRACE_BUFFER_EVENTS]) {}
+
+      const uint32_t tid;
+      std::unique_ptr<TraceEvent[]> events; // nullptr once the thread has exited
+      std::atomic<size_t> count{0};
+      std::atomic<uint64_t> dropped{0};
+      std::vector<TraceEvent> exited;
+      std::string threadName;
+   };
+
+   struct TraceRegistry
+   {
+      std::mutex mutex;
+      std::vector<std::shared_ptr<TraceBuffer>> buffers; // Kept after their thread exits so its events are exported
+      uint64_t epoch = Trace::now();
+   };
+
+   // Never destroyed, as threads such as the worker pool's may exit (and run TraceThreadExit) during static destruction.
+   static TraceRegistry& registry()
+   //------------------------------
+   {
+      static TraceRegistry* the_registry = new TraceRegistry;
+      return *the_registry;
+   }
+
+   // Destroyed when its thread exits, keeping only the events recorded by the thread.
+   struct TraceThreadExit
+   {
+      TraceBuffer* buffer = nullptr;
+
+      ~TraceThreadExit()
+      {
+         if (buffer == nullptr)
+            return;
+         std::lock_guard<std::mutex> lock(registry().mutex);
+         const size_t n = buffer->count.load(std::memory_order_relaxed);
+         buffer->exited.assign(buffer->events.get(), buffer->events.get() + n);
+         buffer->events.reset();
+      }
+   };
+
+   static TraceBuffer& thread_buffer()
+   //---------------------------------
+   {
+      static thread_local TraceBuffer* buffer = nullptr;
+      if (buffer == nullptr)
+      {
+         TraceRegistry& traces = registry();
+         {
+            std::lock_guard<std::mutex> lock(traces.mutex);
+            traces.buffers.push_back(std::make_shared<TraceBuffer>(static_cast<uint32_t>(traces.buffers.size() + 1)));
+            buffer = traces.buffers.back().get();
+         }
+         static thread_local TraceThreadExit onExit;
+         onExit.buffer = buffer;
+      }
+      return *buffer;
+   }
+
+   void Trace::enable(bool isEnabled)
+   //--------------------------------
+   {
+      registry(); // Sets the epoch before the first event
+      enabled.store(isEnabled, std::memory_order_relaxed);
+   }
+
+   void Trace::set_thread_name(const char* name)
+   //-------------------------------------------
+   {
+      TraceBuffer& buffer = thread_buffer();
+      std::lock_guard<std::mutex> lock(registry().mutex);
+      buffer.threadName = (name != nullptr) ? name : "";
+   }
+
+   void Trace::record(const char* name, const char* category, uint64_t startNanos, uint64_t endNanos)
+   //------------------------------------------------------------------------------------------------
+   {
+      TraceBuffer& buffer = thread_buffer();
+      const size_t n = buffer.count.load(std::memory_order_relaxed);
+      if ( (n >= TRACE_BUFFER_EVENTS) || (! buffer.events) ) // Full, or recorded by a thread_local destructor
+      {
+         buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+         return;
+      }
+      buffer.events[n] = TraceEvent{ name, category, startNanos, (endNanos > startNanos) ? endNanos - startNanos : 0 };
+      buffer.count.store(n + 1, std::memory_order_release);
+   }
+
+   uint64_t Trace::dropped()
+   //-----------------------
+   {
+      TraceRegistry& traces = registry();
+      std::lock_guard<std::mutex> lock(traces.mutex);
+      uint64_t total = 0;
+      for (const std::shared_ptr<TraceBuffer>& buffer : traces.buffers)
+         total += buffer->dropped.load(std::memory_order_relaxed);
+      return total;
+   }
+
+   void Trace::clear()
+   //-----------------
+   {
+      TraceRegistry& traces = registry();
+      std::lock_guard<std::mutex> lock(traces.mutex);
+      for (const std::shared_ptr<TraceBuffer>& buffer : traces.buffers)
+      {
+         buffer->count.store(0, std::memory_order_release);
+         buffer->dropped.store(0, std::memory_order_relaxed);
+         buffer->exited.clear();
+      }
+   }
+
+   static void write_json_string(std::ostream& out, const char* s)
+   //-------------------------------------------------------------
+   {
+      out << '"';
+      for (; (s != nullptr) && (*s != 0); s++)
+      {
+         const unsigned char c = static_cast<unsigned char>(*s);
+         if ( (c == '"') || (c == '\\') )
+            out << '\\' << *s;
+         else if (c < 0x20)
+            out << fmt::format("\\u{0:04x}", static_cast<unsigned>(c));
+         else
+            out << *s;
+      }
+      out << '"';
+   }
+
+   bool Trace::write_json(const char* path)
+   //--------------------------------------
+   {
+      Log logger("Trace::write_json");
+      std::ofstream out(path, std::ios_base::out | std::ios_base::trunc);
+      if (! out)
+      {
+         logger.error("Error creating {0}", path);
+         return false;
+      }
+      TraceRegistry& traces = registry();
+      std::lock_guard<std::mutex> lock(traces.mutex);
+      out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+      bool isFirst = true;
+      for (const std::shared_ptr<TraceBuffer>& buffer : traces.buffers)
+      {
+         if (! buffer->threadName.empty())
+         {
+            out << (isFirst ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+                << buffer->tid << ",\"args\":{\"name\":";
+            write_json_string(out, buffer->threadName.c_str());
+            out << "}}";
+            isFirst = false;
+         }
+         const TraceEvent* events = (buffer->events) ? buffer->events.get() : buffer->exited.data();
+         const size_t n = (buffer->events) ? buffer->count.load(std::memory_order_acquire) : buffer->exited.size();
+         for (size_t i = 0; i < n; i++)
+         {
+            const TraceEvent& event = events[i];
+            const uint64_t start = (event.start > traces.epoch) ? event.start - traces.epoch : 0;
+            out << (isFirst ? "\n" : ",\n") << "{\"ph\":\"X\",\"name\":";
+            write_json_string(out, event.name);
+            out << ",\"cat\":";
+            write_json_string(out, event.category);
+            out << fmt::format(",\"ts\":{0:.3f},\"dur\":{1:.3f},\"pid\":1,\"tid\":{2}}}", start / 1000.0,
+                               event.duration / 1000.0, buffer->tid);
+            isFirst = false;
+         }
+      }
+      out << "\n]}\n";
+      if (! out.good())
+      {
+         logger.error("Error writing {0}", path);
+         return false;
+      }
+      return true;
+   }
+}
@@ -10,7 +10,7 @@ namespace bulb
    void Drawable::pre_render(std::vector<utils::Entity>& renderables)
    //-------------------------
    {
-      filament::TransformManager& transformManager = Managers::instance().transformManager;
+      filament::TransformManager& transformManager = managers.transformManager;
       utils::EntityInstance<filament::TransformManager> transform = transformManager.getInstance(renderedEntity);
       transformManager.setTransform(transform, M);
 
@@ -23,6 +23,6 @@ namespace bulb
    {
       Node::~Node();
       if (internalTransform) internalTransform.reset();
-      Managers::instance().entityManager.destroy(renderedEntity);
+      managers.entityManager.destroy(renderedEntity);
    }
 }
\ No newline at end of file
@@ -1,14 +1,19 @@
+#include <cstring>
+
 #include <filamat/MaterialBuilder.h>
 
 #include "bulb/nodes/Geometry.hh"
 #include "bulb/AssetReader.hh"
+#include "bulb/MaterialCache.hh"
+#include "bulb/MeshOptimizer.hh"
 #include "bulb/ut.hh"
 #include "bulb/Log.hh"
 
 namespace bulb
 {
-   bool Geometry::open_filamesh(const char* assetname, filament::Material* defaultMat)
-   //----------------------------------------------------------------------------------
+   bool Geometry::open_filamesh(const char* assetname, filament::Material* defaultMat, bool isOptimized,
+                                const std::vector<float>& lodRatios)
+   //---------------------------------------------------------------------------------------------------
    {
       Log logger("Geometry::open_filamesh");
       AssetReader& reader = AssetReader::instance();
@@ -20,12 +25,13 @@ namespace bulb
             defaultMat = material;
          else
          {
-            std::vector<unsigned char> data;
-            if ( (reader.read_asset_vector("assets/bakedColor", data)) && (! data.empty()) )
+            // Shared between all Geometries without a material instead of building a copy per node
+            defaultMat = managers.material_cache().acquire("assets/bakedColor");
+            if (defaultMat != nullptr)
             {
-               filament::Engine* engine = Managers::instance().engine.get();
-               if (engine == nullptr) return false;
-               defaultMat = filament::Material::Builder().package(data.data(), data.size()).build(*engine);
+               if (defaultMaterial != nullptr)
+                  managers.material_cache().release(defaultMaterial);
+               defaultMaterial = defaultMat;
             }
             else
                logger.error("Error loading assets/bakedColor as default material." );
@@ -34,26 +40,48 @@ namespace bulb
       if (defaultMat == nullptr)
       {
          logger.error("Error loading {0}: Material not specified or error loading material.");
-         Managers::instance().entityManager.destroy(renderedEntity);
+         managers.entityManager.destroy(renderedEntity);
          return false;
       }
-      size_t nBytes;
-      filameshData = reader.read_asset_buffer(assetname, nBytes);
-      if (filameshData != nullptr)
+      std::shared_ptr<AssetView> filamesh = reader.map_asset(assetname);
+      if ( (filamesh) && (! filamesh->empty()) )
+      {
+         MeshDecodeStats decodeStats;
+         filamesh = MeshOptimizer::decode_filamesh(filamesh, decodeStats);
+         if (decodeStats.streams > 0)
+            MeshOptimizer::log(assetname, decodeStats);
+      }
+      if ( (filamesh) && (! filamesh->empty()) && (isOptimized) )
+      {
+         MeshOptimizeStats stats;
+         filamesh = MeshOptimizer::optimize_filamesh(filamesh, stats);
+         MeshOptimizer::log(assetname, stats);
+      }
+      if ( (filamesh) && (! filamesh->empty()) )
       {
+         // Simplified before the view is handed to filament, which may release it as soon as it is uploaded.
+         LodChain chain;
+         if ( (! lodRatios.empty()) && (! MeshOptimizer::filamesh_lods(*filamesh, lodRatios, chain)) )
+            logger.warn("Levels of detail not generated for {0}", assetname);
          filament::MaterialInstance* materialInst = defaultMat->getDefaultInstance(); //->createInstance();
          filamesh::MeshReader::Mesh mesh;
          mesh.vertexBuffer = nullptr; mesh.indexBuffer = nullptr;
-         mesh = filamesh::MeshReader::loadMeshFromBuffer(Managers::instance().engine.get(), filameshData,
-                                                         Geometry::delete_filamesh,
-                                                         this, materialInst);
+         // The mapped file is uploaded without copying and unmapped when filament releases the buffer.
+         void* meshRef = AssetView::retain(filamesh);
+         mesh = filamesh::MeshReader::loadMeshFromBuffer(managers.engine.get(), filamesh->data(),
+                                                         AssetView::release_callback, meshRef, materialInst);
          if (mesh.vertexBuffer == nullptr)
+         {
+            AssetView::release_callback(nullptr, 0, meshRef); // Rejected before any buffer was handed to filament
             return false;
-         Managers::instance().entityManager.destroy(renderedEntity);
+         }
+         set_lod(0); // The previous renderable no longer references level of detail buffers about to be destroyed
+         managers.entityManager.destroy(renderedEntity);
          renderedEntity = mesh.renderable;
          meshVertexBuffer = mesh.vertexBuffer;
          meshIndexBuffer = mesh.indexBuffer;
-//         filament::RenderableManager& rm = Managers::instance().renderManager;
+         make_lods(chain);
+//         filament::RenderableManager& rm = managers.renderManager;
 //         utils::EntityInstance<filament::RenderableManager> ei = rm.getInstance(renderedEntity);
 //         for (size_t i = 0; i < rm.getPrimitiveCount(ei); i++)
 //            rm.setMaterialInstanceAt(ei, i, materialInst);
@@ -63,21 +91,98 @@ namespace bulb
       return false;
    }
 
-   void Geometry::pre_render(std::vector<utils::Entity>& renderables)
-   //-------------------------
+   void Geometry::make_lods(const LodChain& chain)
+   //---------------------------------------------
    {
-      Drawable::pre_render(renderables);
-      if (material != nullptr)
+      release_lods();
+      if (chain.sourceRanges.empty())
+         return;
+      filament::Engine* engine = managers.engine.get();
+      std::vector<LodRange> full;
+      for (const std::pair<uint32_t, uint32_t>& range : chain.sourceRanges)
+         full.push_back(LodRange{ meshIndexBuffer, range.first, range.second });
+      lods.push_back(std::move(full));
+      // Each level is one index buffer holding all the parts, with 16 bit indices where the vertex count allows.
+      const bool isShort = MeshOptimizer::fits_short_indices(chain.vertexCount);
+      const size_t stride = (isShort) ? sizeof(uint16_t) : sizeof(uint32_t);
+      for (const std::vector<std::vector<uint32_t>>& level : chain.levels)
       {
-         filament::MaterialInstance *instance = material->getDefaultInstance();
-         filament::RenderableManager& rm = Managers::instance().renderManager;
-         utils::EntityInstance<filament::RenderableManager> ei = rm.getInstance(renderedEntity);
-         if (ei)
+         size_t total = 0;
+         for (const std::vector<uint32_t>& indices : level)
+            total += indices.size();
+         if ( (total == 0) || (level.size() != chain.sourceRanges.size()) )
+            continue;
+         uint8_t* data = new uint8_t[total * stride];
+         std::vector<LodRange> ranges;
+         filament::IndexBuffer* indexBuffer = filament::IndexBuffer::Builder().indexCount(static_cast<uint32_t>(total))
+               .bufferType((isShort) ? filament::IndexBuffer::IndexType::USHORT : filament::IndexBuffer::IndexType::UINT)
+               .build(*engine);
+         size_t offset = 0;
+         for (size_t part = 0; part < level.size(); part++)
          {
-            for (size_t i = 0; i < rm.getPrimitiveCount(ei); i++)
-               rm.setMaterialInstanceAt(ei, i, instance);
+            const std::vector<uint32_t>& indices = level[part];
+            if (indices.empty()) // Not simplified
+            {
+               ranges.push_back(lods[0][part]);
+               continue;
+            }
+            if (isShort)
+            {
+               uint16_t* p = reinterpret_cast<uint16_t*>(data) + offset;
+               for (uint32_t index : indices)
+                  *p++ = static_cast<uint16_t>(index);
+            }
+            else
+               std::memcpy(reinterpret_cast<uint32_t*>(data) + offset, indices.data(), indices.size() * sizeof(uint32_t));
+            ranges.push_back(LodRange{ indexBuffer, static_cast<uint32_t>(offset), static_cast<uint32_t>(indices.size()) });
+            offset += indices.size();
          }
+         indexBuffer->setBuffer(*engine, filament::IndexBuffer::BufferDescriptor(data, total * stride,
+                                [](void* buffer, size_t, void*) { delete[] static_cast<uint8_t*>(buffer); }));
+         lodIndexBuffers.push_back(indexBuffer);
+         lods.push_back(std::move(ranges));
+      }
+   }
+
+   void Geometry::release_lods()
+   //---------------------------
+   {
+      filament::Engine* engine = managers.engine.get();
+      if (engine != nullptr)
+      {
+         for (filament::IndexBuffer* indexBuffer : lodIndexBuffers)
+            engine->destroy(indexBuffer);
       }
+      lodIndexBuffers.clear();
+      lods.clear();
+      lod = 0;
+   }
+
+   bool Geometry::set_lod(size_t level)
+   //----------------------------------
+   {
+      if (level >= lods.size())
+         return false;
+      if (level == lod)
+         return true;
+      filament::RenderableManager& rm = managers.renderManager;
+      utils::EntityInstance<filament::RenderableManager> instance = rm.getInstance(renderedEntity);
+      if (! instance)
+         return false;
+      const std::vector<LodRange>& ranges = lods[level];
+      for (size_t part = 0; part < std::min(ranges.size(), rm.getPrimitiveCount(instance)); part++)
+         rm.setGeometryAt(instance, part, filament::RenderableManager::PrimitiveType::TRIANGLES, meshVertexBuffer,
+                          ranges[part].indices, ranges[part].offset, ranges[part].count);
+      lod = level;
+      return true;
+   }
+
+   void Geometry::pre_render(std::vector<utils::Entity>& renderables)
+   //-------------------------
+   {
+      Drawable::pre_render(renderables);
+      if (material != nullptr)
+         materialBinding.bind(managers, renderedEntity, material); // Only rebinds if the material or renderable changed
 #if !defined(NDEBUG)
       else
       {
@@ -91,7 +196,7 @@ namespace bulb
    Geometry::~Geometry()
    //------------------
    {
-      filament::Engine* engine = Managers::instance().engine.get();
+      filament::Engine* engine = managers.engine.get();
       if (engine != nullptr)
       {
          if (meshVertexBuffer != nullptr)
@@ -101,19 +206,10 @@ namespace bulb
          engine->destroy(renderedEntity);
 //         if (material != nullptr) engine->destroy(material);
       }
-      Managers::instance().entityManager.destroy(renderedEntity);
-   }
-
-   void Geometry::delete_filamesh(void* p, size_t size, void* user)
-   //--------------------------------------------------------------
-   {
-      if (user == nullptr) return;
-      Geometry* me = static_cast<Geometry*>(user);
-      if (me->filameshData != nullptr) // (p) They call with an offset from the original pointer
-      {
-//       char* pch = static_cast<char*>(p);
-         delete[] me->filameshData;
-         me->filameshData = nullptr;
-      }
+      release_lods();
+      managers.entityManager.destroy(renderedEntity);
+      materialBinding.unbind();
+      if (defaultMaterial != nullptr)
+         managers.material_cache().release(defaultMaterial);
    }
-}
\ No newline at end of file
+}
@@ -1,27 +1,40 @@
 #include <bulb/nodes/Material.hh>
-#include "bulb/AssetReader.hh"
 
 namespace bulb
 {
-   Material::Material(const void* data, size_t datasize, const char* name)  : Composite(true, name)
-   //---------------------------------------------------------------------
+   Material::Material(Managers& context, const void* data, size_t datasize, const char* name) :
+                      Composite(true, name), managers(context)
+   //----------------------------------------------------------------------------------------------
    {
-      filament::Engine* engine = Managers::instance().engine.get();
-      material = filament::Material::Builder().package(data, datasize).build(*engine);
+      material = managers.material_cache().acquire(data, datasize);
+      isCached = (material != nullptr);
+   }
+
+   Material::Material(const Material& other) : Composite(other), managers(other.managers), material(other.material),
+                                               textures(other.textures), samplers(other.samplers),
+                                               isCached(managers.material_cache().retain(other.material))
+   //------------------------------------------------------------------------------------------------------------
+   {
+   }
+
+   Material::~Material()
+   //-------------------
+   {
+      if (isCached)
+         managers.material_cache().release(material);
    }
 
    bool Material::open(const char* filename, const char* name)
 //----------------------------------------------------------------------------------------
    {
-      bulb::AssetReader& reader = bulb::AssetReader::instance();
-      std::vector<char> materialData;
-      reader.read_asset_vector(filename, materialData);
-      if (materialData.empty()) return false;
-      filament::Engine* engine = Managers::instance().engine.get();
-      if (engine == nullptr) return false;
-      material = filament::Material::Builder().package(materialData.data(), materialData.size()).build(*engine);
+      filament::Material* m = managers.material_cache().acquire(filename);
+      if (m == nullptr) return false;
+      if (isCached)
+         managers.material_cache().release(material);
+      material = m;
+      isCached = true;
       set_name(name);
-      return material != nullptr;
+      return true;
    }
 
    bulb::Material& Material::operator()(const char* textureName, filament::Texture* texture,
@@ -53,6 +66,10 @@ namespace bulb
                                                                           wrapModeR)));
       samplers[paramname].setCompareMode(compareMode, compareFunc);
       material->setDefaultParameter(textureName, texture, samplers[paramname]);
+      const filament::TextureSampler& sampler = samplers[paramname];
+      managers.material_instances().update_instances(material, paramname,
+                                                     [textureName, texture, &sampler](filament::MaterialInstance* mi)
+                                                     { mi->setParameter(textureName, texture, sampler); });
    }
 
    filament::Texture* Material::get_texture(const char* textureName)
@@ -0,0 +1,148 @@
+#include "bulb/nodes/Materializable.hh"
+#include "bulb/MaterialInstancePool.hh"
+#include "bulb/MaterialCache.hh"
+#include "bulb/Managers.hh"
+
+#include "utils/EntityInstance.h"
+
+namespace bulb
+{
+   MaterialBinding::MaterialBinding(MaterialBinding&& other) noexcept :
+      managers(other.managers), material(other.material), instance(other.instance), entity(other.entity),
+      overrides(std::move(other.overrides)), isModified(other.isModified)
+   //-------------------------------------------------------------------------
+   {
+      other.material = nullptr;
+      other.instance = nullptr;
+      other.entity.clear();
+      other.isModified = false;
+   }
+
+   MaterialBinding& MaterialBinding::operator=(MaterialBinding&& other) noexcept
+   //---------------------------------------------------------------------------
+   {
+      if (this != &other)
+      {
+         unbind();
+         managers = other.managers; material = other.material; instance = other.instance; entity = other.entity;
+         overrides = std::move(other.overrides);
+         isModified = other.isModified;
+         other.material = nullptr;
+         other.instance = nullptr;
+         other.entity.clear();
+         other.isModified = false;
+      }
+      return *this;
+   }
+
+   bool MaterialBinding::bind(Managers& context, utils::Entity renderable, filament::Material* mat)
+   //---------------------------------------------------------------------------------------------
+   {
+      if (mat == nullptr)
+      {
+         unbind();
+         return false;
+      }
+      if (managers != &context)
+      {
+         unbind();
+         managers = &context;
+      }
+      if ( (mat == material) && (renderable == entity) && (instance != nullptr) )
+         return false;
+      const utils::Entity previousEntity = entity;
+      filament::MaterialInstance* previousInstance = nullptr;
+      filament::Material* previousMaterial = nullptr;
+      bool wasModified = false;
+      if ( (mat != material) || (instance == nullptr) )
+      {
+         MaterialInstancePool& pool = managers->material_instances();
+         filament::MaterialInstance* acquired = pool.acquire(mat);
+         if (acquired == nullptr)
+            return false;
+         managers->material_cache().retain(mat); // Keeps cached materials alive while bound
+         for (auto& pp : overrides)
+         {
+            pp.second(acquired);
+            pool.set_override(acquired, pp.first);
+         }
+         previousInstance = instance;
+         previousMaterial = material;
+         wasModified = isModified;
+         instance = acquired;
+         material = mat;
+         isModified = ! overrides.empty();
+      }
+      entity = renderable;
+      filament::RenderableManager& rm = managers->renderManager;
+      utils::EntityInstance<filament::RenderableManager> ei = rm.getInstance(entity);
+      if (ei)
+      {
+         for (size_t i = 0; i < rm.getPrimitiveCount(ei); i++)
+            rm.setMaterialInstanceAt(ei, i, instance);
+      }
+      // The previous instance is released only after every primitive which may reference it has been rebound.
+      if (previousEntity != entity)
+         detach(previousEntity);
+      release(previousInstance, previousMaterial, wasModified);
+      return true;
+   }
+
+   void MaterialBinding::unbind()
+   //----------------------------
+   {
+      detach(entity);
+      release(instance, material, isModified);
+      instance = nullptr;
+      material = nullptr;
+      entity.clear();
+      isModified = false;
+   }
+
+   void MaterialBinding::detach(utils::Entity renderable)
+   //----------------------------------------------------
+   {
+      // The entity may already have been destroyed (eg by the destructor of the node owning the binding).
+      if ( (managers == nullptr) || (renderable.isNull()) || (! managers->entityManager.isAlive(renderable)) )
+         return;
+      filament::RenderableManager& rm = managers->renderManager;
+      utils::EntityInstance<filament::RenderableManager> ei = rm.getInstance(renderable);
+      if (! ei)
+         return;
+      const filament::Material* fallback = managers->engine->getDefaultMaterial();
+      for (size_t i = 0; i < rm.getPrimitiveCount(ei); i++)
+         rm.setMaterialInstanceAt(ei, i, fallback->getDefaultInstance());
+   }
+
+   void MaterialBinding::release(filament::MaterialInstance* released, filament::Material* releasedMaterial,
+                                 bool wasModified)
+   //-------------------------------------------------------------------------------------------------------
+   {
+      if (managers == nullptr)
+         return;
+      if (released != nullptr)
+         managers->material_instances().release(released, wasModified);
+      if (releasedMaterial != nullptr)
+         managers->material_cache().release(releasedMaterial);
+   }
+
+   void MaterialBinding::clear_parameters()
+   //--------------------------------------
+   {
+      overrides.clear();
+      if ( (managers != nullptr) && (instance != nullptr) )
+         managers->material_instances().clear_overrides(instance);
+   }
+
+   void MaterialBinding::set_override(const std::string& name, std::function<void(filament::MaterialInstance*)> f)
+   //-------------------------------------------------------------------------------------------------------------
+   {
+      if (instance != nullptr)
+      {
+         f(instance);
+         isModified = true;
+         managers->material_instances().set_override(instance, name);
+      }
+      overrides[name] = std::move(f);
+   }
+}
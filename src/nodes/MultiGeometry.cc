@@ -1,21 +1,83 @@
 #include "bulb/nodes/MultiGeometry.hh"
 
+#include <cmath>
+
 #include <gltfio/FilamentAsset.h>
 #include <gltfio/ResourceLoader.h>
 #include <gltfio/SimpleViewer.h>
 #include <bulb/AssetReader.hh>
+#include "bulb/MeshOptimizer.hh"
 #include "bulb/Log.hh"
 #include "bulb/ut.hh"
 
 namespace bulb
 {
+   bulb::MultiGeometry::~MultiGeometry()
+   //----------------------------------
+   {
+      alive->store(false);
+      release_gltf();
+   }
+
+   /** Shows or hides (using the layer mask) the renderables of an asset instance. */
+   static void set_visible(GltfAsset& asset, int instance, bool isVisible)
+   //---------------------------------------------------------------------
+   {
+      filament::RenderableManager& rm = asset.get_managers().renderManager;
+      size_t count = 0;
+      const utils::Entity* entities = asset.get_entities(instance, count);
+      for (size_t i = 0; i < count; i++)
+      {
+         utils::EntityInstance<filament::RenderableManager> renderable = rm.getInstance(entities[i]);
+         if (renderable)
+            rm.setLayerMask(renderable, 0xFF, (isVisible) ? 0x1 : 0x0);
+      }
+   }
+
+   void bulb::MultiGeometry::release_gltf()
+   //-------------------------------------
+   {
+      if (! gltf)
+         return;
+      // The root and children belong to the asset instance, which remains in the asset (for reuse) until the asset
+      // is destroyed along with its last reference, so instances are left visible for their next user.
+      set_lod(0);
+      for (GltfLod& level : lods)
+      {
+         set_visible(*level.asset, level.instance, true);
+         level.asset->release_instance(level.instance);
+      }
+      lods.clear();
+      animations.clear();
+      activeAnimations.clear();
+      gltf->release_instance(gltfInstance);
+      gltf.reset();
+      gltfInstance = -1;
+      renderedEntity = utils::Entity();
+      children.clear();
+   }
 
    void bulb::MultiGeometry::pre_render(std::vector<utils::Entity>& renderables)
 //------------------------------------
    {
-      filament::TransformManager& tfm = Managers::instance().transformManager;
+      filament::TransformManager& tfm = managers.transformManager;
       utils::EntityInstance<filament::TransformManager> rootInstance = tfm.getInstance(renderedEntity);
-      tfm.setTransform(rootInstance, M * S);
+      if (rootInstance) // An empty placeholder (see SceneGraph::make_multi_geometry_async) has no transform
+         tfm.setTransform(rootInstance, M * S);
+      // Levels of detail not displayed stay in the scene (hidden) so they follow the transform too.
+      for (size_t level = 0; level < lods.size() + 1; level++)
+      {
+         if ( (level == lod) || (lods.empty()) )
+            continue;
+         utils::Entity root = (level == 0) ? gltf->get_root(gltfInstance)
+                                           : lods[level - 1].asset->get_root(lods[level - 1].instance);
+         tfm.setTransform(tfm.getInstance(root), M * S);
+         size_t count = 0;
+         const utils::Entity* entities = (level == 0) ? gltf->get_entities(gltfInstance, count)
+                                                      : lods[level - 1].asset->get_entities(lods[level - 1].instance, count);
+         renderables.push_back(root);
+         renderables.insert(renderables.end(), entities, entities + count);
+      }
 /*      std::cout << name << std::endl << M << std::endl << S << std::endl;
       if (gltfAsset)
       {
@@ -27,36 +89,23 @@ namespace bulb
       if ((defaultRootMaterial != nullptr) || (!childrenMaterials.empty()))
       {
 #if !defined(NDEBUG)
-         if (gltfAsset != nullptr)
+         if ( (gltf) && (materialBinding.get_material() != defaultRootMaterial) )
          {
             Log logger("MultiGeometry::pre_render");
             logger.warn("Overriding gltf materials");
          }
 #endif
-         filament::RenderableManager& rm = Managers::instance().renderManager;
          if (defaultRootMaterial != nullptr)
-         {
-            filament::MaterialInstance* instance = defaultRootMaterial->getDefaultInstance();
-            utils::EntityInstance<filament::RenderableManager> ei = rm.getInstance(renderedEntity);
-            if (ei)
-            {
-               for (size_t i = 0; i < rm.getPrimitiveCount(ei); i++)
-                  rm.setMaterialInstanceAt(ei, i, instance);
-            }
-         }
+            materialBinding.bind(managers, renderedEntity, defaultRootMaterial);
          if (!childrenMaterials.empty())
          {
-            for (size_t i = 0; i < children.size(); i++)
+            if (childrenBindings.size() < childrenMaterials.size())
+               childrenBindings.resize(childrenMaterials.size());
+            for (size_t i = 0; i < std::min(children.size(), childrenMaterials.size()); i++)
             {
-               utils::Entity& childEntity = children[i];
                filament::Material* material = childrenMaterials[i];
-               filament::MaterialInstance* instance = material->getDefaultInstance();
-               utils::EntityInstance<filament::RenderableManager> ei = rm.getInstance(childEntity);
-               if (ei)
-               {
-                  for (size_t j = 0; j < rm.getPrimitiveCount(ei); j++)
-                     rm.setMaterialInstanceAt(ei, j, instance);
-               }
+               if (material != nullptr)
+                  childrenBindings[i].bind(managers, children[i], material);
             }
          }
       }
@@ -68,11 +117,11 @@ namespace bulb
    utils::Entity& bulb::MultiGeometry::add_child(filament::math::mat4f* T)
 //---------------------------------------------
    {
-      children.emplace_back(Managers::instance().entityManager.create());
+      children.emplace_back(managers.entityManager.create());
       utils::Entity& entity = children.back();
       if (T != nullptr)
       {
-         filament::TransformManager& tcm = Managers::instance().transformManager;
+         filament::TransformManager& tcm = managers.transformManager;
          tcm.create(renderedEntity, filament::TransformManager::Instance {}, filament::math::mat4f());
          tcm.create(entity, tcm.getInstance(renderedEntity), *T);
       }
@@ -104,166 +153,429 @@ namespace bulb
       childrenMaterials[i] = material;
    }
 
-   bool bulb::MultiGeometry::open_gltf(const char* gltfPath, bool normalized, bool bestShaders)
+   filament::MaterialInstance* bulb::MultiGeometry::get_material_instance_at(size_t i)
+//---------------------------------------------------------------------------------
+   {
+      if (i >= childrenBindings.size())
+         return nullptr;
+      return childrenBindings[i].get_instance();
+   }
+
+   MaterialBinding* bulb::MultiGeometry::child_binding(size_t i)
+//-----------------------------------------------------------
+   {
+      if (i >= children.size())
+         return nullptr;
+      if (childrenBindings.size() < children.size())
+         childrenBindings.resize(children.size());
+      return &childrenBindings[i];
+   }
+
+   bool bulb::MultiGeometry::open_gltf(const char* gltfPath, bool normalized, bool bestShaders,
+                                       gltfio::AssetLoader* loader, bool isOptimized,
+                                       const std::vector<float>& lodRatios)
 //---------------------------------------------------------------------------------------------
    {
-      Log logger("MultiGeometry::open_gltf");
-      if ((gltfAsset) || (gltfLoader))
+      GltfSource source;
+      if (! GltfAsset::read(gltfPath, source, isOptimized))
+         return false;
+      std::shared_ptr<GltfAsset> asset = GltfAsset::create(managers, source, 1, false, loader);
+      if ( (! asset) || (! attach_gltf(asset, normalized)) )
+         return false;
+      LodChain chain;
+      if ( (! lodRatios.empty()) && (MeshOptimizer::gltf_lods(source, lodRatios, chain)) )
+         attach_gltf_lods(GltfAsset::create_lods(managers, source, chain, 1, false, loader));
+      return true;
+   }
+
+   bool bulb::MultiGeometry::attach_gltf(std::shared_ptr<GltfAsset> asset, bool normalized)
+//----------------------------------------------------------------------------------------
+   {
+      if ( (! asset) || (! asset->get_asset()) )
+         return false;
+      if (&asset->get_managers() != &managers)
       {
-         if ( (gltfLoader) && (gltfAsset) )
-            gltfLoader->destroyAsset(gltfAsset);
-         if (gltfLoader)
-            gltfio::AssetLoader::destroy(&gltfLoader);
-         gltfLoader = nullptr;
-         gltfAsset = nullptr;
-         logger.info("Destroyed previous gltf loader/asset instances.");
+         Log logger("MultiGeometry::attach_gltf");
+         logger.error("{0} was created in a different Managers context (engine) to {1}", asset->get_path(), get_name());
+         return false;
       }
-      AssetReader& reader = AssetReader::instance();
-      if (!reader.exists(gltfPath))
+      int instance = asset->acquire_instance();
+      if (instance < 0)
       {
-         logger.error("{0} does not exist.", gltfPath);
+         Log logger("MultiGeometry::attach_gltf");
+         logger.error("No free instances of {0} for {1}", asset->get_path(), get_name());
          return false;
       }
-      if (reader.is_asset_dir(gltfPath))
-      {  //TODO: Search dir for gltf file.
-         logger.error("{0} is a directory but a gltf, glb or zip file was expected.", gltfPath);
+      release_gltf();
+      gltf = std::move(asset);
+      gltfInstance = instance;
+      renderedEntity = gltf->get_root(instance);
+      size_t count = 0;
+      const utils::Entity* entities = gltf->get_entities(instance, count);
+      for (size_t i = 0; i < count; i++)
+         children.push_back(entities[i]);
+      if (normalized)
+         S = scale_to_unitcube(gltf->get_asset()->getBoundingBox());
+      return true;
+   }
+
+   bool bulb::MultiGeometry::attach_gltf_lods(const std::vector<std::shared_ptr<GltfAsset>>& levels)
+//-------------------------------------------------------------------------------------------------
+   {
+      if (! gltf)
          return false;
+      for (const std::shared_ptr<GltfAsset>& asset : levels)
+      {
+         int instance = ( (asset) && (&asset->get_managers() == &managers) ) ? asset->acquire_instance() : -1;
+         if (instance < 0)
+         {
+            Log logger("MultiGeometry::attach_gltf_lods");
+            logger.error("No free instance in the context of {1} of level of detail {0}", lods.size() + 1, get_name());
+            return false;
+         }
+         set_visible(*asset, instance, false);
+         lods.push_back(GltfLod{ asset, instance });
       }
+      return true;
+   }
 
-      std::string filepath(gltfPath),  assetsDir, assetName, ext, nameNoExt;
-      auto p = filepath.rfind('/');
-#if defined (WIN32)
-      if (p == std::string::npos)
-            p = filepath.rfind('\\');
-#endif
-      if (p != std::string::npos)
+   bool bulb::MultiGeometry::set_lod(size_t level)
+//-----------------------------------------------
+   {
+      if ( (! gltf) || (level > lods.size()) )
+         return false;
+      if (level == lod)
+         return true;
+      std::shared_ptr<GltfAsset>& from = (lod == 0) ? gltf : lods[lod - 1].asset;
+      set_visible(*from, (lod == 0) ? gltfInstance : lods[lod - 1].instance, false);
+      std::shared_ptr<GltfAsset>& to = (level == 0) ? gltf : lods[level - 1].asset;
+      const int instance = (level == 0) ? gltfInstance : lods[level - 1].instance;
+      set_visible(*to, instance, true);
+      renderedEntity = to->get_root(instance);
+      size_t count = 0;
+      const utils::Entity* entities = to->get_entities(instance, count);
+      children.assign(entities, entities + count);
+      lod = level;
+      return true;
+   }
+
+   GltfAsset* bulb::MultiGeometry::displayed_gltf(int& instance)
+   //-----------------------------------------------------------
+   {
+      if (! gltf)
+         return nullptr;
+      if (lod == 0)
       {
-         assetsDir = filepath.substr(0, p);
-         assetName = filepath.substr(p+1);
+         instance = gltfInstance;
+         return gltf.get();
       }
-      else
+      instance = lods[lod - 1].instance;
+      return lods[lod - 1].asset.get();
+   }
+
+   /** @return The animator of the displayed asset instance or nullptr if there is none (yet). */
+   static gltfio::Animator* displayed_animator(GltfAsset* asset, int instance)
+   //-------------------------------------------------------------------------
+   {
+      return (asset != nullptr) ? asset->get_animator(instance) : nullptr;
+   }
+
+   size_t bulb::MultiGeometry::animation_count()
+   //-------------------------------------------
+   {
+      int instance = -1;
+      gltfio::Animator* animator = displayed_animator(displayed_gltf(instance), instance);
+      return (animator != nullptr) ? animator->getAnimationCount() : 0;
+   }
+
+   float bulb::MultiGeometry::animation_duration(size_t animation)
+   //-------------------------------------------------------------
+   {
+      int instance = -1;
+      gltfio::Animator* animator = displayed_animator(displayed_gltf(instance), instance);
+      if ( (animator == nullptr) || (animation >= animator->getAnimationCount()) )
+         return 0;
+      return animator->getAnimationDuration(animation);
+   }
+
+   const char* bulb::MultiGeometry::animation_name(size_t animation)
+   //---------------------------------------------------------------
+   {
+      int instance = -1;
+      gltfio::Animator* animator = displayed_animator(displayed_gltf(instance), instance);
+      if ( (animator == nullptr) || (animation >= animator->getAnimationCount()) )
+         return nullptr;
+      return animator->getAnimationName(animation);
+   }
+
+   void bulb::MultiGeometry::set_animation_weight(size_t animation, float weight)
+   //----------------------------------------------------------------------------
+   {
+      // Weights may be set before the asset has loaded, so the animation count is not checked until applied.
+      if (animation >= animations.size())
+         animations.resize(animation + 1);
+      animations[animation].weight = std::max(weight, 0.0f);
+   }
+
+   float bulb::MultiGeometry::get_animation_weight(size_t animation) const
+   //---------------------------------------------------------------------
+   {
+      return (animation < animations.size()) ? animations[animation].weight : 0.0f;
+   }
+
+   void bulb::MultiGeometry::set_animation_time(size_t animation, float seconds)
+   //---------------------------------------------------------------------------
+   {
+      if (animation >= animations.size())
+         animations.resize(animation + 1);
+      animations[animation].time = std::max(seconds, 0.0f);
+   }
+
+   float bulb::MultiGeometry::get_animation_time(size_t animation) const
+   //-------------------------------------------------------------------
+   {
+      return (animation < animations.size()) ? animations[animation].time : 0.0f;
+   }
+
+   bool bulb::MultiGeometry::is_animated() const
+   //-------------------------------------------
+   {
+      return std::any_of(animations.begin(), animations.end(),
+                         [](const GltfAnimation& animation) { return (animation.weight > 0); });
+   }
+
+   void bulb::MultiGeometry::advance_animations(float dt)
+   //----------------------------------------------------
+   {
+      int instance = -1;
+      gltfio::Animator* animator = displayed_animator(displayed_gltf(instance), instance);
+      const size_t count = (animator != nullptr) ? animator->getAnimationCount() : 0;
+      for (size_t i = 0; i < animations.size(); i++)
       {
-#if defined(__ANDROID__)
-         assetsDir = "/";
-#else
-         assetsDir = ".";
-#endif
-         assetName = filepath;
+         GltfAnimation& animation = animations[i];
+         if (animation.weight <= 0)
+            continue;
+         animation.time += dt;
+         const float duration = (i < count) ? animator->getAnimationDuration(i) : 0.0f;
+         if (duration > 0)
+            animation.time = (isAnimationLooping) ? std::fmod(animation.time, duration)
+                                                  : std::min(animation.time, duration);
       }
-      p = assetName.rfind('.');
-      if (p != std::string::npos)
+   }
+
+   bool bulb::MultiGeometry::apply_animations()
+   //------------------------------------------
+   {
+      activeAnimations.clear();
+      int instance = -1;
+      GltfAsset* asset = displayed_gltf(instance);
+      gltfio::Animator* animator = displayed_animator(asset, instance);
+      if (animator == nullptr)
+         return false;
+      const size_t count = std::min(animations.size(), animator->getAnimationCount());
+      for (size_t i = 0; i < count; i++)
+         if (animations[i].weight > 0)
+            activeAnimations.push_back(i);
+      if (activeAnimations.size() == 1)
+         animator->applyAnimation(activeAnimations[0], animations[activeAnimations[0]].time);
+      if (activeAnimations.size() < 2)
+         return false;
+
+      // The Animator can only set transforms, so each animation is applied in turn and the local transforms it
+      // leaves are captured for blending.
+      filament::TransformManager& tm = managers.transformManager;
+      size_t entityCount = 0;
+      const utils::Entity* entities = asset->get_entities(instance, entityCount);
+      animationPoses.resize(activeAnimations.size() * entityCount);
+      for (size_t k = 0; k < activeAnimations.size(); k++)
       {
-         ext = assetName.substr(p);
-         nameNoExt = assetName.substr(0, p);
+         animator->applyAnimation(activeAnimations[k], animations[activeAnimations[k]].time);
+         for (size_t e = 0; e < entityCount; e++)
+         {
+            utils::EntityInstance<filament::TransformManager> transform = tm.getInstance(entities[e]);
+            animationPoses[k * entityCount + e] = (transform) ? tm.getTransform(transform)
+                                                              : filament::math::mat4f();
+         }
       }
-      else
+      return true;
+   }
+
+   /** Splits an affine transform without shear into translation, rotation (quaternion x, y, z, w) and scale. */
+   static void decompose(const filament::math::mat4f& M, float t[3], float q[4], float s[3])
+   //----------------------------------------------------------------------------------------
+   {
+      float r[3][3]; // r[row][column]
+      for (int c = 0; c < 3; c++)
       {
-         ext = "";
-         nameNoExt = assetName;
+         t[c] = M[3][c];
+         s[c] = std::sqrt(M[c][0]*M[c][0] + M[c][1]*M[c][1] + M[c][2]*M[c][2]);
+         const float inverse = (s[c] > 0) ? 1.0f / s[c] : 0.0f;
+         for (int row = 0; row < 3; row++)
+            r[row][c] = M[c][row] * inverse;
       }
-      utils::Path copyToPath(gltfPath);
-      bool isTmpDir = false;
-      if (ext == ".zip")
-      {  //TODO: Handle zips in Android assets even though assets are already zipped ?
-#if defined(HAVE_LIBZIP) && !defined(__ANDROID__)
-         std::string tmpdir = temp_dir() + "/" + nameNoExt;
-         if (is_dir(tmpdir.c_str()))
-            deldirs(tmpdir.c_str());
-         if (unzip(gltfPath, tmpdir))
-         {
-            copyToPath = tmpdir;
-            assetsDir = tmpdir;
-            isTmpDir = true;
-         }
-         else
-         {
-            logger.error("Error decompressing {0}", gltfPath);
-            return false;
-         }
-#else
-         logger.error("Cannot handle {0} due to not being compiled with libzip support.", gltfPath);
-         return false;
-#endif
+      const float trace = r[0][0] + r[1][1] + r[2][2];
+      if (trace > 0)
+      {
+         const float k = 0.5f / std::sqrt(trace + 1.0f);
+         q[3] = 0.25f / k;
+         q[0] = (r[2][1] - r[1][2]) * k;
+         q[1] = (r[0][2] - r[2][0]) * k;
+         q[2] = (r[1][0] - r[0][1]) * k;
+      }
+      else if ( (r[0][0] > r[1][1]) && (r[0][0] > r[2][2]) )
+      {
+         const float k = 2.0f * std::sqrt(std::max(1.0f + r[0][0] - r[1][1] - r[2][2], 0.0f));
+         q[3] = (r[2][1] - r[1][2]) / k;
+         q[0] = 0.25f * k;
+         q[1] = (r[0][1] + r[1][0]) / k;
+         q[2] = (r[0][2] + r[2][0]) / k;
+      }
+      else if (r[1][1] > r[2][2])
+      {
+         const float k = 2.0f * std::sqrt(std::max(1.0f + r[1][1] - r[0][0] - r[2][2], 0.0f));
+         q[3] = (r[0][2] - r[2][0]) / k;
+         q[0] = (r[0][1] + r[1][0]) / k;
+         q[1] = 0.25f * k;
+         q[2] = (r[1][2] + r[2][1]) / k;
       }
-#if defined(__ANDROID__)
       else
       {
-         std::string tmpdir = temp_dir() + "/" + nameNoExt;
-         if (is_dir(tmpdir.c_str()))
-            deldirs(tmpdir.c_str());
-         utils::Path destination(tmpdir);
-         if (  (destination.mkdirRecursive()) &&
-               (reader.copy_assets_to(assetsDir.c_str(), tmpdir.c_str()))
-            )
+         const float k = 2.0f * std::sqrt(std::max(1.0f + r[2][2] - r[0][0] - r[1][1], 0.0f));
+         q[3] = (r[1][0] - r[0][1]) / k;
+         q[0] = (r[0][2] + r[2][0]) / k;
+         q[1] = (r[1][2] + r[2][1]) / k;
+         q[2] = 0.25f * k;
+      }
+   }
+
+   static filament::math::mat4f compose(const float t[3], const float q[4], const float s[3])
+   //-----------------------------------------------------------------------------------------
+   {
+      const float x = q[0], y = q[1], z = q[2], w = q[3];
+      const float r[3][3] = { { 1 - 2*(y*y + z*z), 2*(x*y - z*w),     2*(x*z + y*w) },
+                              { 2*(x*y + z*w),     1 - 2*(x*x + z*z), 2*(y*z - x*w) },
+                              { 2*(x*z - y*w),     2*(y*z + x*w),     1 - 2*(x*x + y*y) } };
+      filament::math::mat4f M;
+      for (int c = 0; c < 3; c++)
+      {
+         for (int row = 0; row < 3; row++)
+            M[c][row] = r[row][c] * s[c];
+         M[c][3] = 0;
+         M[3][c] = t[c];
+      }
+      M[3][3] = 1;
+      return M;
+   }
+
+   void bulb::MultiGeometry::blend_animations()
+   //------------------------------------------
+   {
+      const size_t active = activeAnimations.size();
+      if (active < 2)
+         return;
+      float total = 0;
+      for (size_t animation : activeAnimations)
+         total += animations[animation].weight;
+      const size_t entityCount = animationPoses.size() / active;
+      blendedPoses.resize(entityCount);
+      for (size_t e = 0; e < entityCount; e++)
+      {
+         float t[3] = { 0, 0, 0 }, q[4] = { 0, 0, 0, 0 }, s[3] = { 0, 0, 0 };
+         float first[4] = { 0, 0, 0, 1 };
+         for (size_t k = 0; k < active; k++)
          {
-            copyToPath = destination;
-            assetsDir = tmpdir;
-            isTmpDir = true;
+            float tk[3], qk[4], sk[3];
+            decompose(animationPoses[k * entityCount + e], tk, qk, sk);
+            float w = animations[activeAnimations[k]].weight / total;
+            if (k == 0)
+               std::copy(qk, qk + 4, first);
+            else if (qk[0]*first[0] + qk[1]*first[1] + qk[2]*first[2] + qk[3]*first[3] < 0)
+               w = -w; // Blend along the shortest arc
+            for (int c = 0; c < 3; c++)
+            {
+               t[c] += tk[c] * std::fabs(w);
+               s[c] += sk[c] * std::fabs(w);
+            }
+            for (int c = 0; c < 4; c++)
+               q[c] += qk[c] * w;
          }
+         const float length = std::sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+         if (length > 0)
+            for (float& c : q)
+               c /= length;
          else
-         {
-            logger.error("Could not copy Android assets in directory {0} to sdcard {1}", assetsDir.c_str(),
-                         tmpdir.c_str());
-            return false;
-         }
+            std::copy(first, first + 4, q);
+         blendedPoses[e] = compose(t, q, s);
       }
-#endif
+   }
 
-      Managers& managers = Managers::instance();
-      filament::Engine* engine = managers.engine.get();
-      auto materials = gltfio::createMaterialGenerator(engine);
-      gltfLoader = gltfio::AssetLoader::create({engine, materials});
-      std::vector<unsigned char> data;
-      utils::Path assetPath(assetsDir + "/" + assetName);
-      if ((reader.read_asset_vector(assetPath.c_str(), data)) && (!data.empty()))
+   void bulb::MultiGeometry::store_animations()
+   //------------------------------------------
+   {
+      int instance = -1;
+      GltfAsset* asset = displayed_gltf(instance);
+      if ( (asset == nullptr) || (activeAnimations.size() < 2) )
+         return;
+      filament::TransformManager& tm = managers.transformManager;
+      size_t entityCount = 0;
+      const utils::Entity* entities = asset->get_entities(instance, entityCount);
+      for (size_t e = 0; e < std::min(entityCount, blendedPoses.size()); e++)
       {
-         auto loadStart = std::chrono::high_resolution_clock::now();
-         if (ext == ".glb")
-            gltfAsset = gltfLoader->createAssetFromBinary(data.data(), data.size());
-         else
-            gltfAsset = gltfLoader->createAssetFromJson(data.data(), data.size());
-         auto loadEnd = std::chrono::high_resolution_clock::now();
-         logger.info("GLTF load for {0} took {1}ms", assetName,
-                     std::chrono::duration_cast<std::chrono::milliseconds>(loadEnd - loadStart).count());
-         data.clear();
-         data.shrink_to_fit();
-         if ((!gltfAsset) || (gltfAsset->getEntityCount() == 0))
-         {
-            if (gltfAsset)
-               gltfLoader->destroyAsset(gltfAsset);
-            gltfio::AssetLoader::destroy(&gltfLoader);
-            gltfLoader = nullptr;
-            gltfAsset = nullptr;
-            logger.error("Error loading asset(s) from {0}", gltfPath);
-            return false;
-         }
+         utils::EntityInstance<filament::TransformManager> transform = tm.getInstance(entities[e]);
+         if (transform)
+            tm.setTransform(transform, blendedPoses[e]);
+      }
+   }
 
-         loadStart = std::chrono::high_resolution_clock::now();
-         if (! gltfio::ResourceLoader({Managers::instance().engine.get(), assetPath.getParent(), true, false}).loadResources(gltfAsset))
-            logger.error("Error loading resources from {0}", assetPath.c_str());
-         else
-         {
-            loadEnd = std::chrono::high_resolution_clock::now();
-            logger.info("GLTF Resources load for {0} took {1}ms", assetName,
-                        std::chrono::duration_cast<std::chrono::milliseconds>(loadEnd - loadStart).count());
-         }
-         if (isTmpDir)
-            deldirs(assetsDir.c_str());
-         gltfAsset->releaseSourceData();
-         renderedEntity = gltfAsset->getRoot();
-         const utils::Entity* entities = gltfAsset->getEntities();
-         for (size_t i = 0; i < gltfAsset->getEntityCount(); i++)
-            children.push_back(entities[i]);
-         if (normalized)
-            S = scale_to_unitcube(gltfAsset->getBoundingBox());
-         return true;
+   void bulb::MultiGeometry::update_bones()
+   //--------------------------------------
+   {
+      int instance = -1;
+      gltfio::Animator* animator = displayed_animator(displayed_gltf(instance), instance);
+      if (animator != nullptr)
+         animator->updateBoneMatrices();
+   }
+
+   void bulb::MultiGeometry::animate(float dt, bool isUpdatingBones)
+   //---------------------------------------------------------------
+   {
+      if (! is_animated())
+         return;
+      advance_animations(dt);
+      if (apply_animations())
+      {
+         blend_animations();
+         store_animations();
       }
-      else
+      if (isUpdatingBones)
+         update_bones();
+   }
+
+   bool bulb::MultiGeometry::world_bounds(filament::Box& box)
+   //--------------------------------------------------------
+   {
+      int instance = -1;
+      GltfAsset* asset = displayed_gltf(instance);
+      if (asset == nullptr)
+         return false;
+      const filament::Aabb aabb = asset->get_asset()->getBoundingBox();
+      filament::TransformManager& tm = managers.transformManager;
+      utils::EntityInstance<filament::TransformManager> root = tm.getInstance(renderedEntity);
+      const filament::math::mat4f W = (root) ? tm.getWorldTransform(root) : M * S;
+      // Transformed center and the extent of the transformed box along each world axis
+      filament::math::float3 center, halfExtent;
+      for (int i = 0; i < 3; i++)
       {
-         gltfio::AssetLoader::destroy(&gltfLoader);
-         gltfLoader = nullptr;
-         logger.error("Error loading data from asset file {0}", gltfPath);
+         center[i] = W[3][i];
+         halfExtent[i] = 0;
+         for (int j = 0; j < 3; j++)
+         {
+            center[i] += W[j][i] * (aabb.min[j] + aabb.max[j]) * 0.5f;
+            halfExtent[i] += std::fabs(W[j][i]) * (aabb.max[j] - aabb.min[j]) * 0.5f;
+         }
       }
-      return false;
+      box.center = center;
+      box.halfExtent = halfExtent;
+      return true;
    }
-}
\ No newline at end of file
+}
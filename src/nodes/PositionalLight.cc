@@ -7,35 +7,35 @@
 
 namespace bulb
 {
-   bulb::PositionalLight::PositionalLight(const char* name, filament::LinearColor color,
+   bulb::PositionalLight::PositionalLight(Managers& context, const char* name, filament::LinearColor color,
                                           filament::math::float3 initialPosition, filament::math::float3 direction,
                                           filament::math::float2 cone, float intensity, float efficiency, float fade,
-                                          bool hasShadows) : Drawable(name),
+                                          bool hasShadows) : Drawable(context, name),
                                           initialPosition({initialPosition[0], initialPosition[1], initialPosition[2], 1})
    //---------------------------------------------------------------------------------------------------------------
    {
       filament::LightManager::Builder(filament::LightManager::Type::FOCUSED_SPOT)
                 .color(color).intensity(intensity, efficiency).position(initialPosition)
                 .direction(direction).spotLightCone(cone[0], cone[1]).falloff(fade)
-                .build(*Managers::instance().engine, renderedEntity);
+                .build(*managers.engine, renderedEntity);
    }
 
-   PositionalLight::PositionalLight(const char* name, filament::LinearColor color,
+   PositionalLight::PositionalLight(Managers& context, const char* name, filament::LinearColor color,
                                     filament::math::float3 initialPosition, filament::math::float3 direction,
                                     float intensity, float efficiency, float fade, bool hasShadows) :
-                                    Drawable(name),
+                                    Drawable(context, name),
                                     initialPosition({initialPosition[0], initialPosition[1], initialPosition[2], 1})
    //----------------------------------------------------------------------------------------------
    {
       filament::LightManager::Builder(filament::LightManager::Type::POINT)
             .color(color).intensity(intensity, efficiency).position(initialPosition).direction(direction)
-            .falloff(fade).build(*Managers::instance().engine, renderedEntity);
+            .falloff(fade).build(*managers.engine, renderedEntity);
    }
 
    void PositionalLight::pre_render(std::vector<utils::Entity>& renderables)
    //------------------------------------------------------------------------
    {
-      filament::LightManager& manager = Managers::instance().lightManager;
+      filament::LightManager& manager = managers.lightManager;
       utils::EntityInstance<filament::LightManager> inst = manager.getInstance(renderedEntity);
       filament::math::float4 pos = M*initialPosition;
       if (! near_zero(pos[3], 0.0000001f))
@@ -32,7 +32,9 @@ namespace bulb
 //            std::cout << "Set material from node: " << m->get_material()->getName() << " for " << draw->get_name() << std::endl;
          }
       }
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
       draw->pre_render(renderables);
+      preRenderTime += std::chrono::steady_clock::now() - start;
    }
 
    void RenderVisitor::on_post_traverse(bulb::Node* node)
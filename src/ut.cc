@@ -1,5 +1,10 @@
 #include <fstream>
 #include <memory>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -20,6 +25,8 @@
 #include "math/mat4.h"
 
 #include "Log.hh"
+#include "AssetReader.hh"
+#include "ThreadPool.hh"
 
 namespace bulb
 {
@@ -158,6 +165,30 @@ namespace bulb
       rmdir(dirpath);
    }
 
+   uint64_t hash64(const void* data, size_t size, uint64_t seed)
+   //------------------------------------------------------------
+   {
+      // FNV-1a style mixing a word at a time, with a murmur3 finalizer to spread the high bits.
+      const uint8_t* p = static_cast<const uint8_t*>(data);
+      uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL) ^ size;
+      size_t i = 0;
+      for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+      {
+         uint64_t w;
+         std::memcpy(&w, p + i, sizeof(uint64_t));
+         h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+         h ^= h >> 29;
+      }
+      for (; i < size; i++)
+         h = (h ^ p[i]) * 0x100000001b3ULL;
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return h;
+   }
+
 #ifdef HAVE_LIBZIP
    bool unzip(const char* zipfile, std::string dir)
    //----------------------------------------------
@@ -166,7 +197,7 @@ namespace bulb
       int err = 0;
       struct Dz { void operator()(zip* p) const { if (p) zip_close(p); }; };
       Dz dz;
-      std::unique_ptr<zip, Dz> z(zip_open("foo.zip", ZIP_RDONLY, &err), dz);
+      std::unique_ptr<zip, Dz> z(zip_open(zipfile, ZIP_RDONLY, &err), dz);
       if (! z)
       {
          logger.error("Error opening zip {0}", zipfile);
@@ -232,6 +263,114 @@ namespace bulb
       }
       return true;
    }
+
+   // libzip archives may not be shared between threads, so each worker opens its own archive over the same buffer.
+   static zip* open_zip_buffer(const std::shared_ptr<AssetView>& archive)
+   //--------------------------------------------------------------------
+   {
+      zip_error_t error;
+      zip_error_init(&error);
+      zip_source_t* source = zip_source_buffer_create(archive->data(), archive->size(), 0, &error);
+      zip* z = nullptr;
+      if (source != nullptr)
+      {
+         z = zip_open_from_source(source, ZIP_RDONLY, &error);
+         if (z == nullptr)
+            zip_source_free(source);
+      }
+      zip_error_fini(&error);
+      return z;
+   }
+
+   bool unzip(const char* zipfile, std::unordered_map<std::string, std::shared_ptr<AssetView>>& entries)
+   //---------------------------------------------------------------------------------------------------
+   {
+      Log logger("ut::unzip");
+      std::shared_ptr<AssetView> archive = AssetReader::instance().map_asset(zipfile);
+      if (! archive)
+      {
+         logger.error("Error reading zip {0}", zipfile);
+         return false;
+      }
+      struct Dz { void operator()(zip* p) const { if (p) zip_discard(p); }; };
+      std::unique_ptr<zip, Dz> z(open_zip_buffer(archive), Dz());
+      if (! z)
+      {
+         logger.error("Error opening zip {0}", zipfile);
+         return false;
+      }
+      zip_int64_t no = zip_get_num_entries(z.get(), 0);
+      if (no <= 0)
+      {
+         logger.error("Error or no entries enumerating zip {0}", zipfile);
+         return false;
+      }
+      struct Entry
+      {
+         zip_uint64_t index;
+         std::string name;
+         size_t size;
+         std::shared_ptr<AssetView> contents;
+      };
+      std::vector<Entry> files;
+      struct zip_stat stat;
+      for (zip_int64_t i = 0; i < no; i++)
+      {
+         if (zip_stat_index(z.get(), (zip_uint64_t) i, 0, &stat) < 0)
+         {
+            logger.error("Error getting entry {0} from zip file {1}", i, zipfile);
+            return false;
+         }
+         std::string name(stat.name);
+         if ( (! name.empty()) && (name[name.length() - 1] != '/') )
+            files.push_back(Entry{(zip_uint64_t) i, name, static_cast<size_t>(stat.size), nullptr});
+      }
+      z.reset();
+
+      std::atomic<bool> ok(true);
+      ThreadPool::workers().parallel_for(0, files.size(), [&](size_t first, size_t last)
+      {
+         std::unique_ptr<zip, Dz> zz(open_zip_buffer(archive), Dz());
+         for (size_t i = first; (i < last) && (zz) && (ok); i++)
+         {
+            Entry& entry = files[i];
+            struct Dzf { void operator()(zip_file* p) const { if (p) zip_fclose(p); }; };
+            std::unique_ptr<zip_file, Dzf> zf(zip_fopen_index(zz.get(), entry.index, 0), Dzf());
+            if (! zf)
+            {
+               ok = false;
+               break;
+            }
+            char* buf = new char[std::max(entry.size, size_t(1))];
+            size_t sum = 0;
+            while (sum < entry.size)
+            {
+               zip_int64_t len = zip_fread(zf.get(), buf + sum, entry.size - sum);
+               if (len <= 0)
+                  break;
+               sum += static_cast<size_t>(len);
+            }
+            if (sum < entry.size)
+            {
+               delete[] buf;
+               ok = false;
+               break;
+            }
+            entry.contents = AssetReader::make_view(buf, entry.size,
+                                                    [](const void* p, size_t) { delete[] static_cast<const char*>(p); });
+         }
+         if (! zz)
+            ok = false;
+      }, 1);
+      if (! ok)
+      {
+         logger.error("Error decompressing entries from zip file {0}", zipfile);
+         return false;
+      }
+      for (Entry& entry : files)
+         entries[entry.name] = std::move(entry.contents);
+      return true;
+   }
 #endif
 
 
@@ -0,0 +1,707 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <atomic>
+
+#include "math/mat4.h"
+#include "math/quat.h"
+#include "math/vec3.h"
+
+#include "filament/Engine.h"
+#include "filament/Material.h"
+#include "filament/MaterialInstance.h"
+
+#include "bulb/Managers.hh"
+#include "bulb/MaterialCache.hh"
+#include "bulb/MaterialInstancePool.hh"
+#include "bulb/GltfAsset.hh"
+#include "bulb/MeshOptimizer.hh"
+#include "bulb/StreamingTexture.hh"
+#include "bulb/KeyframeTracks.hh"
+#include "bulb/nodes/AffineTransform.hh"
+
+// Unit tests for the parts of the library which can be checked without a GPU or display, run (from the source
+// directory, for the material assets) by ctest when configured with -DBULB_TESTS=ON, or directly as
+//    bulb_tests [test name]...
+// The MaterialInstancePool test uses filament's NOOP backend.
+
+static size_t failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static bool check(bool isPassed, const char* condition, const char* file, int line)
+//---------------------------------------------------------------------------------
+{
+   if (! isPassed)
+   {
+      std::cerr << file << ":" << line << ": CHECK(" << condition << ") failed" << std::endl;
+      failures++;
+   }
+   return isPassed;
+}
+
+static bool near(double a, double b, double tolerance =1e-5) { return (std::fabs(a - b) <= tolerance); }
+
+static bool near(const filament::math::double3& a, const filament::math::double3& b, double tolerance =1e-5)
+//----------------------------------------------------------------------------------------------------------
+{
+   return ( (near(a[0], b[0], tolerance)) && (near(a[1], b[1], tolerance)) && (near(a[2], b[2], tolerance)) );
+}
+
+static filament::math::double3 translation_of(const bulb::AffineTransform& transform)
+//-----------------------------------------------------------------------------------
+{
+   const filament::math::mat4& T = transform.get_translation();
+   return filament::math::double3(T[3][0], T[3][1], T[3][2]);
+}
+
+static filament::math::double3 scale_of(const bulb::AffineTransform& transform)
+//-----------------------------------------------------------------------------
+{
+   const filament::math::mat4& S = transform.get_scaling();
+   return filament::math::double3(S[0][0], S[1][1], S[2][2]);
+}
+
+/** @return true if the rotation of transform is that of q (w, x, y, z), compared as matrices. */
+static bool has_rotation(const bulb::AffineTransform& transform, const filament::math::quat& q,
+                         double tolerance =1e-5)
+//---------------------------------------------------------------------------------------------
+{
+   const filament::math::mat4 expected(q);
+   const filament::math::mat4& R = transform.get_rotation();
+   for (int column = 0; column < 3; column++)
+      for (int row = 0; row < 3; row++)
+      {
+         if (! near(R[column][row], expected[column][row], tolerance))
+            return false;
+      }
+   return true;
+}
+
+static filament::math::quat y_rotation(double radians)
+//----------------------------------------------------
+{
+   return filament::math::quat(std::cos(radians / 2), 0, std::sin(radians / 2), 0);
+}
+
+static bulb::KeyframeChannel channel(std::vector<float> times, std::vector<float> values,
+                                     bulb::KeyframeInterpolation interpolation =bulb::KeyframeInterpolation::LINEAR)
+//------------------------------------------------------------------------------------------------------------------
+{
+   bulb::KeyframeChannel keys;
+   keys.times = std::move(times);
+   keys.values = std::move(values);
+   keys.interpolation = interpolation;
+   return keys;
+}
+
+static std::unique_ptr<bulb::AffineTransform> make_transform(const char* name)
+//----------------------------------------------------------------------------
+{
+   return std::unique_ptr<bulb::AffineTransform>(new bulb::AffineTransform(name, filament::math::quat(1, 0, 0, 0),
+                                                                           filament::math::double3(0, 0, 0)));
+}
+
+static void test_keyframe_step()
+//------------------------------
+{
+   std::unique_ptr<bulb::AffineTransform> target = make_transform("step");
+   bulb::KeyframeTracks tracks;
+   const bulb::KeyframeChannel none;
+   int track = tracks.add_track(target.get(), channel({ 0, 1, 2 }, { 0,0,0, 10,1,0, 20,2,0 },
+                                                 bulb::KeyframeInterpolation::STEP), none, none, false);
+   CHECK(track == 0);
+   CHECK(tracks.duration(track) == 2.0f);
+   tracks.evaluate(0.5);
+   CHECK(near(translation_of(*target), filament::math::double3(0, 0, 0)));
+   tracks.evaluate(1.0);
+   CHECK(near(translation_of(*target), filament::math::double3(10, 1, 0)));
+   tracks.evaluate(1.99);
+   CHECK(near(translation_of(*target), filament::math::double3(10, 1, 0)));
+   tracks.evaluate(5.0); // After the last key
+   CHECK(near(translation_of(*target), filament::math::double3(20, 2, 0)));
+   tracks.evaluate(0.25); // Backwards
+   CHECK(near(translation_of(*target), filament::math::double3(0, 0, 0)));
+
+   // Rotations step between (normalized) keys without interpolating
+   std::unique_ptr<bulb::AffineTransform> rotated = make_transform("step rotation");
+   const filament::math::quat quarter = y_rotation(M_PI / 2);
+   tracks.add_track(rotated.get(), none, channel({ 0, 1 }, { 0,0,0,2, 0,float(quarter.y),0,float(quarter.w) },
+                                            bulb::KeyframeInterpolation::STEP), none, false);
+   tracks.evaluate(0.9);
+   CHECK(has_rotation(*rotated, filament::math::quat(1, 0, 0, 0)));
+   tracks.evaluate(1.0);
+   CHECK(has_rotation(*rotated, quarter));
+}
+
+static void test_keyframe_linear()
+//--------------------------------
+{
+   std::unique_ptr<bulb::AffineTransform> target = make_transform("linear"), looped = make_transform("looped");
+   bulb::KeyframeTracks tracks;
+   const bulb::KeyframeChannel none;
+   tracks.add_track(target.get(), channel({ 1, 3 }, { 0,0,0, 2,4,-6 }), none, channel({ 1, 3 }, { 1,1,1, 3,1,0 }),
+                    false);
+   tracks.add_track(looped.get(), channel({ 0, 2 }, { 0,0,0, 2,0,0 }), none, none, true);
+
+   tracks.evaluate(0.25); // Before the first key
+   CHECK(near(translation_of(*target), filament::math::double3(0, 0, 0)));
+   CHECK(near(scale_of(*target), filament::math::double3(1, 1, 1)));
+   tracks.evaluate(2.0);
+   CHECK(near(translation_of(*target), filament::math::double3(1, 2, -3)));
+   CHECK(near(scale_of(*target), filament::math::double3(2, 1, 0.5)));
+   CHECK(near(translation_of(*looped), filament::math::double3(0, 0, 0))); // Wrapped to 0
+   tracks.evaluate(2.5);
+   CHECK(near(translation_of(*target), filament::math::double3(1.5, 3, -4.5)));
+   CHECK(near(translation_of(*looped), filament::math::double3(0.5, 0, 0))); // Wrapped to 0.5
+   tracks.evaluate(10.0); // After the last key
+   CHECK(near(translation_of(*target), filament::math::double3(2, 4, -6)));
+   CHECK(near(scale_of(*target), filament::math::double3(3, 1, 0)));
+
+   tracks.set_enabled(0, false);
+   tracks.evaluate(2.0);
+   CHECK(near(translation_of(*target), filament::math::double3(2, 4, -6))); // Unchanged while disabled
+
+   // Malformed channels are rejected
+   CHECK(tracks.add_track(target.get(), channel({ 0, 1 }, { 0,0,0 }), none, none) == -1);
+   CHECK(tracks.add_track(target.get(), channel({ 1, 0 }, { 0,0,0, 1,1,1 }), none, none) == -1);
+   CHECK(tracks.add_track(nullptr, channel({ 0 }, { 0,0,0 }), none, none) == -1);
+   CHECK(tracks.add_track(target.get(), none, none, none) == -1);
+}
+
+static void test_keyframe_cubic_spline()
+//--------------------------------------
+{
+   std::unique_ptr<bulb::AffineTransform> target = make_transform("cubic"), rotated = make_transform("cubic rotation");
+   bulb::KeyframeTracks tracks;
+   const bulb::KeyframeChannel none;
+   // Per key: in tangent, value, out tangent. Over the 2 second span x eases from 0 to 1 with flat tangents, y
+   // follows tangents of 1 (so y = t) and z only has the out tangent of the first key.
+   tracks.add_track(target.get(), channel({ 0, 2 }, { 0,0,0,  0,0,0,  0,1,1,
+                                                 0,1,0,  1,2,0,  0,0,0 }, bulb::KeyframeInterpolation::CUBIC_SPLINE),
+                    none, none, false);
+   tracks.evaluate(0.5);
+   const double s = 0.25, s2 = s * s, s3 = s2 * s;
+   CHECK(near(translation_of(*target), filament::math::double3(3*s2 - 2*s3, 0.5, (s3 - 2*s2 + s) * 2)));
+   tracks.evaluate(1.0);
+   CHECK(near(translation_of(*target), filament::math::double3(0.5, 1, 0.25)));
+   tracks.evaluate(3.0);
+   CHECK(near(translation_of(*target), filament::math::double3(1, 2, 0)));
+
+   // With flat tangents the spline midpoint is the normalized average, the same as slerp for a half turn step
+   const filament::math::quat quarter = y_rotation(M_PI / 2);
+   tracks.add_track(rotated.get(), none, channel({ 0, 1 }, { 0,0,0,0,  0,0,0,1,  0,0,0,0,
+                                                        0,0,0,0,  0,float(quarter.y),0,float(quarter.w),  0,0,0,0 },
+                                            bulb::KeyframeInterpolation::CUBIC_SPLINE), none, false);
+   tracks.evaluate(0.5);
+   CHECK(has_rotation(*rotated, y_rotation(M_PI / 4)));
+   tracks.evaluate(1.0);
+   CHECK(has_rotation(*rotated, quarter));
+
+   // Cubic channels need three values per key
+   CHECK(tracks.add_track(target.get(), channel({ 0, 1 }, { 0,0,0, 1,1,1 }, bulb::KeyframeInterpolation::CUBIC_SPLINE),
+                          none, none) == -1);
+}
+
+static void test_keyframe_slerp()
+//-------------------------------
+{
+   std::unique_ptr<bulb::AffineTransform> target = make_transform("slerp"), flipped = make_transform("flipped");
+   bulb::KeyframeTracks tracks;
+   const bulb::KeyframeChannel none;
+   const filament::math::quat quarter = y_rotation(M_PI / 2);
+   const float qy = float(quarter.y), qw = float(quarter.w);
+   // Keys need not be normalized, and the destination of flipped is in the opposite hemisphere so it must be negated
+   // to take the shortest path.
+   tracks.add_track(target.get(), none, channel({ 1, 2 }, { 0,0,0,2, 0,qy,0,qw }), none, false);
+   tracks.add_track(flipped.get(), none, channel({ 1, 2 }, { 0,0,0,1, 0,-qy,0,-qw }), none, false);
+   const double tolerance = 1e-3; // The slerp is approximated to a few 1e-4 radians
+   tracks.evaluate(0.5);
+   CHECK(has_rotation(*target, filament::math::quat(1, 0, 0, 0)));
+   for (double t : { 0.25, 0.5, 0.75 })
+   {
+      tracks.evaluate(1.0 + t);
+      CHECK(has_rotation(*target, y_rotation(t * M_PI / 2), tolerance));
+      CHECK(has_rotation(*flipped, y_rotation(t * M_PI / 2), tolerance));
+   }
+   tracks.evaluate(4.0);
+   CHECK(has_rotation(*target, quarter));
+}
+
+// Random tracks of every interpolation, many sharing their target with another track.
+static void make_random_tracks(std::vector<std::unique_ptr<bulb::AffineTransform>>& targets,
+                               bulb::KeyframeTracks& tracks, size_t count, unsigned seed)
+//-------------------------------------------------------------------------------------------
+{
+   std::mt19937 random(seed);
+   std::uniform_real_distribution<float> value(-2.0f, 2.0f), step(0.05f, 1.0f);
+   const bulb::KeyframeInterpolation interpolations[] = { bulb::KeyframeInterpolation::STEP,
+                                                          bulb::KeyframeInterpolation::LINEAR,
+                                                          bulb::KeyframeInterpolation::CUBIC_SPLINE };
+   auto random_channel = [&](unsigned components) -> bulb::KeyframeChannel
+   {
+      bulb::KeyframeChannel keys;
+      keys.interpolation = interpolations[random() % 3];
+      const size_t valuesPerKey = (keys.interpolation == bulb::KeyframeInterpolation::CUBIC_SPLINE) ? 3 : 1;
+      const size_t n = 1 + random() % 6;
+      float t = 0.0f;
+      for (size_t key = 0; key < n; key++)
+      {
+         keys.times.push_back(t);
+         t += step(random);
+         for (size_t v = 0; v < valuesPerKey * components; v++)
+            keys.values.push_back(value(random));
+      }
+      return keys;
+   };
+   targets.clear();
+   for (size_t i = 0; i < count; i++)
+      targets.push_back(make_transform("random"));
+   for (size_t i = 0; i < count; i++)
+   {
+      const bulb::KeyframeChannel none;
+      const size_t kinds = 1 + random() % 7;
+      tracks.add_track(targets[i].get(), (kinds & 1) ? random_channel(3) : none, (kinds & 2) ? random_channel(4) : none,
+                       (kinds & 4) ? random_channel(3) : none, (random() % 2) == 0);
+      if (i % 2 == 0) // A second track on the same target
+         tracks.add_track(targets[i].get(), random_channel(3), none, none, true);
+   }
+}
+
+static void test_keyframe_simd()
+//------------------------------
+{
+   // The SIMD kernels must agree with the scalar ones, serially and (with more than 1024 tracks) in parallel.
+   for (size_t count : { size_t(37), size_t(1500) })
+   {
+      std::vector<std::unique_ptr<bulb::AffineTransform>> simdTargets, scalarTargets;
+      bulb::KeyframeTracks simd, scalar;
+      make_random_tracks(simdTargets, simd, count, 7);
+      make_random_tracks(scalarTargets, scalar, count, 7);
+      CHECK(simd.size() == scalar.size());
+      simd.set_simd(true);
+      scalar.set_simd(false);
+      CHECK(! scalar.is_simd());
+      for (double time : { 0.0, 0.3, 1.7, 2.2, 0.9, 6.5 })
+      {
+         simd.evaluate(time);
+         scalar.evaluate(time);
+         size_t mismatches = 0;
+         for (size_t i = 0; i < count; i++)
+         {
+            const bulb::AffineTransform& a = *simdTargets[i];
+            const bulb::AffineTransform& b = *scalarTargets[i];
+            const filament::math::mat4& Ra = a.get_rotation();
+            const filament::math::mat4& Rb = b.get_rotation();
+            bool isSame = ( (near(translation_of(a), translation_of(b), 1e-5)) &&
+                            (near(scale_of(a), scale_of(b), 1e-5)) );
+            for (int column = 0; column < 3; column++)
+               for (int row = 0; row < 3; row++)
+                  isSame = isSame && near(Ra[column][row], Rb[column][row], 1e-5);
+            if (! isSame)
+               mismatches++;
+         }
+         CHECK(mismatches == 0);
+      }
+   }
+}
+
+static void test_material_instance_pool()
+//---------------------------------------
+{
+   bulb::EngineConfig config;
+   config.backend = filament::Engine::Backend::NOOP;
+   std::shared_ptr<bulb::Managers> context = bulb::Managers::create(config);
+   if (! CHECK(context != nullptr))
+      return;
+   filament::Material* material = context->material_cache().acquire("assets/bakedColor");
+   if (! CHECK(material != nullptr))
+      return;
+   bulb::MaterialInstancePool& pool = context->material_instances();
+   size_t visited = 0;
+   std::function<void(filament::MaterialInstance*)> count = [&visited](filament::MaterialInstance*) { visited++; };
+   auto count_instances = [&pool, material, &visited, &count](const char* param) -> size_t
+   {
+      visited = 0;
+      pool.update_instances(material, param, count);
+      return visited;
+   };
+
+   CHECK(pool.acquire(nullptr) == nullptr);
+   filament::MaterialInstance* a = pool.acquire(material);
+   filament::MaterialInstance* b = pool.acquire(material);
+   CHECK( (a != nullptr) && (b != nullptr) && (a != b) );
+   CHECK(count_instances("baseColor") == 2);
+
+   // Released instances are reused rather than recreated
+   pool.release(a);
+   CHECK(count_instances("baseColor") == 2);
+   filament::MaterialInstance* c = pool.acquire(material);
+   CHECK(c == a);
+
+   // Overrides exempt an in use instance from default updates until it is released
+   pool.set_override(c, "baseColor");
+   CHECK(count_instances("baseColor") == 1);
+   CHECK(count_instances("roughness") == 2);
+   pool.release(c);
+   CHECK(count_instances("baseColor") == 2);
+   CHECK(pool.acquire(material) == c);
+   CHECK(count_instances("baseColor") == 2);
+   pool.set_override(c, "baseColor");
+   pool.clear_overrides(c);
+   CHECK(count_instances("baseColor") == 2);
+
+   // Modified instances are destroyed, not pooled
+   pool.release(b, true);
+   CHECK(count_instances("baseColor") == 1);
+
+   // purge and clear only destroy free instances
+   pool.purge(material);
+   CHECK(count_instances("baseColor") == 1);
+   pool.release(c);
+   pool.clear();
+   CHECK(count_instances("baseColor") == 0);
+
+   context->material_cache().release(material);
+   context->engine->flushAndWait();
+}
+
+static void test_decode_uri()
+//---------------------------
+{
+   CHECK(bulb::GltfAsset::decode_uri("scene.bin") == "scene.bin");
+   CHECK(bulb::GltfAsset::decode_uri("my%20scene.bin") == "my scene.bin");
+   CHECK(bulb::GltfAsset::decode_uri("%41%62%2f") == "Ab/");
+   CHECK(bulb::GltfAsset::decode_uri("%e9t%C3%A9.png") == "\xe9t\xc3\xa9.png");
+   // Malformed or truncated escapes are kept as is
+   CHECK(bulb::GltfAsset::decode_uri("100%") == "100%");
+   CHECK(bulb::GltfAsset::decode_uri("a%4") == "a%4");
+   CHECK(bulb::GltfAsset::decode_uri("%zz%g1") == "%zz%g1");
+   // Bytes outside ASCII (negative as char) are not escapes and pass through
+   CHECK(bulb::GltfAsset::decode_uri("\xff%\xff\xff") == "\xff%\xff\xff");
+   CHECK(bulb::GltfAsset::decode_uri("").empty());
+}
+
+// Exact for integers below 2048.
+static uint16_t half_of(uint32_t i)
+//---------------------------------
+{
+   if (i == 0)
+      return 0;
+   int exponent = 0;
+   while ((i >> (exponent + 1)) != 0)
+      exponent++;
+   const uint32_t mantissa = (i << (10 - exponent)) & 0x3FF;
+   return static_cast<uint16_t>(((exponent + 15) << 10) | mantissa);
+}
+
+// The filamesh header as written by the filament filamesh tool (@see filameshio::MeshReader).
+struct TestFilameshHeader
+{
+   uint32_t version, parts;
+   float center[3], halfExtent[3];
+   uint32_t flags;
+   uint32_t offsetPosition, stridePosition, offsetTangents, strideTangents, offsetColor, strideColor;
+   uint32_t offsetUV0, strideUV0, offsetUV1, strideUV1;
+   uint32_t vertexCount, vertexSize, indexType, indexCount, indexSize;
+};
+
+struct TestFilameshPart
+{
+   uint32_t offset, indexCount, minIndex, maxIndex, materialID;
+   float center[3], halfExtent[3];
+};
+
+// A single part filamesh with interleaved half4 positions and 32 bit indices whose triangles use every vertex.
+static std::shared_ptr<bulb::AssetView> make_filamesh(uint32_t vertexCount)
+//-------------------------------------------------------------------------
+{
+   const uint32_t none = std::numeric_limits<uint32_t>::max();
+   std::vector<uint32_t> indices;
+   for (uint32_t v = 0; v < vertexCount; v++)
+      indices.insert(indices.end(), { v, (v + 1) % vertexCount, (v + 2) % vertexCount });
+   TestFilameshHeader header{};
+   header.version = 1;
+   header.parts = 1;
+   header.flags = 0x1; // Interleaved
+   header.offsetPosition = 0;
+   header.stridePosition = 4 * sizeof(uint16_t);
+   header.offsetTangents = header.offsetColor = header.offsetUV0 = header.offsetUV1 = none;
+   header.vertexCount = vertexCount;
+   header.vertexSize = vertexCount * header.stridePosition;
+   header.indexType = 0; // UI32
+   header.indexCount = static_cast<uint32_t>(indices.size());
+   header.indexSize = header.indexCount * sizeof(uint32_t);
+   TestFilameshPart part{};
+   part.indexCount = header.indexCount;
+   part.maxIndex = vertexCount - 1;
+
+   std::vector<uint8_t> positions(header.vertexSize);
+   for (uint32_t v = 0; v < vertexCount; v++)
+   {  // x = v / 1024, y = v % 1024 as halves (exact below 2048)
+      const uint16_t x = half_of(v / 1024), y = half_of(v % 1024);
+      std::memcpy(&positions[v * header.stridePosition], &x, sizeof(uint16_t));
+      std::memcpy(&positions[v * header.stridePosition + sizeof(uint16_t)], &y, sizeof(uint16_t));
+   }
+   const uint8_t magic[] = { 'F', 'I', 'L', 'A', 'M', 'E', 'S', 'H' };
+   std::vector<uint8_t>* data = new std::vector<uint8_t>(magic, magic + sizeof(magic));
+   data->insert(data->end(), reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header + 1));
+   data->insert(data->end(), positions.begin(), positions.end());
+   data->insert(data->end(), reinterpret_cast<const uint8_t*>(indices.data()),
+                reinterpret_cast<const uint8_t*>(indices.data() + indices.size()));
+   data->insert(data->end(), reinterpret_cast<const uint8_t*>(&part), reinterpret_cast<const uint8_t*>(&part + 1));
+   return bulb::AssetReader::make_view(data->data(), data->size(), [data](const void*, size_t) { delete data; });
+}
+
+static void test_index_narrowing()
+//--------------------------------
+{
+   // Indices 0 to 65535 fit in 16 bits, so 65536 vertices is the largest narrowable count.
+   CHECK(bulb::MeshOptimizer::fits_short_indices(65536));
+   CHECK(! bulb::MeshOptimizer::fits_short_indices(65537));
+
+   // The index type optimize_filamesh writes at (and just past) that limit
+   for (uint32_t vertexCount : { 65536u, 65537u })
+   {
+      bulb::MeshOptimizeStats stats;
+      std::shared_ptr<bulb::AssetView> source = make_filamesh(vertexCount);
+      std::shared_ptr<bulb::AssetView> optimized = bulb::MeshOptimizer::optimize_filamesh(source, stats);
+      if ( (! CHECK(optimized != source)) || (! CHECK(stats.skipped == 0)) )
+         continue;
+      TestFilameshHeader header;
+      std::memcpy(&header, optimized->bytes() + 8, sizeof(header));
+      const bool isShort = (vertexCount <= 65536);
+      CHECK(header.vertexCount == vertexCount);
+      CHECK(header.indexType == (isShort ? 1u : 0u)); // UI16 : UI32
+      CHECK(header.indexSize == header.indexCount * (isShort ? sizeof(uint16_t) : sizeof(uint32_t)));
+      const uint8_t* indices = optimized->bytes() + 8 + sizeof(header) + header.vertexSize;
+      uint32_t maxIndex = 0;
+      for (uint32_t i = 0; i < header.indexCount; i++)
+      {
+         uint32_t index;
+         if (isShort)
+         {
+            uint16_t shortIndex;
+            std::memcpy(&shortIndex, indices + i * sizeof(uint16_t), sizeof(uint16_t));
+            index = shortIndex;
+         }
+         else
+            std::memcpy(&index, indices + i * sizeof(uint32_t), sizeof(uint32_t));
+         maxIndex = std::max(maxIndex, index);
+      }
+      CHECK(maxIndex == vertexCount - 1);
+      TestFilameshPart part;
+      std::memcpy(&part, indices + header.indexSize, sizeof(part));
+      CHECK(part.maxIndex == vertexCount - 1);
+   }
+}
+
+// A size x size grid of vertices in the z = 0 plane triangulated into 2 * (size - 1)^2 triangles.
+static void make_grid(size_t size, std::vector<float>& positions, std::vector<uint32_t>& indices)
+//----------------------------------------------------------------------------------------------
+{
+   positions.clear();
+   indices.clear();
+   for (size_t y = 0; y < size; y++)
+      for (size_t x = 0; x < size; x++)
+      {
+         positions.push_back(float(x));
+         positions.push_back(float(y));
+         positions.push_back(0);
+      }
+   for (size_t y = 0; y + 1 < size; y++)
+      for (size_t x = 0; x + 1 < size; x++)
+      {
+         const uint32_t i = static_cast<uint32_t>(y * size + x), right = i + 1;
+         const uint32_t below = static_cast<uint32_t>(i + size), belowRight = below + 1;
+         indices.insert(indices.end(), { i, below, right, right, below, belowRight });
+      }
+}
+
+static void test_lod_thresholds()
+//-------------------------------
+{
+   const std::vector<float>& defaults = bulb::MeshOptimizer::default_lod_ratios();
+   CHECK(! defaults.empty());
+   for (size_t i = 0; i < defaults.size(); i++)
+   {
+      CHECK( (defaults[i] > 0) && (defaults[i] < 1) );
+      if (i > 0)
+         CHECK(defaults[i] < defaults[i - 1]);
+   }
+
+   std::vector<float> positions;
+   std::vector<uint32_t> indices;
+   make_grid(64, positions, indices);
+   const size_t vertexCount = positions.size() / 3;
+   const std::vector<float>& ratios = defaults;
+   std::vector<std::vector<uint32_t>> levels;
+   bulb::MeshOptimizer::simplify(indices.data(), indices.size(), positions.data(), vertexCount, 3 * sizeof(float),
+                                 ratios, 0.02f, levels);
+   if (! CHECK(levels.size() == ratios.size()))
+      return;
+   for (size_t l = 0; l < levels.size(); l++)
+   {
+      const std::vector<uint32_t>& level = levels[l];
+      const size_t target = std::max(size_t(indices.size() * ratios[l]) / 3 * 3, size_t(3));
+      CHECK(! level.empty());
+      CHECK(level.size() % 3 == 0);
+      // Levels further than half as many again over their target fall back to the sloppy simplifier
+      CHECK(level.size() <= target + target / 2);
+      if (l > 0)
+         CHECK(level.size() <= levels[l - 1].size());
+      for (uint32_t index : level)
+      {
+         if (! CHECK(index < vertexCount))
+            break;
+      }
+   }
+
+   // Fewer than one triangle leaves every level empty (unsimplified)
+   bulb::MeshOptimizer::simplify(indices.data(), 2, positions.data(), vertexCount, 3 * sizeof(float), ratios, 0.02f,
+                                 levels);
+   CHECK(levels.size() == ratios.size());
+   for (const std::vector<uint32_t>& level : levels)
+      CHECK(level.empty());
+}
+
+static void test_frame_queue()
+//----------------------------
+{
+   uint8_t frames[4];
+   bulb::FrameQueue queue(2);
+   CHECK(queue.max_pending() == 2);
+   CHECK(queue.pop() == nullptr);
+   CHECK(queue.push(&frames[0]) == nullptr);
+   CHECK(queue.push(&frames[1]) == nullptr);
+   CHECK(queue.push(&frames[2]) == &frames[0]); // Oldest dropped once maxPending are queued
+   CHECK(queue.size() == 2);
+   CHECK(queue.pop() == &frames[1]);
+   CHECK(queue.push(&frames[3]) == nullptr);
+   CHECK(queue.pop() == &frames[2]);
+   CHECK(queue.pop() == &frames[3]);
+   CHECK(queue.pop() == nullptr);
+   CHECK(queue.size() == 0);
+   CHECK(bulb::FrameQueue(0).max_pending() == 1);
+
+   // A producer thread racing the consumer: every buffer is either popped (in submission order) or dropped once.
+   const size_t count = 20000;
+   std::vector<uint8_t> buffers(count);
+   bulb::FrameQueue shared(3);
+   std::vector<size_t> dropped; // Only touched by the producer until it is joined
+   std::atomic<bool> isProduced{false};
+   std::thread producer([&buffers, &shared, &dropped, &isProduced]()
+   {
+      for (uint8_t& buffer : buffers)
+      {
+         uint8_t* oldest = shared.push(&buffer);
+         if (oldest != nullptr)
+            dropped.push_back(size_t(oldest - buffers.data()));
+      }
+      isProduced.store(true);
+   });
+   std::vector<size_t> popped;
+   for (;;)
+   {
+      const bool isLast = isProduced.load();
+      uint8_t* buffer = shared.pop();
+      if (buffer != nullptr)
+         popped.push_back(size_t(buffer - buffers.data()));
+      else if (isLast)
+         break;
+      else
+         std::this_thread::yield();
+   }
+   producer.join();
+   CHECK(popped.size() + dropped.size() == count);
+   std::vector<bool> isSeen(count, false);
+   for (size_t i = 0; i < popped.size(); i++)
+   {
+      if (i > 0)
+         CHECK(popped[i] > popped[i - 1]);
+      isSeen[popped[i]] = true;
+   }
+   for (size_t i : dropped)
+   {
+      CHECK(! isSeen[i]);
+      isSeen[i] = true;
+   }
+   CHECK(std::find(isSeen.begin(), isSeen.end(), false) == isSeen.end());
+}
+
+static void test_texture_ring()
+//-----------------------------
+{
+   // Each upload goes to the texture after the current one, so the RING_SIZE - 1 frames before it (possibly still
+   // in flight) are never overwritten.
+   size_t current = 0;
+   std::vector<size_t> written;
+   for (size_t i = 0; i < 3 * bulb::StreamingTexture::RING_SIZE; i++)
+   {
+      const size_t next = bulb::StreamingTexture::next_texture(current);
+      CHECK(next < bulb::StreamingTexture::RING_SIZE);
+      CHECK(next != current);
+      for (size_t back = 1; (back < bulb::StreamingTexture::RING_SIZE) && (back <= written.size()); back++)
+         CHECK(written[written.size() - back] != next);
+      written.push_back(next);
+      current = next;
+   }
+   CHECK(bulb::StreamingTexture::next_texture(bulb::StreamingTexture::RING_SIZE - 1) == 0);
+}
+
+struct Test
+{
+   const char* name;
+   void (*run)();
+};
+
+static const Test TESTS[] =
+{
+   { "keyframe_step", test_keyframe_step },
+   { "keyframe_linear", test_keyframe_linear },
+   { "keyframe_cubic_spline", test_keyframe_cubic_spline },
+   { "keyframe_slerp", test_keyframe_slerp },
+   { "keyframe_simd", test_keyframe_simd },
+   { "material_instance_pool", test_material_instance_pool },
+   { "decode_uri", test_decode_uri },
+   { "index_narrowing", test_index_narrowing },
+   { "lod_thresholds", test_lod_thresholds },
+   { "frame_queue", test_frame_queue },
+   { "texture_ring", test_texture_ring },
+};
+
+int main(int argc, char** argv)
+//------------------------------
+{
+   size_t run = 0;
+   for (const Test& test : TESTS)
+   {
+      bool isSelected = (argc < 2);
+      for (int i = 1; i < argc; i++)
+         isSelected = isSelected || (std::strcmp(argv[i], test.name) == 0);
+      if (! isSelected)
+         continue;
+      const size_t before = failures;
+      test.run();
+      std::cerr << ((failures == before) ? "PASS " : "FAIL ") << test.name << std::endl;
+      run++;
+   }
+   if (run == 0)
+   {
+      std::cerr << "No tests named";
+      for (int i = 1; i < argc; i++)
+         std::cerr << " " << argv[i];
+      std::cerr << std::endl;
+      return 1;
+   }
+   return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "bulb/AssetPack.hh"
+#include "bulb/AssetReader.hh"
+#include "bulb/ut.hh"
+
+// Bakes files and directories into a .bulbpak archive, eg
+//    bulb_bake samples.bulbpak samples/model samples/material assets
+// Entries are stored under their paths as given, so run from the directory the application reads assets
+// relative to. Use bulb_bake -l pack.bulbpak to list the contents of a pack.
+
+static void usage(const char* argv0)
+//----------------------------------
+{
+   std::cerr << "Usage: " << argv0 << " output.bulbpak file-or-directory..." << std::endl
+             << "       " << argv0 << " -l pack.bulbpak" << std::endl;
+}
+
+static const char* type_name(uint8_t type)
+//----------------------------------------
+{
+   switch (static_cast<bulb::PackEntryType>(type))
+   {
+      case bulb::PackEntryType::MATERIAL: return "material";
+      case bulb::PackEntryType::FILAMESH: return "filamesh";
+      case bulb::PackEntryType::GLTF:     return "gltf";
+      case bulb::PackEntryType::BUFFER:   return "buffer";
+      case bulb::PackEntryType::TEXTURE:  return "texture";
+      default:                            return "other";
+   }
+}
+
+static int list(const char* packPath)
+//-----------------------------------
+{
+   std::shared_ptr<bulb::AssetPack> pack = bulb::AssetPack::open(packPath);
+   if (! pack)
+      return 1;
+   size_t total = 0;
+   for (const std::string& name : pack->names())
+   {
+      size_t size = pack->entry_size(name);
+      total += size;
+      std::cout << size << "\t" << type_name(static_cast<uint8_t>(pack->entry_type(name))) << "\t" << name
+                << std::endl;
+   }
+   std::cout << pack->size() << " entries, " << total << " bytes" << std::endl;
+   return 0;
+}
+
+int main(int argc, char** argv)
+//------------------------------
+{
+   if ( (argc == 3) && (std::strcmp(argv[1], "-l") == 0) )
+      return list(argv[2]);
+   if (argc < 3)
+   {
+      usage(argv[0]);
+      return 1;
+   }
+   bulb::AssetPackWriter writer;
+   for (int i = 2; i < argc; i++)
+   {
+      std::string path = argv[i];
+      while ( (path.size() > 1) && (path.back() == '/') )
+         path.pop_back();
+      if (bulb::is_dir(path.c_str()))
+      {
+         size_t count = writer.add_directory(path);
+         std::cout << path << ": " << count << " files" << std::endl;
+      }
+      else if (! writer.add_file(path))
+         return 1;
+   }
+   if (! writer.write(argv[1]))
+      return 1;
+   std::cout << "Wrote " << writer.size() << " entries to " << argv[1] << std::endl;
+   return 0;
+}
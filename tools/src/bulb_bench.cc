@@ -0,0 +1,431 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <cstring>
+#include <cmath>
+
+#include "filament/Engine.h"
+#include "filament/VertexBuffer.h"
+#include "filament/IndexBuffer.h"
+#include "filament/RenderableManager.h"
+#include "filament/TransformManager.h"
+
+#include "bulb/Managers.hh"
+#include "bulb/SceneGraph.hh"
+#include "bulb/MaterialCache.hh"
+#include "bulb/ThreadPool.hh"
+#include "bulb/FrameStats.hh"
+#include "bulb/nodes/Visitor.hh"
+
+// Microbenchmarks of the scene graph hot paths on synthetic graphs, run against filament's NOOP backend so no GPU
+// or display is needed, eg
+//    bulb_bench --nodes 1000,100000,1000000 --fanout 4,32 --animated 0.1 --json results.json
+// Each graph is a tree of AffineTransforms with the given fan-out (so its depth follows from the node count) whose
+// leaves are Geometry nodes sharing one triangle, or transforms if the material can not be loaded. Results are
+// written as JSON (to stdout unless --json is given) with a summary on stderr.
+
+struct Options
+{
+   std::vector<size_t> nodes{1000, 10000, 100000};
+   std::vector<size_t> fanouts{8};
+   std::vector<double> animated{0.1};
+   size_t repeat = 5;
+   size_t adoptCount = 1000;
+   size_t threads = 0;
+   std::string material = "samples/material/bakedColor";
+   std::string json;
+};
+
+struct Result
+{
+   std::string benchmark;
+   size_t nodes, fanout, depth, drawables;
+   double animated;
+   size_t ops;
+   double nsPerOp, minNsPerOp;
+};
+
+struct BenchContext
+{
+   std::shared_ptr<bulb::Managers> managers;
+   std::shared_ptr<filament::Engine> engine;
+   filament::Material* material = nullptr;
+   filament::VertexBuffer* vb = nullptr;
+   filament::IndexBuffer* ib = nullptr;
+};
+
+// A synthetic graph: nodes[0] is the root, the parent of nodes[i] is nodes[(i - 1) / fanout].
+struct SyntheticGraph
+{
+   std::unique_ptr<bulb::SceneGraph> graph;
+   std::vector<bulb::Node*> nodes;
+   std::vector<std::string> names;
+   std::vector<bulb::AffineTransform*> animatedTransforms;
+   size_t depth = 0, drawables = 0;
+};
+
+static const float TRIANGLE_POSITIONS[] = { 0, 0.5f, 0, -0.5f, -0.5f, 0, 0.5f, -0.5f, 0 };
+static const uint16_t TRIANGLE_INDICES[] = { 0, 1, 2 };
+
+static bool parse_list(const char* arg, std::vector<double>& values)
+//------------------------------------------------------------------
+{
+   values.clear();
+   std::stringstream ss(arg);
+   std::string item;
+   while (std::getline(ss, item, ','))
+   {
+      char* end = nullptr;
+      double v = std::strtod(item.c_str(), &end);
+      if ( (item.empty()) || (*end != 0) || (v < 0) )
+         return false;
+      values.push_back(v);
+   }
+   return ! values.empty();
+}
+
+static bool parse_list(const char* arg, std::vector<size_t>& values)
+//------------------------------------------------------------------
+{
+   std::vector<double> parsed;
+   if (! parse_list(arg, parsed))
+      return false;
+   values.clear();
+   for (double v : parsed)
+      values.push_back(static_cast<size_t>(v));
+   return true;
+}
+
+static void usage(const char* argv0)
+//----------------------------------
+{
+   std::cerr << "Usage: " << argv0 << " [--nodes n,...] [--fanout f,...] [--animated fraction,...] [--repeat r]"
+             << " [--adopt n] [--threads n] [--material path] [--json output.json]" << std::endl;
+}
+
+static bool parse_args(int argc, char** argv, Options& options)
+//-------------------------------------------------------------
+{
+   for (int i = 1; i < argc; i++)
+   {
+      const char* arg = argv[i];
+      if (i + 1 >= argc)
+         return false;
+      const char* value = argv[++i];
+      bool isValid = true;
+      if (std::strcmp(arg, "--nodes") == 0)
+         isValid = parse_list(value, options.nodes);
+      else if (std::strcmp(arg, "--fanout") == 0)
+         isValid = parse_list(value, options.fanouts);
+      else if (std::strcmp(arg, "--animated") == 0)
+         isValid = parse_list(value, options.animated);
+      else if (std::strcmp(arg, "--repeat") == 0)
+         options.repeat = std::max(std::strtoul(value, nullptr, 10), 1ul);
+      else if (std::strcmp(arg, "--adopt") == 0)
+         options.adoptCount = std::strtoul(value, nullptr, 10);
+      else if (std::strcmp(arg, "--threads") == 0)
+         options.threads = std::strtoul(value, nullptr, 10);
+      else if (std::strcmp(arg, "--material") == 0)
+         options.material = value;
+      else if (std::strcmp(arg, "--json") == 0)
+         options.json = value;
+      else
+         isValid = false;
+      if (! isValid)
+         return false;
+   }
+   for (size_t& fanout : options.fanouts)
+      fanout = std::max(fanout, size_t(1));
+   for (size_t& n : options.nodes)
+      n = std::max(n, size_t(2));
+   return true;
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start)
+//-------------------------------------------------------------------
+{
+   return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool create_context(BenchContext& context, const Options& options, const bulb::EngineConfig& config)
+//---------------------------------------------------------------------------------------------------------
+{
+   context.managers = bulb::Managers::create(config);
+   if (! context.managers)
+      return false;
+   context.engine = context.managers->engine;
+   filament::Engine& engine = *context.engine;
+   context.material = context.managers->material_cache().acquire(options.material.c_str());
+   if (context.material == nullptr)
+   {
+      std::cerr << "Could not load material " << options.material << ", leaves will be transforms" << std::endl;
+      return true;
+   }
+   context.vb = filament::VertexBuffer::Builder().vertexCount(3).bufferCount(1)
+                .attribute(filament::VertexAttribute::POSITION, 0, filament::VertexBuffer::AttributeType::FLOAT3)
+                .build(engine);
+   context.vb->setBufferAt(engine, 0, filament::VertexBuffer::BufferDescriptor(TRIANGLE_POSITIONS,
+                                                                               sizeof(TRIANGLE_POSITIONS)));
+   context.ib = filament::IndexBuffer::Builder().indexCount(3).bufferType(filament::IndexBuffer::IndexType::USHORT)
+                .build(engine);
+   context.ib->setBuffer(engine, filament::IndexBuffer::BufferDescriptor(TRIANGLE_INDICES, sizeof(TRIANGLE_INDICES)));
+   return true;
+}
+
+static void destroy_context(BenchContext& context)
+//------------------------------------------------
+{
+   filament::Engine& engine = *context.engine;
+   if (context.material != nullptr)
+      context.managers->material_cache().release(context.material);
+   if (context.vb != nullptr) engine.destroy(context.vb);
+   if (context.ib != nullptr) engine.destroy(context.ib);
+   engine.flushAndWait();
+}
+
+// Builds the graph, timing the make_* and add_child calls (Result "make").
+static double build_graph(BenchContext& context, SyntheticGraph& g, size_t n, size_t fanout, double animated)
+//-----------------------------------------------------------------------------------------------------------
+{
+   g.graph = bulb::SceneGraph::create_headless(*context.managers, 1280, 720);
+   g.nodes.resize(n);
+   g.names.resize(n);
+   for (size_t i = 0; i < n; i++)
+      g.names[i] = "n" + std::to_string(i);
+   std::mt19937 rng(1234);
+   std::uniform_real_distribution<double> uniform(0, 1);
+   const filament::math::quat q = filament::math::quat::fromAxisAngle(filament::math::double3(0, 1, 0), 0.1);
+   const bool hasDrawables = (context.material != nullptr);
+
+   g.graph->start_updating();
+   auto start = std::chrono::steady_clock::now();
+   bulb::Composite* root = g.graph->make_root(g.names[0].c_str(), true);
+   g.nodes[0] = root;
+   for (size_t i = 1; i < n; i++)
+   {
+      const bool isLeaf = (i * fanout + 1 >= n);
+      bulb::Composite* parent = static_cast<bulb::Composite*>(g.nodes[(i - 1) / fanout]);
+      bulb::Node* node;
+      if ( (isLeaf) && (hasDrawables) )
+         node = g.graph->make_geometry(g.names[i].c_str(), context.material);
+      else
+         node = g.graph->make_affine_transform(g.names[i].c_str(), q, filament::math::double3(0.01, 0, 0), 1.0);
+      parent->add_child(node);
+      g.nodes[i] = node;
+   }
+   const double ns = elapsed_ns(start);
+   g.graph->end_updating(true);
+
+   filament::Engine& engine = *context.engine;
+   filament::TransformManager& transformManager = context.managers->transformManager;
+   g.drawables = 0;
+   g.animatedTransforms.clear();
+   for (size_t i = 1; i < n; i++)
+   {
+      if (bulb::Geometry* geometry = dynamic_cast<bulb::Geometry*>(g.nodes[i]))
+      {
+         utils::Entity entity = geometry->get_renderable();
+         transformManager.create(entity);
+         filament::RenderableManager::Builder(1)
+               .boundingBox({{-0.5f, -0.5f, -0.01f}, {0.5f, 0.5f, 0.01f}})
+               .material(0, context.material->getDefaultInstance())
+               .geometry(0, filament::RenderableManager::PrimitiveType::TRIANGLES, context.vb, context.ib, 0, 3)
+               .culling(false)
+               .build(engine, entity);
+         g.drawables++;
+      }
+      else if (bulb::AffineTransform* transform = dynamic_cast<bulb::AffineTransform*>(g.nodes[i]))
+      {
+         if (uniform(rng) < animated)
+            g.animatedTransforms.push_back(transform);
+      }
+   }
+   g.depth = 0;
+   for (size_t i = n - 1; i > 0; i = (i - 1) / fanout)
+      g.depth++;
+   return ns;
+}
+
+// Runs f repeat times and records the median and minimum time per operation.
+static void measure(std::vector<Result>& results, const Result& config, const char* name, size_t ops, size_t repeat,
+                    const std::function<void()>& f)
+//------------------------------------------------------------------------------------------------------------------
+{
+   if (ops == 0)
+      return;
+   std::vector<double> times;
+   for (size_t r = 0; r < repeat; r++)
+   {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      times.push_back(elapsed_ns(start) / ops);
+   }
+   std::sort(times.begin(), times.end());
+   Result result = config;
+   result.benchmark = name;
+   result.ops = ops;
+   result.nsPerOp = times[times.size() / 2];
+   result.minNsPerOp = times.front();
+   results.push_back(result);
+}
+
+static void run_config(BenchContext& context, const Options& options, size_t n, size_t fanout, double animated,
+                       std::vector<Result>& results)
+//--------------------------------------------------------------------------------------------------------------
+{
+   SyntheticGraph g;
+   const double buildNs = build_graph(context, g, n, fanout, animated);
+   Result config{"", n, fanout, g.depth, g.drawables, animated, n - 1, buildNs / (n - 1), buildNs / (n - 1)};
+   config.benchmark = "make";
+   results.push_back(config);
+
+   bulb::Composite* root = static_cast<bulb::Composite*>(g.nodes[0]);
+   measure(results, config, "traversal", n, options.repeat, [root]()
+   {
+      bulb::RenderVisitor visitor;
+      root->traverse(&visitor);
+   });
+
+   double phase = 0;
+   measure(results, config, "transform_update", g.animatedTransforms.size(), options.repeat, [&g, &phase]()
+   {
+      phase += 0.01;
+      for (bulb::AffineTransform* transform : g.animatedTransforms)
+         transform->translation(std::cos(phase), std::sin(phase), 0.0);
+   });
+
+   std::mt19937 rng(4321);
+   const size_t lookups = std::min(n, size_t(100000));
+   std::vector<size_t> picks(lookups);
+   std::uniform_int_distribution<size_t> anyNode(0, n - 1);
+   for (size_t& pick : picks)
+      pick = anyNode(rng);
+   size_t found = 0;
+   measure(results, config, "get_node", lookups, options.repeat, [&g, &picks, &found]()
+   {
+      for (size_t i : picks)
+         found += (g.graph->get_node(g.names[i]) != nullptr) ? 1 : 0;
+   });
+
+   // Detaches and reattaches a node to its parent (remove_child and add_child are linear in the fan-out).
+   const size_t moves = std::min(n - 1, size_t(10000));
+   std::uniform_int_distribution<size_t> nonRoot(1, n - 1);
+   for (size_t& pick : picks)
+      pick = nonRoot(rng);
+   measure(results, config, "remove_add_child", moves, options.repeat, [&g, &picks, moves, fanout]()
+   {
+      for (size_t k = 0; k < moves; k++)
+      {
+         const size_t i = picks[k];
+         bulb::Composite* parent = static_cast<bulb::Composite*>(g.nodes[(i - 1) / fanout]);
+         parent->remove_child(g.nodes[i]);
+         parent->add_child(g.nodes[i]);
+      }
+   });
+
+   // Frames with the graph marked dirty each time, so every render() rebuilds the filament scene.
+   bulb::FrameStats& stats = g.graph->get_frame_stats();
+   stats.reset();
+   measure(results, config, "dirty_frame", 1, options.repeat, [&g]()
+   {
+      g.graph->start_updating();
+      g.graph->end_updating(true);
+      g.graph->render();
+   });
+   Result rebuild = config;
+   rebuild.benchmark = "scene_rebuild";
+   rebuild.ops = 1;
+   rebuild.nsPerOp = stats.phase_stats(bulb::FramePhase::SCENE_REBUILD).p50 * 1000.0;
+   rebuild.minNsPerOp = rebuild.nsPerOp;
+   results.push_back(rebuild);
+   measure(results, config, "clean_frame", 1, options.repeat, [&g]() { g.graph->render(); });
+
+   // adopt_* searches the nodes already owned by the graph, so is measured last on the full graph.
+   const filament::math::quat q = filament::math::quat::fromAxisAngle(filament::math::double3(0, 1, 0), 0.1);
+   std::vector<bulb::AffineTransform*> adopted;
+   for (size_t i = 0; i < options.adoptCount; i++)
+      adopted.push_back(new bulb::AffineTransform(("adopted" + std::to_string(i)).c_str(), q,
+                                                  filament::math::double3(0, 0, 0)));
+   measure(results, config, "adopt", adopted.size(), 1, [&g, &adopted, root]()
+   {
+      for (bulb::AffineTransform* transform : adopted)
+      {
+         g.graph->adopt_affine_transform(transform);
+         root->add_child(transform);
+      }
+   });
+   if (found == 0)
+      std::cerr << "get_node found no nodes" << std::endl;
+   g.graph.reset();
+   context.engine->flushAndWait();
+}
+
+static void write_json(std::ostream& out, const std::vector<Result>& results)
+//--------------------------------------------------------------------------
+{
+   out << "{\n  \"backend\": \"noop\",\n  \"results\": [";
+   for (size_t i = 0; i < results.size(); i++)
+   {
+      const Result& r = results[i];
+      out << ((i == 0) ? "\n" : ",\n") << "    {\"benchmark\": \"" << r.benchmark << "\", \"nodes\": " << r.nodes
+          << ", \"fanout\": " << r.fanout << ", \"depth\": " << r.depth << ", \"drawables\": " << r.drawables
+          << ", \"animated\": " << r.animated << ", \"ops\": " << r.ops << ", \"ns_per_op\": " << r.nsPerOp
+          << ", \"min_ns_per_op\": " << r.minNsPerOp << "}";
+   }
+   out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv)
+//------------------------------
+{
+   Options options;
+   if (! parse_args(argc, argv, options))
+   {
+      usage(argv[0]);
+      return 1;
+   }
+   bulb::ThreadPool::set_worker_count(options.threads);
+   bulb::EngineConfig config;
+   config.backend = filament::Engine::Backend::NOOP;
+   BenchContext context;
+   if (! create_context(context, options, config))
+   {
+      std::cerr << "Error creating the NOOP engine" << std::endl;
+      return 1;
+   }
+   std::vector<Result> results;
+   for (size_t n : options.nodes)
+      for (size_t fanout : options.fanouts)
+         for (double animated : options.animated)
+         {
+            const size_t first = results.size();
+            run_config(context, options, n, fanout, animated, results);
+            std::cerr << n << " nodes, fanout " << fanout << ", depth " << results[first].depth << ", animated "
+                      << animated << std::endl;
+            for (size_t i = first; i < results.size(); i++)
+               std::cerr << "   " << results[i].benchmark << ": " << results[i].nsPerOp << " ns/op ("
+                         << results[i].ops << " ops)" << std::endl;
+         }
+   destroy_context(context);
+
+   if (options.json.empty())
+      write_json(std::cout, results);
+   else
+   {
+      std::ofstream out(options.json);
+      if (! out)
+      {
+         std::cerr << "Error creating " << options.json << std::endl;
+         return 1;
+      }
+      write_json(out, results);
+   }
+   return 0;
+}
@@ -0,0 +1,389 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include "filament/Engine.h"
+#include "filament/Camera.h"
+#include "filament/View.h"
+#include "filament/Viewport.h"
+
+#include "bulb/Managers.hh"
+#include "bulb/SceneGraph.hh"
+#include "bulb/ThreadPool.hh"
+#include "bulb/AssetReader.hh"
+#include "bulb/KeyframeTracks.hh"
+#include "bulb/FrameStats.hh"
+#include "bulb/ut.hh"
+
+// End to end frame benchmark under filament's NOOP backend: the samples/model solar system (optionally with N extra
+// moons per planet, instances of the Luna model) is animated by keyframe tracks with a fixed timestep while the
+// camera flies a scripted path, and each frame (animation, camera and SceneGraph::render) is timed, eg
+//    bulb_frame_bench --satellites 50 --frames 1200 --json frames.json
+// With --views n the target is split into a grid of n views (SceneGraph::add_view) whose cameras fly the same path
+// at different phases, all rendering the one scene.
+// Reported per run: CPU frame time percentiles, FrameStats phase percentiles, the number of frames that rebuilt the
+// filament scene and the heap allocations per frame (counted over all threads of the process).
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(std::size_t size)
+{
+   allocations.fetch_add(1, std::memory_order_relaxed);
+   if (void* p = std::malloc((size > 0) ? size : 1))
+      return p;
+   throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+   allocations.fetch_add(1, std::memory_order_relaxed);
+   return std::malloc((size > 0) ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+struct Options
+{
+   size_t satellites = 0;
+   size_t frames = 600;
+   size_t warmup = 60;
+   double fps = 60;
+   size_t threads = 0;
+   size_t views = 1;
+   uint32_t width = 1280, height = 720;
+   std::string modelDir = "samples/model";
+   std::string json;
+};
+
+struct Planet
+{
+   const char* name;
+   const char* model;
+   double distance, scale, period;
+};
+
+// Distances, scales and orbital periods (seconds) are chosen for the view rather than astronomy.
+static const Planet PLANETS[] =
+{
+   { "Mercury", "Mercury/Mercury.gltf", 0.45, 0.04, 8 },
+   { "Venus", "Venus/Venus.gltf", 0.7, 0.07, 14 },
+   { "Earth", "Earth/Earth.gltf", 1.0, 0.08, 20 },
+   { "Mars", "Mars/Mars.gltf", 1.4, 0.05, 32 },
+   { "Jupiter", "Jupiter/Jupiter.gltf", 2.2, 0.2, 60 },
+};
+
+static void usage(const char* argv0)
+//----------------------------------
+{
+   std::cerr << "Usage: " << argv0 << " [--satellites n] [--frames n] [--warmup n] [--fps f] [--threads n]"
+             << " [--views n] [--size WxH] [--models dir] [--json output.json]" << std::endl;
+}
+
+static bool parse_args(int argc, char** argv, Options& options)
+//-------------------------------------------------------------
+{
+   for (int i = 1; i + 1 < argc; i += 2)
+   {
+      const char* arg = argv[i];
+      const char* value = argv[i + 1];
+      if (std::strcmp(arg, "--satellites") == 0)
+         options.satellites = std::strtoul(value, nullptr, 10);
+      else if (std::strcmp(arg, "--frames") == 0)
+         options.frames = std::max(std::strtoul(value, nullptr, 10), 1ul);
+      else if (std::strcmp(arg, "--warmup") == 0)
+         options.warmup = std::strtoul(value, nullptr, 10);
+      else if (std::strcmp(arg, "--fps") == 0)
+         options.fps = std::max(std::strtod(value, nullptr), 1.0);
+      else if (std::strcmp(arg, "--threads") == 0)
+         options.threads = std::strtoul(value, nullptr, 10);
+      else if (std::strcmp(arg, "--views") == 0)
+         options.views = std::max(std::strtoul(value, nullptr, 10), 1ul);
+      else if (std::strcmp(arg, "--size") == 0)
+      {
+         unsigned w = 0, h = 0;
+         if ( (std::sscanf(value, "%ux%u", &w, &h) != 2) || (w == 0) || (h == 0) )
+            return false;
+         options.width = w; options.height = h;
+      }
+      else if (std::strcmp(arg, "--models") == 0)
+         options.modelDir = value;
+      else if (std::strcmp(arg, "--json") == 0)
+         options.json = value;
+      else
+         return false;
+   }
+   return (argc % 2) == 1;
+}
+
+// A looping rotation about y of one turn in period seconds (keys every 45 degrees).
+static bulb::KeyframeChannel y_rotation(double period, double phase)
+//------------------------------------------------------------------
+{
+   bulb::KeyframeChannel channel;
+   for (int k = 0; k <= 8; k++)
+   {
+      const double angle = phase + k * bulb::pi<double> / 4;
+      channel.times.push_back(static_cast<float>(period * k / 8));
+      filament::math::quat q = filament::math::quat::fromAxisAngle(filament::math::double3(0, 1, 0), angle);
+      channel.values.insert(channel.values.end(), { static_cast<float>(q.x), static_cast<float>(q.y),
+                                                    static_cast<float>(q.z), static_cast<float>(q.w) });
+   }
+   return channel;
+}
+
+// An orbit is an animated rotation at the parent origin with the body translated out along x beneath it.
+static bulb::AffineTransform* add_orbit(bulb::SceneGraph& graph, bulb::Composite* parent, const std::string& name,
+                                        double distance, double scale, double period, double phase)
+//---------------------------------------------------------------------------------------------------------------
+{
+   const filament::math::quat I(1, 0, 0, 0);
+   bulb::AffineTransform* orbit = graph.make_affine_transform((name + "Orbit").c_str(), I,
+                                                              filament::math::double3(0, 0, 0), 1.0);
+   bulb::AffineTransform* body = graph.make_affine_transform((name + "Transform").c_str(), I,
+                                                             filament::math::double3(distance, 0, 0), scale);
+   parent->add_child(orbit);
+   orbit->add_child(body);
+   graph.get_keyframe_tracks().add_track(orbit, bulb::KeyframeChannel(), y_rotation(period, phase),
+                                         bulb::KeyframeChannel());
+   return body;
+}
+
+static bool build_solar_system(bulb::SceneGraph& graph, const Options& options, size_t& bodies)
+//--------------------------------------------------------------------------------------------
+{
+   const std::string moonModel = options.modelDir + "/Luna/Luna.gltf";
+   const size_t planetCount = sizeof(PLANETS) / sizeof(PLANETS[0]);
+   graph.set_gltf_instances(moonModel.c_str(), 1 + planetCount * options.satellites);
+   if (! graph.start_updating())
+      return false;
+   bulb::Composite* root = graph.make_root("root", true);
+   graph.add_sunlight(filament::LinearColor(1, 1, 1), filament::math::float3(0, -1, 1), 800000.0f);
+   bodies = 0;
+   bulb::MultiGeometry* sun = graph.make_multi_geometry("Sun", (options.modelDir + "/Sol/Sol.gltf").c_str(),
+                                                        new bulb::AffineTransform("SunTransform",
+                                                                                  filament::math::mat3(1.0),
+                                                                                  filament::math::double3(0, 0, 0),
+                                                                                  0.3));
+   if (sun == nullptr)
+   {
+      graph.end_updating(true);
+      return false;
+   }
+   root->add_child(sun);
+   bodies++;
+   for (size_t p = 0; p < planetCount; p++)
+   {
+      const Planet& planet = PLANETS[p];
+      bulb::AffineTransform* body = add_orbit(graph, root, planet.name, planet.distance, planet.scale, planet.period,
+                                              p * 1.3);
+      bulb::MultiGeometry* geometry = graph.make_multi_geometry(planet.name,
+                                                                (options.modelDir + "/" + planet.model).c_str());
+      if (geometry == nullptr)
+      {
+         graph.end_updating(true);
+         return false;
+      }
+      body->add_child(geometry);
+      bodies++;
+      // Moons orbit in the planet's (unit sized) frame so are scaled up by the inverse of the planet scale.
+      const size_t moons = options.satellites + ((std::strcmp(planet.name, "Earth") == 0) ? 1 : 0);
+      for (size_t m = 0; m < moons; m++)
+      {
+         const std::string name = std::string(planet.name) + "Moon" + std::to_string(m);
+         const double distance = (1.5 + 0.25 * (m % 16)) + 0.05 * (m / 16);
+         bulb::AffineTransform* moonBody = add_orbit(graph, body, name, distance, 0.15, 3.0 + (m % 7),
+                                                     m * 0.7);
+         bulb::MultiGeometry* moon = graph.make_multi_geometry(name.c_str(), moonModel.c_str());
+         if (moon == nullptr)
+         {
+            graph.end_updating(true);
+            return false;
+         }
+         moonBody->add_child(moon);
+         bodies++;
+      }
+   }
+   graph.end_updating(true);
+   return true;
+}
+
+// The scripted flythrough: a Catmull-Rom loop through waypoints around the system, looking at the sun.
+static void place_camera(filament::Camera* camera, double t, double period)
+//-------------------------------------------------------------------------
+{
+   static const filament::math::double3 WAYPOINTS[] =
+   {
+      { 0, 1.5, -4.5 }, { 3.5, 0.6, -2.5 }, { 3.0, -0.4, 2.0 }, { 0.5, 0.3, 3.0 },
+      { -2.0, 1.2, 1.0 }, { -1.2, 0.2, -0.9 }, { -3.8, 2.0, -2.8 },
+   };
+   const size_t n = sizeof(WAYPOINTS) / sizeof(WAYPOINTS[0]);
+   double u = std::fmod(t / period, 1.0) * n;
+   const size_t i = static_cast<size_t>(u);
+   u -= i;
+   const filament::math::double3& p0 = WAYPOINTS[(i + n - 1) % n];
+   const filament::math::double3& p1 = WAYPOINTS[i % n];
+   const filament::math::double3& p2 = WAYPOINTS[(i + 1) % n];
+   const filament::math::double3& p3 = WAYPOINTS[(i + 2) % n];
+   const double u2 = u * u, u3 = u2 * u;
+   const filament::math::double3 eye = 0.5 * ((2.0 * p1) + (p2 - p0) * u + (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3) * u2 +
+                                              (3.0 * p1 - p0 - 3.0 * p2 + p3) * u3);
+   camera->lookAt(filament::math::float3(eye), filament::math::float3(0, 0, 0), filament::math::float3(0, 1, 0));
+}
+
+static double percentile(std::vector<double> values, double p)
+//------------------------------------------------------------
+{
+   if (values.empty())
+      return 0;
+   const size_t k = std::min(static_cast<size_t>(p * values.size()), values.size() - 1);
+   std::nth_element(values.begin(), values.begin() + k, values.end());
+   return values[k];
+}
+
+int main(int argc, char** argv)
+//------------------------------
+{
+   Options options;
+   if (! parse_args(argc, argv, options))
+   {
+      usage(argv[0]);
+      return 1;
+   }
+   bulb::ThreadPool::set_worker_count(options.threads);
+   bulb::EngineConfig config;
+   config.backend = filament::Engine::Backend::NOOP;
+   std::shared_ptr<bulb::Managers> context = bulb::Managers::create(config);
+   if (! context)
+      return 1;
+   if (bulb::AssetReader::instance().exists("samples.bulbpak")) // Baked with bulb_bake
+      bulb::AssetReader::instance().mount_pack("samples.bulbpak");
+
+   std::unique_ptr<bulb::SceneGraph> graph = bulb::SceneGraph::create_headless(*context, options.width,
+                                                                               options.height);
+   if (! graph)
+      return 1;
+   // Views are tiled in a grid of columns x rows, the main view being the first tile.
+   const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(double(options.views))));
+   const uint32_t rows = static_cast<uint32_t>((options.views + columns - 1) / columns);
+   const uint32_t tileWidth = std::max(options.width / columns, 1u), tileHeight = std::max(options.height / rows, 1u);
+   const double aspect = double(tileWidth) / double(tileHeight);
+   graph->get_view()->setViewport({0, 0, tileWidth, tileHeight});
+   graph->get_camera()->setProjection(70, aspect, 0.0625, 20);
+   std::vector<filament::Camera*> cameras{ graph->get_camera() };
+   for (uint32_t i = 1; i < options.views; i++)
+   {
+      const filament::Viewport viewport(static_cast<int32_t>((i % columns) * tileWidth),
+                                        static_cast<int32_t>((i / columns) * tileHeight), tileWidth, tileHeight);
+      filament::View* view = graph->add_view(viewport);
+      if (view == nullptr)
+         return 1;
+      view->getCamera().setProjection(70, aspect, 0.0625, 20);
+      cameras.push_back(&view->getCamera());
+   }
+   size_t bodies = 0;
+   auto loadStart = std::chrono::steady_clock::now();
+   if (! build_solar_system(*graph, options, bodies))
+   {
+      std::cerr << "Error loading the models from " << options.modelDir << std::endl;
+      return 1;
+   }
+   const double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+   const double dt = 1.0 / options.fps;
+   const double flythroughPeriod = 30.0;
+   std::vector<double> frameMillis;
+   std::vector<uint64_t> frameAllocations;
+   frameMillis.reserve(options.frames);
+   frameAllocations.reserve(options.frames);
+   size_t rebuilds = 0, skipped = 0;
+   const size_t total = options.warmup + options.frames;
+   for (size_t frame = 0; frame < total; frame++)
+   {
+      if (frame == options.warmup)
+         graph->get_frame_stats().reset();
+      const double t = frame * dt;
+      const uint64_t allocationsBefore = allocations.load(std::memory_order_relaxed);
+      auto start = std::chrono::steady_clock::now();
+      graph->animate_keyframes(t);
+      graph->animate_gltf(static_cast<float>(dt));
+      for (size_t i = 0; i < cameras.size(); i++)
+         place_camera(cameras[i], t + i * flythroughPeriod / cameras.size(), flythroughPeriod);
+      const bool isRebuild = graph->is_dirty();
+      const bool isRendered = graph->render();
+      const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      const uint64_t allocated = allocations.load(std::memory_order_relaxed) - allocationsBefore;
+      if (frame < options.warmup)
+         continue;
+      frameMillis.push_back(ms);
+      frameAllocations.push_back(allocated);
+      if (isRebuild)
+         rebuilds++;
+      if (! isRendered)
+         skipped++;
+   }
+
+   std::vector<double> allocationCounts(frameAllocations.begin(), frameAllocations.end());
+   double allocationSum = 0;
+   for (double a : allocationCounts)
+      allocationSum += a;
+   std::string phases;
+   const bulb::FrameStats& stats = graph->get_frame_stats();
+   for (size_t i = 0; i < static_cast<size_t>(bulb::FramePhase::COUNT); i++)
+   {
+      const bulb::FramePhase phase = static_cast<bulb::FramePhase>(i);
+      const bulb::FramePhaseStats s = stats.phase_stats(phase);
+      phases += std::string((i == 0) ? "" : ",") + "\n      \"" + bulb::frame_phase_name(phase) +
+                "\": {\"p50_us\": " + std::to_string(s.p50) + ", \"p95_us\": " + std::to_string(s.p95) +
+                ", \"p99_us\": " + std::to_string(s.p99) + ", \"max_us\": " + std::to_string(s.max) + "}";
+   }
+   const double p50 = percentile(frameMillis, 0.50), p95 = percentile(frameMillis, 0.95),
+                p99 = percentile(frameMillis, 0.99), maxMs = percentile(frameMillis, 1.0);
+   const std::string json =
+         "{\n  \"backend\": \"noop\",\n  \"views\": " + std::to_string(options.views) +
+         ",\n  \"satellites_per_planet\": " + std::to_string(options.satellites) +
+         ",\n  \"bodies\": " + std::to_string(bodies) + ",\n  \"load_seconds\": " + std::to_string(loadSeconds) +
+         ",\n  \"frames\": " + std::to_string(frameMillis.size()) + ",\n  \"skipped_frames\": " +
+         std::to_string(skipped) + ",\n  \"frame_ms\": {\"p50\": " + std::to_string(p50) + ", \"p95\": " +
+         std::to_string(p95) + ", \"p99\": " + std::to_string(p99) + ", \"max\": " + std::to_string(maxMs) +
+         "},\n  \"scene_rebuilds\": " + std::to_string(rebuilds) + ",\n  \"allocations_per_frame\": {\"mean\": " +
+         std::to_string(allocationSum / std::max(allocationCounts.size(), size_t(1))) + ", \"p50\": " +
+         std::to_string(percentile(allocationCounts, 0.5)) + ", \"max\": " +
+         std::to_string(percentile(allocationCounts, 1.0)) + "},\n  \"phases\": {" + phases + "\n  }\n}\n";
+
+   std::cerr << bodies << " bodies loaded in " << loadSeconds << "s, " << frameMillis.size() << " frames: p50 "
+             << p50 << "ms, p95 " << p95 << "ms, p99 " << p99 << "ms, max " << maxMs << "ms, " << rebuilds
+             << " scene rebuilds, " << allocationSum / std::max(allocationCounts.size(), size_t(1))
+             << " allocations per frame" << std::endl;
+   graph.reset();
+   if (options.json.empty())
+      std::cout << json;
+   else
+   {
+      std::ofstream out(options.json);
+      if (! (out << json))
+      {
+         std::cerr << "Error writing " << options.json << std::endl;
+         return 1;
+      }
+   }
+   return 0;
+}